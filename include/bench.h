@@ -0,0 +1,33 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// --- Synthetic dataset generator (dataset_gen.c) ---
+
+/**
+ * @brief Writes users.txt with 'count' records: "<id> user<id> pass<id>".
+ * @param dir Directory to write into (must exist).
+ * @return 0 on success, -1 on failure.
+ */
+int gen_users_file(const char *dir, long count);
+
+/**
+ * @brief Writes groups.txt with 'count' records: "<id> group<id> <owner_id>".
+ * Owners are picked from [1, user_count].
+ * @return 0 on success, -1 on failure.
+ */
+int gen_groups_file(const char *dir, long count, long user_count);
+
+/**
+ * @brief Writes group_members.txt with 'count' records: "<group_id> <user_id> <status>".
+ * Roughly 1 in 8 memberships is left pending (status 0).
+ * @return 0 on success, -1 on failure.
+ */
+int gen_group_members_file(const char *dir, long count, long group_count, long user_count);
+
+/**
+ * @brief Generates all three text DB files in 'dir' with the same record count.
+ * @return 0 on success, -1 on failure.
+ */
+int gen_dataset(const char *dir, long records);
+
+#endif // BENCH_H
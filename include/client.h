@@ -1,6 +1,8 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include <stdio.h>
+
 // --- Client network functions (client_net.c) ---
 
 /**
@@ -21,6 +23,18 @@ void handle_server_message(int sockfd);
  */
 void handle_user_input(int sockfd);
 
+/**
+ * @brief Parses one command line (e.g. "MKDIR docs") and sends the request
+ * @param sockfd Socket file descriptor
+ * @param input Command line without trailing newline
+ */
+void execute_command(int sockfd, char *input);
+
+/**
+ * @brief Returns the last LOGIN sent ("user pass"), or NULL if none.
+ */
+const char *get_saved_login();
+
 /**
  * @brief Prints the initial command menu
  */
@@ -46,19 +60,153 @@ void print_help();
 // --- File transder functions (file_transfer.c) ---
 
 /**
- * @brief Uploads a file to the server
+ * @brief Starts uploading a file to the server on a new stream.
+ * Returns immediately; data is sent by transfer_pump().
  * @param sockfd Socket file descriptor
  * @param filename Name/path of file to upload
  */
 void upload_file(int sockfd, char *filename);
 
 /**
- * @brief Downloads a file from the server
+ * @brief Starts downloading a file from the server on a new stream.
+ * Returns immediately; data arrives through transfer_handle_packet().
  * @param sockfd Socket file descriptor
  * @param filename Name of file to download
  */
 void download_file(int sockfd, char *filename);
 
+/**
+ * @brief Queues an upload of local_path stored as remote_name on the server.
+ * @return 0 if queued, -1 if the file cannot be opened or the queue is full
+ */
+int upload_file_as(int sockfd, const char *local_path, const char *remote_name);
+
+/**
+ * @brief Queues a download of remote_name saved to local_path.
+ * @return 0 if queued, -1 if the queue is full
+ */
+int download_file_to(int sockfd, const char *remote_name, const char *local_path);
+
+/**
+ * @brief Queues a download of archived version `version` of remote_name.
+ * @return 0 if queued, -1 if the queue is full
+ */
+int download_version_to(int sockfd, const char *remote_name, int version, const char *local_path);
+
+/**
+ * @brief Tunes the calling thread's transfer engine.
+ * @param quiet_mode 1 = only report errors (no per-file progress lines)
+ * @param active_limit Transfers started at once (0 keeps the current value)
+ */
+void transfer_configure(int quiet_mode, int active_limit);
+
+/**
+ * @brief Number of transfers finished successfully / with an error so far.
+ */
+void transfer_get_results(int *completed, int *failed);
+
+/**
+ * @brief Feeds a packet received on a transfer stream to its state machine.
+ * @return 1 if the packet belonged to a transfer, 0 otherwise
+ */
+int transfer_handle_packet(int sockfd, int stream_id, int msg_type, char *payload, int len);
+
+/**
+ * @brief Returns 1 if an upload has data ready to send (select on write).
+ */
+int transfer_wants_write();
+
+/**
+ * @brief Sends one chunk for every active upload (round-robin).
+ */
+void transfer_pump(int sockfd);
+
+/**
+ * @brief Number of transfers started (not queued) and not yet finished.
+ */
+int transfer_active_count();
+
+/**
+ * @brief Cancels a queued or running transfer (server drops its stream).
+ * @return 0 on success, -1 if the transfer does not exist
+ */
+int transfer_cancel(int sockfd, int id);
+
+/**
+ * @brief Pauses (paused = 1) or resumes (paused = 0) a transfer.
+ * @return 0 on success, -1 if the transfer does not exist
+ */
+int transfer_set_paused(int sockfd, int id, int paused);
+
+/**
+ * @brief Prints every queued/active transfer with its state and progress.
+ */
+void transfer_print_list();
+
+/**
+ * @brief Redraws the one-line progress display (rate-limited).
+ */
+void transfer_render_progress();
+
+/**
+ * @brief Number of transfers not finished yet, queued ones included.
+ */
+int transfer_pending_count();
+
+/**
+ * @brief After a reconnect: continues every transfer the server kept
+ * (`listing`: "<stream_id> <U|D> <offset>" lines) and restarts the others.
+ */
+void transfer_resume_all(int sockfd, const char *listing);
+
+/**
+ * @brief Fails every unfinished transfer (the session could not be resumed).
+ */
+void transfer_abort_all();
+
+// --- Recursive transfers (tree_transfer.c) ---
+
+/**
+ * @brief Runs "UPLOAD -r <local_dir> [remote_dir] [-j N]" (upload = 1) or
+ * "DOWNLOAD -r <remote_dir> [local_dir] [-j N]" (upload = 0).
+ * Folders are created in batches first, then files are spread over N extra
+ * logged-in connections. Blocks until the whole tree is transferred.
+ * @param sockfd Main connection (used to find the server address)
+ * @param upload 1 for UPLOAD -r, 0 for DOWNLOAD -r
+ * @param input Full command line
+ */
+void tree_transfer_command(int sockfd, int upload, char *input);
+
+// --- Download cache (cache.c) ---
+
+/**
+ * @brief Looks up the cached server version of a downloaded file.
+ * Only valid while the local copy still has the size/mtime it was written with.
+ * @param remote Server path
+ * @param local Local path the file was saved to
+ * @param etag Receives the cached version token
+ * @return 1 if the local copy can be revalidated with etag, 0 otherwise
+ */
+int cache_lookup(const char *remote, const char *local, char *etag, size_t etag_size);
+
+/**
+ * @brief Records that `local` now holds version `etag` of `remote`.
+ */
+void cache_store(const char *remote, const char *local, const char *etag);
+
+// --- Batch mode (batch.c) ---
+
+/**
+ * @brief Runs commands from a script without waiting for each reply.
+ * Up to `window` requests are in flight; replies are matched to requests by
+ * stream ID. Prints one result line per command and a throughput summary.
+ * @param sockfd Connected socket file descriptor
+ * @param in Script to read (one command per line, '#' starts a comment)
+ * @param window Maximum number of requests awaiting a reply
+ * @return Number of commands that failed, transfers included
+ */
+int run_batch(int sockfd, FILE *in, int window);
+
 /**
  * @brief Gets the size of a file (utility function)
  * @param filename Path to the file
@@ -8,11 +8,14 @@
 // --- CONFIGURATION CONSTANTS ---
 #define SERVER_PORT 3636
 #define BUFFER_SIZE 4096
-#define MAX_CLIENTS 100
+#define MAX_CLIENTS 100 // Default of max_clients (config.h)
+#define RESUME_TOKEN_LEN 32 // Hex characters of a session resumption token
 
 // --- FILE PATHS ---
 #define DATA_DIR "./data"
 #define USER_DB_FILE "./data/users.txt"
+#define GROUP_DB_FILE "./data/groups.txt"
+#define GROUP_MEMBER_DB_FILE "./data/group_members.txt"
 #define LOG_FILE "./data/server.log"
 
 // --- DATA STRUCTURES ---
@@ -31,6 +34,7 @@ typedef struct {
     char username[50];      // Username
     char client_ip[INET_ADDRSTRLEN]; // Client IP Address
     int is_logged_in;       // 0: No, 1: Yes
+    char resume_token[RESUME_TOKEN_LEN + 1]; // Issued at login (resume.c), "" if none
 } Session;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+// FS_CONFIG overrides the path of the server configuration file.
+#define SERVER_CONF "./data/server.conf"
+#define CONFIG_STRING_MAX 2048
+
+// Server tuning knobs, read from SERVER_CONF at startup ("key value" lines,
+// '#' comments, unknown keys and out-of-range values are reported and
+// ignored). An environment variable, where one is listed, wins over the
+// file. SIGHUP re-reads the file: "reload" keys take effect at once (new
+// connections for the socket options), "restart" keys keep their current
+// value and only log that a restart is needed. The rate limits in
+// RATELIMIT_CONF and the quotas in QUOTA_CONF are re-read on SIGHUP as well.
+typedef enum {
+    CFG_PORT,                  // restart
+    CFG_ACCEPT_THREADS,        // restart, 0 = one per online CPU
+    CFG_LISTEN_BACKLOG,        // restart
+    CFG_MAX_CLIENTS,           // reload, connections beyond it are refused (tables grow to it)
+    CFG_FRAME_SIZE,            // reload, download chunk (bytes, <= BUFFER_SIZE: the protocol's payload limit)
+    CFG_SOCKET_SNDBUF,         // reload, SO_SNDBUF of new connections (0 = kernel default)
+    CFG_SOCKET_RCVBUF,         // reload, SO_RCVBUF of new connections (0 = kernel default)
+    CFG_TCP_NODELAY,           // reload, 1 = disable Nagle on new connections
+    CFG_TCP_CORK,              // reload, 1 = cork each round of download frames
+    CFG_FILE_CACHE_BYTES,      // reload
+    CFG_FILE_CACHE_MAX_FILE,   // reload
+    CFG_VERSION_KEEP,          // reload
+    CFG_VERSION_MAX_AGE_DAYS,  // reload
+    CFG_RESUME_TTL,            // reload
+    CFG_TRACE_SAMPLE,          // reload
+    CFG_IDLE_TIMEOUT,          // reload, seconds (0 = never)
+    CFG_STALL_TIMEOUT,         // reload, seconds without a frame on a running transfer
+    CFG_TRANSFER_TIMEOUT,      // reload, seconds a single transfer may take
+    CFG_DRAIN_TIMEOUT,         // reload, seconds a replaced process finishes transfers (upgrade.h)
+    CFG_REPL_PORT,             // restart, replication port of a primary (0 = off, replication.h)
+    CFG_REPL_LOG_KEEP_MB,      // reload, replication log kept for lagging replicas
+    CFG_RECONCILE_INTERVAL,    // reload, seconds between folder total repairs (search_index.h)
+    CFG_COUNT
+} ConfigKey;
+
+// String keys, all restart only (empty = unset)
+typedef enum {
+    CFG_STORAGE_DIRS,          // Shard list (storage.h)
+    CFG_REPLICATE_FROM,        // "host:port" of the primary: runs as a read-only replica
+    CFG_REPL_SECRET,           // Shared by a primary and its replicas
+    CFG_CLUSTER_SECRET,        // Shared with bin/router: lets it log connections in for its users
+    CFG_STR_COUNT
+} ConfigString;
+
+/**
+ * @brief Loads SERVER_CONF (a missing file means defaults) and blocks SIGHUP
+ * in the calling thread. Call first in main(), before any thread exists.
+ */
+void config_init();
+
+/**
+ * @brief Current value of a numeric key (lock-free).
+ */
+long config_get(ConfigKey key);
+
+/**
+ * @brief Value of a string key (from the file, or its FS_* variable), NULL if unset.
+ */
+const char *config_string(ConfigString key);
+
+/**
+ * @brief Starts a thread that waits for SIGHUP, re-reads the file and then
+ * calls `on_reload` so the modules pick the new values up.
+ */
+void config_start_reloader(void (*on_reload)(void));
+
+/**
+ * @brief Appends the config source and reload count for MSG_STATS.
+ * @return Number of characters written.
+ */
+int config_format_stats(char *buf, size_t size);
+
+#endif // CONFIG_H
@@ -0,0 +1,64 @@
+#ifndef CONN_TIMEOUT_H
+#define CONN_TIMEOUT_H
+
+#include <stddef.h>
+#include "timer_wheel.h"
+
+// --- CONFIGURATION ---
+// Defaults of idle_timeout / stall_timeout / transfer_timeout (config.h),
+// in seconds, 0 = never.
+#define CONN_DEFAULT_IDLE_TIMEOUT 1800
+#define CONN_DEFAULT_STALL_TIMEOUT 60
+#define CONN_DEFAULT_TRANSFER_TIMEOUT 0
+
+typedef enum {
+    CONN_TIMEOUT_NONE,
+    CONN_TIMEOUT_IDLE,      // No request and no transfer making progress
+    CONN_TIMEOUT_STALL,     // A running transfer moved no frame
+    CONN_TIMEOUT_TRANSFER   // A transfer ran longer than allowed
+} ConnTimeoutReason;
+
+// One watchdog per connection, on the shared timer wheel. The connection
+// thread only publishes when each limit started counting (lock-free stores,
+// after every packet); the wheel callback turns them into a deadline with
+// the current configuration and re-arms itself while the connection is
+// healthy. An expired connection is shut down, which wakes its thread up
+// (poll, recv or a blocked send) into the normal cleanup path.
+typedef struct {
+    TimerEntry entry;
+    int sockfd;
+    long long idle_base;      // Monotonic ms each limit counts from, 0 = not running
+    long long stall_base;
+    long long transfer_base;
+    long long scheduled_ms;   // Deadline the entry is armed for
+    int expired;              // ConnTimeoutReason, set by the wheel thread
+} ConnTimer;
+
+/**
+ * @brief Arms the watchdog of a new connection (idle from now).
+ */
+void conn_timeout_start(ConnTimer *t, int sockfd);
+
+/**
+ * @brief Publishes when each limit started counting (0 = not applicable).
+ */
+void conn_timeout_update(ConnTimer *t, long long idle_base, long long stall_base, long long transfer_base);
+
+/**
+ * @brief Disarms the watchdog. Call before close(): the wheel never touches
+ * the descriptor afterwards.
+ */
+void conn_timeout_stop(ConnTimer *t);
+
+/**
+ * @brief Reason name for logs ("idle", "stalled transfer", ...).
+ */
+const char *conn_timeout_reason(int reason);
+
+/**
+ * @brief Appends the timeout counters for MSG_STATS.
+ * @return Number of characters written.
+ */
+int conn_timeout_format_stats(char *buf, size_t size);
+
+#endif // CONN_TIMEOUT_H
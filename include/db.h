@@ -26,5 +26,7 @@ int db_read_groups(GroupInfo *groups, int max_count);
 int db_write_group(const GroupInfo *group);
 int db_read_group_members(GroupMemberInfo *members, int max_count);
 int db_write_group_member(const GroupMemberInfo *member);
+int db_find_group(int group_id, GroupInfo *out);
+int db_member_status(int group_id, int user_id);
 
 #endif
@@ -0,0 +1,71 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+// Defaults of file_cache_bytes / file_cache_max_file (config.h).
+#define FILE_CACHE_DEFAULT_BYTES (64L * 1024 * 1024)
+#define FILE_CACHE_DEFAULT_MAX_FILE (256L * 1024)
+#define FILE_CACHE_MAX_FILE_LIMIT (1024L * 1024) // A hit is framed in memory and sent with writev
+#define FILE_CACHE_PROTECTED_PCT 80              // Share of the budget for entries hit twice
+
+// Contents of one small file, shared by all connections. Entries are
+// reference counted: an invalidated entry stays valid for readers that
+// already hold it and is freed by the last file_cache_release().
+typedef struct FileCacheEntry {
+    char path[512];          // Physical path (hash key)
+    char etag[64];           // Version the data belongs to (see make_etag)
+    char *data;
+    long size;
+    int refs;
+    int dead;                // Removed from the cache, freed when refs drops to 0
+    int protected_seg;       // Segmented LRU: 0 = probation, 1 = protected
+    struct FileCacheEntry *hnext;
+    struct FileCacheEntry *prev, *next;
+} FileCacheEntry;
+
+/**
+ * @brief Reads the size limits from the configuration (at startup and on
+ * reload; a smaller budget evicts at once).
+ */
+void file_cache_init();
+
+/**
+ * @brief Largest file that is served from / admitted to the cache.
+ */
+long file_cache_max_file();
+
+/**
+ * @brief Looks up a file, taking a reference on a hit.
+ * An entry whose etag differs from the file's current one is dropped.
+ * @return The entry (release with file_cache_release), or NULL on a miss.
+ */
+FileCacheEntry *file_cache_acquire(const char *path, const char *etag);
+
+/**
+ * @brief Adds a file's contents (takes ownership of `data`, malloc'd).
+ * @return A referenced entry; it may already be detached if it was too
+ * large to keep, but is still usable until released. NULL (and `data`
+ * freed) if out of memory: serve the file without the cache.
+ */
+FileCacheEntry *file_cache_insert(const char *path, const char *etag, char *data, long size);
+
+/**
+ * @brief Drops a reference taken by acquire/insert.
+ */
+void file_cache_release(FileCacheEntry *e);
+
+/**
+ * @brief Drops `path` and, if it is a folder, everything below it.
+ * Called by the upload, rename, move, copy and delete handlers.
+ */
+void file_cache_invalidate(const char *path);
+
+/**
+ * @brief Appends a one-line hit/miss/size summary (for MSG_STATS).
+ * @return Number of characters written.
+ */
+int file_cache_format_stats(char *buf, size_t size);
+
+#endif // FILE_CACHE_H
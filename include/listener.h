@@ -0,0 +1,66 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stddef.h>
+#include <netinet/in.h>
+#include "common.h"
+
+// --- CONFIGURATION ---
+// accept_threads (config.h) sets the number of acceptors (default: one per
+// online CPU), listen_backlog the accept queue length of each listening
+// socket (the kernel caps it at net.core.somaxconn).
+#define LISTENER_MAX_ACCEPTORS 32
+#define LISTENER_DEFAULT_BACKLOG 4096
+
+// Every acceptor thread owns a listening socket bound to the same port with
+// SO_REUSEPORT, so the kernel spreads incoming connections over them and
+// each has its own accept queue. An acceptor only accepts and starts the
+// connection thread; session registration and logging happen in that thread.
+// If SO_REUSEPORT is not available, the acceptors share one socket.
+
+typedef struct {
+    int sockfd;
+    struct sockaddr_in addr;
+    Session *restored;  // Handed over by the previous process (upgrade.h), NULL if new
+} AcceptedConn;
+
+/**
+ * @brief Creates and binds the listening sockets.
+ * @return Number of acceptors, or -1 on error (already reported with perror).
+ */
+int listener_open(int port);
+
+/**
+ * @brief Takes over listening sockets received from the previous process
+ * (`shared`: one socket for every acceptor, see listener_export).
+ * @return Number of acceptors, or -1 on error.
+ */
+int listener_adopt(const int *fds, int count, int shared);
+
+/**
+ * @brief Starts the acceptors and returns only after listener_stop(). Each
+ * accepted connection runs `handler` in a detached thread, with a malloc'd
+ * AcceptedConn the handler must free.
+ */
+void listener_run(void *(*handler)(void *));
+
+/**
+ * @brief The listening sockets to hand over to the next process.
+ * @param shared Set to 1 if every acceptor uses the same socket (then only it is returned).
+ * @return Number of descriptors written to `fds`.
+ */
+int listener_export(int *fds, int max, int *shared);
+
+/**
+ * @brief Makes the acceptors return (the sockets stay open, now served by
+ * the next process).
+ */
+void listener_stop();
+
+/**
+ * @brief Appends acceptor counters for MSG_STATS.
+ * @return Number of characters written.
+ */
+int listener_format_stats(char *buf, size_t size);
+
+#endif // LISTENER_H
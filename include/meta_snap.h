@@ -0,0 +1,84 @@
+#ifndef META_SNAP_H
+#define META_SNAP_H
+
+#include <stddef.h>
+#include "db.h"
+
+// --- CONFIGURATION ---
+#define META_SNAP_FILE "./data/meta.snap"
+#define META_SNAP_VERSION 1
+#define META_SNAP_REFRESH_INTERVAL 5 // Seconds between staleness checks (server)
+#define META_SNAP_RACY_MS 100        // Sources modified this close to a build are not trusted
+#define META_SNAP_UNAVAILABLE -2     // Lookup result: no usable snapshot, read the .txt file
+
+// Binary snapshot of users.txt, groups.txt and group_members.txt, mapped
+// read-only so startup costs one mmap() instead of a parse. Layout (native
+// byte order, every section 8-byte aligned):
+//
+//   header | users | users_by_name | groups | groups_by_id
+//          | members | members_by_pair | string table
+//
+// Records are fixed size and keep the order of the .txt files; the *_by_*
+// sections are arrays of record numbers sorted for binary search; names and
+// passwords are NUL-terminated strings referenced by offset into the string
+// table. The .txt files stay the source of truth: the header records the
+// size and mtime of each one, and a section whose file changed since the
+// build is ignored (callers fall back to the text scan) until the snapshot
+// is rebuilt.
+
+/**
+ * @brief Converts the three .txt files into a snapshot at `path` (written to
+ * "<path>.tmp", then renamed). Takes db_mutex while reading.
+ * @return 0 on success, -1 on error.
+ */
+int meta_snap_build(const char *path);
+
+/**
+ * @brief Maps and validates a snapshot, replacing the current one.
+ * @return 0 on success, -1 if the file is missing or invalid.
+ */
+int meta_snap_open(const char *path);
+
+/**
+ * @brief Unmaps the current snapshot (lookups return META_SNAP_UNAVAILABLE).
+ */
+void meta_snap_close();
+
+/**
+ * @brief Starts a thread that rebuilds and remaps the snapshot whenever a
+ * source file changed (checked every `interval_sec`, first check at once).
+ */
+void meta_snap_start_refresher(const char *path, int interval_sec);
+
+/**
+ * @brief Same contract as db_check_login, through the users_by_name index.
+ * @return UserID, -1 if no match, META_SNAP_UNAVAILABLE if users.txt changed.
+ */
+int meta_snap_check_login(const char *username, const char *password);
+
+/**
+ * @brief Same contract as db_read_groups / db_read_group_members (file order).
+ * @return Count, -1 if the file did not exist, or META_SNAP_UNAVAILABLE.
+ */
+int meta_snap_read_groups(GroupInfo *groups, int max_count);
+int meta_snap_read_group_members(GroupMemberInfo *members, int max_count);
+
+/**
+ * @brief Looks a group up through the groups_by_id index.
+ * @return 1 if found (copied to `out`), 0 if not, or META_SNAP_UNAVAILABLE.
+ */
+int meta_snap_find_group(int group_id, GroupInfo *out);
+
+/**
+ * @brief Membership of a user through the members_by_pair index.
+ * @return 1 (accepted), 0 (pending), -1 (none) or META_SNAP_UNAVAILABLE.
+ */
+int meta_snap_member_status(int group_id, int user_id);
+
+/**
+ * @brief One-line summary for MSG_STATS and the metasnap tool.
+ * @return Number of characters written.
+ */
+int meta_snap_format_info(char *buf, size_t size);
+
+#endif // META_SNAP_H
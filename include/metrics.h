@@ -0,0 +1,41 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+#define METRICS_FILE "./data/metrics.txt"
+#define METRICS_DUMP_INTERVAL 60   // Seconds between periodic dumps
+#define METRICS_MAX_TYPES 64       // Upper bound for MessageType values tracked
+#define METRICS_REPORT_SIZE 16384  // MSG_STATS report and periodic dump (sent in BUFFER_SIZE chunks)
+
+/**
+ * @brief Records one handled request on the calling thread's private stats.
+ * Lock-free: each thread only ever writes its own counters.
+ *
+ * @param msg_type The request MessageType.
+ * @param latency_ns Time spent in the handler, in nanoseconds.
+ * @param bytes_in Bytes received for this request (headers included).
+ * @param bytes_out Bytes sent for this request (headers included).
+ * @param is_error Non-zero if the handler answered with an error.
+ */
+void metrics_record(int msg_type, unsigned long long latency_ns,
+                    unsigned long long bytes_in, unsigned long long bytes_out, int is_error);
+
+/**
+ * @brief Merges all per-thread stats and formats them as a text table.
+ * @return Number of bytes written (always null-terminated, truncated if needed).
+ */
+int metrics_format(char *buffer, size_t size);
+
+/**
+ * @brief Starts a detached thread that rewrites 'path' every 'interval_sec'.
+ */
+void metrics_start_dumper(const char *path, int interval_sec);
+
+/**
+ * @brief Returns a printable name for a MessageType ("MSG_LOGIN", ...).
+ */
+const char *msg_type_name(int msg_type);
+
+#endif // METRICS_H
@@ -2,6 +2,7 @@
 #define NETWORK_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include "common.h"   // To get BUFFER_SIZE
 #include "protocol.h" // To get struct PacketHeader, MessageType
 
@@ -30,6 +31,8 @@ int recv_all(int sockfd, void *buffer, size_t len);
 
 /**
  * @brief Encapsulates and sends a complete Message (Header + Payload).
+ * The packet is tagged with the calling thread's net_reply_stream, so
+ * handlers automatically answer on the stream the request arrived on.
  * 
  * @param sockfd The destination socket.
  * @param type The message type (MSG_LOGIN, MSG_UPLOAD, etc.).
@@ -52,4 +55,33 @@ int send_packet(int sockfd, int type, const void *payload, int payload_len);
  */
 int recv_packet(int sockfd, int *type, void *payload_buffer);
 
+/**
+ * @brief Same as send_packet() but on an explicit stream.
+ */
+int send_packet_stream(int sockfd, int stream_id, int type, const void *payload, int payload_len);
+
+/**
+ * @brief Sends pre-built packets (headers + payloads) with writev,
+ * finishing partial writes. Counts the bytes like send_packet().
+ * @param iov Buffers to send; modified in place during partial writes.
+ * @return 0 on success, -1 on failure.
+ */
+int send_iov(int sockfd, struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Same as recv_packet() but also returns the packet's stream ID.
+ */
+int recv_packet_stream(int sockfd, int *stream_id, int *type, void *payload_buffer);
+
+// Stream used by send_packet() on this thread (set per request by the server)
+extern __thread int net_reply_stream;
+
+// --- PER-THREAD TRAFFIC COUNTERS ---
+// Updated by send_packet/recv_packet on the calling thread only, so they need
+// no locking. The server metrics read deltas around each request.
+
+extern __thread unsigned long long net_tx_bytes;   // Header + payload bytes sent
+extern __thread unsigned long long net_rx_bytes;   // Header + payload bytes received
+extern __thread unsigned long long net_tx_errors;  // MSG_ERROR / MSG_FILE_ERROR packets sent
+
 #endif // NETWORK_H
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef PATH_LOCK_H
+#define PATH_LOCK_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+#define PATH_LOCK_SHARDS 64
+#define PATH_LOCK_BUCKETS 256 // Per shard
+#define PATH_LOCK_MAX_PATH 512
+
+// Multi-granularity modes: locking a path in S/X first takes IS/IX on every
+// ancestor folder, so e.g. DELETE of a folder (X) conflicts with a copy
+// anywhere below it (IS on the folder) without scanning the tree. Downloads
+// take no lock: uploads are committed by rename, so an open file never changes.
+typedef enum {
+    LOCK_MODE_IS,  // Intent shared (ancestor of an S lock)
+    LOCK_MODE_IX,  // Intent exclusive (ancestor of an X lock)
+    LOCK_MODE_S,   // Shared: copy source
+    LOCK_MODE_X,   // Exclusive: upload commit, rename, move, delete, copy destination
+    LOCK_MODE_COUNT
+} PathLockMode;
+
+// A held lock. Locks are try-only: a caller reports "busy" (or retries a
+// bounded number of times), so a connection thread can never deadlock.
+typedef struct {
+    int held;
+    int mode;
+    char path[PATH_LOCK_MAX_PATH]; // Normalized logical path
+} PathLock;
+
+/**
+ * @brief Normalizes a logical path ("./a//b/" -> "a/b"), relative to the
+ * storage root.
+ */
+void path_lock_normalize(const char *path, char *out, size_t size);
+
+/**
+ * @brief Tries to lock `path` (S or X) plus intent locks on its ancestors.
+ * Nothing is held if it fails.
+ * @return 0 on success, -1 if a conflicting lock is held.
+ */
+int path_lock_try(PathLock *lock, const char *path, int mode);
+
+/**
+ * @brief Releases a lock taken by path_lock_try (no-op if not held).
+ */
+void path_lock_release(PathLock *lock);
+
+#endif // PATH_LOCK_H
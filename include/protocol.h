@@ -44,12 +44,54 @@ typedef enum
 
     // Directory Listing
     MSG_LIST_FILES,
-    MSG_LIST_RESPONSE
+    MSG_LIST_RESPONSE,
+
+    // Monitoring
+    MSG_STATS,
+
+    // Transfer stream control (sent on the transfer's stream)
+    MSG_TRANSFER_PAUSE,
+    MSG_TRANSFER_RESUME,
+
+    // Recursive transfers (UPLOAD -r / DOWNLOAD -r)
+    MSG_CREATE_FOLDERS, // Payload: one folder path per line
+    MSG_LIST_TREE,      // Request: folder; replies: entry chunks, then MSG_SUCCESS
+
+    // Conditional download: reply to "DOWNLOAD <file> <etag>" when the
+    // client's copy is current (payload: etag, no data follows)
+    MSG_NOT_MODIFIED,
+
+    // File history (previous contents kept on overwrite/delete)
+    MSG_LIST_VERSIONS,    // Payload: file; reply: MSG_LIST_RESPONSE, newest first
+    MSG_DOWNLOAD_VERSION, // Payload: "file id"; replies like MSG_DOWNLOAD_REQ
+    MSG_RESTORE_VERSION,  // Payload: "file id"
+
+    // Session resumption after a dropped connection
+    MSG_RESUME_SESSION,   // Payload: token; reply: greeting, then "<stream_id> <U|D> <offset>" per kept transfer
+    MSG_RESUME_TRANSFER,  // On a kept transfer's stream; payload: offset to continue from
+
+    // Group-sharded cluster: sent by the routing front-end (bin/router) to
+    // its backends, refused unless cluster_secret is set and matches
+    MSG_CLUSTER_AUTH,        // Payload: "<secret> <user_id> <username>"; logs the connection in as that user
+    MSG_CLUSTER_CREATE_GROUP, // Payload: "<secret> <group_id> <name>"; the logged-in user owns it
+
+    // Filename search: "<pattern> [limit [offset]]", a substring or a glob
+    // ('*', '?', '[') matched against names; replies are MSG_SEARCH pages of
+    // "path\n" lines (folders end in '/'), then MSG_SUCCESS with the count
+    MSG_SEARCH,
+
+    // Folder totals: payload folder ("" = root); reply MSG_SUCCESS
+    // "<folder>: <files> files, <folders> folders, <bytes> bytes"
+    MSG_FOLDER_STATS
 } MessageType;
 
+// Marks the resumption token at the end of a successful MSG_LOGIN reply
+#define RESUME_TOKEN_TAG " Resume token: "
+
 typedef struct
 {
     MessageType type;
+    int stream_id;   // 0 = control stream; each transfer runs on its own stream
     int payload_len;
 } PacketHeader;
 
@@ -0,0 +1,57 @@
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+// Read at startup and on SIGHUP. Sizes are in bytes, 0 = no limit:
+//   group_quota <bytes>       every group folder
+//   user_quota <bytes>        the files each user uploaded
+//   group <id> <bytes>        (per-group override)
+//   user <id> <bytes>         (per-user override)
+#define QUOTA_CONF "./data/quota.conf"
+#define QUOTA_MAX_RULES 1024
+
+// Storage quotas, checked when an upload is announced. Usage comes from
+// the search index, which keeps a folder's total size and each uploader's
+// bytes up to date (search_index.h), so a check costs two lookups. Space
+// for an upload in progress is reserved until it is committed or dropped,
+// so concurrent uploads cannot overshoot together; deleting files lowers
+// the usage at once.
+
+typedef struct {
+    int limited;            // A quota applied: the upload must keep to its size
+    int group_id;           // Charged group, 0 = none
+    int user_id;            // Charged user, 0 = none
+    long long group_bytes;  // Reserved on each (0 = nothing held)
+    long long user_bytes;
+} QuotaReservation;
+
+/**
+ * @brief Loads limits from a config file (missing file = unlimited).
+ * @return 0 on success, -1 if the file could not be read.
+ */
+int quota_load(const char *path);
+
+/**
+ * @brief Reserves room for `bytes` written to `filename` by `user_id` (-1:
+ * no user quota applies). Replacing a file only needs room for the growth.
+ * @param err Receives the reason on refusal.
+ * @return 0 if admitted (release `r` later), -1 if a quota would be exceeded.
+ */
+int quota_reserve(int user_id, const char *filename, long long bytes, QuotaReservation *r, char *err,
+                  size_t err_size);
+
+/**
+ * @brief Returns reserved space once the write is committed (and counted
+ * by the index) or abandoned. Safe to call twice.
+ */
+void quota_release(QuotaReservation *r);
+
+/**
+ * @brief Appends limits and reservations for MSG_STATS.
+ * @return Number of characters written.
+ */
+int quota_format_stats(char *buf, size_t size);
+
+#endif // QUOTA_H
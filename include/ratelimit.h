@@ -0,0 +1,53 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+// --- CONFIGURATION ---
+// Read at startup and re-read on SIGHUP with the rest of the configuration,
+// so limits can be tuned while the server is running.
+#define RATELIMIT_CONF "./data/ratelimit.conf"
+
+typedef enum {
+    RL_UPLOAD,
+    RL_DOWNLOAD
+} RateDirection;
+
+// Priority classes: lower classes must leave headroom in the shared
+// (global / group) buckets so interactive users are never starved.
+typedef enum {
+    RL_CLASS_INTERACTIVE,
+    RL_CLASS_NORMAL,
+    RL_CLASS_BULK,
+    RL_CLASS_COUNT
+} RateClass;
+
+/**
+ * @brief Charges 'bytes' against the session, group and global buckets.
+ * Buckets may go into debt; the caller should pause for the returned time.
+ *
+ * @param sockfd Session socket (per-session bucket key).
+ * @param user_id Logged-in user (selects the priority class), -1 for guests.
+ * @param group_id Group owning the file, -1 if not in a group folder.
+ * @param direction RL_UPLOAD or RL_DOWNLOAD.
+ * @param bytes Payload bytes about to be transferred.
+ * @return Nanoseconds to wait before transferring (0 = go now).
+ */
+long long rl_reserve(int sockfd, int user_id, int group_id, int direction, long bytes);
+
+/**
+ * @brief Charges 'bytes' only if every bucket can cover them now.
+ * @return 0 if charged, -1 if the transfer would have to wait (nothing charged).
+ */
+int rl_try_reserve(int sockfd, int user_id, int group_id, int direction, long bytes);
+
+/**
+ * @brief Drops the per-session buckets when a client disconnects.
+ */
+void rl_remove_session(int sockfd);
+
+/**
+ * @brief Loads limits from a config file (missing file = unlimited).
+ * @return 0 on success, -1 if the file could not be read.
+ */
+int rl_load_config(const char *path);
+
+#endif // RATELIMIT_H
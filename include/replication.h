@@ -0,0 +1,79 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+// A primary sets repl_port; a replica sets replicate_from ("host:port").
+// Both share repl_secret (required: a primary without one does not start).
+// The log lives next to the metadata files.
+#define REPL_LOG_DIR "./data/replog"
+#define REPL_STATE_FILE "./data/replog/replica.state" // Replica: "<log_id> <offset>" applied
+#define REPL_SEGMENT_BYTES (1 << 20)   // A log segment is closed at this size
+#define REPL_DEFAULT_LOG_KEEP_MB 1024   // Default of repl_log_keep_mb (records and their file copies)
+#define REPL_MAX_REPLICAS 16
+#define REPL_HEARTBEAT_MS 5000          // Idle primary pings its replicas this often
+#define REPL_RETRY_DELAY 2              // Seconds before a replica reconnects
+
+// Primary/replica replication. Every mutation of the primary (uploads,
+// restores, deletes, renames, moves, copies, new folders, and the users,
+// groups and memberships files) appends one text record to an ordered log,
+// under the same path locks as the change itself, so the log order is the
+// order the changes happened in. A record that writes content keeps a copy
+// of it as of that moment: a hard link to the published file (files are
+// only ever replaced by rename), or a copy for the metadata files and
+// across disks. A record's ID is its byte offset in the log.
+//
+// A replica connects to repl_port and asks for the records after the last
+// offset it applied; the primary streams them, and the replica acknowledges
+// each one once applied. A replica whose offset the primary no longer has
+// (a new log, or segments dropped past repl_log_keep_mb) first gets a full
+// copy of the current tree and metadata, then the records from the offset
+// the copy was taken at. Applying a record twice is harmless, so the
+// replica only has to persist its offset lazily.
+//
+// Replicas serve logins, LIST and DOWNLOAD (and the other read requests);
+// every request that would change data is refused.
+
+/**
+ * @brief Starts replication if configured (after storage_init): a primary
+ * opens or recovers its log and listens on repl_port; a replica only takes
+ * its role (see repl_start_follower).
+ */
+void repl_init();
+
+/**
+ * @brief Replica: starts the thread that follows the primary and applies
+ * its changes to the tree (once no other process writes the tree).
+ */
+void repl_start_follower();
+
+/**
+ * @brief 1 if this server is a read-only replica.
+ */
+int repl_is_replica();
+
+/**
+ * @brief Records a change on a primary (no-op otherwise). Call after the
+ * change succeeded, while still holding its path locks. Paths are logical
+ * (relative to the storage root).
+ */
+void repl_log_put(const char *filename);
+void repl_log_mkdir(const char *filename);
+void repl_log_delete(const char *filename);
+void repl_log_move(const char *src_filename, const char *dest_filename);
+void repl_log_copy(const char *src_filename, const char *dest_filename);
+
+/**
+ * @brief Records the new content of a metadata file (USER_DB_FILE,
+ * GROUP_DB_FILE or GROUP_MEMBER_DB_FILE) after it was written.
+ */
+void repl_log_meta(const char *db_file);
+
+/**
+ * @brief Appends the replication role, log range and replica lag for MSG_STATS.
+ * @return Number of characters written.
+ */
+int repl_format_stats(char *buf, size_t size);
+
+#endif // REPLICATION_H
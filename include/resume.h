@@ -0,0 +1,91 @@
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stddef.h>
+#include "common.h"
+#include "stream.h"
+
+// --- CONFIGURATION ---
+// Default of resume_ttl (config.h): seconds a dropped session can be resumed.
+#define RESUME_DEFAULT_TTL 300
+#define RESUME_BUCKETS 1024
+#define RESUME_MAX_TOKENS 8192
+#define RESUME_TAKEOVER_WAIT_MS 500 // Resume while the old connection is still seen as alive
+#define RESUME_SWEEP_INTERVAL_MS 1000
+
+// A successful login issues a random token, kept only in memory (a server
+// restart invalidates every token). When the connection drops, its
+// unfinished transfers are detached and kept with the token; presenting the
+// token on a new connection (MSG_RESUME_SESSION) restores the user in one
+// round trip, without a users.txt lookup, and hands those transfers to the
+// new connection. A token expires TTL seconds after its connection dropped;
+// LOGOUT revokes it.
+
+/**
+ * @brief Arms the periodic expiry sweep (after timer_wheel_start).
+ */
+void resume_start_sweeper();
+
+/**
+ * @brief Issues a token for a connection that just logged in.
+ * @param token Receives RESUME_TOKEN_LEN hex characters.
+ * @return 0 on success, -1 if the table is full.
+ */
+int resume_issue(int sockfd, int user_id, const char *username, char *token);
+
+/**
+ * @brief Attaches a token to a new connection. If its previous connection
+ * is still open (the server has not noticed the drop yet), that connection
+ * is shut down and its transfers detached first.
+ * @param parked Receives the detached transfers (up to MAX_STREAMS_PER_CONN).
+ * @return 0 on success, -1 if the token is unknown, expired or still busy.
+ */
+int resume_claim(const char *token, int sockfd, int *user_id, char *username, Stream *parked, int *parked_count);
+
+/**
+ * @brief Called when the connection holding `token` closes: keeps its
+ * detached transfers and starts the expiry countdown.
+ */
+void resume_detach(const char *token, int sockfd, Stream *parked, int count);
+
+/**
+ * @brief Invalidates a token (LOGOUT).
+ */
+void resume_revoke(const char *token);
+
+/**
+ * @brief Invalidates every token of a user except `keep_token` (may be
+ * NULL), e.g. after a password change or account deletion.
+ */
+void resume_revoke_user(int user_id, const char *keep_token);
+
+// A detached token handed over to the next process (upgrade.h)
+typedef struct {
+    char token[RESUME_TOKEN_LEN + 1];
+    int user_id;
+    char username[50];
+    long ttl_left;    // Seconds
+} ResumeExport;
+
+/**
+ * @brief Removes every detached token from the table for a handover. Their
+ * parked transfers are discarded (the client restarts them).
+ * @param out Receives a malloc'd array the caller frees.
+ * @return Number of tokens, or -1 on allocation failure.
+ */
+int resume_export(ResumeExport **out);
+
+/**
+ * @brief Adds a token issued by the previous process: attached to `sockfd`,
+ * or detached (sockfd -1) for `ttl_left` more seconds.
+ * @return 0 on success, -1 if the table is full.
+ */
+int resume_import(const char *token, int sockfd, int user_id, const char *username, long ttl_left);
+
+/**
+ * @brief Appends token table counters for MSG_STATS.
+ * @return Number of characters written.
+ */
+int resume_format_stats(char *buf, size_t size);
+
+#endif // RESUME_H
@@ -0,0 +1,67 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+// Routing front-end for a group-sharded cluster (bin/router). It speaks the
+// client protocol, so the unchanged client connects to it like to a server.
+// Each Group_<id> lives on one backend server, picked by consistent hashing
+// of "Group_<id>"; everything else (accounts, the group list, personal
+// files) goes to the metadata node. The router logs each user in at the
+// metadata node, then on the backends with MSG_CLUSTER_AUTH, which they
+// accept only with their cluster_secret.
+
+// --- CONFIGURATION ---
+#define ROUTER_DEFAULT_PORT 3640
+#define ROUTER_MAX_NODES 32        // Metadata node plus backends
+#define ROUTER_VNODES 64           // Ring points per backend: evens out the group spread
+#define ROUTER_MAX_ROUTES 64       // Transfers tracked per client (stream -> backend)
+#define ROUTER_CALL_STREAM ((1 << 30) - 1) // Requests the router sends itself (below client batch tags)
+#define ROUTER_CONNECT_TIMEOUT_MS 3000
+
+#define ROUTER_META 0              // Node index of the metadata node
+
+typedef struct {
+    char host[64];
+    int port;
+} RouterNode;
+
+// --- Node list and ring (ring.c) ---
+
+/**
+ * @brief Parses "host:port" into a node.
+ * @return 0 on success, -1 if malformed.
+ */
+int router_parse_node(const char *spec, RouterNode *out);
+
+/**
+ * @brief Builds the hash ring over backends 1..count-1 of `nodes`
+ * (index 0 is the metadata node, which only joins the ring if listed again).
+ * @return 0 on success, -1 on allocation failure.
+ */
+int ring_build(const RouterNode *nodes, int count);
+
+/**
+ * @brief Node index owning a group.
+ */
+int ring_lookup(int group_id);
+
+/**
+ * @brief Group ID named by a logical path ("Group_3/a.txt", "/Group_3"), or
+ * -1 for paths outside any group.
+ */
+int router_path_group(const char *path);
+
+// --- Client relay (relay.c) ---
+
+/**
+ * @brief Sets the node list and the secret presented to backends. Call
+ * once before the first client thread starts.
+ */
+void relay_init(const RouterNode *nodes, int count, const char *secret);
+
+/**
+ * @brief Thread body serving one client connection until either side
+ * closes. `arg` is a malloc'd int holding the socket.
+ */
+void *relay_client_thread(void *arg);
+
+#endif // ROUTER_H
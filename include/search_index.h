@@ -0,0 +1,110 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+#define SEARCH_DEFAULT_LIMIT 1000              // Results per MSG_SEARCH unless the request asks for fewer
+#define SEARCH_MAX_LIMIT 10000
+#define SEARCH_MIN_COMPACT 65536               // Stale postings tolerated before a rebuild is considered
+#define SEARCH_DEFAULT_RECONCILE_INTERVAL 600  // reconcile_interval: seconds between repair passes (0 = off)
+#define SEARCH_OWNER_XATTR "user.fileshare.owner"  // User ID of the uploader, set on each uploaded file
+
+// In-memory filename index over every storage shard's files/ folder.
+// Entries form a tree of names (one node per file or folder, linked to its
+// parent), so renaming or moving a folder updates a single node. Each
+// node's own name is indexed by its lowercase trigrams; a query reads the
+// rarest trigram's postings and checks each candidate's name, so postings
+// left behind by renames and deletes cost a little time, never a wrong
+// result, until they are compacted away.
+//
+// Every node also carries the totals of its subtree (bytes, files,
+// folders). A change adds its difference to the node's ancestors, so a
+// folder's size is read without walking it. Files also remember who
+// uploaded them (SEARCH_OWNER_XATTR), and the bytes of each uploader are
+// summed the same way (quota.h).
+//
+// Built by a background scan at startup, then kept current by the handlers
+// that change files (upload, restore, mkdir, rename, move, copy, delete,
+// group folders, replication). The same thread then re-walks the disk every
+// reconcile_interval seconds and repairs entries and totals that drifted. Paths are logical, relative to the root.
+
+typedef struct {
+    long long bytes;  // Size of all files below the folder
+    long files;
+    long folders;     // Subfolders at any depth
+} FolderStats;
+
+/**
+ * @brief Starts the background scan that fills the index (after storage_init).
+ */
+void search_index_init();
+
+/**
+ * @brief Adds a file or folder (and any missing parent folders).
+ */
+void search_index_add(const char *filename, int is_dir);
+
+/**
+ * @brief Adds a folder and everything under it, read from disk (COPY).
+ */
+void search_index_add_tree(const char *filename);
+
+/**
+ * @brief Removes an entry and, for a folder, everything under it.
+ */
+void search_index_remove(const char *filename);
+
+/**
+ * @brief Renames or moves an entry (a folder keeps its content).
+ */
+void search_index_move(const char *src_filename, const char *dest_filename);
+
+/**
+ * @brief 1 if the user may see entries of a group (checked at query time,
+ * at most once per group and query).
+ */
+typedef int (*SearchGroupFilter)(int group_id, void *ctx);
+
+/**
+ * @brief Finds entries whose name contains `pattern` (case-insensitive), or
+ * matches it as a glob when it has '*', '?' or '['.
+ * @param out Receives a malloc'd block of "path\n" lines, folders ending in
+ *            '/' (free() it); NULL if nothing matched.
+ * @param more Set to 1 if matches remain after this page.
+ * @param total Set to the number of matches, skipped ones included (only
+ *              known when *more is 0).
+ * @return Number of lines in *out.
+ */
+int search_index_query(const char *pattern, long offset, int limit, SearchGroupFilter filter, void *ctx,
+                       char **out, size_t *out_len, int *more, long *total);
+
+/**
+ * @brief Totals of a folder ("" for the root).
+ * @return 0, or -1 if it is not a known folder or the startup scan is not done.
+ */
+int search_index_folder_stats(const char *filename, FolderStats *out);
+
+/**
+ * @brief 1 once the startup scan is done (totals cover every file).
+ */
+int search_index_ready();
+
+/**
+ * @brief Size and uploader (0 = unknown) of an indexed file.
+ * @return 0, or -1 if it is not a known file.
+ */
+int search_index_file_info(const char *filename, long long *size, int *owner);
+
+/**
+ * @brief Bytes of the files a user uploaded that still exist.
+ */
+long long search_index_owner_bytes(int user_id);
+
+/**
+ * @brief Appends entry, trigram, folder total and reconciler counters for MSG_STATS.
+ * @return Number of characters written.
+ */
+int search_index_format_stats(char *buf, size_t size);
+
+#endif // SEARCH_INDEX_H
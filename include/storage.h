@@ -0,0 +1,88 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+// storage_dirs (config.h) or FS_STORAGE_DIRS lists the shard base directories, separated by ':', each
+// optionally weighted with "@<weight>" (e.g. "./data:/mnt/disk2/fs@2").
+// Every base holds files/, staging/ and versions/ on one filesystem, so
+// uploads and version snapshots never cross a disk.
+#define STORAGE_DEFAULT_DIRS "./data"
+#define STORAGE_MAX_SHARDS 16
+#define STORAGE_REBALANCE_INTERVAL 30 // Seconds between rebalancer passes
+
+// Placement unit: the top-level item of a logical path ("Group_3" for
+// "Group_3/a/b.txt", or a root-level file). A whole group lives on one
+// shard, so renames and moves inside it stay plain rename() calls. The home
+// shard is chosen by weighted rendezvous hashing: adding a shard only moves
+// the items that now hash to it, and the rebalancer moves them in the
+// background. Until then an item is served from the shard that holds it.
+
+/**
+ * @brief Parses the shard list, creates the shard folders and discards
+ * staging files left by a previous run (unless `keep_staging`: the
+ * previous process is still running). Call once at startup.
+ */
+void storage_init(int keep_staging);
+
+/**
+ * @brief Starts the rebalancer if there is more than one shard. Path locks
+ * only exclude threads of this process: call it once no other process
+ * writes the tree.
+ */
+void storage_start_rebalancer();
+
+/**
+ * @brief Ends the rebalancer (a process being replaced leaves the moves to
+ * its successor). Returns once no move is switching over.
+ */
+void storage_stop_rebalancer();
+
+/**
+ * @brief Number of configured shards.
+ */
+int storage_shard_count();
+
+/**
+ * @brief Shard that holds (or, for a new item, will hold) a logical path.
+ */
+int storage_shard_of(const char *filename);
+
+/**
+ * @brief Physical path of a logical path ("" = the shard's files/ root).
+ */
+void storage_path(const char *filename, char *out, size_t size);
+
+/**
+ * @brief Root folders of one shard ("<base>/files/", "<base>/staging/",
+ * "<base>/versions/").
+ */
+const char *storage_files_dir(int shard);
+const char *storage_staging_dir(int shard);
+const char *storage_versions_dir(int shard);
+
+/**
+ * @brief Moves a file or folder to a new logical path. Within a shard this
+ * is rename(); across shards the item is streamed into the destination's
+ * staging folder, renamed into place, then removed from the source.
+ * The caller holds X locks on both paths.
+ * @return 0 on success, -1 with errno set (EEXIST if the target exists).
+ */
+int storage_move(const char *src_filename, const char *dest_filename);
+
+/**
+ * @brief Publishes a finished staging file as `filename` (atomic rename).
+ * Falls back to a copy through the destination shard's staging folder if
+ * the item was rebalanced to another shard meanwhile.
+ * @return 0 on success, -1 on error.
+ */
+int storage_publish(const char *staged, const char *filename);
+
+/**
+ * @brief Appends one line per shard (items, bytes free) for MSG_STATS.
+ * @return Number of characters written.
+ */
+int storage_format_stats(char *buf, size_t size);
+
+#endif // STORAGE_H
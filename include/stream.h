@@ -0,0 +1,132 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include "trace.h"
+#include "quota.h"
+
+// --- CONFIGURATION ---
+#define MAX_STREAMS_PER_CONN 16
+
+typedef enum {
+    STREAM_UPLOAD,    // Client -> Server MSG_FILE_DATA frames
+    STREAM_DOWNLOAD   // Server -> Client MSG_FILE_DATA frames
+} StreamKind;
+
+// One in-progress transfer on a connection. Streams live in a per-thread
+// table: each connection is served by exactly one thread.
+typedef struct {
+    int in_use;
+    int stream_id;
+    int kind;
+    FILE *f;
+    char filename[256];        // Logical path (for logs)
+    char filepath[512];        // Physical path on disk
+    char staging[512];         // Upload: file being written, renamed to filepath on FILE_END
+    char log_prefix[256];
+    long filesize;             // Announced (upload) or actual (download) size
+    long transferred;
+    int user_id;
+    int group_id;
+    QuotaReservation quota;    // Upload: space held until commit or abort
+    long long not_before_ns;   // Rate limiting: don't send (download) or read (upload) before this time
+    int paused;                // Client sent MSG_TRANSFER_PAUSE
+    int resume_pending;        // Kept across a reconnect, waits for MSG_RESUME_TRANSFER
+    int commit_pending;        // Upload: fully received, target locked by another request (retried)
+    long long started_ms;      // Timeouts (conn_timeout.h), monotonic ms
+    long long progress_ms;     // Last frame moved (or pause lifted)
+    TraceContext trace;
+    TraceSpan io_span;
+    TraceSpan net_span;
+} Stream;
+
+/**
+ * @brief Claims a stream slot on the current connection.
+ * @return The stream, or NULL if the ID is already active or the table is full.
+ */
+Stream *stream_open(int stream_id, int kind);
+
+/**
+ * @brief Creates a fresh staging file for an upload of `filename`, on the
+ * same shard as its target (sets st->staging).
+ * @return The file opened for writing, or NULL on error.
+ */
+FILE *stream_staging_open(Stream *st, const char *filename);
+
+/**
+ * @brief Finds an active stream on the current connection.
+ */
+Stream *stream_find(int stream_id);
+
+/**
+ * @brief Routes a MSG_FILE_DATA / MSG_FILE_END / MSG_FILE_ERROR or
+ * MSG_TRANSFER_PAUSE / MSG_TRANSFER_RESUME frame to its stream.
+ * @return 1 if the frame belonged to a stream, 0 otherwise.
+ */
+int stream_handle_packet(int sockfd, int stream_id, int msg_type, char *payload, int len);
+
+/**
+ * @brief Sends at most one chunk for every download stream (round-robin).
+ */
+void stream_pump(int sockfd);
+
+/**
+ * @brief How long the connection loop may block in poll().
+ * @return 0 if a download can send now, -1 if nothing is pending,
+ *         otherwise milliseconds until the next rate-limited send or read.
+ */
+int stream_poll_timeout();
+
+/**
+ * @brief 1 while an upload of the current connection is held back by the
+ * rate limiter: the connection loop does not read the socket until
+ * stream_poll_timeout() expires.
+ */
+int stream_read_blocked();
+
+/**
+ * @brief Number of active streams on the current connection.
+ */
+int stream_active_count();
+
+/**
+ * @brief Where the transfer timeouts of the current connection count from.
+ * @param stall_base Oldest progress among running (not paused) transfers, 0 if none.
+ * @param transfer_base Start of the oldest transfer, 0 if none.
+ */
+void stream_timeout_bases(long long *stall_base, long long *transfer_base);
+
+/**
+ * @brief Aborts every stream of the current connection (on disconnect).
+ */
+void stream_close_all(int sockfd);
+
+// --- RESUMPTION (resume.c keeps detached streams between connections) ---
+
+/**
+ * @brief Moves every stream of the current connection into `out` with its
+ * file still open (uploads keep their staging file).
+ * @return Number of streams moved (at most `max`).
+ */
+int stream_detach_all(Stream *out, int max);
+
+/**
+ * @brief Attaches a detached stream to the current connection. It stays
+ * idle until the client sends MSG_RESUME_TRANSFER on its stream.
+ * @return 0 on success, -1 if its stream ID is taken or the table is full.
+ */
+int stream_adopt(const Stream *detached);
+
+/**
+ * @brief Continues an adopted stream from `offset`: uploads drop the bytes
+ * past it, downloads seek to it.
+ * @return 0 on success, -1 if the stream is not waiting or the offset is invalid.
+ */
+int stream_resume(Stream *st, long offset);
+
+/**
+ * @brief Closes a detached stream that will never be resumed.
+ */
+void stream_discard(Stream *detached);
+
+#endif // STREAM_H
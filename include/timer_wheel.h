@@ -0,0 +1,53 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+// --- CONFIGURATION ---
+#define TIMER_TICK_MS 100     // Resolution
+#define TIMER_LEVEL_BITS 6    // 64 slots per level
+#define TIMER_LEVELS 4        // 64^4 ticks = about 19 days; later deadlines are clamped
+
+// Hierarchical timing wheel: level 0 holds the timers due in the next 64
+// ticks, one slot per tick; each higher level covers 64 times the span of
+// the one below with the same number of slots. When level 0 wraps, the next
+// slot of level 1 is cascaded (its timers redistributed one level down),
+// and so on. Adding, re-arming and cancelling are O(1); a tick only touches
+// the timers that are due (plus, every 64^k ticks, one cascaded slot).
+//
+// Callbacks run on the wheel thread, under the wheel lock: once
+// timer_cancel() returns, the callback is not running and will not run.
+// A callback must not call the timer_* functions.
+
+typedef struct TimerEntry {
+    struct TimerEntry *prev, *next;
+    unsigned long long expires;   // Tick
+    int armed;
+    // Returns the next deadline (monotonic ms) to stay armed, or 0 to disarm
+    long long (*fire)(struct TimerEntry *entry, long long now_ms);
+} TimerEntry;
+
+/**
+ * @brief Monotonic clock in milliseconds (the time base of deadlines).
+ */
+long long timer_now_ms();
+
+/**
+ * @brief Starts the thread that advances the wheel every TIMER_TICK_MS.
+ */
+void timer_wheel_start();
+
+/**
+ * @brief Arms (or re-arms) an entry for `deadline_ms`. `entry->fire` must be set.
+ */
+void timer_arm(TimerEntry *entry, long long deadline_ms);
+
+/**
+ * @brief Disarms an entry; waits for a running callback to return.
+ */
+void timer_cancel(TimerEntry *entry);
+
+/**
+ * @brief Number of armed timers.
+ */
+int timer_armed_count();
+
+#endif // TIMER_WHEEL_H
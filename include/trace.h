@@ -0,0 +1,84 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// --- CONFIGURATION ---
+#define TRACE_FILE "./data/trace.json"  // Chrome trace export target (on SIGUSR2)
+#define TRACE_RING_SIZE 65536           // Span records kept in memory (power of two)
+#define TRACE_DEFAULT_SAMPLE 64         // Trace 1 request in N (0 = off, 1 = all)
+
+// Phases a request's time can be attributed to
+typedef enum {
+    TRACE_REQUEST,     // Whole handler
+    TRACE_PERMISSION,  // Group permission checks
+    TRACE_DB_READ,     // Text DB scans
+    TRACE_LOCK_WAIT,   // Waiting for file locks
+    TRACE_FILE_IO,     // Disk reads/writes
+    TRACE_NET_SEND,    // Blocked in send
+    TRACE_NET_RECV,    // Blocked in recv (waiting on the client)
+    TRACE_PHASE_COUNT
+} TracePhase;
+
+// A span measured on the stack. 'count' > 1 means several intervals were
+// accumulated (e.g. every fwrite of an upload) and emitted as one record.
+typedef struct {
+    unsigned long long start_ns;
+    unsigned long long total_ns;
+    unsigned int count;
+    int phase;
+} TraceSpan;
+
+// Request identity, saved so work done later (e.g. transfer frames on a
+// stream) is attributed to the request that started it
+typedef struct {
+    unsigned long long request_id;
+    int sampled;
+    int msg_type;
+} TraceContext;
+
+/**
+ * @brief Reads the sampling rate (trace_sample, config.h) and starts the
+ * SIGUSR2 exporter thread. Must be called before other threads are created.
+ */
+void trace_init();
+
+/**
+ * @brief Changes the sampling rate at runtime (0 = off, N = 1 in N requests).
+ */
+void trace_set_sample_rate(int one_in_n);
+
+/**
+ * @brief Assigns a new request ID on the calling thread and decides whether
+ * this request is sampled. Called by client_handler for every packet.
+ */
+void trace_begin_request(int msg_type);
+
+/**
+ * @brief Emits the TRACE_REQUEST span and clears the current request.
+ */
+void trace_end_request();
+
+/**
+ * @brief Returns the current request ID of the calling thread (0 if none).
+ */
+unsigned long long trace_request_id();
+
+void trace_context_save(TraceContext *ctx);
+void trace_context_restore(const TraceContext *ctx);
+
+// Single interval: begin + end emits one record
+void trace_span_begin(TraceSpan *span, int phase);
+void trace_span_end(TraceSpan *span);
+
+// Accumulated intervals: call pause/resume around each slice, then flush once
+void trace_accum_init(TraceSpan *span, int phase);
+void trace_accum_start(TraceSpan *span);
+void trace_accum_stop(TraceSpan *span);
+void trace_accum_flush(TraceSpan *span);
+
+/**
+ * @brief Writes the ring contents as Chrome trace JSON (chrome://tracing, Perfetto).
+ * @return Number of events written, or -1 on error.
+ */
+int trace_export_chrome(const char *path);
+
+#endif // TRACE_H
@@ -0,0 +1,73 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stddef.h>
+#include "common.h"
+
+// --- CONFIGURATION ---
+#define UPGRADE_SOCKET "./data/upgrade.sock" // Unix socket a new process asks for the takeover on
+#define UPGRADE_DEFAULT_DRAIN_TIMEOUT 300    // Default of drain_timeout (config.h), seconds
+#define UPGRADE_RECORD_SIZE 256
+
+// Zero-downtime restart. A running server listens on UPGRADE_SOCKET; a new
+// binary started with --takeover connects to it and receives, as text
+// records with the descriptors attached (SCM_RIGHTS):
+//   LISTENER <count> <shared>                 + the listening sockets
+//   TOKEN <user_id> <username> <token> <ttl>  per detached resume token
+//   READY
+// and then, while the old process drains:
+//   CONN <logged_in> <user_id> <username> <token|-> + a client socket
+//   DONE
+// The listening sockets never close, so no connection attempt is refused:
+// the kernel queues them until the new acceptors run. The old process stops
+// accepting, hands over every connection that sits between requests with
+// no transfer running (its Session goes along), lets the others finish
+// their transfers for up to drain_timeout seconds, and exits.
+
+/**
+ * @brief New process: takes the listening sockets and resume tokens over
+ * from the running server. Call instead of listener_open().
+ * @return Number of acceptors, or -1 if no server answered.
+ */
+int upgrade_takeover();
+
+/**
+ * @brief New process: starts the thread that receives the connections the
+ * old one hands over and runs `handler` for each (an AcceptedConn with a
+ * `restored` Session, like the acceptors). `on_done` runs on that thread
+ * once the old process is gone (DONE, or the socket closed).
+ */
+void upgrade_start_receiver(void *(*handler)(void *), void (*on_done)(void));
+
+/**
+ * @brief Creates UPGRADE_SOCKET and the thread that answers a takeover.
+ * @return 0 on success, -1 on error (the server runs without upgrades).
+ */
+int upgrade_listen();
+
+/**
+ * @brief Descriptor that becomes readable once a takeover started (poll it
+ * with the client socket), -1 before upgrade_listen().
+ */
+int upgrade_wake_fd();
+
+/**
+ * @brief 1 once a takeover started: connections should be handed over.
+ */
+int upgrade_in_progress();
+
+/**
+ * @brief Sends a connection with its session to the new process. The
+ * caller then forgets the connection (no resume detach) and closes it.
+ * @return 0 on success, -1 if it must keep serving it.
+ */
+int upgrade_handoff(int sockfd, const Session *sess);
+
+/**
+ * @brief Old process, after listener_run() returned: waits until every
+ * connection was handed over or closed, or drain_timeout, then tells the new
+ * process it is done.
+ */
+void upgrade_drain();
+
+#endif // UPGRADE_H
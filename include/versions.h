@@ -0,0 +1,86 @@
+#ifndef VERSIONS_H
+#define VERSIONS_H
+
+#include <stddef.h>
+
+// --- CONFIGURATION ---
+// Defaults of version_keep / version_max_age_days (config.h, 0 = no age limit).
+#define VERSION_DEFAULT_KEEP 10
+#define VERSION_DEFAULT_MAX_AGE_DAYS 30
+#define VERSION_SWEEP_INTERVAL 3600 // Seconds between retention passes over every history
+
+// Every file has a history folder (named by a hash of its logical path, in
+// the versions/ folder of its storage shard) holding hardlinks to its
+// previous contents, one per version ID. Files are never modified in place
+// (uploads commit by rename), so a linked inode is an immutable snapshot and
+// archiving or restoring one copies no data. The folder also records the
+// logical path, so renaming a folder can find the histories below it and a
+// background sweep can apply the retention policy to histories that are no
+// longer snapshotted (deleted files).
+// Callers hold the path's X lock (path_lock.h) around every change.
+
+/**
+ * @brief Reads the retention policy from the configuration (at startup,
+ * after storage_init, and on reload).
+ */
+void versions_init();
+
+/**
+ * @brief Archives the current content of a file before it is replaced or
+ * deleted, then applies the retention policy to its history.
+ * @param filename Logical path.
+ * @param filepath Physical path of the current file.
+ * @return The new version ID, or -1 if there was no regular file to archive.
+ */
+int version_snapshot(const char *filename, const char *filepath);
+
+/**
+ * @brief Physical path of version `id` of a file.
+ * @return 0 if that version exists, -1 otherwise.
+ */
+int version_path(const char *filename, int id, char *out, size_t size);
+
+/**
+ * @brief Makes version `id` the current content (the current one is archived
+ * first). Two links and a rename: O(1) whatever the file size.
+ * @return 0 on success, -1 if the version does not exist or on error.
+ */
+int version_restore(const char *filename, const char *filepath, int id);
+
+/**
+ * @brief Moves a file's history along with it (RENAME / MOVE), or for a
+ * folder the histories of every file below it. Versions are renumbered
+ * after the newest one if the new name already has a history.
+ */
+void versions_rename(const char *old_filename, const char *new_filename);
+
+/**
+ * @brief Applies the retention policy to every history, drops empty ones
+ * and finishes interrupted moves (run every VERSION_SWEEP_INTERVAL).
+ */
+void versions_sweep();
+
+/**
+ * @brief Starts the background sweep (once no other process writes the tree).
+ */
+void versions_start_sweeper();
+
+/**
+ * @brief Ends the background sweep (a process being replaced). Returns once
+ * no history is being swept.
+ */
+void versions_stop_sweeper();
+
+/**
+ * @brief Formats the history, newest first: "<id> <size> <archived at>".
+ * @return Number of versions listed.
+ */
+int versions_format_list(const char *filename, char *buf, size_t size);
+
+/**
+ * @brief Appends the totals of the last sweep for MSG_STATS.
+ * @return Number of characters written.
+ */
+int versions_format_stats(char *buf, size_t size);
+
+#endif // VERSIONS_H
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "network.h"
+#include "db.h"
+#include "meta_snap.h"
+#include "bench.h"
+
+// Default dataset sizes (records per file), each run is capped by --max-records
+static const long dataset_sizes[] = {1000, 10000, 100000, 1000000};
+// Payload sizes for the framing benchmark (BUFFER_SIZE is the protocol maximum)
+static const int payload_sizes[] = {0, 64, 512, 1024, BUFFER_SIZE};
+
+// --- JSON RESULT WRITER ---
+
+static FILE *json_out;
+static int json_result_count = 0;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Appends one result object to the JSON "results" array.
+ * @param bytes_per_op Payload bytes moved per operation (0 if not applicable).
+ */
+static void report(const char *name, long records, int bytes_per_op, long iterations, double elapsed_ns)
+{
+    double ns_per_op = elapsed_ns / (double)iterations;
+    double mb_per_sec = 0.0;
+    if (bytes_per_op > 0)
+        mb_per_sec = ((double)bytes_per_op * iterations / (1024.0 * 1024.0)) / (elapsed_ns / 1e9);
+
+    fprintf(json_out, "%s\n    {\"name\": \"%s\", \"records\": %ld, \"payload_bytes\": %d, "
+                      "\"iterations\": %ld, \"ns_per_op\": %.1f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f}",
+            json_result_count ? "," : "", name, records, bytes_per_op, iterations,
+            ns_per_op, 1e9 / ns_per_op, mb_per_sec);
+    json_result_count++;
+
+    fprintf(stderr, "  %-24s records=%-8ld payload=%-5d %12.1f ns/op\n", name, records, bytes_per_op, ns_per_op);
+}
+
+// --- NETWORK FRAMING BENCHMARKS ---
+
+typedef struct {
+    int sockfd;
+    int payload_len;
+    long iterations;
+} SenderArgs;
+
+static void *sender_thread(void *arg)
+{
+    SenderArgs *a = (SenderArgs *)arg;
+    char payload[BUFFER_SIZE];
+    memset(payload, 'x', sizeof(payload));
+
+    for (long i = 0; i < a->iterations; i++)
+    {
+        if (send_packet(a->sockfd, MSG_FILE_DATA, payload, a->payload_len) < 0)
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Measures one send_packet -> recv_packet round over a socketpair.
+ * The sender runs on its own thread so the socket buffer never deadlocks.
+ */
+static void bench_packets(int payload_len, long iterations)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        perror("socketpair");
+        return;
+    }
+
+    SenderArgs args = {sv[0], payload_len, iterations};
+    char buffer[BUFFER_SIZE + 1];
+    int msg_type;
+    long received = 0;
+
+    double start = now_ns();
+    pthread_t tid;
+    pthread_create(&tid, NULL, sender_thread, &args);
+    while (received < iterations && recv_packet(sv[1], &msg_type, buffer) >= 0)
+        received++;
+    pthread_join(tid, NULL);
+    double elapsed = now_ns() - start;
+
+    close(sv[0]);
+    close(sv[1]);
+
+    if (received == iterations)
+        report("send_recv_packet", 0, payload_len, iterations, elapsed);
+    else
+        fprintf(stderr, "send_recv_packet: only %ld/%ld packets received\n", received, iterations);
+}
+
+// --- TEXT DB BENCHMARKS ---
+
+/**
+ * @brief Picks an iteration count so each DB benchmark scans roughly the same
+ * number of records regardless of dataset size.
+ */
+static long db_iterations(long records)
+{
+    long iters = 2000000 / records;
+    return iters < 3 ? 3 : iters;
+}
+
+static void bench_snapshot(long records);
+
+static void bench_db(long records)
+{
+    if (gen_dataset(DATA_DIR, records) < 0)
+    {
+        fprintf(stderr, "Cannot generate dataset of %ld records\n", records);
+        return;
+    }
+
+    long iters = db_iterations(records);
+    char user[50], pass[50];
+    double start;
+
+    // Worst case: the matching user is the last line of users.txt
+    snprintf(user, sizeof(user), "user%ld", records);
+    snprintf(pass, sizeof(pass), "pass%ld", records);
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+        db_check_login(user, pass);
+    report("db_check_login_hit", records, 0, iters, now_ns() - start);
+
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+        db_check_login("no_such_user", "x");
+    report("db_check_login_miss", records, 0, iters, now_ns() - start);
+
+    // Every call scans the whole file for duplicates before appending
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+    {
+        snprintf(user, sizeof(user), "bench_new_%ld", i);
+        db_register_user(user, "pw");
+    }
+    report("db_register_user", records, 0, iters, now_ns() - start);
+
+    GroupInfo *groups = malloc(sizeof(GroupInfo) * records);
+    GroupMemberInfo *members = malloc(sizeof(GroupMemberInfo) * records);
+    if (!groups || !members)
+    {
+        fprintf(stderr, "Out of memory for %ld records\n", records);
+        free(groups);
+        free(members);
+        return;
+    }
+
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+        db_read_groups(groups, (int)records);
+    report("db_read_groups", records, 0, iters, now_ns() - start);
+
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+        db_read_group_members(members, (int)records);
+    report("db_read_group_members", records, 0, iters, now_ns() - start);
+
+    free(groups);
+    free(members);
+    bench_snapshot(records);
+}
+
+// --- BINARY SNAPSHOT BENCHMARKS ---
+
+/**
+ * @brief Converts the dataset left by bench_db, then measures mapping the
+ * snapshot (server startup) and indexed lookups through the db_* functions.
+ */
+static void bench_snapshot(long records)
+{
+    const long lookups = 200000;
+    char user[50], pass[50];
+    double start;
+
+    usleep((META_SNAP_RACY_MS + 20) * 1000); // Files written just now are not trusted
+    start = now_ns();
+    if (meta_snap_build(META_SNAP_FILE) != 0)
+    {
+        fprintf(stderr, "Cannot build snapshot of %ld records\n", records);
+        return;
+    }
+    report("meta_snap_build", records, 0, 1, now_ns() - start);
+
+    long iters = db_iterations(records);
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+        meta_snap_open(META_SNAP_FILE);
+    report("meta_snap_open", records, 0, iters, now_ns() - start);
+
+    snprintf(user, sizeof(user), "user%ld", records);
+    snprintf(pass, sizeof(pass), "pass%ld", records);
+    start = now_ns();
+    for (long i = 0; i < lookups; i++)
+        db_check_login(user, pass);
+    report("snap_check_login_hit", records, 0, lookups, now_ns() - start);
+
+    start = now_ns();
+    for (long i = 0; i < lookups; i++)
+        db_member_status((int)(i % records) + 1, (int)(i % records) + 1);
+    report("snap_member_status", records, 0, lookups, now_ns() - start);
+
+    meta_snap_close(); // The next dataset size starts from the text files again
+    unlink(META_SNAP_FILE);
+}
+
+// --- WORKING DIRECTORY ---
+
+/**
+ * @brief Moves into a fresh temp directory containing ./data so the DB
+ * functions (which use relative paths) never touch the real database.
+ */
+static int enter_scratch_dir(char *dir_template)
+{
+    if (mkdtemp(dir_template) == NULL)
+    {
+        perror("mkdtemp");
+        return -1;
+    }
+    if (chdir(dir_template) != 0 || mkdir(DATA_DIR, 0755) != 0)
+    {
+        perror("scratch dir");
+        return -1;
+    }
+    return 0;
+}
+
+static void leave_scratch_dir(const char *dir)
+{
+    unlink("./data/users.txt");
+    unlink("./data/groups.txt");
+    unlink("./data/group_members.txt");
+    rmdir(DATA_DIR);
+    if (chdir("/") == 0)
+        rmdir(dir);
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--max-records N] [--net-iters N] [--out results.json]\n", prog);
+    fprintf(stderr, "       %s gen <dir> <records>\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    // Dataset generator mode: writes users.txt, groups.txt, group_members.txt
+    if (argc >= 2 && strcmp(argv[1], "gen") == 0)
+    {
+        if (argc != 4)
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        long records = atol(argv[3]);
+        if (records <= 0 || gen_dataset(argv[2], records) < 0)
+        {
+            fprintf(stderr, "Error: Cannot generate dataset in '%s'\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        printf("Generated %ld records per file in %s\n", records, argv[2]);
+        return EXIT_SUCCESS;
+    }
+
+    long max_records = 1000000;
+    long net_iters = 200000;
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--max-records") == 0 && i + 1 < argc)
+            max_records = atol(argv[++i]);
+        else if (strcmp(argv[i], "--net-iters") == 0 && i + 1 < argc)
+            net_iters = atol(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Resolve the output path before leaving the caller's working directory
+    char out_abs[4096];
+    json_out = stdout;
+    if (out_path)
+    {
+        if (out_path[0] != '/' && getcwd(out_abs, sizeof(out_abs) - strlen(out_path) - 2))
+        {
+            strcat(out_abs, "/");
+            strcat(out_abs, out_path);
+        }
+        else
+        {
+            snprintf(out_abs, sizeof(out_abs), "%s", out_path);
+        }
+        json_out = fopen(out_abs, "w");
+        if (!json_out)
+        {
+            perror(out_abs);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char scratch[] = "/tmp/fs_bench.XXXXXX";
+    if (enter_scratch_dir(scratch) < 0)
+        return EXIT_FAILURE;
+
+    fprintf(json_out, "{\n  \"benchmark\": \"fs-primitives\",\n  \"buffer_size\": %d,\n  \"results\": [", BUFFER_SIZE);
+
+    fprintf(stderr, "Network framing (socketpair):\n");
+    for (size_t i = 0; i < sizeof(payload_sizes) / sizeof(payload_sizes[0]); i++)
+        bench_packets(payload_sizes[i], net_iters);
+
+    fprintf(stderr, "Text DB:\n");
+    for (size_t i = 0; i < sizeof(dataset_sizes) / sizeof(dataset_sizes[0]); i++)
+    {
+        if (dataset_sizes[i] > max_records)
+            break;
+        bench_db(dataset_sizes[i]);
+    }
+
+    fprintf(json_out, "\n  ]\n}\n");
+    if (json_out != stdout)
+        fclose(json_out);
+
+    leave_scratch_dir(scratch);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+// Small deterministic PRNG so datasets are reproducible between runs
+static unsigned long gen_seed = 88172645463325252UL;
+
+static unsigned long gen_next()
+{
+    gen_seed ^= gen_seed << 13;
+    gen_seed ^= gen_seed >> 7;
+    gen_seed ^= gen_seed << 17;
+    return gen_seed;
+}
+
+static FILE *open_in_dir(const char *dir, const char *name)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f)
+        perror(path);
+    return f;
+}
+
+int gen_users_file(const char *dir, long count)
+{
+    FILE *f = open_in_dir(dir, "users.txt");
+    if (!f)
+        return -1;
+
+    // Format in file: ID Username Password
+    for (long id = 1; id <= count; id++)
+        fprintf(f, "%ld user%ld pass%ld\n", id, id, id);
+
+    fclose(f);
+    return 0;
+}
+
+int gen_groups_file(const char *dir, long count, long user_count)
+{
+    FILE *f = open_in_dir(dir, "groups.txt");
+    if (!f)
+        return -1;
+
+    if (user_count < 1)
+        user_count = 1;
+
+    // Format in file: GroupID Name OwnerID
+    for (long id = 1; id <= count; id++)
+        fprintf(f, "%ld group%ld %ld\n", id, id, (long)(gen_next() % user_count) + 1);
+
+    fclose(f);
+    return 0;
+}
+
+int gen_group_members_file(const char *dir, long count, long group_count, long user_count)
+{
+    FILE *f = open_in_dir(dir, "group_members.txt");
+    if (!f)
+        return -1;
+
+    if (group_count < 1)
+        group_count = 1;
+    if (user_count < 1)
+        user_count = 1;
+
+    // Format in file: GroupID UserID Status
+    for (long i = 0; i < count; i++)
+    {
+        long group_id = (long)(gen_next() % group_count) + 1;
+        long user_id = (long)(gen_next() % user_count) + 1;
+        int status = (gen_next() % 8 == 0) ? 0 : 1;
+        fprintf(f, "%ld %ld %d\n", group_id, user_id, status);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int gen_dataset(const char *dir, long records)
+{
+    if (gen_users_file(dir, records) < 0)
+        return -1;
+    if (gen_groups_file(dir, records, records) < 0)
+        return -1;
+    if (gen_group_members_file(dir, records, records, records) < 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include "common.h"
+#include "network.h"
+#include "protocol.h"
+#include "client.h"
+
+// Batch requests are tagged with stream IDs from this base upward, well away
+// from the IDs the transfer engine hands out (1, 2, 3, ...).
+#define BATCH_TAG_BASE (1 << 30)
+#define BATCH_MAX_WINDOW 256
+
+typedef struct {
+    int in_use;
+    int tag;
+    int line_no;
+    char command[128];
+    long long sent_ns;
+    char *chunks;         // Chunks of a long reply, printed under the result line
+    size_t chunks_len;
+} PendingRequest;
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int is_transfer_command(const char *line) {
+    return strncasecmp(line, "UPLOAD ", 7) == 0 || strncasecmp(line, "DOWNLOAD ", 9) == 0 ||
+           strncasecmp(line, "DOWNLOAD_VERSION ", 17) == 0;
+}
+
+// Prints the lines of a reply indented under its result line
+static void print_indented(char *rest) {
+    while (rest && *rest) {
+        char *next = strchr(rest, '\n');
+        if (next) *next++ = '\0';
+        printf("                        %s\n", rest);
+        rest = next;
+    }
+}
+
+// Keeps a chunk (MSG_STATS, MSG_SEARCH) until its request completes
+static void add_chunk(PendingRequest *p, const char *chunk, int len) {
+    char *grown = realloc(p->chunks, p->chunks_len + len + 1);
+    if (grown == NULL) {
+        fprintf(stderr, "Out of memory, reply of line %d cut short\n", p->line_no);
+        return;
+    }
+    memcpy(grown + p->chunks_len, chunk, len);
+    p->chunks_len += len;
+    grown[p->chunks_len] = '\0';
+    p->chunks = grown;
+}
+
+// Prints "<line> OK|FAIL <ms> <command> -> <reply>"; multi-line replies
+// (listings, stats) follow indented.
+static void print_result(PendingRequest *p, int ok, double ms, char *reply) {
+    char *rest = strchr(reply, '\n');
+    if (rest) *rest++ = '\0';
+    printf("%5d %-4s %8.2fms  %s -> %s\n", p->line_no, ok ? "OK" : "FAIL", ms, p->command, reply);
+    print_indented(p->chunks);
+    print_indented(rest);
+    free(p->chunks);
+    p->chunks = NULL;
+    p->chunks_len = 0;
+}
+
+int run_batch(int sockfd, FILE *in, int window) {
+    PendingRequest pending[BATCH_MAX_WINDOW];
+    memset(pending, 0, sizeof(pending));
+    if (window < 1) window = 1;
+    if (window > BATCH_MAX_WINDOW) window = BATCH_MAX_WINDOW;
+
+    int next_tag = BATCH_TAG_BASE;
+    int in_flight = 0, line_no = 0, eof = 0;
+    int sent = 0, ok = 0, failed = 0, skipped = 0, transfers = 0;
+    int transfers_ok = 0, transfers_failed = 0, not_started = 0;
+    double total_ms = 0;
+    char line[BUFFER_SIZE];
+    char buffer[BUFFER_SIZE + 1];
+
+    long long start = now_ns();
+    int done_before, failed_before;
+    transfer_get_results(&done_before, &failed_before);
+
+    while (!eof || in_flight > 0 || transfer_pending_count() > 0) {
+        // 1. Fill the window
+        while (!eof && in_flight < window) {
+            if (fgets(line, sizeof(line), in) == NULL) {
+                eof = 1;
+                break;
+            }
+            line_no++;
+            line[strcspn(line, "\r\n")] = 0;
+
+            char *cmd = line;
+            while (*cmd == ' ' || *cmd == '\t') cmd++;
+            if (*cmd == '\0' || *cmd == '#') continue;
+            if (strcasecmp(cmd, "EXIT") == 0) {
+                eof = 1;
+                break;
+            }
+
+            // Transfers run on their own streams and report themselves; one
+            // that did not even start (bad local path, usage) failed here
+            if (is_transfer_command(cmd)) {
+                int queued = transfer_pending_count();
+                execute_command(sockfd, cmd);
+                if (transfer_pending_count() == queued) not_started++;
+                transfers++;
+                continue;
+            }
+
+            unsigned long long tx_before = net_tx_bytes;
+            net_reply_stream = next_tag;
+            execute_command(sockfd, cmd);
+            net_reply_stream = 0;
+
+            if (net_tx_bytes == tx_before) {
+                // Usage error or client-side command: nothing to wait for
+                printf("%5d SKIP %10s  %s\n", line_no, "", cmd);
+                skipped++;
+                continue;
+            }
+
+            for (int i = 0; i < window; i++) {
+                if (!pending[i].in_use) {
+                    pending[i].in_use = 1;
+                    pending[i].tag = next_tag;
+                    pending[i].line_no = line_no;
+                    pending[i].sent_ns = now_ns();
+                    snprintf(pending[i].command, sizeof(pending[i].command), "%.*s", (int)sizeof(pending[i].command) - 1, cmd);
+                    break;
+                }
+            }
+            next_tag++;
+            if (next_tag <= 0) next_tag = BATCH_TAG_BASE;
+            in_flight++;
+            sent++;
+        }
+
+        if (eof && in_flight == 0 && transfer_pending_count() == 0) break;
+
+        // 2. Wait for replies (and upload writability)
+        fd_set read_fds, write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(sockfd, &read_fds);
+        if (transfer_wants_write())
+            FD_SET(sockfd, &write_fds);
+
+        if (select(sockfd + 1, &read_fds, &write_fds, NULL, NULL) < 0) {
+            perror("select error");
+            break;
+        }
+
+        if (FD_ISSET(sockfd, &read_fds)) {
+            int stream_id, msg_type;
+            int len = recv_packet_stream(sockfd, &stream_id, &msg_type, buffer);
+            if (len < 0) {
+                printf("Disconnected from server (%d requests unanswered).\n", in_flight);
+                failed += in_flight;
+                break;
+            }
+
+            if (stream_id >= BATCH_TAG_BASE) {
+                // 3. Match the reply to its request
+                for (int i = 0; i < window; i++) {
+                    PendingRequest *p = &pending[i];
+                    if (!p->in_use || p->tag != stream_id) continue;
+
+                    // Chunks of a long reply; the final packet completes the request
+                    if (msg_type == MSG_STATS || msg_type == MSG_SEARCH) {
+                        add_chunk(p, buffer, len);
+                        break;
+                    }
+
+                    double ms = (now_ns() - p->sent_ns) / 1e6;
+                    int success = msg_type != MSG_ERROR && msg_type != MSG_FILE_ERROR;
+                    print_result(p, success, ms, buffer);
+                    if (success) ok++; else failed++;
+                    total_ms += ms;
+                    p->in_use = 0;
+                    in_flight--;
+                    break;
+                }
+            } else if (stream_id != 0) {
+                transfer_handle_packet(sockfd, stream_id, msg_type, buffer, len);
+            }
+        }
+
+        if (FD_ISSET(sockfd, &write_fds))
+            transfer_pump(sockfd);
+    }
+
+    for (int i = 0; i < window; i++) free(pending[i].chunks); // Unanswered
+
+    transfer_get_results(&transfers_ok, &transfers_failed);
+    transfers_ok -= done_before;
+    transfers_failed += not_started - failed_before;
+
+    double elapsed = (now_ns() - start) / 1e9;
+    int answered = ok + failed;
+    printf("--- BATCH SUMMARY ---\n");
+    printf("Requests: %d sent, %d ok, %d failed, %d skipped; transfers: %d (%d ok, %d failed)\n",
+           sent, ok, failed, skipped, transfers, transfers_ok, transfers_failed);
+    printf("Elapsed: %.3fs, throughput: %.1f req/s, avg latency: %.2fms (window %d)\n",
+           elapsed, elapsed > 0 ? sent / elapsed : 0.0, answered > 0 ? total_ms / answered : 0.0, window);
+    fflush(stdout);
+
+    return failed + transfers_failed;
+}
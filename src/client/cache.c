@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "client.h"
+
+// Download cache manifest: which local file holds which server version.
+// Stored as an append-only log of "etag size mtime_ns remote local" lines
+// (later lines win) and compacted when loaded, so recording one download
+// costs one small append even for trees with 100k files.
+#define CACHE_MANIFEST ".fileshare_cache"
+#define CACHE_BUCKETS 65536
+
+typedef struct CacheEntry {
+    char local[512];
+    char remote[256];
+    char etag[64];
+    long size;                // Local copy as written by the download...
+    long long mtime_ns;       // ...so local edits invalidate the entry
+    struct CacheEntry *next;
+} CacheEntry;
+
+static CacheEntry *buckets[CACHE_BUCKETS];
+static int loaded = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; // Workers of DOWNLOAD -r share it
+
+static unsigned int hash_path(const char *s) {
+    unsigned int h = 5381;
+    while (*s) h = h * 33 + (unsigned char)*s++;
+    return h % CACHE_BUCKETS;
+}
+
+static CacheEntry *find_entry(const char *local) {
+    for (CacheEntry *e = buckets[hash_path(local)]; e; e = e->next) {
+        if (strcmp(e->local, local) == 0) return e;
+    }
+    return NULL;
+}
+
+static CacheEntry *put_entry(const char *local) {
+    CacheEntry *e = find_entry(local);
+    if (!e) {
+        unsigned int h = hash_path(local);
+        e = calloc(1, sizeof(CacheEntry));
+        snprintf(e->local, sizeof(e->local), "%s", local);
+        e->next = buckets[h];
+        buckets[h] = e;
+    }
+    return e;
+}
+
+static long long mtime_ns(const struct stat *st) {
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+// Reads the manifest; rewrites it if superseded lines make up most of it
+static void load_manifest() {
+    loaded = 1;
+    FILE *f = fopen(CACHE_MANIFEST, "r");
+    if (!f) return;
+
+    char line[1024], etag[64], remote[256], local[512];
+    long size;
+    long long mtime;
+    int lines = 0, entries = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%63s %ld %lld %255s %511s", etag, &size, &mtime, remote, local) != 5) continue;
+        lines++;
+        if (!find_entry(local)) entries++;
+        CacheEntry *e = put_entry(local);
+        snprintf(e->etag, sizeof(e->etag), "%s", etag);
+        snprintf(e->remote, sizeof(e->remote), "%s", remote);
+        e->size = size;
+        e->mtime_ns = mtime;
+    }
+    fclose(f);
+
+    if (lines > 2 * entries + 64) {
+        FILE *out = fopen(CACHE_MANIFEST ".tmp", "w");
+        if (!out) return;
+        for (int i = 0; i < CACHE_BUCKETS; i++) {
+            for (CacheEntry *e = buckets[i]; e; e = e->next) {
+                fprintf(out, "%s %ld %lld %s %s\n", e->etag, e->size, e->mtime_ns, e->remote, e->local);
+            }
+        }
+        fclose(out);
+        rename(CACHE_MANIFEST ".tmp", CACHE_MANIFEST);
+    }
+}
+
+int cache_lookup(const char *remote, const char *local, char *etag, size_t etag_size) {
+    struct stat st;
+    if (stat(local, &st) != 0) return 0;
+
+    int hit = 0;
+    pthread_mutex_lock(&cache_lock);
+    if (!loaded) load_manifest();
+    CacheEntry *e = find_entry(local);
+    if (e && strcmp(e->remote, remote) == 0 && e->size == st.st_size && e->mtime_ns == mtime_ns(&st)) {
+        snprintf(etag, etag_size, "%s", e->etag);
+        hit = 1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return hit;
+}
+
+void cache_store(const char *remote, const char *local, const char *etag) {
+    struct stat st;
+    if (etag[0] == '\0' || stat(local, &st) != 0) return;
+
+    pthread_mutex_lock(&cache_lock);
+    if (!loaded) load_manifest();
+    CacheEntry *e = put_entry(local);
+    snprintf(e->etag, sizeof(e->etag), "%s", etag);
+    snprintf(e->remote, sizeof(e->remote), "%s", remote);
+    e->size = st.st_size;
+    e->mtime_ns = mtime_ns(&st);
+
+    FILE *f = fopen(CACHE_MANIFEST, "a");
+    if (f) {
+        fprintf(f, "%s %ld %lld %s %s\n", e->etag, e->size, e->mtime_ns, e->remote, e->local);
+        fclose(f);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -18,6 +18,21 @@ void upload_file(int sockfd, char *filename);
 void request_list_files(int sockfd);
 void download_file(int sockfd, char *filename);
 
+// Last LOGIN sent ("user pass"), reused by UPLOAD -r / DOWNLOAD -r workers
+static char saved_login[256] = "";
+
+// Session resumption: token from the last login reply, and where to reconnect
+#define RECONNECT_ATTEMPTS 5
+#define RECONNECT_DELAY_MS 200 // Multiplied by the attempt number
+static char resume_token[RESUME_TOKEN_LEN + 1] = "";
+static struct sockaddr_in server_addr;
+static int have_server_addr = 0;
+
+const char *get_saved_login()
+{
+    return saved_login[0] ? saved_login : NULL;
+}
+
 // --- MAIN LOOP ---
 
 /**
@@ -26,9 +41,12 @@ void download_file(int sockfd, char *filename);
  */
 void client_main_loop(int sockfd)
 {
-    fd_set read_fds;
+    fd_set read_fds, write_fds;
     int max_fd;
 
+    socklen_t addr_len = sizeof(server_addr);
+    have_server_addr = getpeername(sockfd, (struct sockaddr *)&server_addr, &addr_len) == 0;
+
     printf("\n--- CLIENT STARTED ---\n");
     print_main_menu();
     printf("> ");
@@ -41,10 +59,17 @@ void client_main_loop(int sockfd)
         FD_SET(sockfd, &read_fds);       // Watch the socket (Server messages)
         FD_SET(STDIN_FILENO, &read_fds); // Watch the keyboard (User input)
 
+        // Watch for writability only while an upload has data to send
+        FD_ZERO(&write_fds);
+        if (transfer_wants_write())
+            FD_SET(sockfd, &write_fds);
+
         max_fd = sockfd;
 
-        // 2. Wait for activity
-        int activity = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+        // 2. Wait for activity (wake up periodically to redraw progress)
+        struct timeval tv = {0, 500000};
+        int activity = select(max_fd + 1, &read_fds, &write_fds, NULL,
+                              transfer_active_count() > 0 ? &tv : NULL);
 
         if ((activity < 0))
         {
@@ -65,7 +90,80 @@ void client_main_loop(int sockfd)
             printf("> "); // Repaint prompt
             fflush(stdout);
         }
+
+        // 5. Push upload chunks
+        if (FD_ISSET(sockfd, &write_fds))
+        {
+            transfer_pump(sockfd);
+        }
+
+        transfer_render_progress();
+    }
+}
+
+// --- RECONNECT ---
+
+/**
+ * @brief Presents the token on a fresh connection and hands the transfers the
+ * server kept back to the transfer engine.
+ * @return 0 if the connection is usable (resumed, or logged out if the
+ * token expired), -1 if it dropped again.
+ */
+static int resume_session(int sockfd)
+{
+    int msg_type, stream_id;
+    char buffer[BUFFER_SIZE + 1];
+
+    // Transfer frames only flow after MSG_RESUME_TRANSFER, so the next packet is the reply
+    send_packet(sockfd, MSG_RESUME_SESSION, resume_token, strlen(resume_token));
+    if (recv_packet_stream(sockfd, &stream_id, &msg_type, buffer) < 0)
+        return -1;
+
+    if (msg_type != MSG_SUCCESS)
+    {
+        printf("[ERROR] %s\n", buffer);
+        resume_token[0] = '\0';
+        transfer_abort_all();
+        return 0;
     }
+
+    // Greeting line, then "<stream_id> <U|D> <offset>" per kept transfer
+    char *listing = strchr(buffer, '\n');
+    if (listing)
+        *listing++ = '\0';
+    printf("[SUCCESS] %s\n", buffer);
+    transfer_resume_all(sockfd, listing ? listing : "");
+    return 0;
+}
+
+/**
+ * @brief Reconnects after the server connection dropped, on the same
+ * descriptor number (dup2), so every caller keeps using `sockfd`.
+ * @return 0 if reconnected, -1 if there is no session to resume or the server is unreachable.
+ */
+static int client_reconnect(int sockfd)
+{
+    if (!resume_token[0] || !have_server_addr)
+        return -1;
+
+    printf("\r\x1b[K[INFO] Connection lost, reconnecting...\n");
+    for (int attempt = 1; attempt <= RECONNECT_ATTEMPTS; attempt++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0)
+        {
+            dup2(fd, sockfd);
+            close(fd);
+            if (resume_session(sockfd) == 0)
+                return 0;
+        }
+        else if (fd >= 0)
+        {
+            close(fd);
+        }
+        usleep(RECONNECT_DELAY_MS * 1000 * attempt);
+    }
+    return -1;
 }
 
 /**
@@ -74,17 +172,39 @@ void client_main_loop(int sockfd)
 void handle_server_message(int sockfd)
 {
     int msg_type;
-    char buffer[BUFFER_SIZE];
+    int stream_id;
+    char buffer[BUFFER_SIZE + 1];
 
     // Use the recv_packet function from network.c
-    int payload_len = recv_packet(sockfd, &msg_type, buffer);
+    int payload_len = recv_packet_stream(sockfd, &stream_id, &msg_type, buffer);
 
     if (payload_len < 0)
     {
+        if (client_reconnect(sockfd) == 0)
+        {
+            printf("> ");
+            fflush(stdout);
+            return;
+        }
         printf("\nDisconnected from server.\n");
         exit(0);
     }
 
+    // Packets on a transfer stream go to that transfer's state machine
+    if (stream_id != 0 && transfer_handle_packet(sockfd, stream_id, msg_type, buffer, payload_len))
+    {
+        if (msg_type != MSG_FILE_DATA)
+        {
+            printf("> ");
+            fflush(stdout);
+        }
+        return;
+    }
+
+    // Frames still in flight for a transfer that was cancelled
+    if (stream_id != 0 && (msg_type == MSG_FILE_DATA || msg_type == MSG_FILE_END || msg_type == MSG_NOT_MODIFIED))
+        return;
+
     // Clear the current line to prevent messing up the prompt "> "
     printf("\r\x1b[K");
 
@@ -92,8 +212,17 @@ void handle_server_message(int sockfd)
     switch (msg_type)
     {
     case MSG_SUCCESS:
+    {
+        // Login reply: keep the token for a reconnect, don't print it
+        char *tag = strstr(buffer, RESUME_TOKEN_TAG);
+        if (tag)
+        {
+            snprintf(resume_token, sizeof(resume_token), "%s", tag + strlen(RESUME_TOKEN_TAG));
+            *tag = '\0';
+        }
         printf("[SUCCESS] %s\n", buffer);
         break;
+    }
 
     case MSG_ERROR:
         printf("[ERROR] %s\n", buffer);
@@ -109,6 +238,12 @@ void handle_server_message(int sockfd)
     case MSG_LIST_RESPONSE:
         printf("\n--- SERVER FILES ---\n%s\n--------------------\n", buffer);
         break;
+    case MSG_STATS:
+        printf("%s", buffer); // One chunk of the report, MSG_SUCCESS ends it
+        break;
+    case MSG_SEARCH:
+        printf("%s", buffer); // One page of "path\n" lines, MSG_SUCCESS ends the list
+        break;
     default:
         printf("[INFO] Received MSG Type %d: %s\n", msg_type, buffer);
         break;
@@ -124,7 +259,6 @@ void handle_server_message(int sockfd)
 void handle_user_input(int sockfd)
 {
     char input[BUFFER_SIZE];
-    char command[50], arg1[100], arg2[100];
 
     // Read line from keyboard
     if (fgets(input, sizeof(input), stdin) == NULL)
@@ -138,8 +272,19 @@ void handle_user_input(int sockfd)
     if (strlen(input) == 0)
         return;
 
+    execute_command(sockfd, input);
+}
+
+/**
+ * @brief Parses one command line and sends the matching request.
+ * Requests go out on net_reply_stream, so batch mode can tag them.
+ */
+void execute_command(int sockfd, char *input)
+{
+    char command[50], arg1[100], arg2[100], arg3[256];
+
     // Parse command
-    int args = sscanf(input, "%s %s %s", command, arg1, arg2);
+    int args = sscanf(input, "%49s %99s %99s %255s", command, arg1, arg2, arg3);
 
     if (strcasecmp(command, "EXIT") == 0)
     {
@@ -165,6 +310,8 @@ void handle_user_input(int sockfd)
             char payload[256];
             sprintf(payload, "%s %s", arg1, arg2);
             send_packet(sockfd, MSG_LOGIN, payload, strlen(payload));
+            // Recursive transfers log extra connections in with these
+            snprintf(saved_login, sizeof(saved_login), "%s", payload);
         }
     }
     else if (strcasecmp(command, "REGISTER") == 0)
@@ -182,8 +329,9 @@ void handle_user_input(int sockfd)
     }
     else if (strcasecmp(command, "LOGOUT") == 0)
     {
-        // Send logout request
+        // Send logout request (the server revokes the resume token)
         send_packet(sockfd, MSG_LOGOUT, "", 0);
+        resume_token[0] = '\0';
     }
     else if (strcasecmp(command, "CHANGE_PASS") == 0)
     {
@@ -348,7 +496,11 @@ void handle_user_input(int sockfd)
     {
         if (args < 2)
         {
-            printf("Usage: UPLOAD <filename>\n");
+            printf("Usage: UPLOAD <filename> | UPLOAD -r <local_dir> [remote_dir] [-j N]\n");
+        }
+        else if (strcmp(arg1, "-r") == 0)
+        {
+            tree_transfer_command(sockfd, 1, input);
         }
         else
         {
@@ -360,7 +512,11 @@ void handle_user_input(int sockfd)
     {
         if (args < 2)
         {
-            printf("Usage: DOWNLOAD <filename>\n");
+            printf("Usage: DOWNLOAD <filename> | DOWNLOAD -r <remote_dir> [local_dir] [-j N]\n");
+        }
+        else if (strcmp(arg1, "-r") == 0)
+        {
+            tree_transfer_command(sockfd, 0, input);
         }
         else
         {
@@ -433,6 +589,97 @@ void handle_user_input(int sockfd)
             send_packet(sockfd, MSG_MOVE_ITEM, payload, strlen(payload));
         }
     }
+    // --- FILE HISTORY ---
+    else if (strcasecmp(command, "VERSIONS") == 0)
+    {
+        if (args < 2)
+        {
+            printf("Usage: VERSIONS <file>\n");
+        }
+        else
+        {
+            send_packet(sockfd, MSG_LIST_VERSIONS, arg1, strlen(arg1));
+        }
+    }
+    else if (strcasecmp(command, "DOWNLOAD_VERSION") == 0)
+    {
+        if (args < 3 || atoi(arg2) <= 0)
+        {
+            printf("Usage: DOWNLOAD_VERSION <file> <version_id> [local_file]\n");
+        }
+        else
+        {
+            // Default local name: "<name>.v<id>", so the current copy is kept
+            char local[512];
+            char *base = strrchr(arg1, '/');
+            if (args >= 4)
+                snprintf(local, sizeof(local), "%s", arg3);
+            else
+                snprintf(local, sizeof(local), "%s.v%d", base ? base + 1 : arg1, atoi(arg2));
+            download_version_to(sockfd, arg1, atoi(arg2), local);
+        }
+    }
+    else if (strcasecmp(command, "RESTORE") == 0)
+    {
+        if (args < 3 || atoi(arg2) <= 0)
+        {
+            printf("Usage: RESTORE <file> <version_id>\n");
+        }
+        else
+        {
+            char payload[300];
+            snprintf(payload, sizeof(payload), "%s %d", arg1, atoi(arg2));
+            send_packet(sockfd, MSG_RESTORE_VERSION, payload, strlen(payload));
+        }
+    }
+    // Filename search over every folder the user can see
+    else if (strcasecmp(command, "SEARCH") == 0)
+    {
+        if (args < 2)
+        {
+            printf("Usage: SEARCH <text|glob> [limit [offset]]\n");
+        }
+        else
+        {
+            char payload[500];
+            if (args == 2) snprintf(payload, sizeof(payload), "%s", arg1);
+            else if (args == 3) snprintf(payload, sizeof(payload), "%s %s", arg1, arg2);
+            else snprintf(payload, sizeof(payload), "%s %s %s", arg1, arg2, arg3);
+            send_packet(sockfd, MSG_SEARCH, payload, strlen(payload));
+        }
+    }
+    // Recursive size of a folder (the root without an argument)
+    else if (strcasecmp(command, "FOLDER_STATS") == 0)
+    {
+        const char *folder = args >= 2 ? arg1 : "";
+        send_packet(sockfd, MSG_FOLDER_STATS, folder, strlen(folder));
+    }
+    // --- TRANSFER QUEUE COMMANDS ---
+    else if (strcasecmp(command, "TRANSFERS") == 0)
+    {
+        transfer_print_list();
+    }
+    else if (strcasecmp(command, "CANCEL") == 0 || strcasecmp(command, "PAUSE") == 0 ||
+             strcasecmp(command, "RESUME") == 0)
+    {
+        if (args < 2)
+        {
+            printf("Usage: %s <transfer_id>\n", command);
+        }
+        else if (strcasecmp(command, "CANCEL") == 0)
+        {
+            transfer_cancel(sockfd, atoi(arg1));
+        }
+        else
+        {
+            transfer_set_paused(sockfd, atoi(arg1), strcasecmp(command, "PAUSE") == 0);
+        }
+    }
+    // Per-request latency/traffic stats from the server
+    else if (strcasecmp(command, "STATS") == 0)
+    {
+        send_packet(sockfd, MSG_STATS, "", 0);
+    }
     else
     {
         printf("Unknown command. Type 'HELP' for menu.\n");
@@ -110,11 +110,15 @@ void print_logged_in_menu()
 
     printf(CLR_CMD  "  [11] UPLOAD FILE\n" CLR_RESET);
     printf("       Command: " CLR_CMD "UPLOAD <filename>\n" CLR_RESET);
-    printf("       Example: " CLR_EX  "UPLOAD document.pdf\n\n" CLR_RESET);
+    printf("                " CLR_CMD "UPLOAD -r <local_folder> [remote_folder] [-j connections]\n" CLR_RESET);
+    printf("       Example: " CLR_EX  "UPLOAD document.pdf\n" CLR_RESET);
+    printf("                " CLR_EX  "UPLOAD -r photos Group_3 -j 8\n\n" CLR_RESET);
 
     printf(CLR_CMD  "  [12] DOWNLOAD FILE\n" CLR_RESET);
     printf("       Command: " CLR_CMD "DOWNLOAD <filename>\n" CLR_RESET);
-    printf("       Example: " CLR_EX  "DOWNLOAD report.docx\n\n" CLR_RESET);
+    printf("                " CLR_CMD "DOWNLOAD -r <remote_folder> [local_folder] [-j connections]\n" CLR_RESET);
+    printf("       Example: " CLR_EX  "DOWNLOAD report.docx\n" CLR_RESET);
+    printf("                " CLR_EX  "DOWNLOAD -r Group_3/photos backup\n\n" CLR_RESET);
 
     printf(CLR_CMD  "  [13] CREATE FOLDER\n" CLR_RESET);
     printf("       Command: " CLR_CMD "MKDIR <foldername>\n" CLR_RESET);
@@ -136,13 +140,35 @@ void print_logged_in_menu()
     printf("       Command: " CLR_CMD "COPY <source> <destination>\n" CLR_RESET);
     printf("       Example: " CLR_EX  "COPY data.csv backup/\n\n" CLR_RESET);
 
+    printf(CLR_CMD  "  [18] TRANSFER QUEUE\n" CLR_RESET);
+    printf("       Command: " CLR_CMD "TRANSFERS\n" CLR_RESET);
+    printf("                " CLR_CMD "PAUSE <id> | RESUME <id> | CANCEL <id>\n" CLR_RESET);
+    printf("       Example: " CLR_EX  "CANCEL 3\n\n" CLR_RESET);
+
+    printf(CLR_CMD  "  [19] FILE VERSIONS\n" CLR_RESET);
+    printf("       Command: " CLR_CMD "VERSIONS <file>\n" CLR_RESET);
+    printf("                " CLR_CMD "DOWNLOAD_VERSION <file> <id> [local_file]\n" CLR_RESET);
+    printf("                " CLR_CMD "RESTORE <file> <id>\n" CLR_RESET);
+    printf("       Example: " CLR_EX  "RESTORE report.docx 2\n\n" CLR_RESET);
+
+    printf(CLR_CMD  "  [20] SEARCH FILES\n" CLR_RESET);
+    printf("       Command: " CLR_CMD "SEARCH <text|glob> [limit [offset]]\n" CLR_RESET);
+    printf("       Example: " CLR_EX  "SEARCH *.pdf 50\n\n" CLR_RESET);
+
+    printf(CLR_CMD  "  [21] FOLDER SIZE\n" CLR_RESET);
+    printf("       Command: " CLR_CMD "FOLDER_STATS [folder]\n" CLR_RESET);
+    printf("       Example: " CLR_EX  "FOLDER_STATS Group_1\n\n" CLR_RESET);
+
     /* OTHER */
     printf(CLR_SECTION "--- OTHER --------------------------------------------------------\n" CLR_RESET);
 
-    printf(CLR_CMD  "  [18] SHOW THIS MENU\n" CLR_RESET);
+    printf(CLR_CMD  "  [22] SERVER STATS\n" CLR_RESET);
+    printf("       Command: " CLR_CMD "STATS\n\n" CLR_RESET);
+
+    printf(CLR_CMD  "  [23] SHOW THIS MENU\n" CLR_RESET);
     printf("       Command: " CLR_CMD "HELP\n\n" CLR_RESET);
 
-    printf(CLR_CMD  "  [19] EXIT APPLICATION\n" CLR_RESET);
+    printf(CLR_CMD  "  [24] EXIT APPLICATION\n" CLR_RESET);
     printf("       Command: " CLR_CMD "EXIT\n\n" CLR_RESET);
 
     printf(CLR_SECTION "Tip: " CLR_EX "Type the command name + parameters, not the number.\n" CLR_RESET);
@@ -1,10 +1,67 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/stat.h>
 #include "common.h"
 #include "network.h"
 #include "protocol.h"
+#include "client.h"
+
+// Transfers run as state machines driven by client_main_loop(), each on
+// its own stream, so the prompt stays usable while they are in progress.
+#define MAX_TRANSFERS 64          // Active + queued
+#define MAX_ACTIVE_TRANSFERS 4    // Started at once, the rest wait in FIFO order
+#define PROGRESS_INTERVAL_MS 500  // Progress line is redrawn at most this often
+
+typedef enum {
+    XFER_UPLOAD,
+    XFER_DOWNLOAD
+} TransferKind;
+
+typedef enum {
+    XFER_QUEUED,      // Waiting for a free active slot
+    XFER_WAIT_REPLY,  // Request sent, waiting for the server's go-ahead
+    XFER_ACTIVE,      // Data frames flowing
+    XFER_WAIT_DONE    // Upload fully sent, waiting for the server's confirmation
+} TransferState;
+
+typedef struct {
+    int in_use;
+    int stream_id;          // Also the transfer ID shown to the user
+    int kind;
+    int state;
+    int paused;
+    long queue_seq;         // FIFO order among queued transfers
+    FILE *f;
+    char remote_name[256];
+    char local_name[512];
+    char etag[64];          // Server version being downloaded (for the cache)
+    int version;            // Download: archived version ID, 0 = current content
+    long filesize;
+    long transferred;
+    long long started_ms;
+    int resuming;           // MSG_RESUME_TRANSFER sent after a reconnect
+} Transfer;
+
+// Per-thread so recursive-transfer workers (tree_transfer.c) each drive
+// their own connection with an independent transfer table.
+static __thread Transfer transfers[MAX_TRANSFERS];
+static __thread int next_stream_id = 1;
+static __thread long next_queue_seq = 0;
+static __thread long long last_render_ms = 0;
+static __thread int max_active = MAX_ACTIVE_TRANSFERS;
+static __thread int quiet = 0;
+static __thread int completed_count = 0;
+static __thread int failed_count = 0;
+
+static const char *state_names[] = {"queued", "starting", "active", "finishing"};
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 long get_file_size(const char *filename) {
     struct stat st;
@@ -12,98 +69,443 @@ long get_file_size(const char *filename) {
     return -1;
 }
 
-void upload_file(int sockfd, char *filename) {
-    // Check if file exists
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        printf("[ERROR] Cannot open file '%s'\n", filename);
-        return;
+static Transfer *transfer_alloc(int kind) {
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        if (!transfers[i].in_use) {
+            memset(&transfers[i], 0, sizeof(Transfer));
+            transfers[i].in_use = 1;
+            transfers[i].kind = kind;
+            transfers[i].state = XFER_QUEUED;
+            transfers[i].queue_seq = next_queue_seq++;
+            transfers[i].stream_id = next_stream_id++;
+            if (next_stream_id >= (1 << 30)) next_stream_id = 1;
+            return &transfers[i];
+        }
     }
-    long filesize = get_file_size(filename);
+    printf("[ERROR] Too many transfers queued (max %d)\n", MAX_TRANSFERS);
+    return NULL;
+}
 
-    // Send UPLOAD message
-    char req_payload[256];
-    sprintf(req_payload, "%s %ld", filename, filesize);
-    send_packet(sockfd, MSG_UPLOAD_REQ, req_payload, strlen(req_payload));
+static Transfer *transfer_find(int stream_id) {
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        if (transfers[i].in_use && transfers[i].stream_id == stream_id)
+            return &transfers[i];
+    }
+    return NULL;
+}
 
-    // Wait for server SUCCESS message
-    int msg_type;
-    char response[BUFFER_SIZE];
-    recv_packet(sockfd, &msg_type, response);
+int transfer_active_count() {
+    int n = 0;
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        if (transfers[i].in_use && transfers[i].state != XFER_QUEUED)
+            n++;
+    }
+    return n;
+}
 
-    if (msg_type != MSG_SUCCESS) {
-        printf("[ERROR] Server denied upload. Reason: %s\n", response);
-        fclose(f);
-        return;
+int transfer_pending_count() {
+    int n = 0;
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        if (transfers[i].in_use) n++;
     }
+    return n;
+}
 
-    // Sending data (split into chunk)
-    printf("[INFO] Uploading '%s' (%ld bytes)...\n", filename, filesize);
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read;
+// Sends the request for the oldest queued transfers while slots are free
+static void transfer_start_queued(int sockfd) {
+    while (transfer_active_count() < max_active) {
+        Transfer *next = NULL;
+        for (int i = 0; i < MAX_TRANSFERS; i++) {
+            Transfer *t = &transfers[i];
+            if (t->in_use && t->state == XFER_QUEUED && !t->paused &&
+                (next == NULL || t->queue_seq < next->queue_seq))
+                next = t;
+        }
+        if (next == NULL) return;
+
+        next->state = XFER_WAIT_REPLY;
+        next->started_ms = now_ms();
+        if (next->kind == XFER_UPLOAD) {
+            // Send UPLOAD message on the transfer's own stream
+            char req_payload[300];
+            snprintf(req_payload, sizeof(req_payload), "%s %ld", next->remote_name, next->filesize);
+            send_packet_stream(sockfd, next->stream_id, MSG_UPLOAD_REQ, req_payload, strlen(req_payload));
+        } else if (next->version > 0) {
+            // Archived versions never change: nothing to revalidate
+            char req_payload[300];
+            snprintf(req_payload, sizeof(req_payload), "%s %d", next->remote_name, next->version);
+            send_packet_stream(sockfd, next->stream_id, MSG_DOWNLOAD_VERSION, req_payload, strlen(req_payload));
+        } else {
+            // "<file> <etag>" when a valid cached copy exists
+            char req_payload[400];
+            char cached_etag[64];
+            if (cache_lookup(next->remote_name, next->local_name, cached_etag, sizeof(cached_etag))) {
+                snprintf(req_payload, sizeof(req_payload), "%s %s", next->remote_name, cached_etag);
+            } else {
+                snprintf(req_payload, sizeof(req_payload), "%s", next->remote_name);
+            }
+            send_packet_stream(sockfd, next->stream_id, MSG_DOWNLOAD_REQ, req_payload, strlen(req_payload));
+        }
+    }
+}
+
+static void transfer_release(int sockfd, Transfer *t) {
+    if (t->f) fclose(t->f);
+    t->f = NULL;
+    t->in_use = 0;
+    transfer_start_queued(sockfd);
+}
+
+void transfer_configure(int quiet_mode, int active_limit) {
+    quiet = quiet_mode;
+    if (active_limit > 0) max_active = active_limit;
+}
+
+void transfer_get_results(int *completed, int *failed) {
+    *completed = completed_count;
+    *failed = failed_count;
+}
+
+int upload_file_as(int sockfd, const char *local_path, const char *remote_name) {
+    // Check if file exists
+    FILE *f = fopen(local_path, "rb");
+    if (!f) {
+        printf("[ERROR] Cannot open file '%s'\n", local_path);
+        return -1;
+    }
 
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0) {
-        send_packet(sockfd, MSG_FILE_DATA, buffer, bytes_read);
+    Transfer *t = transfer_alloc(XFER_UPLOAD);
+    if (!t) {
+        fclose(f);
+        return -1;
     }
+    t->f = f;
+    t->filesize = get_file_size(local_path);
+    snprintf(t->local_name, sizeof(t->local_name), "%s", local_path);
+    snprintf(t->remote_name, sizeof(t->remote_name), "%s", remote_name);
 
-    // Send END file sending message
-    send_packet(sockfd, MSG_FILE_END, "EOF", 3);
-    
-    fclose(f);
-    printf("[INFO] File sent. Waiting for confirmation...\n");
+    if (!quiet) printf("[INFO] Transfer #%d: upload '%s' queued.\n", t->stream_id, local_path);
+    transfer_start_queued(sockfd);
+    return 0;
+}
+
+void upload_file(int sockfd, char *filename) {
+    upload_file_as(sockfd, filename, filename);
 }
 
 void request_list_files(int sockfd) {
     send_packet(sockfd, MSG_LIST_FILES, "", 0);
 }
 
-void download_file(int sockfd, char *filename) {
-    // Send download request
-    send_packet(sockfd, MSG_DOWNLOAD_REQ, filename, strlen(filename));
+int download_file_to(int sockfd, const char *remote_name, const char *local_path) {
+    Transfer *t = transfer_alloc(XFER_DOWNLOAD);
+    if (!t) return -1;
 
-    // Wait for server reply
-    int msg_type;
-    char buffer[BUFFER_SIZE + 1];
-    int payload_len = recv_packet(sockfd, &msg_type, buffer);
+    snprintf(t->remote_name, sizeof(t->remote_name), "%s", remote_name);
+    snprintf(t->local_name, sizeof(t->local_name), "%s", local_path);
 
-    if (msg_type == MSG_ERROR) {
-        printf("[ERROR] Download failed: %s\n", buffer);
-        return;
-    }
+    if (!quiet) printf("[INFO] Transfer #%d: download '%s' queued.\n", t->stream_id, remote_name);
+    transfer_start_queued(sockfd);
+    return 0;
+}
+
+int download_version_to(int sockfd, const char *remote_name, int version, const char *local_path) {
+    Transfer *t = transfer_alloc(XFER_DOWNLOAD);
+    if (!t) return -1;
+
+    snprintf(t->remote_name, sizeof(t->remote_name), "%s", remote_name);
+    snprintf(t->local_name, sizeof(t->local_name), "%s", local_path);
+    t->version = version;
 
+    if (!quiet) printf("[INFO] Transfer #%d: download of '%s' version %d queued.\n", t->stream_id, remote_name, version);
+    transfer_start_queued(sockfd);
+    return 0;
+}
+
+void download_file(int sockfd, char *filename) {
     char *save_name = strrchr(filename, '/');
     if (save_name) {
         save_name++;
     } else {
         save_name = filename;
     }
+    download_file_to(sockfd, filename, save_name);
+}
 
-    printf("[INFO] Downloading '%s' from Server...\n", filename);
+// --- USER CONTROL ---
 
-    FILE *f = fopen(save_name, "wb"); 
-    if (!f) {
-        printf("[ERROR] Cannot write file '%s' locally. Check permissions.\n", save_name);
-        return;
-    }
-
-    long total_received = 0;
-    
-    while (1) {
-        payload_len = recv_packet(sockfd, &msg_type, buffer);
-        if (payload_len < 0) break;
-
-        if (msg_type == MSG_FILE_DATA) {
-            fwrite(buffer, 1, payload_len, f);
-            total_received += payload_len;
-            printf("\rReceived: %ld bytes", total_received);
-            fflush(stdout);
-        } else if (msg_type == MSG_FILE_END) {
-            printf("\n[SUCCESS] File download completed!\n");
-            break;
+int transfer_cancel(int sockfd, int id) {
+    Transfer *t = transfer_find(id);
+    if (!t) {
+        printf("[ERROR] No transfer #%d\n", id);
+        return -1;
+    }
+
+    if (t->state != XFER_QUEUED) {
+        // Server drops the stream (and the partial upload)
+        send_packet_stream(sockfd, t->stream_id, MSG_FILE_ERROR, "Cancelled", 9);
+    }
+    if (t->kind == XFER_DOWNLOAD && t->f) {
+        fclose(t->f);
+        t->f = NULL;
+        remove(t->local_name); // Don't leave a truncated file behind
+    }
+    printf("[INFO] Transfer #%d cancelled (%s '%s').\n", id,
+           t->kind == XFER_UPLOAD ? "upload" : "download", t->remote_name);
+    transfer_release(sockfd, t);
+    return 0;
+}
+
+int transfer_set_paused(int sockfd, int id, int paused) {
+    Transfer *t = transfer_find(id);
+    if (!t) {
+        printf("[ERROR] No transfer #%d\n", id);
+        return -1;
+    }
+    if (t->paused == paused) return 0;
+
+    t->paused = paused;
+    if (t->state != XFER_QUEUED) {
+        // Uploads pause locally; the server still needs to know for downloads
+        send_packet_stream(sockfd, t->stream_id, paused ? MSG_TRANSFER_PAUSE : MSG_TRANSFER_RESUME, "", 0);
+    }
+    printf("[INFO] Transfer #%d %s.\n", id, paused ? "paused" : "resumed");
+    if (!paused) transfer_start_queued(sockfd);
+    return 0;
+}
+
+void transfer_print_list() {
+    int shown = 0;
+    printf("--- TRANSFERS ---\n");
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        Transfer *t = &transfers[i];
+        if (!t->in_use) continue;
+        int pct = t->filesize > 0 ? (int)(t->transferred * 100 / t->filesize) : 0;
+        printf("#%-4d %-8s %-10s %3d%%  %s%s\n", t->stream_id,
+               t->kind == XFER_UPLOAD ? "UPLOAD" : "DOWNLOAD", state_names[t->state], pct,
+               t->remote_name, t->paused ? " (paused)" : "");
+        shown++;
+    }
+    if (!shown) printf("(No transfers)\n");
+    printf("-----------------\n");
+}
+
+// --- RECONNECT ---
+
+// Puts a started transfer back at the head of its queue position, from byte 0
+static void transfer_requeue(Transfer *t) {
+    if (t->kind == XFER_UPLOAD) {
+        if (t->f) fclose(t->f);
+        t->f = fopen(t->local_name, "rb");
+    } else if (t->f) {
+        fclose(t->f);
+        t->f = NULL;
+    }
+    t->transferred = 0;
+    t->resuming = 0;
+    t->state = XFER_QUEUED;
+}
+
+// Continues a transfer the server kept, from the offset both sides have
+static int transfer_continue(int sockfd, Transfer *t, long server_offset) {
+    long offset;
+    if (t->kind == XFER_UPLOAD) {
+        // The server has exactly `server_offset` bytes; the rest is resent
+        if (!t->f) t->f = fopen(t->local_name, "rb");
+        if (!t->f || server_offset > t->filesize || fseek(t->f, server_offset, SEEK_SET) != 0) return -1;
+        offset = server_offset;
+    } else {
+        // Everything written locally is kept; the server re-sends from there
+        if (!t->f) return -1;
+        fflush(t->f);
+        offset = t->transferred;
+    }
+    t->transferred = offset;
+    t->resuming = 1;
+    t->state = XFER_WAIT_REPLY;
+
+    char req_payload[32];
+    snprintf(req_payload, sizeof(req_payload), "%ld", offset);
+    send_packet_stream(sockfd, t->stream_id, MSG_RESUME_TRANSFER, req_payload, strlen(req_payload));
+    return 0;
+}
+
+void transfer_resume_all(int sockfd, const char *listing) {
+    int kept[MAX_TRANSFERS] = {0};
+
+    // "<stream_id> <U|D> <offset>" per transfer the server kept
+    const char *line = listing;
+    while (line && *line) {
+        int id;
+        char kind;
+        long offset;
+        if (sscanf(line, "%d %c %ld", &id, &kind, &offset) == 3) {
+            Transfer *t = transfer_find(id);
+            int matches = t && t->state != XFER_QUEUED &&
+                          kind == (t->kind == XFER_UPLOAD ? 'U' : 'D');
+            if (matches && transfer_continue(sockfd, t, offset) == 0) {
+                kept[t - transfers] = 1;
+            } else {
+                // Not ours (anymore): let the server drop it
+                send_packet_stream(sockfd, id, MSG_FILE_ERROR, "Cancelled", 9);
+            }
+        }
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+
+    // Transfers the server did not keep start over
+    int restarted = 0;
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        Transfer *t = &transfers[i];
+        if (t->in_use && t->state != XFER_QUEUED && !kept[i]) {
+            transfer_requeue(t);
+            restarted++;
+        }
+    }
+    if (restarted && !quiet) printf("[INFO] %d transfer(s) restarted from the beginning.\n", restarted);
+    transfer_start_queued(sockfd);
+}
+
+void transfer_abort_all() {
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        Transfer *t = &transfers[i];
+        if (!t->in_use) continue;
+        printf("[ERROR] Transfer #%d: %s '%s' aborted, log in again to retry.\n", t->stream_id,
+               t->kind == XFER_UPLOAD ? "Upload" : "Download", t->remote_name);
+        if (t->f) fclose(t->f);
+        t->f = NULL;
+        t->in_use = 0;
+        failed_count++;
+    }
+}
+
+// --- EVENT HANDLING (called from client_main_loop) ---
+
+int transfer_handle_packet(int sockfd, int stream_id, int msg_type, char *payload, int len) {
+    Transfer *t = transfer_find(stream_id);
+    if (!t) return 0;
+
+    if (msg_type == MSG_ERROR || msg_type == MSG_FILE_ERROR) {
+        printf("\r\x1b[K[ERROR] Transfer #%d: %s '%s' failed: %s\n", t->stream_id,
+               t->kind == XFER_UPLOAD ? "Upload" : "Download", t->remote_name, payload);
+        failed_count++;
+        transfer_release(sockfd, t);
+        return 1;
+    }
+
+    if (t->kind == XFER_UPLOAD) {
+        if (t->state == XFER_WAIT_REPLY && msg_type == MSG_SUCCESS) {
+            if (t->resuming) {
+                if (!quiet) printf("\r\x1b[K[INFO] Transfer #%d: upload of '%s' resumed at %ld bytes\n", t->stream_id, t->local_name, t->transferred);
+            } else {
+                if (!quiet) printf("\r\x1b[K[INFO] Transfer #%d: uploading '%s' (%ld bytes)...\n", t->stream_id, t->local_name, t->filesize);
+            }
+            t->resuming = 0;
+            t->state = XFER_ACTIVE;
+        } else if (t->state == XFER_WAIT_DONE && msg_type == MSG_SUCCESS) {
+            if (!quiet) printf("\r\x1b[K[SUCCESS] Transfer #%d: %s\n", t->stream_id, payload);
+            completed_count++;
+            transfer_release(sockfd, t);
+        }
+        return 1;
+    }
+
+    // Download
+    if (t->state == XFER_WAIT_REPLY && msg_type == MSG_NOT_MODIFIED) {
+        if (!quiet) printf("\r\x1b[K[SUCCESS] Transfer #%d: '%s' not modified, local copy '%s' is current\n",
+                           t->stream_id, t->remote_name, t->local_name);
+        completed_count++;
+        transfer_release(sockfd, t);
+    } else if (t->state == XFER_WAIT_REPLY && msg_type == MSG_SUCCESS && t->resuming) {
+        // Same file, same local handle: only the position moved
+        if (!quiet) printf("\r\x1b[K[INFO] Transfer #%d: download of '%s' resumed at %ld bytes\n", t->stream_id, t->remote_name, t->transferred);
+        t->resuming = 0;
+        t->state = XFER_ACTIVE;
+    } else if (t->state == XFER_WAIT_REPLY && msg_type == MSG_SUCCESS) {
+        // "<size> <etag>"
+        t->etag[0] = '\0';
+        sscanf(payload, "%ld %63s", &t->filesize, t->etag);
+        t->f = fopen(t->local_name, "wb");
+        if (!t->f) {
+            printf("\r\x1b[K[ERROR] Cannot write file '%s' locally. Check permissions.\n", t->local_name);
+            // Tell the server to stop streaming this file
+            send_packet_stream(sockfd, t->stream_id, MSG_FILE_ERROR, "Cancelled", 9);
+            failed_count++;
+            transfer_release(sockfd, t);
+            return 1;
+        }
+        if (!quiet) printf("\r\x1b[K[INFO] Transfer #%d: downloading '%s' (%ld bytes)...\n", t->stream_id, t->remote_name, t->filesize);
+        t->state = XFER_ACTIVE;
+    } else if (msg_type == MSG_FILE_DATA && t->f) {
+        fwrite(payload, 1, len, t->f);
+        t->transferred += len;
+    } else if (msg_type == MSG_FILE_END) {
+        if (!quiet) printf("\r\x1b[K[SUCCESS] Transfer #%d: download of '%s' completed (%ld bytes)\n",
+                           t->stream_id, t->remote_name, t->transferred);
+        // Record after closing so the cached mtime is the final one
+        fclose(t->f);
+        t->f = NULL;
+        if (t->transferred == t->filesize && t->version == 0)
+            cache_store(t->remote_name, t->local_name, t->etag);
+        completed_count++;
+        transfer_release(sockfd, t);
+    }
+    return 1;
+}
+
+int transfer_wants_write() {
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        Transfer *t = &transfers[i];
+        if (t->in_use && t->kind == XFER_UPLOAD && t->state == XFER_ACTIVE && !t->paused)
+            return 1;
+    }
+    return 0;
+}
+
+void transfer_pump(int sockfd) {
+    char buffer[BUFFER_SIZE];
+
+    // One chunk per active upload per round, so uploads share the link fairly
+    for (int i = 0; i < MAX_TRANSFERS; i++) {
+        Transfer *t = &transfers[i];
+        if (!t->in_use || t->kind != XFER_UPLOAD || t->state != XFER_ACTIVE || t->paused)
+            continue;
+
+        size_t bytes_read = fread(buffer, 1, sizeof(buffer), t->f);
+        if (bytes_read > 0) {
+            send_packet_stream(sockfd, t->stream_id, MSG_FILE_DATA, buffer, bytes_read);
+            t->transferred += bytes_read;
         } else {
-            printf("\n[ERROR] Unexpected packet type: %d\n", msg_type);
-            break;
+            // Send END file sending message
+            send_packet_stream(sockfd, t->stream_id, MSG_FILE_END, "EOF", 3);
+            fclose(t->f);
+            t->f = NULL;
+            t->state = XFER_WAIT_DONE;
         }
     }
-    fclose(f);
-}
\ No newline at end of file
+}
+
+void transfer_render_progress() {
+    long long now = now_ms();
+    if (now - last_render_ms < PROGRESS_INTERVAL_MS) return;
+    last_render_ms = now;
+
+    char line[512] = "";
+    size_t len = 0;
+    for (int i = 0; i < MAX_TRANSFERS && len < sizeof(line) - 64; i++) {
+        Transfer *t = &transfers[i];
+        if (!t->in_use || t->state != XFER_ACTIVE) continue;
+
+        int pct = t->filesize > 0 ? (int)(t->transferred * 100 / t->filesize) : 0;
+        double secs = (now - t->started_ms) / 1000.0;
+        double mbps = secs > 0 ? t->transferred / (1024.0 * 1024.0) / secs : 0;
+        len += snprintf(line + len, sizeof(line) - len, "[#%d %s %d%% %.1fMB/s%s] ", t->stream_id,
+                        t->kind == XFER_UPLOAD ? "up" : "down", pct, mbps, t->paused ? " paused" : "");
+    }
+    if (len == 0) return;
+
+    // Redraw in place: progress followed by the prompt
+    printf("\r\x1b[K%s> ", line);
+    fflush(stdout);
+}
@@ -11,10 +11,24 @@
 int main(int argc, char *argv[])
 {
     // 1. Validate command-line arguments
-    if (argc != 3)
+    // Optional: --batch <file|-> [--window N] runs a script non-interactively
+    char *batch_path = NULL;
+    int window = 32;
+    for (int i = 3; i < argc; i++)
     {
-        fprintf(stderr, "Usage: %s <Server_IP> <Port>\n", argv[0]);
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch_path = argv[++i];
+        else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+            window = atoi(argv[++i]);
+        else
+            argc = 0; // Force the usage message
+    }
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <Server_IP> <Port> [--batch <file|-> [--window N]]\n", argv[0]);
         fprintf(stderr, "Example: %s 127.0.0.1 3636\n", argv[0]);
+        fprintf(stderr, "         %s 127.0.0.1 3636 --batch script.txt --window 64\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -65,6 +79,23 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    // Batch mode: no menu, just results and a summary
+    if (batch_path)
+    {
+        FILE *in = strcmp(batch_path, "-") == 0 ? stdin : fopen(batch_path, "r");
+        if (!in)
+        {
+            perror("Cannot open batch file");
+            close(sockfd);
+            return EXIT_FAILURE;
+        }
+        int failed = run_batch(sockfd, in, window);
+        if (in != stdin)
+            fclose(in);
+        close(sockfd);
+        return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     printf("✓ Connected to server successfully!\n");
     printf("═══════════════════════════════════════\n\n");
 
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "network.h"
+#include "protocol.h"
+#include "client.h"
+
+// UPLOAD -r / DOWNLOAD -r. The main connection is left alone (its transfers
+// keep their state); folder setup runs on a private control connection and
+// files are spread round-robin over worker connections, each driven by its
+// own thread with its own (thread-local) transfer table.
+#define TREE_DEFAULT_CONNECTIONS 4
+#define TREE_MAX_CONNECTIONS 16
+#define TREE_WORKER_QUEUE 32   // Transfers queued per worker connection
+#define TREE_WORKER_ACTIVE 16  // Started at once (server allows 16 streams per connection)
+
+typedef struct {
+    char *path;   // Relative to the tree root
+    long size;
+} TreeEntry;
+
+typedef struct {
+    TreeEntry *items;
+    int count;
+    int cap;
+} TreeList;
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    const char *login;
+    int upload;
+    TreeList *files;
+    const char *local_root;
+    const char *remote_root;
+    int index;      // This worker handles files index, index + stride, ...
+    int stride;
+    int completed;  // Updated by the worker, read by the progress loop
+    int failed;
+    int finished;
+} TreeWorker;
+
+static void tree_list_add(TreeList *list, const char *path, long size) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 256;
+        list->items = realloc(list->items, list->cap * sizeof(TreeEntry));
+    }
+    list->items[list->count].path = strdup(path);
+    list->items[list->count].size = size;
+    list->count++;
+}
+
+static void tree_list_free(TreeList *list) {
+    for (int i = 0; i < list->count; i++) free(list->items[i].path);
+    free(list->items);
+    memset(list, 0, sizeof(TreeList));
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Joins "a" and "b" with a '/', skipping empty parts
+static void join_path(char *out, size_t size, const char *a, const char *b) {
+    if (*a && *b) {
+        snprintf(out, size, "%s/%s", a, b);
+    } else {
+        snprintf(out, size, "%s", *a ? a : b);
+    }
+}
+
+// --- CONNECTIONS ---
+
+// Sends one request on stream 0 and waits for its reply (control connection only)
+static int sync_request(int fd, int type, const char *payload, char *reply) {
+    int stream_id, msg_type;
+    if (send_packet_stream(fd, 0, type, payload, strlen(payload)) < 0) return -1;
+    do {
+        if (recv_packet_stream(fd, &stream_id, &msg_type, reply) < 0) return -1;
+    } while (stream_id != 0);
+    return msg_type;
+}
+
+// Opens another connection to the same server and logs it in
+static int open_session(const struct sockaddr_storage *addr, socklen_t addr_len, const char *login) {
+    int fd = socket(addr->ss_family, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (const struct sockaddr *)addr, addr_len) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char reply[BUFFER_SIZE + 1];
+    if (sync_request(fd, MSG_LOGIN, login, reply) != MSG_SUCCESS) {
+        printf("[ERROR] Worker login failed: %s\n", reply);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// --- TREE WALKS ---
+
+static void walk_local(const char *root, const char *rel, TreeList *dirs, TreeList *files) {
+    char dir_path[1024];
+    join_path(dir_path, sizeof(dir_path), root, rel);
+
+    DIR *d = opendir(dir_path);
+    if (!d) return;
+
+    struct dirent *dir;
+    while ((dir = readdir(d)) != NULL) {
+        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
+
+        char child_rel[768], child_path[1024];
+        join_path(child_rel, sizeof(child_rel), rel, dir->d_name);
+        join_path(child_path, sizeof(child_path), root, child_rel);
+
+        struct stat st;
+        if (stat(child_path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            tree_list_add(dirs, child_rel, 0);
+            walk_local(root, child_rel, dirs, files);
+        } else if (S_ISREG(st.st_mode)) {
+            tree_list_add(files, child_rel, st.st_size);
+        }
+    }
+    closedir(d);
+}
+
+// Collects the server's MSG_LIST_TREE chunks ("D 0 path" / "F size path")
+static int walk_remote(int fd, const char *remote_root, TreeList *dirs, TreeList *files) {
+    char buffer[BUFFER_SIZE + 1];
+    int stream_id, msg_type;
+
+    if (send_packet_stream(fd, 0, MSG_LIST_TREE, remote_root, strlen(remote_root)) < 0) return -1;
+    while (1) {
+        if (recv_packet_stream(fd, &stream_id, &msg_type, buffer) < 0) return -1;
+        if (msg_type == MSG_SUCCESS) return 0;
+        if (msg_type == MSG_ERROR) {
+            printf("[ERROR] %s\n", buffer);
+            return -1;
+        }
+        if (msg_type != MSG_LIST_TREE) continue;
+
+        char *saveptr;
+        for (char *line = strtok_r(buffer, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+            char kind;
+            long size;
+            int offset;
+            if (sscanf(line, "%c %ld %n", &kind, &size, &offset) < 2) continue;
+            tree_list_add(kind == 'D' ? dirs : files, line + offset, size);
+        }
+    }
+}
+
+// Creates remote folders, packing as many paths per MSG_CREATE_FOLDERS as fit
+static int create_remote_folders(int fd, const char *remote_root, TreeList *dirs) {
+    char batch[BUFFER_SIZE];
+    char reply[BUFFER_SIZE + 1];
+    size_t len = 0;
+    int requests = 0, errors = 0, stream_id, msg_type;
+
+    // Parents of the destination first (like mkdir -p), then the root itself
+    for (const char *slash = strchr(remote_root, '/'); slash; slash = strchr(slash + 1, '/')) {
+        len += snprintf(batch + len, sizeof(batch) - len, "%.*s\n", (int)(slash - remote_root), remote_root);
+    }
+    len += snprintf(batch + len, sizeof(batch) - len, "%s\n", remote_root);
+    for (int i = 0; i <= dirs->count; i++) {
+        char line[1024];
+        size_t n = 0;
+        if (i < dirs->count) {
+            join_path(line, sizeof(line), remote_root, dirs->items[i].path);
+            n = strlen(line) + 1;
+        }
+        // Flush when the next path does not fit (or at the end).
+        // Requests are pipelined; replies are collected below.
+        if (len > 0 && (i == dirs->count || len + n >= sizeof(batch))) {
+            if (send_packet_stream(fd, 0, MSG_CREATE_FOLDERS, batch, len) < 0) return -1;
+            requests++;
+            len = 0;
+        }
+        if (i < dirs->count) {
+            memcpy(batch + len, line, n - 1);
+            batch[len + n - 1] = '\n';
+            len += n;
+        }
+    }
+
+    for (int i = 0; i < requests; i++) {
+        if (recv_packet_stream(fd, &stream_id, &msg_type, reply) < 0) return -1;
+        if (msg_type == MSG_ERROR) {
+            printf("[ERROR] MKDIR batch: %s\n", reply);
+            errors++;
+        }
+    }
+    return errors ? -1 : requests;
+}
+
+static void create_local_folders(const char *local_root, TreeList *dirs) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s", local_root);
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0777);
+        *slash = '/';
+    }
+    mkdir(local_root, 0777);
+    for (int i = 0; i < dirs->count; i++) {
+        join_path(path, sizeof(path), local_root, dirs->items[i].path);
+        if (mkdir(path, 0777) != 0 && errno != EEXIST)
+            printf("[ERROR] Cannot create local folder '%s'\n", path);
+    }
+}
+
+// --- WORKERS ---
+
+static void *tree_worker_main(void *arg) {
+    TreeWorker *w = (TreeWorker *)arg;
+    TreeList *files = w->files;
+    int local_failed = 0;
+
+    int fd = open_session(&w->addr, w->addr_len, w->login);
+    if (fd < 0) {
+        for (int i = w->index; i < files->count; i += w->stride) local_failed++;
+        __atomic_store_n(&w->failed, local_failed, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->finished, 1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    transfer_configure(1, TREE_WORKER_ACTIVE);
+    char buffer[BUFFER_SIZE + 1];
+    int next = w->index;
+
+    while (next < files->count || transfer_pending_count() > 0) {
+        // 1. Keep the queue topped up
+        while (next < files->count && transfer_pending_count() < TREE_WORKER_QUEUE) {
+            char local_path[1024], remote_path[1024];
+            join_path(local_path, sizeof(local_path), w->local_root, files->items[next].path);
+            join_path(remote_path, sizeof(remote_path), w->remote_root, files->items[next].path);
+
+            int rc = w->upload ? upload_file_as(fd, local_path, remote_path)
+                               : download_file_to(fd, remote_path, local_path);
+            if (rc < 0) local_failed++;
+            next += w->stride;
+        }
+        if (transfer_pending_count() == 0) continue;
+
+        // 2. Same event loop as client_main_loop, minus the keyboard
+        fd_set read_fds, write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(fd, &read_fds);
+        if (transfer_wants_write())
+            FD_SET(fd, &write_fds);
+
+        if (select(fd + 1, &read_fds, &write_fds, NULL, NULL) < 0) break;
+
+        if (FD_ISSET(fd, &read_fds)) {
+            int stream_id, msg_type;
+            int len = recv_packet_stream(fd, &stream_id, &msg_type, buffer);
+            if (len < 0) {
+                printf("[ERROR] Worker %d lost its connection.\n", w->index);
+                local_failed += transfer_pending_count();
+                for (; next < files->count; next += w->stride) local_failed++;
+                break;
+            }
+            transfer_handle_packet(fd, stream_id, msg_type, buffer, len);
+        }
+        if (FD_ISSET(fd, &write_fds))
+            transfer_pump(fd);
+
+        int completed, failed;
+        transfer_get_results(&completed, &failed);
+        __atomic_store_n(&w->completed, completed, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->failed, failed + local_failed, __ATOMIC_RELAXED);
+    }
+
+    int completed, failed;
+    transfer_get_results(&completed, &failed);
+    __atomic_store_n(&w->completed, completed, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->failed, failed + local_failed, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->finished, 1, __ATOMIC_RELEASE);
+    close(fd);
+    return NULL;
+}
+
+// Runs the workers and redraws "done/total" until all of them finish
+static void run_workers(const struct sockaddr_storage *addr, socklen_t addr_len, const char *login,
+                        int upload, TreeList *files, const char *local_root, const char *remote_root,
+                        int connections, long total_bytes) {
+    TreeWorker workers[TREE_MAX_CONNECTIONS];
+    pthread_t threads[TREE_MAX_CONNECTIONS];
+    if (connections > files->count) connections = files->count > 0 ? files->count : 1;
+
+    double start = now_sec();
+    for (int i = 0; i < connections; i++) {
+        TreeWorker *w = &workers[i];
+        memset(w, 0, sizeof(TreeWorker));
+        memcpy(&w->addr, addr, addr_len);
+        w->addr_len = addr_len;
+        w->login = login;
+        w->upload = upload;
+        w->files = files;
+        w->local_root = local_root;
+        w->remote_root = remote_root;
+        w->index = i;
+        w->stride = connections;
+        pthread_create(&threads[i], NULL, tree_worker_main, w);
+    }
+
+    int completed = 0, failed = 0;
+    for (int tick = 0;; tick++) {
+        int all_done = 1;
+        completed = failed = 0;
+        for (int i = 0; i < connections; i++) {
+            completed += __atomic_load_n(&workers[i].completed, __ATOMIC_RELAXED);
+            failed += __atomic_load_n(&workers[i].failed, __ATOMIC_RELAXED);
+            if (!__atomic_load_n(&workers[i].finished, __ATOMIC_ACQUIRE)) all_done = 0;
+        }
+        if (all_done) break;
+        if (tick % 5 == 0) {
+            printf("\r\x1b[K[%s -r] %d/%d files, %d failed", upload ? "UPLOAD" : "DOWNLOAD",
+                   completed + failed, files->count, failed);
+            fflush(stdout);
+        }
+        usleep(100000);
+    }
+    for (int i = 0; i < connections; i++) pthread_join(threads[i], NULL);
+
+    double elapsed = now_sec() - start;
+    printf("\r\x1b[K[%s] %s -r: %d files (%.1f MB) in %.2fs over %d connections, %.1f files/s, %d failed\n",
+           failed ? "ERROR" : "SUCCESS", upload ? "UPLOAD" : "DOWNLOAD", completed,
+           total_bytes / (1024.0 * 1024.0), elapsed, connections,
+           elapsed > 0 ? completed / elapsed : 0.0, failed);
+}
+
+// --- COMMAND ENTRY POINT ---
+
+void tree_transfer_command(int sockfd, int upload, char *input) {
+    // <CMD> -r <src> [dst] [-j N]
+    char *tokens[6];
+    int ntok = 0, connections = TREE_DEFAULT_CONNECTIONS;
+    char line[BUFFER_SIZE];
+    snprintf(line, sizeof(line), "%s", input);
+
+    char *saveptr;
+    for (char *tok = strtok_r(line, " \t", &saveptr); tok && ntok < 6; tok = strtok_r(NULL, " \t", &saveptr)) {
+        if (strcmp(tok, "-j") == 0) {
+            char *n = strtok_r(NULL, " \t", &saveptr);
+            if (n) connections = atoi(n);
+            continue;
+        }
+        tokens[ntok++] = tok;
+    }
+    if (ntok < 3 || connections < 1 || connections > TREE_MAX_CONNECTIONS) {
+        printf("Usage: %s -r <source_dir> [dest_dir] [-j 1-%d]\n", upload ? "UPLOAD" : "DOWNLOAD",
+               TREE_MAX_CONNECTIONS);
+        return;
+    }
+
+    const char *login = get_saved_login();
+    if (!login) {
+        printf("[ERROR] LOGIN first: recursive transfers open extra logged-in connections.\n");
+        return;
+    }
+
+    char src[512], dst[512];
+    snprintf(src, sizeof(src), "%s", tokens[2]);
+    snprintf(dst, sizeof(dst), "%s", ntok > 3 ? tokens[3] : (upload ? "" : "."));
+    // Strip trailing '/' so basename() style lookups work
+    for (size_t n = strlen(src); n > 1 && src[n - 1] == '/'; n--) src[n - 1] = '\0';
+    for (size_t n = strlen(dst); n > 1 && dst[n - 1] == '/'; n--) dst[n - 1] = '\0';
+    const char *base = strrchr(src, '/') ? strrchr(src, '/') + 1 : src;
+
+    // The tree lands inside dst under the source folder's own name
+    char dest_root[1024];
+    join_path(dest_root, sizeof(dest_root), dst, base);
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getpeername(sockfd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("getpeername");
+        return;
+    }
+
+    int ctl = open_session(&addr, addr_len, login);
+    if (ctl < 0) {
+        printf("[ERROR] Cannot open a control connection.\n");
+        return;
+    }
+
+    TreeList dirs = {0}, files = {0};
+    long total_bytes = 0;
+
+    if (upload) {
+        struct stat st;
+        if (stat(src, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            printf("[ERROR] '%s' is not a local folder.\n", src);
+            close(ctl);
+            return;
+        }
+        walk_local(src, "", &dirs, &files);
+        printf("[INFO] UPLOAD -r: %d folders, %d files -> '%s'\n", dirs.count, files.count, dest_root);
+
+        int batches = create_remote_folders(ctl, dest_root, &dirs);
+        if (batches < 0) {
+            printf("[ERROR] Could not create the remote folders; aborting.\n");
+        } else {
+            printf("[INFO] Remote folders ready (%d MKDIR batch request(s)).\n", batches);
+        }
+        close(ctl);
+        if (batches >= 0) {
+            for (int i = 0; i < files.count; i++) total_bytes += files.items[i].size;
+            run_workers(&addr, addr_len, login, 1, &files, src, dest_root, connections, total_bytes);
+        }
+    } else {
+        int rc = walk_remote(ctl, src, &dirs, &files);
+        close(ctl);
+        if (rc == 0) {
+            printf("[INFO] DOWNLOAD -r: %d folders, %d files -> '%s'\n", dirs.count, files.count, dest_root);
+            create_local_folders(dest_root, &dirs);
+            for (int i = 0; i < files.count; i++) total_bytes += files.items[i].size;
+            run_workers(&addr, addr_len, login, 0, &files, dest_root, src, connections, total_bytes);
+        }
+    }
+
+    tree_list_free(&dirs);
+    tree_list_free(&files);
+}
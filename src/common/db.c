@@ -5,6 +5,8 @@
 #include <errno.h>
 #include <pthread.h>
 #include "common.h"
+#include "db.h"
+#include "meta_snap.h"
 
 pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -16,6 +18,10 @@ pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
  */
 int db_check_login(const char *username, const char *password)
 {
+    int snap_id = meta_snap_check_login(username, password);
+    if (snap_id != META_SNAP_UNAVAILABLE)
+        return snap_id; // Indexed lookup in the mapped snapshot
+
     pthread_mutex_lock(&db_mutex);
 
     FILE *f = fopen(USER_DB_FILE, "r");
@@ -195,23 +201,13 @@ int db_delete_user(int user_id)
 
 //--------- GROUP MANAGEMENT ---------
 
-typedef struct
-{
-    int group_id;
-    char name[64];
-    int owner_id;
-} GroupInfo;
-
-typedef struct
-{
-    int group_id;
-    int user_id;
-    int status;
-} GroupMemberInfo; // 0: Pending, 1: Accepted
-
 int db_read_groups(GroupInfo *groups, int max_count)
 {
-    FILE *f = fopen("./data/groups.txt", "r");
+    int snap_count = meta_snap_read_groups(groups, max_count);
+    if (snap_count != META_SNAP_UNAVAILABLE)
+        return snap_count;
+
+    FILE *f = fopen(GROUP_DB_FILE, "r");
     if (!f)
         return -1;
     int count = 0;
@@ -237,7 +233,7 @@ int db_write_group(const GroupInfo *group)
         }
     }
 
-    FILE *f = fopen("./data/groups.txt", "a");
+    FILE *f = fopen(GROUP_DB_FILE, "a");
     if (!f)
         return -1;
     fprintf(f, "%d %s %d\n", group->group_id, group->name, group->owner_id);
@@ -247,7 +243,11 @@ int db_write_group(const GroupInfo *group)
 
 int db_read_group_members(GroupMemberInfo *members, int max_count)
 {
-    FILE *f = fopen("./data/group_members.txt", "r");
+    int snap_count = meta_snap_read_group_members(members, max_count);
+    if (snap_count != META_SNAP_UNAVAILABLE)
+        return snap_count;
+
+    FILE *f = fopen(GROUP_MEMBER_DB_FILE, "r");
     if (!f)
         return -1;
     int count = 0;
@@ -260,6 +260,58 @@ int db_read_group_members(GroupMemberInfo *members, int max_count)
 }
 
 
+/**
+ * @brief Looks up one group by ID (first match in file order).
+ * @return 1 if found (copied to out), 0 if not found, -1 if groups.txt is missing.
+ */
+int db_find_group(int group_id, GroupInfo *out)
+{
+    int snap_found = meta_snap_find_group(group_id, out);
+    if (snap_found != META_SNAP_UNAVAILABLE)
+        return snap_found;
+
+    FILE *f = fopen(GROUP_DB_FILE, "r");
+    if (!f)
+        return -1;
+    GroupInfo g;
+    int found = 0;
+    while (fscanf(f, "%d %63s %d", &g.group_id, g.name, &g.owner_id) == 3)
+    {
+        if (g.group_id == group_id)
+        {
+            *out = g;
+            found = 1;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/**
+ * @brief Membership of a user in a group.
+ * @return 1 if accepted, 0 if pending, -1 if not in the group.
+ */
+int db_member_status(int group_id, int user_id)
+{
+    int snap_status = meta_snap_member_status(group_id, user_id);
+    if (snap_status != META_SNAP_UNAVAILABLE)
+        return snap_status;
+
+    FILE *f = fopen(GROUP_MEMBER_DB_FILE, "r");
+    if (!f)
+        return -1;
+    GroupMemberInfo m;
+    int status = -1;
+    while (status != 1 && fscanf(f, "%d %d %d", &m.group_id, &m.user_id, &m.status) == 3)
+    {
+        if (m.group_id == group_id && m.user_id == user_id)
+            status = m.status == 1 ? 1 : 0;
+    }
+    fclose(f);
+    return status;
+}
+
 int db_write_group_member(const GroupMemberInfo *member)
 {
     // Ensure data directory exists
@@ -273,7 +325,7 @@ int db_write_group_member(const GroupMemberInfo *member)
         }
     }
 
-    FILE *f = fopen("./data/group_members.txt", "a");
+    FILE *f = fopen(GROUP_MEMBER_DB_FILE, "a");
     if (!f)
         return -1;
     fprintf(f, "%d %d %d\n", member->group_id, member->user_id, member->status);
@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "meta_snap.h"
+
+#define SNAP_MAGIC "FSMETA\0"
+#define SNAP_BYTE_ORDER 0x01020304u
+
+extern pthread_mutex_t db_mutex;
+
+// --- ON-DISK FORMAT ---
+
+enum { SRC_USERS, SRC_GROUPS, SRC_MEMBERS, SRC_COUNT };
+enum { SEC_USERS, SEC_USERS_BY_NAME, SEC_GROUPS, SEC_GROUPS_BY_ID, SEC_MEMBERS, SEC_MEMBERS_BY_PAIR,
+       SEC_STRINGS, SEC_COUNT };
+
+typedef struct {
+    int64_t size;       // -1 if the file did not exist
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int32_t racy;       // Modified within META_SNAP_RACY_MS of the build: never trusted
+    int32_t pad;
+} SourceStamp;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t count;     // Records (bytes for the string table)
+} Section;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    int64_t built_at;
+    SourceStamp sources[SRC_COUNT];
+    Section sections[SEC_COUNT];
+} SnapHeader;
+
+typedef struct { int32_t id; uint32_t name; uint32_t password; } UserRec;
+typedef struct { int32_t id; int32_t owner_id; uint32_t name; } GroupRec;
+typedef struct { int32_t group_id; int32_t user_id; int32_t status; } MemberRec;
+
+static const char *source_paths[SRC_COUNT] = {USER_DB_FILE, GROUP_DB_FILE, GROUP_MEMBER_DB_FILE};
+static const size_t section_elem[SEC_COUNT] = {sizeof(UserRec), sizeof(uint32_t), sizeof(GroupRec), sizeof(uint32_t),
+                                               sizeof(MemberRec), sizeof(uint32_t), 1};
+
+// --- MAPPED SNAPSHOT ---
+
+static pthread_rwlock_t snap_lock = PTHREAD_RWLOCK_INITIALIZER;
+static const unsigned char *snap_base = NULL;
+static size_t snap_size = 0;
+
+#define HDR ((const SnapHeader *)snap_base)
+
+static const void *section(int sec) {
+    return snap_base + HDR->sections[sec].offset;
+}
+
+static uint64_t section_count(int sec) {
+    return HDR->sections[sec].count;
+}
+
+static const char *string_at(uint32_t off) {
+    return off < section_count(SEC_STRINGS) ? (const char *)section(SEC_STRINGS) + off : "";
+}
+
+static void stamp_of(const struct stat *st, SourceStamp *out) {
+    memset(out, 0, sizeof(*out));
+    if (!st) {
+        out->size = -1;
+        return;
+    }
+    out->size = st->st_size;
+    out->mtime_sec = st->st_mtim.tv_sec;
+    out->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+// A section is usable while its source file is exactly as it was at build time
+static int source_fresh(int src) {
+    const SourceStamp *built = &HDR->sources[src];
+    if (built->racy) return 0;
+
+    struct stat st;
+    SourceStamp now;
+    stamp_of(stat(source_paths[src], &st) == 0 ? &st : NULL, &now);
+    return now.size == built->size && now.mtime_sec == built->mtime_sec && now.mtime_nsec == built->mtime_nsec;
+}
+
+// Takes the read lock; on success the caller reads the snapshot, then unlocks
+static int begin_read(int src) {
+    pthread_rwlock_rdlock(&snap_lock);
+    if (snap_base && source_fresh(src)) return 0;
+    pthread_rwlock_unlock(&snap_lock);
+    return -1;
+}
+
+static int validate(const unsigned char *base, size_t size) {
+    const SnapHeader *h = (const SnapHeader *)base;
+    if (size < sizeof(SnapHeader) || memcmp(h->magic, SNAP_MAGIC, 8) != 0) return -1;
+    if (h->version != META_SNAP_VERSION || h->byte_order != SNAP_BYTE_ORDER || h->file_size != size) return -1;
+
+    for (int i = 0; i < SEC_COUNT; i++) {
+        const Section *s = &h->sections[i];
+        if (s->offset % 8 != 0 || s->offset < sizeof(SnapHeader) || s->offset > size) return -1;
+        if (s->count > (size - s->offset) / section_elem[i]) return -1;
+    }
+    // Record numbers in the indexes are checked on access; strings must end inside the table
+    const Section *strings = &h->sections[SEC_STRINGS];
+    if (strings->count > 0 && base[strings->offset + strings->count - 1] != '\0') return -1;
+    return 0;
+}
+
+// --- BUILD ---
+
+typedef struct {
+    void *data;
+    size_t count, cap;
+} Array;
+
+// Appends `n` uninitialized elements, returns the first (NULL if out of memory)
+static void *array_push(Array *a, size_t elem, size_t n) {
+    if (a->count + n > a->cap) {
+        size_t cap = a->cap ? a->cap : 1024;
+        while (cap < a->count + n) cap *= 2;
+        void *bigger = realloc(a->data, cap * elem);
+        if (!bigger) return NULL;
+        a->data = bigger;
+        a->cap = cap;
+    }
+    a->count += n;
+    return (char *)a->data + elem * (a->count - n);
+}
+
+static int64_t string_add(Array *strings, const char *s) {
+    size_t len = strlen(s) + 1;
+    int64_t off = strings->count;
+    if (off + len > UINT32_MAX) return -1;
+    char *dst = array_push(strings, 1, len);
+    if (!dst) return -1;
+    memcpy(dst, s, len);
+    return off;
+}
+
+// Opens a source and records its stamp (racy if written just before the build)
+static FILE *open_source(int src, SourceStamp *stamp) {
+    FILE *f = fopen(source_paths[src], "r");
+    struct stat st;
+    if (!f || fstat(fileno(f), &st) != 0) {
+        if (f) fclose(f);
+        stamp_of(NULL, stamp);
+        return NULL;
+    }
+    stamp_of(&st, stamp);
+
+    // An mtime has the resolution of the kernel tick: a rewrite of the same
+    // size within that tick would keep the stamp (same idea as git's "racy" index)
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t age_ms = (now.tv_sec - stamp->mtime_sec) * 1000 + (now.tv_nsec - stamp->mtime_nsec) / 1000000;
+    stamp->racy = age_ms < META_SNAP_RACY_MS;
+    return f;
+}
+
+// Sort context of the index comparators (meta_snap_build is serialized)
+static const void *sort_recs;
+static const char *sort_strings;
+
+static int cmp_user_name(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    const UserRec *users = sort_recs;
+    int c = strcmp(sort_strings + users[x].name, sort_strings + users[y].name);
+    return c ? c : (x > y) - (x < y); // Equal names keep file order: first match wins, as in the text scan
+}
+
+static int cmp_group_id(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    const GroupRec *groups = sort_recs;
+    if (groups[x].id != groups[y].id) return groups[x].id < groups[y].id ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+static int cmp_member_pair(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    const MemberRec *members = sort_recs;
+    if (members[x].group_id != members[y].group_id) return members[x].group_id < members[y].group_id ? -1 : 1;
+    if (members[x].user_id != members[y].user_id) return members[x].user_id < members[y].user_id ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+static uint32_t *sorted_index(const void *recs, size_t count, const char *strings,
+                              int (*cmp)(const void *, const void *)) {
+    uint32_t *index = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!index) return NULL;
+    for (size_t i = 0; i < count; i++) index[i] = (uint32_t)i;
+    sort_recs = recs;
+    sort_strings = strings;
+    qsort(index, count, sizeof(uint32_t), cmp);
+    return index;
+}
+
+static int write_padded(FILE *f, const void *data, size_t len) {
+    static const char zeros[8] = {0};
+    if (len && fwrite(data, 1, len, f) != len) return -1;
+    size_t pad = (8 - len % 8) % 8;
+    return pad && fwrite(zeros, 1, pad, f) != pad ? -1 : 0;
+}
+
+int meta_snap_build(const char *path) {
+    static pthread_mutex_t build_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&build_mutex);
+
+    SnapHeader h;
+    memset(&h, 0, sizeof(h));
+    Array users = {0}, groups = {0}, members = {0}, strings = {0};
+    uint32_t *indexes[3] = {NULL, NULL, NULL};
+    int ok = 1;
+    string_add(&strings, ""); // Offset 0 is the empty string
+
+    // Same formats as the text scans in db.c
+    pthread_mutex_lock(&db_mutex);
+    FILE *f = open_source(SRC_USERS, &h.sources[SRC_USERS]);
+    if (f) {
+        int id;
+        char u[50], p[50];
+        while (ok && fscanf(f, "%d %49s %49s", &id, u, p) == 3) {
+            UserRec *r = array_push(&users, sizeof(UserRec), 1);
+            int64_t name = string_add(&strings, u), pass = string_add(&strings, p);
+            if (!r || name < 0 || pass < 0) ok = 0;
+            else *r = (UserRec){id, (uint32_t)name, (uint32_t)pass};
+        }
+        fclose(f);
+    }
+    f = open_source(SRC_GROUPS, &h.sources[SRC_GROUPS]);
+    if (f) {
+        GroupInfo g;
+        while (ok && fscanf(f, "%d %63s %d", &g.group_id, g.name, &g.owner_id) == 3) {
+            GroupRec *r = array_push(&groups, sizeof(GroupRec), 1);
+            int64_t name = string_add(&strings, g.name);
+            if (!r || name < 0) ok = 0;
+            else *r = (GroupRec){g.group_id, g.owner_id, (uint32_t)name};
+        }
+        fclose(f);
+    }
+    f = open_source(SRC_MEMBERS, &h.sources[SRC_MEMBERS]);
+    if (f) {
+        GroupMemberInfo m;
+        while (ok && fscanf(f, "%d %d %d", &m.group_id, &m.user_id, &m.status) == 3) {
+            MemberRec *r = array_push(&members, sizeof(MemberRec), 1);
+            if (!r) ok = 0;
+            else *r = (MemberRec){m.group_id, m.user_id, m.status};
+        }
+        fclose(f);
+    }
+    pthread_mutex_unlock(&db_mutex);
+
+    if (ok) {
+        indexes[0] = sorted_index(users.data, users.count, strings.data, cmp_user_name);
+        indexes[1] = sorted_index(groups.data, groups.count, strings.data, cmp_group_id);
+        indexes[2] = sorted_index(members.data, members.count, strings.data, cmp_member_pair);
+        ok = indexes[0] && indexes[1] && indexes[2];
+    }
+
+    const void *data[SEC_COUNT] = {users.data, indexes[0], groups.data, indexes[1],
+                                   members.data, indexes[2], strings.data};
+    size_t counts[SEC_COUNT] = {users.count, users.count, groups.count, groups.count,
+                                members.count, members.count, strings.count};
+
+    memcpy(h.magic, SNAP_MAGIC, 8);
+    h.version = META_SNAP_VERSION;
+    h.byte_order = SNAP_BYTE_ORDER;
+    h.built_at = time(NULL);
+    uint64_t offset = (sizeof(SnapHeader) + 7) / 8 * 8;
+    for (int i = 0; i < SEC_COUNT; i++) {
+        h.sections[i].offset = offset;
+        h.sections[i].count = counts[i];
+        offset += (counts[i] * section_elem[i] + 7) / 8 * 8;
+    }
+    h.file_size = offset;
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()); // Two processes during an upgrade
+    f = ok ? fopen(tmp, "wb") : NULL;
+    if (f) {
+        ok = write_padded(f, &h, sizeof(h)) == 0;
+        for (int i = 0; ok && i < SEC_COUNT; i++)
+            ok = write_padded(f, data[i], counts[i] * section_elem[i]) == 0;
+        ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if (!ok) unlink(tmp);
+    } else {
+        ok = 0;
+    }
+
+    free(users.data);
+    free(groups.data);
+    free(members.data);
+    free(strings.data);
+    for (int i = 0; i < 3; i++) free(indexes[i]);
+    pthread_mutex_unlock(&build_mutex);
+    return ok ? 0 : -1;
+}
+
+// --- MAPPING ---
+
+int meta_snap_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SnapHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    if (validate(map, st.st_size) != 0) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&snap_lock);
+    const unsigned char *old = snap_base;
+    size_t old_size = snap_size;
+    snap_base = map;
+    snap_size = st.st_size;
+    pthread_rwlock_unlock(&snap_lock);
+
+    if (old) munmap((void *)old, old_size);
+    return 0;
+}
+
+void meta_snap_close() {
+    pthread_rwlock_wrlock(&snap_lock);
+    if (snap_base) munmap((void *)snap_base, snap_size);
+    snap_base = NULL;
+    snap_size = 0;
+    pthread_rwlock_unlock(&snap_lock);
+}
+
+static char refresh_path[512];
+static int refresh_interval;
+
+static int needs_rebuild() {
+    pthread_rwlock_rdlock(&snap_lock);
+    int stale = !snap_base;
+    for (int i = 0; !stale && i < SRC_COUNT; i++) stale = !source_fresh(i);
+    pthread_rwlock_unlock(&snap_lock);
+    return stale;
+}
+
+static void *refresher_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        if (needs_rebuild() && meta_snap_build(refresh_path) == 0) meta_snap_open(refresh_path);
+        sleep(refresh_interval);
+    }
+    return NULL;
+}
+
+void meta_snap_start_refresher(const char *path, int interval_sec) {
+    snprintf(refresh_path, sizeof(refresh_path), "%s", path);
+    refresh_interval = interval_sec > 0 ? interval_sec : META_SNAP_REFRESH_INTERVAL;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, refresher_thread, NULL) == 0) pthread_detach(tid);
+}
+
+// --- LOOKUPS ---
+
+int meta_snap_check_login(const char *username, const char *password) {
+    if (begin_read(SRC_USERS) != 0) return META_SNAP_UNAVAILABLE;
+
+    const UserRec *users = section(SEC_USERS);
+    const uint32_t *by_name = section(SEC_USERS_BY_NAME);
+    uint64_t n = section_count(SEC_USERS), lo = 0, hi = n;
+    while (lo < hi) { // Lower bound of the name
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (by_name[mid] < n && strcmp(string_at(users[by_name[mid]].name), username) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    int id = -1;
+    for (; lo < n && by_name[lo] < n; lo++) {
+        const UserRec *u = &users[by_name[lo]];
+        if (strcmp(string_at(u->name), username) != 0) break;
+        if (strcmp(string_at(u->password), password) == 0) {
+            id = u->id;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&snap_lock);
+    return id;
+}
+
+int meta_snap_read_groups(GroupInfo *groups, int max_count) {
+    if (begin_read(SRC_GROUPS) != 0) return META_SNAP_UNAVAILABLE;
+
+    int count = -1;
+    if (HDR->sources[SRC_GROUPS].size >= 0) {
+        const GroupRec *recs = section(SEC_GROUPS);
+        uint64_t n = section_count(SEC_GROUPS);
+        for (count = 0; count < max_count && (uint64_t)count < n; count++) {
+            groups[count].group_id = recs[count].id;
+            groups[count].owner_id = recs[count].owner_id;
+            snprintf(groups[count].name, sizeof(groups[count].name), "%s", string_at(recs[count].name));
+        }
+    }
+    pthread_rwlock_unlock(&snap_lock);
+    return count;
+}
+
+int meta_snap_read_group_members(GroupMemberInfo *members, int max_count) {
+    if (begin_read(SRC_MEMBERS) != 0) return META_SNAP_UNAVAILABLE;
+
+    int count = -1;
+    if (HDR->sources[SRC_MEMBERS].size >= 0) {
+        const MemberRec *recs = section(SEC_MEMBERS);
+        uint64_t n = section_count(SEC_MEMBERS);
+        for (count = 0; count < max_count && (uint64_t)count < n; count++) {
+            members[count].group_id = recs[count].group_id;
+            members[count].user_id = recs[count].user_id;
+            members[count].status = recs[count].status;
+        }
+    }
+    pthread_rwlock_unlock(&snap_lock);
+    return count;
+}
+
+int meta_snap_find_group(int group_id, GroupInfo *out) {
+    if (begin_read(SRC_GROUPS) != 0) return META_SNAP_UNAVAILABLE;
+
+    const GroupRec *recs = section(SEC_GROUPS);
+    const uint32_t *by_id = section(SEC_GROUPS_BY_ID);
+    uint64_t n = section_count(SEC_GROUPS), lo = 0, hi = n;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (by_id[mid] < n && recs[by_id[mid]].id < group_id) lo = mid + 1;
+        else hi = mid;
+    }
+
+    int found = lo < n && by_id[lo] < n && recs[by_id[lo]].id == group_id;
+    if (found) {
+        const GroupRec *g = &recs[by_id[lo]];
+        out->group_id = g->id;
+        out->owner_id = g->owner_id;
+        snprintf(out->name, sizeof(out->name), "%s", string_at(g->name));
+    }
+    pthread_rwlock_unlock(&snap_lock);
+    return found;
+}
+
+int meta_snap_member_status(int group_id, int user_id) {
+    if (begin_read(SRC_MEMBERS) != 0) return META_SNAP_UNAVAILABLE;
+
+    const MemberRec *recs = section(SEC_MEMBERS);
+    const uint32_t *by_pair = section(SEC_MEMBERS_BY_PAIR);
+    uint64_t n = section_count(SEC_MEMBERS), lo = 0, hi = n;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const MemberRec *m = by_pair[mid] < n ? &recs[by_pair[mid]] : NULL;
+        if (m && (m->group_id < group_id || (m->group_id == group_id && m->user_id < user_id))) lo = mid + 1;
+        else hi = mid;
+    }
+
+    int status = -1; // Duplicate entries: accepted wins over pending
+    for (; lo < n && by_pair[lo] < n; lo++) {
+        const MemberRec *m = &recs[by_pair[lo]];
+        if (m->group_id != group_id || m->user_id != user_id) break;
+        if (m->status == 1) status = 1;
+        else if (status < 0) status = 0;
+    }
+    pthread_rwlock_unlock(&snap_lock);
+    return status;
+}
+
+int meta_snap_format_info(char *buf, size_t size) {
+    static const char *names[SRC_COUNT] = {"users", "groups", "members"};
+    int n;
+    pthread_rwlock_rdlock(&snap_lock);
+    if (!snap_base) {
+        n = snprintf(buf, size, "META_SNAP none\n");
+    } else {
+        char stale[64] = "";
+        for (int i = 0; i < SRC_COUNT; i++) {
+            if (!source_fresh(i)) {
+                strcat(stale, stale[0] ? "," : "");
+                strcat(stale, names[i]);
+            }
+        }
+        n = snprintf(buf, size, "META_SNAP v%u users=%llu groups=%llu members=%llu size=%lluKB stale=%s\n",
+                     HDR->version, (unsigned long long)section_count(SEC_USERS),
+                     (unsigned long long)section_count(SEC_GROUPS), (unsigned long long)section_count(SEC_MEMBERS),
+                     (unsigned long long)(snap_size / 1024), stale[0] ? stale : "none");
+    }
+    pthread_rwlock_unlock(&snap_lock);
+    return n < 0 ? 0 : ((size_t)n >= size ? (int)size - 1 : n);
+}
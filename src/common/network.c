@@ -3,10 +3,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <errno.h>
 
 #include "network.h"
 
+__thread unsigned long long net_tx_bytes = 0;
+__thread unsigned long long net_rx_bytes = 0;
+__thread unsigned long long net_tx_errors = 0;
+__thread int net_reply_stream = 0;
+
 // --- LOW LEVEL WRAPPERS ---
 
 int send_all(int sockfd, const void *buffer, size_t len) {
@@ -16,7 +22,7 @@ int send_all(int sockfd, const void *buffer, size_t len) {
 
     while (total_sent < len) {
         // Send data starting from the current offset
-        n = send(sockfd, (const char *)buffer + total_sent, bytes_left, 0);
+        n = send(sockfd, (const char *)buffer + total_sent, bytes_left, MSG_NOSIGNAL);
         
         if (n == -1) { 
             perror("send_all error");
@@ -56,28 +62,93 @@ int recv_all(int sockfd, void *buffer, size_t len) {
 // --- HIGH LEVEL PROTOCOL HANDLERS ---
 
 int send_packet(int sockfd, int type, const void *payload, int payload_len) {
+    return send_packet_stream(sockfd, net_reply_stream, type, payload, payload_len);
+}
+
+int send_packet_stream(int sockfd, int stream_id, int type, const void *payload, int payload_len) {
     PacketHeader header;
     
     // 1. Prepare Header
+    if (payload == NULL) payload_len = 0;
     header.type = type;
+    header.stream_id = stream_id;
     header.payload_len = payload_len;
 
-    // 2. Send Header first (Fixed size)
-    if (send_all(sockfd, &header, sizeof(PacketHeader)) < 0) {
+    // 2. Send Header + Payload with one syscall. Two separate sends make
+    // Nagle hold back the payload until the peer's delayed ACK fires, which
+    // costs ~40ms per request/response round trip.
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(PacketHeader);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = payload_len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = payload_len > 0 ? 2 : 1;
+
+    ssize_t n = sendmsg(sockfd, &msg, MSG_NOSIGNAL); // EPIPE instead of SIGPIPE
+    if (n == -1) {
+        perror("send_packet error");
         return -1;
     }
 
-    // 3. Send Payload (if any)
-    if (payload_len > 0 && payload != NULL) {
-        if (send_all(sockfd, payload, payload_len) < 0) {
-            return -1;
+    // 3. Finish whatever the kernel did not take (large payloads)
+    size_t total = sizeof(PacketHeader) + payload_len;
+    if ((size_t)n < total) {
+        if ((size_t)n < sizeof(PacketHeader)) {
+            if (send_all(sockfd, (char *)&header + n, sizeof(PacketHeader) - n) < 0)
+                return -1;
+            n = sizeof(PacketHeader);
         }
+        if (send_all(sockfd, (const char *)payload + (n - sizeof(PacketHeader)),
+                     total - n) < 0)
+            return -1;
     }
 
+    net_tx_bytes += sizeof(PacketHeader) + payload_len;
+    if (type == MSG_ERROR || type == MSG_FILE_ERROR)
+        net_tx_errors++;
+
+    return 0;
+}
+
+int send_iov(int sockfd, struct iovec *iov, int iovcnt) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    while (iovcnt > 0) {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt < UIO_MAXIOV ? iovcnt : UIO_MAXIOV; // Longer lists go out in parts
+        ssize_t n = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("send_iov error");
+            return -1;
+        }
+        net_tx_bytes += n;
+
+        // Skip what was sent; resume mid-buffer if needed
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
     return 0;
 }
 
 int recv_packet(int sockfd, int *type, void *payload_buffer) {
+    int stream_id;
+    return recv_packet_stream(sockfd, &stream_id, type, payload_buffer);
+}
+
+int recv_packet_stream(int sockfd, int *stream_id, int *type, void *payload_buffer) {
     PacketHeader header;
     int status;
 
@@ -88,8 +159,9 @@ int recv_packet(int sockfd, int *type, void *payload_buffer) {
         return -1; 
     }
 
-    // Output the message type
+    // Output the message type and stream
     *type = header.type;
+    *stream_id = header.stream_id;
 
     // 2. Process Payload
     if (header.payload_len > 0) {
@@ -111,5 +183,7 @@ int recv_packet(int sockfd, int *type, void *payload_buffer) {
         ((char*)payload_buffer)[0] = '\0';
     }
 
+    net_rx_bytes += sizeof(PacketHeader) + (header.payload_len > 0 ? header.payload_len : 0);
+
     return header.payload_len;
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "common.h"
+#include "router.h"
+
+static RouterNode nodes[ROUTER_MAX_NODES];
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <port> <metadata host:port> <backend host:port>...\n", prog);
+    fprintf(stderr, "Example: %s %d 127.0.0.1:3636 127.0.0.1:3701 127.0.0.1:3702\n", prog, ROUTER_DEFAULT_PORT);
+    fprintf(stderr, "FS_CLUSTER_SECRET must match cluster_secret on the backends.\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4 || argc - 2 > ROUTER_MAX_NODES) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    int port = atoi(argv[1]);
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "Error: Invalid port number '%s'. Must be between 1-65535.\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    int count = 0;
+    for (int i = 2; i < argc; i++) {
+        if (router_parse_node(argv[i], &nodes[count++]) != 0) {
+            fprintf(stderr, "Error: '%s' is not host:port\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    const char *secret = getenv("FS_CLUSTER_SECRET");
+    if (!secret || !secret[0]) fprintf(stderr, "Warning: FS_CLUSTER_SECRET is not set, backends will refuse logins\n");
+    if (ring_build(nodes, count) != 0) {
+        perror("Ring allocation failed");
+        return EXIT_FAILURE;
+    }
+    relay_init(nodes, count, secret);
+    signal(SIGPIPE, SIG_IGN);
+
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (server_fd < 0 || bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server_fd, 1024) < 0) {
+        perror("Router listen failed");
+        return EXIT_FAILURE;
+    }
+
+    printf("Router listening on port %d: metadata %s:%d, %d backend(s)\n", port, nodes[0].host, nodes[0].port,
+           count - 1);
+    for (int g = 1; g <= 8; g++) {
+        int n = ring_lookup(g);
+        printf("  Group_%d -> %s:%d\n", g, nodes[n].host, nodes[n].port);
+    }
+    fflush(stdout);
+
+    while (1) {
+        int sock = accept(server_fd, NULL, NULL);
+        if (sock < 0) continue;
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        int *arg = malloc(sizeof(int));
+        pthread_t tid;
+        if (!arg) {
+            close(sock);
+            continue;
+        }
+        *arg = sock;
+        if (pthread_create(&tid, NULL, relay_client_thread, arg) != 0) {
+            perror("Router thread creation failed");
+            free(arg);
+            close(sock);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return 0;
+}
@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "common.h"
+#include "network.h"
+#include "router.h"
+#include "search_index.h"
+
+static const RouterNode *nodes;
+static int node_count;
+static const char *cluster_secret;
+
+typedef struct {
+    int stream_id;   // 0 = free
+    int node;
+    int ending;      // Upload sent FILE_END: the node's next reply finishes it
+} Route;
+
+// One client connection and the backend connections opened on its behalf
+typedef struct {
+    int client;
+    int fds[ROUTER_MAX_NODES];    // -1 until first used
+    int authed[ROUTER_MAX_NODES]; // MSG_CLUSTER_AUTH accepted on that connection
+    int logged_in;
+    int user_id;
+    char username[50];
+    Route routes[ROUTER_MAX_ROUTES]; // Transfer frames follow the request that opened the stream
+    int next_route;
+    char reply[BUFFER_SIZE + 1];
+} RelayConn;
+
+void relay_init(const RouterNode *list, int count, const char *secret) {
+    nodes = list;
+    node_count = count;
+    cluster_secret = secret && secret[0] ? secret : "-";
+}
+
+static int connect_node(const RouterNode *node) {
+    char port[16];
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", node->port);
+    if (getaddrinfo(node->host, port, &hints, &res) != 0) return -1;
+
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock >= 0) {
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return sock;
+}
+
+// --- STREAM ROUTES ---
+
+static Route *route_find(RelayConn *rc, int stream_id) {
+    for (int i = 0; i < ROUTER_MAX_ROUTES && stream_id != 0; i++) {
+        if (rc->routes[i].stream_id == stream_id) return &rc->routes[i];
+    }
+    return NULL;
+}
+
+static void route_set(RelayConn *rc, int stream_id, int node) {
+    Route *r = route_find(rc, stream_id);
+    for (int i = 0; i < ROUTER_MAX_ROUTES && !r; i++) {
+        if (rc->routes[i].stream_id == 0) r = &rc->routes[i];
+    }
+    if (!r) {
+        // More open transfers than the server allows: reuse the oldest slot
+        r = &rc->routes[rc->next_route];
+        rc->next_route = (rc->next_route + 1) % ROUTER_MAX_ROUTES;
+    }
+    *r = (Route){stream_id, node, 0};
+}
+
+// Retires the route of a transfer the node reports as finished
+static void route_note_reply(RelayConn *rc, int stream_id, int type) {
+    Route *r = route_find(rc, stream_id);
+    if (!r) return;
+    if (type == MSG_FILE_END || type == MSG_FILE_ERROR || type == MSG_ERROR || type == MSG_NOT_MODIFIED ||
+        (type == MSG_SUCCESS && r->ending))
+        r->stream_id = 0;
+}
+
+static int node_of_path(const char *path) {
+    int group_id = router_path_group(path);
+    return group_id < 0 ? ROUTER_META : ring_lookup(group_id);
+}
+
+// --- BACKEND CONNECTIONS ---
+
+static int send_client(RelayConn *rc, int stream_id, int type, const char *msg) {
+    return send_packet_stream(rc->client, stream_id, type, msg, (int)strlen(msg));
+}
+
+// Closes a backend connection; its transfers fail on the client side
+static void drop_node(RelayConn *rc, int n) {
+    if (rc->fds[n] < 0) return;
+    close(rc->fds[n]);
+    rc->fds[n] = -1;
+    rc->authed[n] = 0;
+    for (int i = 0; i < ROUTER_MAX_ROUTES; i++) {
+        if (rc->routes[i].node == n && rc->routes[i].stream_id != 0) {
+            send_client(rc, rc->routes[i].stream_id, MSG_FILE_ERROR, "Storage node disconnected");
+            rc->routes[i].stream_id = 0;
+        }
+    }
+}
+
+static void drop_backends(RelayConn *rc) {
+    for (int n = 0; n < node_count; n++) {
+        if (n != ROUTER_META) drop_node(rc, n);
+    }
+}
+
+/**
+ * @brief Waits for the next packet on ROUTER_CALL_STREAM, passing anything
+ * else the node sends on to the client.
+ * @return Reply type (payload in rc->reply), or -1 if the node is gone.
+ */
+static int await_call(RelayConn *rc, int n, int *reply_len) {
+    int fd = rc->fds[n];
+    while (1) {
+        int stream_id, reply_type;
+        int got = recv_packet_stream(fd, &stream_id, &reply_type, rc->reply);
+        if (got < 0) {
+            drop_node(rc, n);
+            return -1;
+        }
+        if (stream_id == ROUTER_CALL_STREAM) {
+            rc->reply[got] = '\0';
+            if (reply_len) *reply_len = got;
+            return reply_type;
+        }
+        route_note_reply(rc, stream_id, reply_type);
+        send_packet_stream(rc->client, stream_id, reply_type, rc->reply, got);
+    }
+}
+
+/**
+ * @brief Sends a request of the router's own on ROUTER_CALL_STREAM and waits
+ * for its (first) reply.
+ * @return Reply type (payload in rc->reply), or -1 if the node is gone.
+ */
+static int call_node(RelayConn *rc, int n, int type, const char *payload, int len, int *reply_len) {
+    if (send_packet_stream(rc->fds[n], ROUTER_CALL_STREAM, type, payload, len) < 0) {
+        drop_node(rc, n);
+        return -1;
+    }
+    return await_call(rc, n, reply_len);
+}
+
+// Connection to node `n`, logged in as the client's user if it is
+static int node_fd(RelayConn *rc, int n) {
+    if (rc->fds[n] < 0) {
+        rc->fds[n] = connect_node(&nodes[n]);
+        if (rc->fds[n] < 0) return -1;
+    }
+    if (n != ROUTER_META && rc->logged_in && !rc->authed[n]) {
+        char msg[BUFFER_SIZE];
+        int len = snprintf(msg, sizeof(msg), "%s %d %s", cluster_secret, rc->user_id, rc->username);
+        if (call_node(rc, n, MSG_CLUSTER_AUTH, msg, len, NULL) != MSG_SUCCESS) {
+            fprintf(stderr, "Router: %s:%d refused the cluster login (cluster_secret mismatch?)\n",
+                    nodes[n].host, nodes[n].port);
+            drop_node(rc, n);
+            return -1;
+        }
+        rc->authed[n] = 1;
+    }
+    return rc->fds[n];
+}
+
+static void forward(RelayConn *rc, int n, int stream_id, int type, const char *payload, int len) {
+    int fd = node_fd(rc, n);
+    if (fd < 0) {
+        int transfer_frame = type == MSG_FILE_DATA || type == MSG_FILE_END;
+        send_client(rc, stream_id, transfer_frame ? MSG_FILE_ERROR : MSG_ERROR,
+                    "Storage node for this group is unavailable");
+        return;
+    }
+    if (send_packet_stream(fd, stream_id, type, payload, len) < 0) drop_node(rc, n);
+}
+
+// --- REQUESTS THAT NEED MORE THAN ONE NODE ---
+
+// "Login successful. Welcome bob (ID: 1)" / "Session resumed. Welcome back bob (ID: 1)"
+static int parse_identity(RelayConn *rc, const char *reply) {
+    const char *p = strstr(reply, "Welcome ");
+    if (!p) return -1;
+    p += 8;
+    if (strncmp(p, "back ", 5) == 0) p += 5;
+    char user[50];
+    int user_id;
+    if (sscanf(p, "%49s (ID: %d)", user, &user_id) != 2) return -1;
+    rc->logged_in = 1;
+    rc->user_id = user_id;
+    snprintf(rc->username, sizeof(rc->username), "%s", user);
+    return 0;
+}
+
+// Login, logout and account deletion run on the metadata node; the
+// backends are then logged in again, lazily, as the new identity
+static void handle_session_change(RelayConn *rc, int stream_id, int type, const char *payload, int len) {
+    int reply_len;
+    int reply_type = call_node(rc, ROUTER_META, type, payload, len, &reply_len);
+    if (reply_type < 0) return;
+
+    if (reply_type == MSG_SUCCESS) {
+        // Backends were logged in as the previous identity
+        drop_backends(rc);
+        rc->logged_in = 0;
+        if (type == MSG_LOGIN || type == MSG_RESUME_SESSION) parse_identity(rc, rc->reply);
+    }
+    send_packet_stream(rc->client, stream_id, reply_type, rc->reply, reply_len);
+}
+
+// The metadata node assigns the ID; the owning node then records the group
+static void handle_create_group(RelayConn *rc, int stream_id, const char *payload, int len) {
+    int reply_len;
+    int reply_type = call_node(rc, ROUTER_META, MSG_CREATE_GROUP, payload, len, &reply_len);
+    if (reply_type < 0) return;
+
+    const char *id_text = strstr(rc->reply, "ID: ");
+    int group_id = id_text ? atoi(id_text + 4) : 0;
+    if (reply_type == MSG_SUCCESS && group_id > 0) {
+        char meta_reply[BUFFER_SIZE + 1];
+        memcpy(meta_reply, rc->reply, reply_len + 1);
+
+        int n = ring_lookup(group_id);
+        char msg[BUFFER_SIZE];
+        int msg_len = snprintf(msg, sizeof(msg), "%s %d %s", cluster_secret, group_id, payload);
+        if (node_fd(rc, n) < 0 || call_node(rc, n, MSG_CLUSTER_CREATE_GROUP, msg, msg_len, NULL) != MSG_SUCCESS) {
+            snprintf(msg, sizeof(msg), "Group %d created, but its storage node %s:%d did not accept it",
+                     group_id, nodes[n].host, nodes[n].port);
+            send_client(rc, stream_id, MSG_ERROR, msg);
+            return;
+        }
+        memcpy(rc->reply, meta_reply, reply_len + 1);
+    }
+    send_packet_stream(rc->client, stream_id, reply_type, rc->reply, reply_len);
+}
+
+// The owning node checks ownership and deletes the files and memberships;
+// then the metadata node drops the group from the list
+static void handle_delete_group(RelayConn *rc, int stream_id, const char *payload, int len) {
+    int n = ring_lookup(atoi(payload));
+    int reply_len;
+    if (node_fd(rc, n) < 0) {
+        send_client(rc, stream_id, MSG_ERROR, "Storage node for this group is unavailable");
+        return;
+    }
+    int reply_type = call_node(rc, n, MSG_DELETE_GROUP, payload, len, &reply_len);
+    if (reply_type < 0) {
+        send_client(rc, stream_id, MSG_ERROR, "Storage node for this group is unavailable");
+        return;
+    }
+    if (reply_type == MSG_SUCCESS && n != ROUTER_META) {
+        char node_reply[BUFFER_SIZE + 1];
+        memcpy(node_reply, rc->reply, reply_len + 1);
+        call_node(rc, ROUTER_META, MSG_DELETE_GROUP, payload, len, NULL);
+        memcpy(rc->reply, node_reply, reply_len + 1);
+    }
+    send_packet_stream(rc->client, stream_id, reply_type, rc->reply, reply_len);
+}
+
+// Splits a folder batch by node and adds the per-node counts up
+static void handle_create_folders(RelayConn *rc, int stream_id, const char *payload, int len) {
+    char (*parts)[BUFFER_SIZE + 1] = malloc(sizeof(*parts) * ROUTER_MAX_NODES);
+    int part_len[ROUTER_MAX_NODES] = {0};
+    if (!parts) {
+        send_client(rc, stream_id, MSG_ERROR, "Router out of memory");
+        return;
+    }
+    int used = 0, last = ROUTER_META;
+
+    for (const char *line = payload; line < payload + len;) {
+        const char *end = memchr(line, '\n', payload + len - line);
+        int line_len = end ? (int)(end - line) : (int)(payload + len - line);
+        char path[BUFFER_SIZE + 1];
+        snprintf(path, sizeof(path), "%.*s", line_len, line);
+        int n = node_of_path(path);
+        if (part_len[n] == 0) used++;
+        part_len[n] += snprintf(parts[n] + part_len[n], sizeof(parts[n]) - part_len[n], "%s\n", path);
+        last = n;
+        line += line_len + 1;
+    }
+    if (used <= 1) {
+        forward(rc, last, stream_id, MSG_CREATE_FOLDERS, payload, len);
+        free(parts);
+        return;
+    }
+
+    int created = 0, existed = 0, failed = 0;
+    for (int n = 0; n < node_count; n++) {
+        if (part_len[n] == 0) continue;
+        int c = 0, e = 0, f = 0;
+        if (node_fd(rc, n) >= 0 && call_node(rc, n, MSG_CREATE_FOLDERS, parts[n], part_len[n], NULL) >= 0 &&
+            sscanf(rc->reply, "Folders: %d created, %d existed, %d failed.", &c, &e, &f) == 3) {
+            created += c;
+            existed += e;
+            failed += f;
+        } else {
+            for (const char *p = parts[n]; (p = strchr(p, '\n')) != NULL; p++) failed++;
+        }
+    }
+    free(parts);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Folders: %d created, %d existed, %d failed.", created, existed, failed);
+    send_client(rc, stream_id, failed ? MSG_ERROR : MSG_SUCCESS, msg);
+}
+
+// Each node indexes the groups it stores (the metadata node also the
+// personal folders), so a search asks them in turn and pages over the
+// concatenation: a node's "of <total>" tells how much of the offset it used.
+// Group folders the metadata node keeps as placeholders are left out.
+static void handle_search(RelayConn *rc, int stream_id, const char *payload, int len) {
+    char pattern[256];
+    int limit = SEARCH_DEFAULT_LIMIT;
+    long offset = 0;
+    if (sscanf(payload, "%255s %d %ld", pattern, &limit, &offset) < 1 || limit <= 0 || offset < 0) {
+        forward(rc, ROUTER_META, stream_id, MSG_SEARCH, payload, len); // The node explains the usage
+        return;
+    }
+    if (limit > SEARCH_MAX_LIMIT) limit = SEARCH_MAX_LIMIT;
+
+    int emitted = 0, hidden = 0, more = 0;
+    long skip = offset;
+    for (int n = 0; n < node_count && !more; n++) {
+        if (node_fd(rc, n) < 0) continue;
+        // With the page full, only ask whether anything is left
+        int want = emitted < limit ? limit - emitted : 1;
+        char msg[300];
+        int msg_len = snprintf(msg, sizeof(msg), "%s %d %ld", pattern, want, skip);
+        int reply_len, reply_type = call_node(rc, n, MSG_SEARCH, msg, msg_len, &reply_len);
+
+        int count = 0, shown = 0;
+        for (; reply_type == MSG_SEARCH; reply_type = await_call(rc, n, &reply_len)) {
+            char page[BUFFER_SIZE];
+            int page_len = 0;
+            for (char *line = rc->reply, *end; (end = memchr(line, '\n', rc->reply + reply_len - line)) != NULL;
+                 line = end + 1) {
+                count++;
+                *end = '\0';
+                if (node_of_path(line) != n) continue;
+                shown++;
+                page_len += snprintf(page + page_len, sizeof(page) - page_len, "%s\n", line);
+            }
+            if (emitted < limit && page_len > 0) send_packet_stream(rc->client, stream_id, MSG_SEARCH, page, page_len);
+        }
+        if (reply_type != MSG_SUCCESS) continue;
+
+        long total = 0;
+        if (emitted == limit) {
+            more = shown > 0;
+        } else if (strstr(rc->reply, "more after")) {
+            more = 1;
+        } else if (count == 0 && sscanf(rc->reply, "%*d results of %ld", &total) == 1) {
+            skip -= total; // All of this node's matches came before the offset
+        } else {
+            skip = 0;
+        }
+        if (emitted < limit) {
+            emitted += count;
+            hidden += count - shown;
+        }
+    }
+
+    char msg[96];
+    if (more) snprintf(msg, sizeof(msg), "%d results, more after offset %ld", emitted - hidden, offset + emitted);
+    else snprintf(msg, sizeof(msg), "%d results of %ld", emitted - hidden, offset - skip + emitted - hidden);
+    send_client(rc, stream_id, MSG_SUCCESS, msg);
+}
+
+// --- CLIENT REQUESTS ---
+
+static void handle_client_packet(RelayConn *rc, int stream_id, int type, char *payload, int len) {
+    char first[BUFFER_SIZE + 1] = "", second[BUFFER_SIZE + 1] = "";
+    sscanf(payload, "%4096s %4096s", first, second);
+
+    switch (type) {
+    // Transfer frames go where the transfer was opened
+    case MSG_FILE_DATA:
+    case MSG_FILE_END:
+    case MSG_FILE_ERROR:
+    case MSG_TRANSFER_PAUSE:
+    case MSG_TRANSFER_RESUME:
+    case MSG_RESUME_TRANSFER: {
+        Route *r = route_find(rc, stream_id);
+        forward(rc, r ? r->node : ROUTER_META, stream_id, type, payload, len);
+        if (r && type == MSG_FILE_END) r->ending = 1;
+        if (r && type == MSG_FILE_ERROR) r->stream_id = 0; // Cancelled
+        break;
+    }
+
+    case MSG_LOGIN:
+    case MSG_LOGOUT:
+    case MSG_DELETE_ACCOUNT:
+    case MSG_RESUME_SESSION:
+        handle_session_change(rc, stream_id, type, payload, len);
+        break;
+
+    case MSG_CREATE_GROUP:
+        handle_create_group(rc, stream_id, payload, len);
+        break;
+    case MSG_DELETE_GROUP:
+        handle_delete_group(rc, stream_id, payload, len);
+        break;
+    case MSG_JOIN_GROUP:
+    case MSG_LEAVE_GROUP:
+    case MSG_LIST_MEMBERS:
+    case MSG_KICK_MEMBER:
+    case MSG_INVITE_MEMBER:
+    case MSG_APPROVE_MEMBER:
+        forward(rc, ring_lookup(atoi(payload)), stream_id, type, payload, len);
+        break;
+
+    case MSG_CREATE_FOLDERS:
+        handle_create_folders(rc, stream_id, payload, len);
+        break;
+
+    case MSG_RENAME_ITEM:
+    case MSG_MOVE_ITEM:
+    case MSG_COPY_ITEM: {
+        int n = node_of_path(first);
+        if (second[0] && node_of_path(second) != n) {
+            send_client(rc, stream_id, MSG_ERROR,
+                        "Source and destination are on different storage nodes: download and upload instead");
+            break;
+        }
+        forward(rc, n, stream_id, type, payload, len);
+        break;
+    }
+
+    case MSG_UPLOAD_REQ:
+    case MSG_DOWNLOAD_REQ:
+    case MSG_DOWNLOAD_VERSION:
+        route_set(rc, stream_id, node_of_path(first));
+        forward(rc, node_of_path(first), stream_id, type, payload, len);
+        break;
+
+    case MSG_LIST_FILES:
+    case MSG_LIST_TREE:
+    case MSG_DELETE_ITEM:
+    case MSG_CREATE_FOLDER:
+    case MSG_LIST_VERSIONS:
+    case MSG_RESTORE_VERSION:
+    case MSG_FOLDER_STATS:
+        forward(rc, node_of_path(first), stream_id, type, payload, len);
+        break;
+
+    case MSG_SEARCH:
+        handle_search(rc, stream_id, payload, len);
+        break;
+
+    // Accounts, the group list, statistics
+    default:
+        forward(rc, ROUTER_META, stream_id, type, payload, len);
+        break;
+    }
+}
+
+void *relay_client_thread(void *arg) {
+    RelayConn *rc = calloc(1, sizeof(RelayConn));
+    int client = *(int *)arg;
+    free(arg);
+    if (!rc) {
+        close(client);
+        return NULL;
+    }
+    rc->client = client;
+    for (int n = 0; n < ROUTER_MAX_NODES; n++) rc->fds[n] = -1;
+
+    if (node_fd(rc, ROUTER_META) < 0) {
+        send_client(rc, 0, MSG_ERROR, "Metadata node unavailable");
+        close(client);
+        free(rc);
+        return NULL;
+    }
+
+    char buffer[BUFFER_SIZE + 1];
+    while (rc->fds[ROUTER_META] >= 0) {
+        struct pollfd pfd[ROUTER_MAX_NODES + 1];
+        int owner[ROUTER_MAX_NODES + 1];
+        int count = 0;
+        pfd[count++] = (struct pollfd){client, POLLIN, 0};
+        for (int n = 0; n < node_count; n++) {
+            if (rc->fds[n] < 0) continue;
+            owner[count] = n;
+            pfd[count++] = (struct pollfd){rc->fds[n], POLLIN, 0};
+        }
+        if (poll(pfd, count, -1) < 0) continue;
+
+        // Node replies first: they free the node's send buffer
+        for (int i = 1; i < count; i++) {
+            int n = owner[i];
+            if (!pfd[i].revents || rc->fds[n] != pfd[i].fd) continue;
+            int stream_id, type;
+            int len = recv_packet_stream(rc->fds[n], &stream_id, &type, buffer);
+            if (len < 0) {
+                drop_node(rc, n);
+                continue;
+            }
+            route_note_reply(rc, stream_id, type);
+            if (send_packet_stream(client, stream_id, type, buffer, len) < 0) goto done;
+        }
+        if (pfd[0].revents) {
+            int stream_id, type;
+            int len = recv_packet_stream(client, &stream_id, &type, buffer);
+            if (len < 0) break;
+            handle_client_packet(rc, stream_id, type, buffer, len);
+        }
+    }
+
+done:
+    memset(rc->routes, 0, sizeof(rc->routes)); // Nobody left to tell
+    for (int n = 0; n < node_count; n++) drop_node(rc, n);
+    close(client);
+    free(rc);
+    return NULL;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "router.h"
+
+typedef struct {
+    unsigned int hash;
+    int node;
+} RingPoint;
+
+static RingPoint *ring = NULL;
+static int ring_size = 0;
+
+// FNV-1a, with a final mix so that nearby keys ("Group_1", "Group_2")
+// land far apart on the ring
+static unsigned int ring_hash(const char *key) {
+    unsigned int h = 2166136261u;
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static int cmp_point(const void *a, const void *b) {
+    const RingPoint *x = a, *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->node - y->node;
+}
+
+int router_parse_node(const char *spec, RouterNode *out) {
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= sizeof(out->host)) return -1;
+    int port = atoi(colon + 1);
+    if (port <= 0 || port > 65535) return -1;
+    snprintf(out->host, sizeof(out->host), "%.*s", (int)(colon - spec), spec);
+    out->port = port;
+    return 0;
+}
+
+int ring_build(const RouterNode *nodes, int count) {
+    free(ring);
+    ring_size = 0;
+    ring = malloc(sizeof(RingPoint) * ROUTER_VNODES * (count > 1 ? count - 1 : 1));
+    if (!ring) return -1;
+
+    // Points hash the node's address, not its position: reordering or
+    // adding backends only moves the groups adjacent to the changed points
+    for (int n = 1; n < count; n++) {
+        for (int v = 0; v < ROUTER_VNODES; v++) {
+            char key[100];
+            snprintf(key, sizeof(key), "%s:%d#%d", nodes[n].host, nodes[n].port, v);
+            ring[ring_size].hash = ring_hash(key);
+            ring[ring_size].node = n;
+            ring_size++;
+        }
+    }
+    qsort(ring, ring_size, sizeof(RingPoint), cmp_point);
+    return 0;
+}
+
+int ring_lookup(int group_id) {
+    if (ring_size == 0) return ROUTER_META;
+
+    char key[32];
+    snprintf(key, sizeof(key), "Group_%d", group_id);
+    unsigned int h = ring_hash(key);
+
+    // First point at or after the key, wrapping around
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return ring[lo == ring_size ? 0 : lo].node;
+}
+
+int router_path_group(const char *path) {
+    while (*path == '/' || (path[0] == '.' && path[1] == '/')) path += *path == '/' ? 1 : 2;
+
+    int group_id;
+    char end;
+    if (strncmp(path, "Group_", 6) != 0) return -1;
+    int fields = sscanf(path + 6, "%d%c", &group_id, &end);
+    if (fields < 1 || group_id <= 0) return -1;
+    if (fields == 2 && end != '/') return -1; // "Group_3x" is an ordinary folder
+    return group_id;
+}
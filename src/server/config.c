@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "config.h"
+#include "listener.h"
+#include "file_cache.h"
+#include "versions.h"
+#include "resume.h"
+#include "trace.h"
+#include "ratelimit.h"
+#include "conn_timeout.h"
+#include "upgrade.h"
+#include "replication.h"
+#include "search_index.h"
+#include "quota.h"
+
+void log_activity(const char *msg);
+
+typedef struct {
+    const char *name;
+    const char *env;     // Environment override, NULL if none
+    int reloadable;
+    long def, min, max;
+} ConfigDef;
+
+static const ConfigDef defs[CFG_COUNT] = {
+    [CFG_PORT]                 = {"port", NULL, 0, SERVER_PORT, 1, 65535},
+    [CFG_ACCEPT_THREADS]       = {"accept_threads", "FS_ACCEPT_THREADS", 0, 0, 0, LISTENER_MAX_ACCEPTORS},
+    [CFG_LISTEN_BACKLOG]       = {"listen_backlog", "FS_LISTEN_BACKLOG", 0, LISTENER_DEFAULT_BACKLOG, 1, 1 << 20},
+    [CFG_MAX_CLIENTS]          = {"max_clients", NULL, 1, MAX_CLIENTS, 1, 1L << 16},
+    [CFG_FRAME_SIZE]           = {"frame_size", NULL, 1, BUFFER_SIZE, 512, BUFFER_SIZE},
+    [CFG_SOCKET_SNDBUF]        = {"socket_sndbuf", NULL, 1, 0, 0, 64L << 20},
+    [CFG_SOCKET_RCVBUF]        = {"socket_rcvbuf", NULL, 1, 0, 0, 64L << 20},
+    [CFG_TCP_NODELAY]          = {"tcp_nodelay", NULL, 1, 1, 0, 1},
+    [CFG_TCP_CORK]             = {"tcp_cork", NULL, 1, 0, 0, 1},
+    [CFG_FILE_CACHE_BYTES]     = {"file_cache_bytes", "FS_FILE_CACHE_BYTES", 1, FILE_CACHE_DEFAULT_BYTES, 0, 1L << 40},
+    [CFG_FILE_CACHE_MAX_FILE]  = {"file_cache_max_file", "FS_FILE_CACHE_MAX_FILE", 1, FILE_CACHE_DEFAULT_MAX_FILE, 0, FILE_CACHE_MAX_FILE_LIMIT},
+    [CFG_VERSION_KEEP]         = {"version_keep", "FS_VERSION_KEEP", 1, VERSION_DEFAULT_KEEP, 0, 1L << 20},
+    [CFG_VERSION_MAX_AGE_DAYS] = {"version_max_age_days", "FS_VERSION_MAX_AGE_DAYS", 1, VERSION_DEFAULT_MAX_AGE_DAYS, 0, 1L << 20},
+    [CFG_RESUME_TTL]           = {"resume_ttl", "FS_RESUME_TTL", 1, RESUME_DEFAULT_TTL, 1, 1L << 24},
+    [CFG_TRACE_SAMPLE]         = {"trace_sample", "FS_TRACE_SAMPLE", 1, TRACE_DEFAULT_SAMPLE, 0, 1L << 30},
+    [CFG_IDLE_TIMEOUT]         = {"idle_timeout", NULL, 1, CONN_DEFAULT_IDLE_TIMEOUT, 0, 1L << 24},
+    [CFG_STALL_TIMEOUT]        = {"stall_timeout", NULL, 1, CONN_DEFAULT_STALL_TIMEOUT, 0, 1L << 24},
+    [CFG_TRANSFER_TIMEOUT]     = {"transfer_timeout", NULL, 1, CONN_DEFAULT_TRANSFER_TIMEOUT, 0, 1L << 24},
+    [CFG_DRAIN_TIMEOUT]        = {"drain_timeout", NULL, 1, UPGRADE_DEFAULT_DRAIN_TIMEOUT, 0, 1L << 24},
+    [CFG_REPL_PORT]            = {"repl_port", "FS_REPL_PORT", 0, 0, 0, 65535},
+    [CFG_REPL_LOG_KEEP_MB]     = {"repl_log_keep_mb", NULL, 1, REPL_DEFAULT_LOG_KEEP_MB, 1, 1L << 24},
+    [CFG_RECONCILE_INTERVAL]   = {"reconcile_interval", NULL, 1, SEARCH_DEFAULT_RECONCILE_INTERVAL, 0, 1L << 24},
+};
+
+// String keys: restart only
+static const struct {
+    const char *name;
+    const char *env;
+} str_defs[CFG_STR_COUNT] = {
+    [CFG_STORAGE_DIRS]   = {"storage_dirs", "FS_STORAGE_DIRS"},
+    [CFG_REPLICATE_FROM] = {"replicate_from", "FS_REPLICATE_FROM"},
+    [CFG_REPL_SECRET]    = {"repl_secret", "FS_REPL_SECRET"},
+    [CFG_CLUSTER_SECRET] = {"cluster_secret", "FS_CLUSTER_SECRET"},
+};
+
+static long values[CFG_COUNT];
+static char strings[CFG_STR_COUNT][CONFIG_STRING_MAX];
+static char conf_path[512];
+static int conf_found = 0;
+static int reload_count = 0;
+static sigset_t hup_set;
+static void (*reload_hook)(void);
+
+static int parse_long(const char *s, long *out) {
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (end == s || (*end && *end != '\n' && *end != ' ' && *end != '\t' && *end != '\r')) return -1;
+    *out = v;
+    return 0;
+}
+
+// Reads the file into `next` (starting from defaults) and the string keys
+// into `strs`. Returns 0 if the file was read, -1 if it does not exist.
+static int load_file(long *next, char strs[][CONFIG_STRING_MAX]) {
+    for (int i = 0; i < CFG_COUNT; i++) next[i] = defs[i].def;
+    for (int i = 0; i < CFG_STR_COUNT; i++) strs[i][0] = '\0';
+
+    FILE *f = fopen(conf_path, "r");
+    if (!f) return -1;
+
+    char line[CONFIG_STRING_MAX + 128], key[64], value[CONFIG_STRING_MAX], log_msg[CONFIG_STRING_MAX + 256];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        int fields = sscanf(line, "%63s %2047s", key, value);
+        if (line[0] == '#' || fields < 1) continue;
+
+        int k = 0;
+        while (k < CFG_STR_COUNT && strcmp(str_defs[k].name, key) != 0) k++;
+        if (k < CFG_STR_COUNT) {
+            snprintf(strs[k], CONFIG_STRING_MAX, "%s", fields == 2 ? value : "");
+            continue;
+        }
+
+        k = 0;
+        while (k < CFG_COUNT && strcmp(defs[k].name, key) != 0) k++;
+        long v;
+        if (k == CFG_COUNT) {
+            snprintf(log_msg, sizeof(log_msg), "Config %s:%d: unknown key '%s' ignored", conf_path, line_no, key);
+            log_activity(log_msg);
+        } else if (fields != 2 || parse_long(value, &v) != 0 ||
+                   v < defs[k].min || v > defs[k].max) {
+            snprintf(log_msg, sizeof(log_msg), "Config %s:%d: %s must be %ld..%ld, keeping %ld",
+                     conf_path, line_no, key, defs[k].min, defs[k].max, next[k]);
+            log_activity(log_msg);
+        } else {
+            next[k] = v;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// Environment variables win over the file (kept for existing setups)
+static void apply_env(long *next, char strs[][CONFIG_STRING_MAX]) {
+    for (int i = 0; i < CFG_COUNT; i++) {
+        const char *env = defs[i].env ? getenv(defs[i].env) : NULL;
+        long v;
+        if (env && parse_long(env, &v) == 0 && v >= defs[i].min && v <= defs[i].max) next[i] = v;
+    }
+    for (int i = 0; i < CFG_STR_COUNT; i++) {
+        const char *env = getenv(str_defs[i].env);
+        if (env && *env) snprintf(strs[i], CONFIG_STRING_MAX, "%s", env);
+    }
+}
+
+void config_init() {
+    const char *env = getenv("FS_CONFIG");
+    snprintf(conf_path, sizeof(conf_path), "%s", env && *env ? env : SERVER_CONF);
+
+    conf_found = load_file(values, strings) == 0;
+    apply_env(values, strings);
+
+    // Block SIGHUP in every thread (inherited by threads created later)
+    sigemptyset(&hup_set);
+    sigaddset(&hup_set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup_set, NULL);
+}
+
+long config_get(ConfigKey key) {
+    return __atomic_load_n(&values[key], __ATOMIC_RELAXED);
+}
+
+const char *config_string(ConfigString key) {
+    return strings[key][0] ? strings[key] : NULL;
+}
+
+static void config_reload() {
+    long next[CFG_COUNT];
+    char strs[CFG_STR_COUNT][CONFIG_STRING_MAX];
+    char log_msg[700];
+
+    int found = load_file(next, strs) == 0;
+    apply_env(next, strs);
+
+    int changed = 0;
+    for (int i = 0; i < CFG_COUNT; i++) {
+        if (next[i] == values[i]) continue;
+        if (!defs[i].reloadable) {
+            snprintf(log_msg, sizeof(log_msg), "Config: %s changed to %ld, restart to apply (keeping %ld)",
+                     defs[i].name, next[i], values[i]);
+        } else {
+            snprintf(log_msg, sizeof(log_msg), "Config: %s %ld -> %ld", defs[i].name, values[i], next[i]);
+            __atomic_store_n(&values[i], next[i], __ATOMIC_RELAXED);
+            changed++;
+        }
+        log_activity(log_msg);
+    }
+    for (int i = 0; i < CFG_STR_COUNT; i++) {
+        if (strcmp(strs[i], strings[i]) == 0) continue;
+        snprintf(log_msg, sizeof(log_msg), "Config: %s changed, restart to apply", str_defs[i].name);
+        log_activity(log_msg);
+    }
+
+    conf_found = found;
+    reload_count++;
+    snprintf(log_msg, sizeof(log_msg), "Configuration reloaded from %s%s (%d values changed).",
+             conf_path, found ? "" : " (missing, defaults)", changed);
+    log_activity(log_msg);
+}
+
+// Waits for SIGHUP (kill -HUP <pid>)
+static void *reloader_thread(void *arg) {
+    (void)arg;
+    int sig;
+    while (sigwait(&hup_set, &sig) == 0) {
+        config_reload();
+        rl_load_config(RATELIMIT_CONF);
+        quota_load(QUOTA_CONF);
+        if (reload_hook) reload_hook();
+    }
+    return NULL;
+}
+
+void config_start_reloader(void (*on_reload)(void)) {
+    reload_hook = on_reload;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, reloader_thread, NULL) != 0) {
+        perror("Config reloader thread creation failed");
+        return;
+    }
+    pthread_detach(tid);
+}
+
+int config_format_stats(char *buf, size_t size) {
+    int n = snprintf(buf, size, "CONFIG %s%s reloads=%d max_clients=%ld frame_size=%ld nodelay=%ld cork=%ld\n",
+                     conf_path, conf_found ? "" : " (missing, defaults)", reload_count,
+                     config_get(CFG_MAX_CLIENTS), config_get(CFG_FRAME_SIZE),
+                     config_get(CFG_TCP_NODELAY), config_get(CFG_TCP_CORK));
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
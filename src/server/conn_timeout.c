@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "conn_timeout.h"
+#include "config.h"
+
+// A connection with no limit running is looked at again this often, so
+// that a limit enabled by a reload reaches it
+#define CONN_RECHECK_MS 60000
+
+static unsigned long long stat_expired[4];
+
+static long long deadline_of(long long base, ConfigKey key, int reason, long long best, int *best_reason) {
+    long long limit_ms = config_get(key) * 1000;
+    if (base <= 0 || limit_ms <= 0) return best;
+    long long deadline = base + limit_ms;
+    if (best == 0 || deadline < best) {
+        *best_reason = reason;
+        return deadline;
+    }
+    return best;
+}
+
+// Earliest deadline among the running limits, 0 if none applies
+static long long next_deadline(ConnTimer *t, int *reason) {
+    long long d = 0;
+    *reason = CONN_TIMEOUT_NONE;
+    d = deadline_of(__atomic_load_n(&t->idle_base, __ATOMIC_RELAXED), CFG_IDLE_TIMEOUT, CONN_TIMEOUT_IDLE, d, reason);
+    d = deadline_of(__atomic_load_n(&t->stall_base, __ATOMIC_RELAXED), CFG_STALL_TIMEOUT, CONN_TIMEOUT_STALL, d, reason);
+    d = deadline_of(__atomic_load_n(&t->transfer_base, __ATOMIC_RELAXED), CFG_TRANSFER_TIMEOUT, CONN_TIMEOUT_TRANSFER, d, reason);
+    return d;
+}
+
+// Wheel thread, wheel lock held
+static long long watchdog_fire(TimerEntry *entry, long long now_ms) {
+    ConnTimer *t = (ConnTimer *)((char *)entry - offsetof(ConnTimer, entry));
+    int reason;
+    long long deadline = next_deadline(t, &reason);
+
+    if (deadline == 0 || deadline > now_ms) {
+        long long next = deadline == 0 || deadline > now_ms + CONN_RECHECK_MS ? now_ms + CONN_RECHECK_MS : deadline;
+        __atomic_store_n(&t->scheduled_ms, next, __ATOMIC_RELAXED);
+        return next;
+    }
+
+    __atomic_store_n(&t->expired, reason, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stat_expired[reason], 1, __ATOMIC_RELAXED);
+    // The descriptor is still this connection's: conn_timeout_stop() runs
+    // under the wheel lock before close()
+    shutdown(t->sockfd, SHUT_RDWR);
+    return 0;
+}
+
+void conn_timeout_start(ConnTimer *t, int sockfd) {
+    long long now = timer_now_ms();
+    t->entry.armed = 0;
+    t->entry.fire = watchdog_fire;
+    t->sockfd = sockfd;
+    t->idle_base = now;
+    t->stall_base = 0;
+    t->transfer_base = 0;
+    t->expired = CONN_TIMEOUT_NONE;
+
+    int reason;
+    long long deadline = next_deadline(t, &reason);
+    t->scheduled_ms = deadline == 0 || deadline > now + CONN_RECHECK_MS ? now + CONN_RECHECK_MS : deadline;
+    timer_arm(&t->entry, t->scheduled_ms);
+}
+
+void conn_timeout_update(ConnTimer *t, long long idle_base, long long stall_base, long long transfer_base) {
+    __atomic_store_n(&t->idle_base, idle_base, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->stall_base, stall_base, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->transfer_base, transfer_base, __ATOMIC_RELAXED);
+
+    // A later deadline is picked up lazily when the entry fires; only an
+    // earlier one (a transfer just started) needs the lock
+    int reason;
+    long long deadline = next_deadline(t, &reason);
+    if (deadline != 0 && deadline < __atomic_load_n(&t->scheduled_ms, __ATOMIC_RELAXED) &&
+        !__atomic_load_n(&t->expired, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&t->scheduled_ms, deadline, __ATOMIC_RELAXED);
+        timer_arm(&t->entry, deadline);
+    }
+}
+
+void conn_timeout_stop(ConnTimer *t) {
+    timer_cancel(&t->entry);
+}
+
+const char *conn_timeout_reason(int reason) {
+    switch (reason) {
+    case CONN_TIMEOUT_IDLE: return "idle";
+    case CONN_TIMEOUT_STALL: return "stalled transfer";
+    case CONN_TIMEOUT_TRANSFER: return "transfer time limit";
+    default: return "none";
+    }
+}
+
+int conn_timeout_format_stats(char *buf, size_t size) {
+    int n = snprintf(buf, size, "TIMEOUTS idle=%lds stall=%lds transfer=%lds expired(idle/stall/transfer)=%llu/%llu/%llu timers=%d\n",
+                     config_get(CFG_IDLE_TIMEOUT), config_get(CFG_STALL_TIMEOUT), config_get(CFG_TRANSFER_TIMEOUT),
+                     __atomic_load_n(&stat_expired[CONN_TIMEOUT_IDLE], __ATOMIC_RELAXED),
+                     __atomic_load_n(&stat_expired[CONN_TIMEOUT_STALL], __ATOMIC_RELAXED),
+                     __atomic_load_n(&stat_expired[CONN_TIMEOUT_TRANSFER], __ATOMIC_RELAXED),
+                     timer_armed_count());
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
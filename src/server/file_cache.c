@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "file_cache.h"
+#include "config.h"
+
+// Segmented LRU: new entries start in the probation segment; a second hit
+// promotes them to the protected segment. Eviction takes the probation LRU
+// first, so one-off downloads cannot flush the files that are hit repeatedly.
+
+#define FILE_CACHE_BUCKETS 4096
+
+typedef struct {
+    FileCacheEntry *head; // MRU
+    FileCacheEntry *tail; // LRU
+    long bytes;
+} Segment;
+
+// Folders with cached files below them, and how many: invalidating a plain
+// file is a hash lookup, only a folder with cached files scans the segments
+typedef struct FolderCount {
+    char path[512];
+    int files;
+    struct FolderCount *hnext;
+} FolderCount;
+
+static FileCacheEntry *buckets[FILE_CACHE_BUCKETS];
+static FolderCount *folders[FILE_CACHE_BUCKETS];
+static int folders_incomplete = 0; // A count could not be allocated: always scan
+static Segment probation, protected_seg;
+static long capacity = FILE_CACHE_DEFAULT_BYTES;
+static long max_file = FILE_CACHE_DEFAULT_MAX_FILE;
+static int entry_count = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long stat_hits, stat_misses, stat_evictions, stat_invalidations;
+
+static unsigned int hash_prefix(const char *s, size_t len) {
+    unsigned int h = 5381;
+    for (size_t i = 0; i < len && s[i]; i++) h = h * 33 + (unsigned char)s[i];
+    return h % FILE_CACHE_BUCKETS;
+}
+
+static unsigned int hash_path(const char *s) {
+    return hash_prefix(s, (size_t)-1);
+}
+
+static void enforce_limits();
+
+void file_cache_init() {
+    pthread_mutex_lock(&cache_lock);
+    capacity = config_get(CFG_FILE_CACHE_BYTES);
+    long limit = config_get(CFG_FILE_CACHE_MAX_FILE);
+    __atomic_store_n(&max_file, capacity == 0 ? -1 : limit, __ATOMIC_RELAXED); // -1 = disabled
+    enforce_limits(); // A smaller budget evicts at once
+    pthread_mutex_unlock(&cache_lock);
+}
+
+long file_cache_max_file() {
+    return __atomic_load_n(&max_file, __ATOMIC_RELAXED);
+}
+
+// --- LIST / HASH HELPERS (cache_lock held) ---
+
+static Segment *segment_of(FileCacheEntry *e) {
+    return e->protected_seg ? &protected_seg : &probation;
+}
+
+static void list_unlink(FileCacheEntry *e) {
+    Segment *seg = segment_of(e);
+    if (e->prev) e->prev->next = e->next; else seg->head = e->next;
+    if (e->next) e->next->prev = e->prev; else seg->tail = e->prev;
+    e->prev = e->next = NULL;
+    seg->bytes -= e->size;
+}
+
+static void list_push_front(FileCacheEntry *e, int protected_flag) {
+    e->protected_seg = protected_flag;
+    Segment *seg = segment_of(e);
+    e->prev = NULL;
+    e->next = seg->head;
+    if (seg->head) seg->head->prev = e; else seg->tail = e;
+    seg->head = e;
+    seg->bytes += e->size;
+}
+
+static FolderCount **folder_slot(const char *path, size_t len) {
+    FolderCount **pp = &folders[hash_prefix(path, len)];
+    while (*pp && (strncmp((*pp)->path, path, len) != 0 || (*pp)->path[len] != '\0')) pp = &(*pp)->hnext;
+    return pp;
+}
+
+// Counts a file in (delta 1) or out of (delta -1) every folder above it
+static void count_folders(const char *path, int delta) {
+    for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t len = slash - path;
+        FolderCount **pp = folder_slot(path, len);
+        if (delta < 0) {
+            if (*pp && --(*pp)->files == 0) {
+                FolderCount *f = *pp;
+                *pp = f->hnext;
+                free(f);
+            }
+        } else if (*pp) {
+            (*pp)->files++;
+        } else {
+            FolderCount *f = calloc(1, sizeof(FolderCount));
+            if (!f) {
+                folders_incomplete = 1;
+                continue;
+            }
+            memcpy(f->path, path, len);
+            f->files = 1;
+            *pp = f;
+        }
+    }
+}
+
+static void entry_free(FileCacheEntry *e) {
+    free(e->data);
+    free(e);
+}
+
+// Unlinks from the hash and its segment; freed now or by the last reader
+static void entry_remove(FileCacheEntry *e) {
+    FileCacheEntry **pp = &buckets[hash_path(e->path)];
+    while (*pp && *pp != e) pp = &(*pp)->hnext;
+    if (*pp) *pp = e->hnext;
+
+    list_unlink(e);
+    count_folders(e->path, -1);
+    if (--entry_count == 0) folders_incomplete = 0; // Every count is gone
+    e->dead = 1;
+    if (e->refs == 0) entry_free(e);
+}
+
+static FileCacheEntry *find_entry(const char *path) {
+    for (FileCacheEntry *e = buckets[hash_path(path)]; e; e = e->hnext) {
+        if (strcmp(e->path, path) == 0) return e;
+    }
+    return NULL;
+}
+
+static void enforce_limits() {
+    // Protected overflow is demoted, not dropped: it gets one more chance
+    long protected_cap = capacity / 100 * FILE_CACHE_PROTECTED_PCT;
+    while (protected_seg.bytes > protected_cap && protected_seg.tail) {
+        FileCacheEntry *e = protected_seg.tail;
+        list_unlink(e);
+        list_push_front(e, 0);
+    }
+    while (probation.bytes + protected_seg.bytes > capacity) {
+        FileCacheEntry *victim = probation.tail ? probation.tail : protected_seg.tail;
+        if (!victim) break;
+        entry_remove(victim);
+        stat_evictions++;
+    }
+}
+
+// --- PUBLIC API ---
+
+FileCacheEntry *file_cache_acquire(const char *path, const char *etag) {
+    pthread_mutex_lock(&cache_lock);
+    FileCacheEntry *e = find_entry(path);
+    if (e && strcmp(e->etag, etag) != 0) {
+        // Changed on disk without going through a handler
+        entry_remove(e);
+        stat_invalidations++;
+        e = NULL;
+    }
+
+    if (e) {
+        list_unlink(e);
+        list_push_front(e, 1); // Probation hit -> protected; protected hit -> MRU
+        enforce_limits();
+        e->refs++;
+        stat_hits++;
+    } else {
+        stat_misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return e;
+}
+
+FileCacheEntry *file_cache_insert(const char *path, const char *etag, char *data, long size) {
+    FileCacheEntry *e = calloc(1, sizeof(FileCacheEntry));
+    if (e == NULL) {
+        free(data);
+        return NULL;
+    }
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    snprintf(e->etag, sizeof(e->etag), "%s", etag);
+    e->data = data;
+    e->size = size;
+    e->refs = 1;
+
+    pthread_mutex_lock(&cache_lock);
+    FileCacheEntry *old = find_entry(path);
+    if (old) entry_remove(old); // Another connection loaded it concurrently
+
+    if (size > capacity) {
+        e->dead = 1; // Caller still gets to serve it once
+    } else {
+        unsigned int h = hash_path(path);
+        e->hnext = buckets[h];
+        buckets[h] = e;
+        list_push_front(e, 0);
+        count_folders(e->path, 1);
+        entry_count++;
+        enforce_limits();
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return e;
+}
+
+void file_cache_release(FileCacheEntry *e) {
+    pthread_mutex_lock(&cache_lock);
+    e->refs--;
+    int free_now = e->dead && e->refs == 0;
+    pthread_mutex_unlock(&cache_lock);
+    if (free_now) entry_free(e);
+}
+
+void file_cache_invalidate(const char *path) {
+    char key[512];
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') len--;
+    if (len >= sizeof(key)) return; // Longer than any cached path
+    memcpy(key, path, len);
+    key[len] = '\0';
+
+    pthread_mutex_lock(&cache_lock);
+    FileCacheEntry *file = entry_count > 0 ? find_entry(key) : NULL;
+    if (file) {
+        entry_remove(file);
+        stat_invalidations++;
+    }
+    if (entry_count > 0 && (folders_incomplete || *folder_slot(key, len))) {
+        // Folder renames/deletes must also drop every file below them
+        Segment *segs[2] = {&probation, &protected_seg};
+        for (int s = 0; s < 2; s++) {
+            FileCacheEntry *e = segs[s]->head;
+            while (e) {
+                FileCacheEntry *next = e->next;
+                if (strncmp(e->path, key, len) == 0 && e->path[len] == '/') {
+                    entry_remove(e);
+                    stat_invalidations++;
+                }
+                e = next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int file_cache_format_stats(char *buf, size_t size) {
+    pthread_mutex_lock(&cache_lock);
+    int n = snprintf(buf, size,
+                     "FILE_CACHE entries=%d bytes=%ld/%ld (protected %ld) hits=%llu misses=%llu evictions=%llu invalidations=%llu\n",
+                     entry_count, probation.bytes + protected_seg.bytes, capacity, protected_seg.bytes,
+                     stat_hits, stat_misses, stat_evictions, stat_invalidations);
+    pthread_mutex_unlock(&cache_lock);
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
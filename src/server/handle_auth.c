@@ -3,6 +3,11 @@
 #include "common.h"
 #include "protocol.h"
 #include "network.h"
+#include "trace.h"
+#include "stream.h"
+#include "resume.h"
+#include "replication.h"
+#include "config.h"
 
 // Forward declarations (should be in headers)
 int db_check_login(const char *username, const char *password);
@@ -12,6 +17,64 @@ int db_delete_user(int user_id);
 Session *find_session(int sockfd);
 void log_activity(const char *msg);
 
+/**
+ * @brief 1 if `secret` matches `expected` (compared in constant time);
+ * always 0 when `expected` is NULL (no secret configured).
+ */
+int secret_matches(const char *expected, const char *secret) {
+    if (!expected) return 0;
+    size_t len = strlen(expected), given = strlen(secret);
+    unsigned char diff = len != given;
+    for (size_t i = 0; i < len; i++) diff |= (unsigned char)(expected[i] ^ (i < given ? secret[i] : 0));
+    return diff == 0;
+}
+
+/**
+ * @brief 1 if `secret` matches cluster_secret; always 0 when no secret is
+ * configured.
+ */
+int cluster_secret_ok(const char *secret) {
+    return secret_matches(config_string(CFG_CLUSTER_SECRET), secret);
+}
+
+/**
+ * @brief Logs a router connection in as the user it authenticated at the
+ * metadata node (payload: "<secret> <user_id> <username>"). No password is
+ * checked, and no resumption token is issued: the router owns the session.
+ */
+void handle_cluster_auth(int sockfd, char *payload) {
+    Session *sess = find_session(sockfd);
+    if (sess == NULL) {
+        send_packet(sockfd, MSG_ERROR, "Session Error", 13);
+        return;
+    }
+
+    char secret[CONFIG_STRING_MAX], user[50];
+    int user_id;
+    if (sscanf(payload, "%2047s %d %49s", secret, &user_id, user) < 3 || !cluster_secret_ok(secret)) {
+        char *msg = "Cluster authentication refused";
+        send_packet(sockfd, MSG_ERROR, msg, strlen(msg));
+        char log_msg[200];
+        snprintf(log_msg, sizeof(log_msg), "Refused cluster authentication from %s", sess->client_ip);
+        log_activity(log_msg);
+        return;
+    }
+
+    sess->user_id = user_id;
+    sess->is_logged_in = 1;
+    snprintf(sess->username, sizeof(sess->username), "%s", user);
+    sess->resume_token[0] = '\0';
+
+    char msg[100];
+    int len = snprintf(msg, sizeof(msg), "Cluster login as %s (ID: %d)", user, user_id);
+    send_packet(sockfd, MSG_SUCCESS, msg, len);
+
+    char log_msg[200];
+    snprintf(log_msg, sizeof(log_msg), "User '%s' (ID %d) logged in through the router at %s", user, user_id,
+             sess->client_ip);
+    log_activity(log_msg);
+}
+
 void handle_login(int sockfd, char *payload) {
     // Get user session
     Session *sess = find_session(sockfd);
@@ -44,7 +107,10 @@ void handle_login(int sockfd, char *payload) {
         return;
     }
 
+    TraceSpan db_span;
+    trace_span_begin(&db_span, TRACE_DB_READ);
     int user_id = db_check_login(user, pass);
+    trace_span_end(&db_span);
     
     if (user_id != -1) {
         // Update Session
@@ -52,10 +118,12 @@ void handle_login(int sockfd, char *payload) {
         sess->is_logged_in = 1;
         strcpy(sess->username, user);
 
-        // Send Success Response
-        char msg[100];
-        sprintf(msg, "Login successful. Welcome %s (ID: %d)", user, user_id);
-        send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
+        // Send Success Response (with a token to resume the session after a drop)
+        char msg[200];
+        int len = sprintf(msg, "Login successful. Welcome %s (ID: %d)", user, user_id);
+        if (resume_issue(sockfd, user_id, user, sess->resume_token) == 0)
+            len += sprintf(msg + len, "%s%s", RESUME_TOKEN_TAG, sess->resume_token);
+        send_packet(sockfd, MSG_SUCCESS, msg, len);
         
         // Log
         char log_msg[200];
@@ -70,6 +138,62 @@ void handle_login(int sockfd, char *payload) {
     }
 }
 
+/**
+ * @brief Restores a dropped session from its token: no password check, no
+ * users.txt lookup. Transfers kept with the token are attached to this
+ * connection and listed in the reply; each continues once the client sends
+ * MSG_RESUME_TRANSFER with the offset it has.
+ */
+void handle_resume_session(int sockfd, char *payload) {
+    Session *sess = find_session(sockfd);
+    if (sess == NULL) {
+        send_packet(sockfd, MSG_ERROR, "Session Error", 13);
+        return;
+    }
+    if (sess->is_logged_in) {
+        char *msg = "Resume failed: already logged in.";
+        send_packet(sockfd, MSG_ERROR, msg, strlen(msg));
+        return;
+    }
+
+    char token[RESUME_TOKEN_LEN + 1] = "";
+    sscanf(payload, "%32s", token);
+
+    Stream parked[MAX_STREAMS_PER_CONN];
+    int parked_count = 0, user_id;
+    char username[50];
+    if (resume_claim(token, sockfd, &user_id, username, parked, &parked_count) != 0) {
+        char *msg = "Resume failed: session expired. Please LOGIN again.";
+        send_packet(sockfd, MSG_ERROR, msg, strlen(msg));
+        log_activity("Failed session resume attempt.");
+        return;
+    }
+
+    sess->user_id = user_id;
+    sess->is_logged_in = 1;
+    snprintf(sess->username, sizeof(sess->username), "%s", username);
+    snprintf(sess->resume_token, sizeof(sess->resume_token), "%s", token);
+
+    char msg[BUFFER_SIZE];
+    int len = snprintf(msg, sizeof(msg), "Session resumed. Welcome back %s (ID: %d)", username, user_id);
+    int kept = 0;
+    for (int i = 0; i < parked_count; i++) {
+        if (stream_adopt(&parked[i]) != 0) {
+            stream_discard(&parked[i]);
+            continue;
+        }
+        len += snprintf(msg + len, sizeof(msg) - len, "\n%d %c %ld", parked[i].stream_id,
+                        parked[i].kind == STREAM_UPLOAD ? 'U' : 'D', parked[i].transferred);
+        kept++;
+    }
+    send_packet(sockfd, MSG_SUCCESS, msg, len);
+
+    char log_msg[200];
+    snprintf(log_msg, sizeof(log_msg), "User '%s' (ID %d) resumed session from %s (%d transfers kept)",
+             username, user_id, sess->client_ip, kept);
+    log_activity(log_msg);
+}
+
 void handle_register(int sockfd, char *payload) {
     Session *sess = find_session(sockfd);
     if (sess && sess->is_logged_in) {
@@ -90,6 +214,7 @@ void handle_register(int sockfd, char *payload) {
     int new_id = db_register_user(user, pass);
     
     if (new_id != -1) {
+        repl_log_meta(USER_DB_FILE);
         char msg[100];
         sprintf(msg, "Registration successful. Please login. ID: %d", new_id);
         send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
@@ -129,6 +254,8 @@ void handle_logout(int sockfd, char *payload) {
     sess->user_id = -1;
     sess->is_logged_in = 0;
     strcpy(sess->username, "Guest");
+    resume_revoke(sess->resume_token);
+    sess->resume_token[0] = '\0';
 
     // Send success message
     char msg[100];
@@ -162,10 +289,12 @@ void handle_change_password(int sockfd, char *payload) {
     
     if (check_id == sess->user_id) {
         if (db_change_password(sess->user_id, new_pass) == 0) {
+            repl_log_meta(USER_DB_FILE);
             char msg[100];
             sprintf(msg, "Password changed successfully for user '%s'.", sess->username);
             send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
-            
+            resume_revoke_user(sess->user_id, sess->resume_token); // Other devices must log in again
+
             log_activity("User changed password successfully.");
         } else {
             send_packet(sockfd, MSG_ERROR, "Database error updating password.", 31);
@@ -193,11 +322,14 @@ void handle_delete_account(int sockfd, char *payload) {
     if (check_id == sess->user_id) {
         // Perform deletion
         if (db_delete_user(sess->user_id) == 0) {
+            repl_log_meta(USER_DB_FILE);
             char log_msg[200];
             sprintf(log_msg, "User '%s' (ID %d) deleted their account.", sess->username, sess->user_id);
             log_activity(log_msg);
 
             // Force Logout
+            resume_revoke_user(sess->user_id, NULL);
+            sess->resume_token[0] = '\0';
             sess->user_id = -1;
             sess->is_logged_in = 0;
             strcpy(sess->username, "Guest");
@@ -9,10 +9,18 @@
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
-#include <sys/file.h>
 #include "db.h"
-
-#define FILE_STORAGE_PATH "./data/files/"
+#include "trace.h"
+#include "stream.h"
+#include "file_cache.h"
+#include "ratelimit.h"
+#include "path_lock.h"
+#include "versions.h"
+#include "storage.h"
+#include "replication.h"
+#include "search_index.h"
+#include "quota.h"
+#include "config.h"
 
 
 int remove_directory_recursive(const char *path);
@@ -31,19 +39,15 @@ void get_log_prefix(int sockfd, char *buffer) {
     }
 }
 
-int is_file_busy(const char *filepath) {
-    FILE *f = fopen(filepath, "r");
-    if (!f) return 0;
-
-    int fd = fileno(f);
-    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
-        fclose(f);
-        return 1;
-    }
-
-    flock(fd, LOCK_UN);
-    fclose(f);
-    return 0;
+/**
+ * @brief Extracts the group ID from a "Group_<id>/..." path.
+ * @return The group ID, or -1 if the path is not inside a group folder.
+ */
+int parse_group_id(const char *path) {
+    int group_id;
+    if (strncmp(path, "Group_", 6) == 0 && sscanf(path, "Group_%d", &group_id) == 1)
+        return group_id;
+    return -1;
 }
 
 void handle_list_files(int sockfd, char *subpath) {
@@ -59,6 +63,7 @@ void handle_list_files(int sockfd, char *subpath) {
     struct dirent *dir;
     char file_list[BUFFER_SIZE] = "";
     char full_path[512];
+    int is_root = (subpath == NULL || strlen(subpath) == 0);
     
 
     if (subpath != NULL && strstr(subpath, "..")) {
@@ -70,18 +75,30 @@ void handle_list_files(int sockfd, char *subpath) {
         return;
     }
 
-    if (subpath != NULL && strlen(subpath) > 0) {
-        sprintf(full_path, "%s%s", FILE_STORAGE_PATH, subpath);
-    } else {
-        sprintf(full_path, "%s", FILE_STORAGE_PATH);
-    }
+    // The root is the union of every shard's root; anything deeper lives on one shard
+    storage_path(is_root ? "" : subpath, full_path, sizeof(full_path));
+    int shard = 0;
 
     d = opendir(full_path);
     if (d) {
         sprintf(file_list, "--- Content of: /%s ---\n", (subpath ? subpath : "root"));
 
-        while ((dir = readdir(d)) != NULL) {
+        while (1) {
+            dir = readdir(d);
+            if (dir == NULL) {
+                if (!is_root || ++shard >= storage_shard_count()) break;
+                closedir(d);
+                snprintf(full_path, sizeof(full_path), "%s", storage_files_dir(shard));
+                d = opendir(full_path);
+                if (!d) break;
+                continue;
+            }
             if (strcmp(dir->d_name, ".") != 0 && strcmp(dir->d_name, "..") != 0) {
+                // Reply must fit in one packet: stop before overflowing it
+                if (strlen(file_list) + strlen(dir->d_name) + 88 > sizeof(file_list)) {
+                    strcat(file_list, "(listing truncated)\n");
+                    break;
+                }
                 strcat(file_list, dir->d_name);
                 
                 struct stat st;
@@ -89,12 +106,24 @@ void handle_list_files(int sockfd, char *subpath) {
                 sprintf(item_path, "%s/%s", full_path, dir->d_name);
                 if (stat(item_path, &st) == 0 && S_ISDIR(st.st_mode)) {
                     strcat(file_list, "/");
+
+                    // Totals come from the index: no walk of the subfolder
+                    char item_name[768];
+                    FolderStats fs;
+                    snprintf(item_name, sizeof(item_name), "%s%s%s", is_root ? "" : subpath, is_root ? "" : "/",
+                             dir->d_name);
+                    if (search_index_folder_stats(item_name, &fs) == 0) {
+                        char totals[80];
+                        snprintf(totals, sizeof(totals), "  (%ld files, %ld folders, %lld bytes)", fs.files,
+                                 fs.folders, fs.bytes);
+                        strcat(file_list, totals);
+                    }
                 }
                 
                 strcat(file_list, "\n");
             }
         }
-        closedir(d);
+        if (d) closedir(d);
         
         if (strlen(file_list) < 30) strcat(file_list, "(Empty folder)");
 
@@ -112,98 +141,181 @@ void handle_upload_request(int sockfd, char *payload) {
     char log_prefix[256];
     get_log_prefix(sockfd, log_prefix);
 
-    char filename[100];
+    char filename[256];
     long filesize = 0;
     
-    sscanf(payload, "%s %ld", filename, &filesize);
+    sscanf(payload, "%255s %ld", filename, &filesize);
 
     Session *s = find_session(sockfd);
     if (s && !check_group_write_permission(s->user_id, filename)) {
         send_packet(sockfd, MSG_ERROR, "Access Denied: You are not a member of this group", 48);
-        char log_msg[512];
+        char log_msg[1024];
         sprintf(log_msg, "%s - UPLOAD denied to '%s' (Not a group member)", log_prefix, filename);
         log_activity(log_msg);
         return;
     }
 
-    char log_msg[512];
+    char log_msg[1024];
     sprintf(log_msg, "%s requesting UPLOAD '%s' (%ld bytes)", log_prefix, filename, filesize);
     log_activity(log_msg);
 
-    char filepath[200];
-    sprintf(filepath, "%s%s", FILE_STORAGE_PATH, filename);
+    // Refused before any byte is received; the space stays reserved until
+    // the upload is committed or dropped
+    QuotaReservation quota;
+    char quota_err[160];
+    if (quota_reserve(s ? s->user_id : -1, filename, filesize > 0 ? filesize : 0, &quota, quota_err,
+                      sizeof(quota_err)) != 0) {
+        send_packet(sockfd, MSG_ERROR, quota_err, strlen(quota_err));
+        snprintf(log_msg, sizeof(log_msg), "%s - UPLOAD refused: '%s' (%s)", log_prefix, filename, quota_err);
+        log_activity(log_msg);
+        return;
+    }
 
-    FILE *f = fopen(filepath, "wb");
+    // Data frames arrive later on the same stream as this request
+    Stream *st = stream_open(net_reply_stream, STREAM_UPLOAD);
+    if (!st) {
+        quota_release(&quota);
+        char *err = "Too many transfers on this connection (or stream busy).";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    char filepath[512];
+    storage_path(filename, filepath, sizeof(filepath));
+
+    // Written to a private staging file and renamed over the target on
+    // FILE_END (see upload_finish), so readers of the current version are
+    // never blocked and never see a partial file
+    FILE *f = stream_staging_open(st, filename);
     if (!f) {
+        st->in_use = 0;
+        quota_release(&quota);
         send_packet(sockfd, MSG_ERROR, "Server cannot create file", 25);
         sprintf(log_msg, "%s - UPLOAD failed: Cannot create file on disk", log_prefix);
         log_activity(log_msg);
         return;
     }
 
-    int fd = fileno(f);
-    if (flock(fd, LOCK_EX) != 0) {
-        perror("Lock failed");
-        fclose(f);
-    return;
-    }
-    
+    st->f = f;
+    snprintf(st->filename, sizeof(st->filename), "%s", filename);
+    snprintf(st->filepath, sizeof(st->filepath), "%s", filepath);
+    snprintf(st->log_prefix, sizeof(st->log_prefix), "%s", log_prefix);
+    st->filesize = filesize;
+    st->user_id = s ? s->user_id : -1;
+    st->group_id = parse_group_id(filename);
+    st->quota = quota;
 
     send_packet(sockfd, MSG_SUCCESS, "Ready to receive", 16);
+}
 
-    int msg_type;
-    char buffer[BUFFER_SIZE];
-    long total_received = 0;
-    int payload_len;
+/**
+ * @brief Builds the download validator: inode, size and mtime (ns) in hex.
+ * Any rewrite, rename-over or touch of the file changes it.
+ */
+void make_etag(const struct stat *st, char *etag, size_t size) {
+    snprintf(etag, size, "%lx-%lx-%llx", (unsigned long)st->st_ino, (unsigned long)st->st_size,
+             (unsigned long long)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec);
+}
 
-    while (1) {
-        payload_len = recv_packet(sockfd, &msg_type, buffer);
-        
-        if (payload_len < 0) break; // Error handling
-
-        if (msg_type == MSG_FILE_DATA) {
-            fwrite(buffer, 1, payload_len, f);
-            total_received += payload_len;
-        } 
-        else if (msg_type == MSG_FILE_END) {
-            printf("Upload completed: %s (%ld bytes)\n", filename, total_received);
-            break;
+/**
+ * @brief Serves a small file from the hot-file cache (loading it on a miss):
+ * the reply, every data frame and FILE_END go out in one writev.
+ * @return 0 if the download was served, -1 to fall back to streaming.
+ */
+static int serve_cached_download(int sockfd, Session *s, const char *filename, const char *filepath,
+                                 const char *etag, const char *log_prefix) {
+    FileCacheEntry *e = file_cache_acquire(filepath, etag);
+    if (!e) {
+        // Uploads replace files by rename, so no lock is needed: the open
+        // descriptor keeps reading the version it found
+        FILE *f = fopen(filepath, "rb");
+        if (!f) return -1;
+
+        struct stat st;
+        char cur_etag[64];
+        if (fstat(fileno(f), &st) != 0 || st.st_size > file_cache_max_file()) {
+            fclose(f);
+            return -1;
+        }
+        make_etag(&st, cur_etag, sizeof(cur_etag));
+
+        TraceSpan io_span;
+        trace_span_begin(&io_span, TRACE_FILE_IO);
+        char *data = malloc(st.st_size > 0 ? st.st_size : 1);
+        if (!data) {
+            trace_span_end(&io_span);
+            fclose(f);
+            return -1;
         }
-        else {
-            break;
+        size_t got = fread(data, 1, st.st_size, f);
+        trace_span_end(&io_span);
+        fclose(f);
+        if ((long)got != (long)st.st_size) {
+            free(data);
+            return -1;
         }
+        e = file_cache_insert(filepath, cur_etag, data, st.st_size);
+        if (!e) return -1;
     }
-    
-    fclose(f);
-    
-    char success_msg[100];
-    sprintf(success_msg, "File uploaded successfully: %s", filename);
-    send_packet(sockfd, MSG_SUCCESS, success_msg, strlen(success_msg));
-
-    sprintf(log_msg, "%s - UPLOAD completed: '%s' (Received %ld bytes)", log_prefix, filename, total_received);
-    log_activity(log_msg);
-}
 
-void handle_download_request(int sockfd, char *filename) {
-    char log_prefix[256];
-    get_log_prefix(sockfd, log_prefix);
-
-    char log_msg[512];
-    sprintf(log_msg, "%s requesting DOWNLOAD '%s'", log_prefix, filename);
-    log_activity(log_msg);
-
-    Session *s = find_session(sockfd);
-    if (s && !check_group_write_permission(s->user_id, filename)) {
-        send_packet(sockfd, MSG_ERROR, "Access Denied: You are not a member of this group", 50);
-        char log_msg[512];
-        sprintf(log_msg, "%s - DOWNLOAD denied to '%s' (Not a group member)", log_prefix, filename);
-        log_activity(log_msg);
-        return;
+    // Sent at once only if the limits allow the whole file now; otherwise
+    // the stream paces it without blocking the other streams
+    if (rl_try_reserve(sockfd, s ? s->user_id : -1, parse_group_id(filename), RL_DOWNLOAD, e->size) != 0) {
+        file_cache_release(e);
+        return -1;
     }
 
-    char filepath[256];
-    sprintf(filepath, "%s%s", FILE_STORAGE_PATH, filename);
+    // Reply + data frames + FILE_END, all on the request's stream
+    long frame_size = config_get(CFG_FRAME_SIZE);
+    int frames = (int)((e->size + frame_size - 1) / frame_size);
+    PacketHeader *headers = malloc((frames + 2) * sizeof(PacketHeader));
+    struct iovec *iov = malloc((2 * frames + 3) * sizeof(struct iovec));
+    if (!headers || !iov) {
+        free(headers);
+        free(iov);
+        file_cache_release(e);
+        return -1;
+    }
+    int n = 0;
+
+    char reply[100];
+    int reply_len = snprintf(reply, sizeof(reply), "%ld %s", e->size, e->etag);
+    headers[0] = (PacketHeader){MSG_SUCCESS, net_reply_stream, reply_len};
+    iov[n++] = (struct iovec){&headers[0], sizeof(PacketHeader)};
+    iov[n++] = (struct iovec){reply, reply_len};
+
+    for (int i = 0; i < frames; i++) {
+        long off = (long)i * frame_size;
+        int len = (int)(e->size - off < frame_size ? e->size - off : frame_size);
+        headers[i + 1] = (PacketHeader){MSG_FILE_DATA, net_reply_stream, len};
+        iov[n++] = (struct iovec){&headers[i + 1], sizeof(PacketHeader)};
+        iov[n++] = (struct iovec){e->data + off, len};
+    }
+    headers[frames + 1] = (PacketHeader){MSG_FILE_END, net_reply_stream, 0};
+    iov[n++] = (struct iovec){&headers[frames + 1], sizeof(PacketHeader)};
+
+    TraceSpan net_span;
+    trace_span_begin(&net_span, TRACE_NET_SEND);
+    int res = send_iov(sockfd, iov, n);
+    trace_span_end(&net_span);
+    free(headers);
+    free(iov);
+
+    char log_msg[1024];
+    snprintf(log_msg, sizeof(log_msg), "%s - DOWNLOAD %s: Sent '%s' (%ld bytes, memory)", log_prefix,
+             res == 0 ? "success" : "failed", filename, e->size);
+    log_activity(log_msg);
+    file_cache_release(e);
+    return 0;
+}
 
+/**
+ * @brief Replies to a download of `filepath` (the current file or one of its
+ * versions): not-modified, from the hot-file cache, or as a new stream.
+ */
+static void start_download(int sockfd, Session *s, const char *filename, const char *filepath,
+                           const char *if_none_match, const char *log_prefix) {
+    char log_msg[1024];
     struct stat st;
     if (stat(filepath, &st) != 0) {
         char *err = "File not found.";
@@ -221,8 +333,34 @@ void handle_download_request(int sockfd, char *filename) {
         return;
     }
 
+    char etag[64];
+    make_etag(&st, etag, sizeof(etag));
+    if (if_none_match && strcmp(if_none_match, etag) == 0) {
+        // Client copy is current: one reply, no stream, no data
+        send_packet(sockfd, MSG_NOT_MODIFIED, etag, strlen(etag));
+        sprintf(log_msg, "%s - DOWNLOAD not modified: '%s'", log_prefix, filename);
+        log_activity(log_msg);
+        return;
+    }
+
+    // Small files: straight from memory, no stream
+    if (st.st_size <= file_cache_max_file() &&
+        serve_cached_download(sockfd, s, filename, filepath, etag, log_prefix) == 0)
+        return;
+
+    // Chunks are sent by stream_pump() from the connection loop
+    Stream *ds = stream_open(net_reply_stream, STREAM_DOWNLOAD);
+    if (!ds) {
+        char *err = "Too many transfers on this connection (or stream busy).";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    // No lock: an upload, rename or delete of this path replaces or unlinks
+    // the directory entry, and this descriptor keeps streaming the old inode
     FILE *f = fopen(filepath, "rb");
     if (!f) {
+        ds->in_use = 0;
         char *err = "Access denied or file locked.";
         send_packet(sockfd, MSG_ERROR, err, strlen(err));
         sprintf(log_msg, "%s - DOWNLOAD failed: Cannot open file", log_prefix);
@@ -230,30 +368,184 @@ void handle_download_request(int sockfd, char *filename) {
         return;
     }
     int fd = fileno(f);
-    if (flock(fd, LOCK_SH) != 0) {
-    }
 
+    // Re-read from the descriptor: this is the version that will be streamed
+    struct stat open_st;
+    if (fstat(fd, &open_st) == 0) {
+        st = open_st;
+        make_etag(&st, etag, sizeof(etag));
+    }
     long filesize = st.st_size;
+
+    ds->f = f;
+    snprintf(ds->filename, sizeof(ds->filename), "%s", filename);
+    snprintf(ds->filepath, sizeof(ds->filepath), "%s", filepath);
+    snprintf(ds->log_prefix, sizeof(ds->log_prefix), "%s", log_prefix);
+    ds->filesize = filesize;
+    ds->user_id = s ? s->user_id : -1;
+    ds->group_id = parse_group_id(filename);
     
     char msg[100];
-    sprintf(msg, "%ld", filesize);
+    sprintf(msg, "%ld %s", filesize, etag);
     send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
 
     printf("[INFO] Sending file '%s' to Client...\n", filename);
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read;
-    long total_sent = 0;
-    
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0) {
-        send_packet(sockfd, MSG_FILE_DATA, buffer, bytes_read);
-        total_sent += bytes_read;
+}
+
+
+void handle_download_request(int sockfd, char *payload) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+
+    // "<filename> [etag]": the etag is the client's cached version
+    char *filename = payload;
+    char *if_none_match = strchr(payload, ' ');
+    if (if_none_match) *if_none_match++ = '\0';
+
+    char log_msg[1024];
+    sprintf(log_msg, "%s requesting DOWNLOAD '%s'", log_prefix, filename);
+    log_activity(log_msg);
+
+    Session *s = find_session(sockfd);
+    if (s && !check_group_write_permission(s->user_id, filename)) {
+        send_packet(sockfd, MSG_ERROR, "Access Denied: You are not a member of this group", 50);
+        sprintf(log_msg, "%s - DOWNLOAD denied to '%s' (Not a group member)", log_prefix, filename);
+        log_activity(log_msg);
+        return;
+    }
+
+    char filepath[512];
+    storage_path(filename, filepath, sizeof(filepath));
+    start_download(sockfd, s, filename, filepath, if_none_match, log_prefix);
+}
+
+/**
+ * @brief Continues a transfer kept across a reconnect (see handle_resume_session).
+ * Payload: the offset the client continues from (uploads: at most what the
+ * server received; downloads: what the client has written).
+ */
+void handle_resume_transfer(int sockfd, char *payload) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+
+    Stream *st = stream_find(net_reply_stream);
+    long offset = atol(payload);
+    if (!st || stream_resume(st, offset) != 0) {
+        char *err = "Cannot resume transfer: unknown stream or invalid offset.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    char msg[100];
+    snprintf(msg, sizeof(msg), "%ld resumed at %ld", st->filesize, offset);
+    send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
+
+    char log_msg[1024];
+    snprintf(log_msg, sizeof(log_msg), "%s - %s resumed: '%s' at byte %ld", log_prefix,
+             st->kind == STREAM_UPLOAD ? "UPLOAD" : "DOWNLOAD", st->filename, offset);
+    log_activity(log_msg);
+}
+
+void handle_list_versions(int sockfd, char *filename) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+
+    Session *s = find_session(sockfd);
+    if (s && !check_group_write_permission(s->user_id, filename)) {
+        send_packet(sockfd, MSG_ERROR, "Access Denied: You are not a member of this group", 50);
+        return;
+    }
+
+    char list[BUFFER_SIZE];
+    int header = snprintf(list, sizeof(list), "--- Versions of: /%s (id size archived) ---\n", filename);
+    if (header >= (int)sizeof(list)) header = sizeof(list) - 1;
+    if (versions_format_list(filename, list + header, sizeof(list) - header) == 0)
+        snprintf(list + header, sizeof(list) - header, "(No previous versions)");
+    send_packet(sockfd, MSG_LIST_RESPONSE, list, strlen(list));
+
+    char log_msg[512];
+    sprintf(log_msg, "%s requested LIST_VERSIONS '%s'", log_prefix, filename);
+    log_activity(log_msg);
+}
+
+void handle_download_version(int sockfd, char *payload) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+
+    char filename[256];
+    int id;
+    if (sscanf(payload, "%255s %d", filename, &id) < 2) {
+        char *err = "Usage: DOWNLOAD_VERSION <file> <version_id>";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    char log_msg[1024];
+    sprintf(log_msg, "%s requesting DOWNLOAD '%s' version %d", log_prefix, filename, id);
+    log_activity(log_msg);
+
+    Session *s = find_session(sockfd);
+    if (s && !check_group_write_permission(s->user_id, filename)) {
+        send_packet(sockfd, MSG_ERROR, "Access Denied: You are not a member of this group", 50);
+        return;
+    }
+
+    char vpath[512];
+    if (version_path(filename, id, vpath, sizeof(vpath)) != 0) {
+        char *err = "Version not found.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+    start_download(sockfd, s, filename, vpath, NULL, log_prefix);
+}
+
+void handle_restore_version(int sockfd, char *payload) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+
+    char filename[256];
+    int id;
+    if (sscanf(payload, "%255s %d", filename, &id) < 2) {
+        char *err = "Usage: RESTORE <file> <version_id>";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    Session *s = find_session(sockfd);
+    if (s && !check_group_write_permission(s->user_id, filename)) {
+        send_packet(sockfd, MSG_ERROR, "Access Denied: You are not a member of this group", 50);
+        return;
+    }
+
+    char filepath[512];
+    storage_path(filename, filepath, sizeof(filepath));
+
+    PathLock lock;
+    if (path_lock_try(&lock, filename, LOCK_MODE_X) != 0) {
+        char *err = "File is busy. Try again later.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+    int res = version_restore(filename, filepath, id);
+    if (res == 0) {
+        file_cache_invalidate(filepath);
+        repl_log_put(filename);
+        search_index_add(filename, 0);
+    }
+    path_lock_release(&lock);
+
+    char log_msg[1024];
+    if (res == 0) {
+        char msg[300];
+        snprintf(msg, sizeof(msg), "Restored '%s' to version %d", filename, id);
+        send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
+        sprintf(log_msg, "%s - RESTORE success: '%s' version %d", log_prefix, filename, id);
+    } else {
+        char *err = "Version not found or restore failed.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        sprintf(log_msg, "%s - RESTORE failed: '%s' version %d", log_prefix, filename, id);
     }
-    
-    send_packet(sockfd, MSG_FILE_END, "", 0);
-    fclose(f);
-    sprintf(log_msg, "%s - DOWNLOAD success: Sent '%s' (%ld bytes)", log_prefix, filename, total_sent);
     log_activity(log_msg);
-    printf("[INFO] File sent successfully.\n");
 }
 
 
@@ -278,22 +570,25 @@ void handle_delete_item(int sockfd, char *filename) {
     sprintf(log_msg, "%s requested DELETE '%s'", log_prefix, filename);
     log_activity(log_msg);
 
-    char filepath[256];
-    sprintf(filepath, "%s%s", FILE_STORAGE_PATH, filename);
+    char filepath[512];
+    storage_path(filename, filepath, sizeof(filepath));
 
     
 
-    struct stat st;
-    if (stat(filepath, &st) == 0 && S_ISREG(st.st_mode)) {
-        if (is_file_busy(filepath)) {
-            send_packet(sockfd, MSG_ERROR, "Cannot delete: File is being used by another user.", 50);
-            return;
-        }
+    // X on a folder also conflicts with copies and upload commits below it
+    PathLock lock;
+    if (path_lock_try(&lock, filename, LOCK_MODE_X) != 0) {
+        send_packet(sockfd, MSG_ERROR, "Cannot delete: File is being used by another user.", 50);
+        return;
     }
-    
+
+    struct stat st;
+    file_cache_invalidate(filepath);
     if (stat(filepath, &st) == 0 && S_ISDIR(st.st_mode)) {
         // Nếu là thư mục, gọi hàm xóa đệ quy
         if (remove_directory_recursive(filepath) == 0){
+            repl_log_delete(filename);
+            search_index_remove(filename);
             send_packet(sockfd, MSG_SUCCESS, "Folder deleted", 14);
             sprintf(log_msg, "%s - DELETE success (Folder): '%s'", log_prefix, filename);
             log_activity(log_msg);}
@@ -304,7 +599,10 @@ void handle_delete_item(int sockfd, char *filename) {
             }
     } else {
         // Nếu là file thường
+        version_snapshot(filename, filepath); // Deleted files stay restorable
         if (remove(filepath) == 0){
+            repl_log_delete(filename);
+            search_index_remove(filename);
             send_packet(sockfd, MSG_SUCCESS, "File deleted", 12);
             sprintf(log_msg, "%s - DELETE success (File): '%s'", log_prefix, filename);
             log_activity(log_msg);
@@ -315,6 +613,7 @@ void handle_delete_item(int sockfd, char *filename) {
             log_activity(log_msg);
         }
     }
+    path_lock_release(&lock);
 }
 
 
@@ -344,37 +643,37 @@ void handle_rename_item(int sockfd, char *payload) {
     log_activity(log_msg);
 
     char old_path[512], new_path[512];
-    sprintf(old_path, "%s%s", FILE_STORAGE_PATH, old_name);
-    sprintf(new_path, "%s%s", FILE_STORAGE_PATH, new_name);
+    storage_path(old_name, old_path, sizeof(old_path));
+    storage_path(new_name, new_path, sizeof(new_path));
 
     // --- CHECK RACE CONDITION ---
-    if (is_file_busy(old_path)) {
+    PathLock old_lock, new_lock;
+    TraceSpan lock_span;
+    trace_span_begin(&lock_span, TRACE_LOCK_WAIT);
+    int locked = path_lock_try(&old_lock, old_name, LOCK_MODE_X);
+    if (locked == 0 && path_lock_try(&new_lock, new_name, LOCK_MODE_X) != 0) {
+        path_lock_release(&old_lock);
+        locked = -1;
+    }
+    trace_span_end(&lock_span);
+    if (locked != 0) {
         send_packet(sockfd, MSG_ERROR, "Cannot rename: File is busy.", 27);
         return;
     }
 
-    FILE *f = fopen(old_path, "r");
-    int fd = fileno(f);
-    flock(fd, LOCK_EX);
-    // sleep(20);
-
     if (access(old_path, F_OK) != 0) {
         send_packet(sockfd, MSG_ERROR, "File/Folder not found", 21);
         sprintf(log_msg, "%s - RENAME failed", log_prefix);
         log_activity(log_msg);
-        flock(fd, LOCK_UN);
-        return;
-    }
-
-    if (access(new_path, F_OK) == 0) {
+    } else if (access(new_path, F_OK) == 0) {
         send_packet(sockfd, MSG_ERROR, "New name already exists", 23);
         sprintf(log_msg, "%s - RENAME failed", log_prefix);
         log_activity(log_msg);
-        flock(fd, LOCK_UN);
-        return;
-    }
-
-    if (rename(old_path, new_path) == 0) {
+    } else if (storage_move(old_name, new_name) == 0) { // Top-level renames may change shard
+        file_cache_invalidate(old_path);
+        versions_rename(old_name, new_name);
+        repl_log_move(old_name, new_name);
+        search_index_move(old_name, new_name);
         send_packet(sockfd, MSG_SUCCESS, "Rename successful", 17);
         sprintf(log_msg, "%s - RENAME success", log_prefix);
         log_activity(log_msg);
@@ -383,7 +682,17 @@ void handle_rename_item(int sockfd, char *payload) {
         sprintf(log_msg, "%s - RENAME failed", log_prefix);
         log_activity(log_msg);
     }
-    flock(fd, LOCK_UN);
+    path_lock_release(&new_lock);
+    path_lock_release(&old_lock);
+}
+
+// Space an item takes, from the index (a folder's total, without a walk)
+static long long item_bytes(const char *name) {
+    long long size;
+    int owner;
+    FolderStats fs;
+    if (search_index_file_info(name, &size, &owner) == 0) return size;
+    return search_index_folder_stats(name, &fs) == 0 ? fs.bytes : 0;
 }
 
 void handle_move_item(int sockfd, char *payload) {
@@ -415,7 +724,7 @@ void handle_move_item(int sockfd, char *payload) {
     }
 
     char src_path[PATH_MAX];
-    snprintf(src_path, sizeof(src_path), "%s%s", FILE_STORAGE_PATH, src_name);
+    storage_path(src_name, src_path, sizeof(src_path));
 
     struct stat st_src;
     if (stat(src_path, &st_src) != 0) {
@@ -423,26 +732,15 @@ void handle_move_item(int sockfd, char *payload) {
         return;
     }
 
-    if (S_ISREG(st_src.st_mode)) {
-        if (is_file_busy(src_path)) {
-            send_packet(sockfd, MSG_ERROR, "Cannot move: File is being used by another user.", 50);
-            return;
-        }
-    }
-
-    FILE *f = fopen(src_path, "r");
-    int fd = fileno(f);
-    flock(fd, LOCK_EX);
-
     char raw_dest_path[PATH_MAX];
-    snprintf(raw_dest_path, sizeof(raw_dest_path), "%s%s", FILE_STORAGE_PATH, dest_folder_input);
+    storage_path(dest_folder_input, raw_dest_path, sizeof(raw_dest_path));
 
     char resolved_dest_path[PATH_MAX];
     char resolved_storage_root[PATH_MAX];
 
-    if (realpath(FILE_STORAGE_PATH, resolved_storage_root) == NULL) {
+    // Checked against the root of the shard holding the destination
+    if (realpath(storage_files_dir(storage_shard_of(dest_folder_input)), resolved_storage_root) == NULL) {
         perror("Server Error: Cannot resolve storage root");
-        flock(fd, LOCK_UN);
         return; 
     }
 
@@ -456,7 +754,6 @@ void handle_move_item(int sockfd, char *payload) {
         char log_msg[512];
         sprintf(log_msg, "%s - SECURITY ALERT: Attempted to move file outside root!", log_prefix);
         log_activity(log_msg);
-        flock(fd, LOCK_UN);
         return;
     }
 
@@ -467,13 +764,42 @@ void handle_move_item(int sockfd, char *payload) {
     char final_dest_path[PATH_MAX];
     snprintf(final_dest_path, sizeof(final_dest_path), "%s/%s", resolved_dest_path, filename_only);
 
-    if (access(final_dest_path, F_OK) == 0) {
-        send_packet(sockfd, MSG_ERROR, "Item already exists in destination", 50);
-        flock(fd, LOCK_UN);
+    // Lock the source and its logical destination (relative to the root)
+    char dest_name[PATH_MAX];
+    snprintf(dest_name, sizeof(dest_name), "%s/%s",
+             resolved_dest_path + strlen(resolved_storage_root), filename_only);
+
+    PathLock src_lock, dest_lock;
+    TraceSpan lock_span;
+    trace_span_begin(&lock_span, TRACE_LOCK_WAIT);
+    int locked = path_lock_try(&src_lock, src_name, LOCK_MODE_X);
+    if (locked == 0 && path_lock_try(&dest_lock, dest_name, LOCK_MODE_X) != 0) {
+        path_lock_release(&src_lock);
+        locked = -1;
+    }
+    trace_span_end(&lock_span);
+    if (locked != 0) {
+        send_packet(sockfd, MSG_ERROR, "Cannot move: File is being used by another user.", 50);
         return;
     }
 
-    if (rename(src_path, final_dest_path) == 0) {
+    // Moving into another group adds to that group's usage (quota.h)
+    char dest_norm[PATH_LOCK_MAX_PATH], quota_err[160];
+    path_lock_normalize(dest_name, dest_norm, sizeof(dest_norm));
+    QuotaReservation quota = {0};
+    int quota_ok = parse_group_id(dest_norm) == parse_group_id(src_name) ||
+                   quota_reserve(-1, dest_name, item_bytes(src_name), &quota, quota_err, sizeof(quota_err)) == 0;
+
+    // A move to another shard (another group or disk) is streamed by storage_move
+    if (access(final_dest_path, F_OK) == 0) {
+        send_packet(sockfd, MSG_ERROR, "Item already exists in destination", 50);
+    } else if (!quota_ok) {
+        send_packet(sockfd, MSG_ERROR, quota_err, strlen(quota_err));
+    } else if (storage_move(src_name, dest_name) == 0) {
+        file_cache_invalidate(src_path);
+        versions_rename(src_name, dest_name);
+        repl_log_move(src_name, dest_name);
+        search_index_move(src_name, dest_name);
         send_packet(sockfd, MSG_SUCCESS, "Move successful", 15);
         
         char log_msg[512];
@@ -482,14 +808,14 @@ void handle_move_item(int sockfd, char *payload) {
     } else {
         if (errno == EINVAL) {
             send_packet(sockfd, MSG_ERROR, "Invalid move: Cannot move folder into itself", 50);
-        } else if (errno == EXDEV) {
-            send_packet(sockfd, MSG_ERROR, "Cannot move across different disk partitions", 50);
         } else {
             send_packet(sockfd, MSG_ERROR, "Move failed (System Error)", 50);
             perror("Move Error");
         }
     }
-    flock(fd, LOCK_UN);
+    quota_release(&quota);
+    path_lock_release(&dest_lock);
+    path_lock_release(&src_lock);
 }
 
 void handle_create_folder(int sockfd, char *foldername) {
@@ -509,8 +835,8 @@ void handle_create_folder(int sockfd, char *foldername) {
     sprintf(log_msg, "%s requested CREATE FOLDER '%s'", log_prefix, foldername);
     log_activity(log_msg);
 
-    char path[256];
-    sprintf(path, "%s%s", FILE_STORAGE_PATH, foldername);
+    char path[512];
+    storage_path(foldername, path, sizeof(path));
     
 #ifdef _WIN32
     if (_mkdir(path) == 0)
@@ -518,6 +844,8 @@ void handle_create_folder(int sockfd, char *foldername) {
     if (mkdir(path, 0777) == 0)
 #endif
     {
+        repl_log_mkdir(foldername);
+        search_index_add(foldername, 1);
         send_packet(sockfd, MSG_SUCCESS, "Folder created.", 15);
         sprintf(log_msg, "%s - MKDIR success", log_prefix);
         log_activity(log_msg);
@@ -528,6 +856,245 @@ void handle_create_folder(int sockfd, char *foldername) {
     }
 }
 
+/**
+ * @brief Creates several folders in one request (payload: one path per line).
+ * Existing folders count as success, so parents may be listed before children
+ * and a batch can be replayed safely.
+ */
+void handle_create_folders(int sockfd, char *payload) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+    Session *s = find_session(sockfd);
+
+    int created = 0, existed = 0, failed = 0;
+    int last_group = -2, last_allowed = 0; // Most batches target a single group
+    char *saveptr;
+
+    for (char *line = strtok_r(payload, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        if (*line == '\0') continue;
+        if (strstr(line, "..")) {
+            failed++;
+            continue;
+        }
+
+        int group_id = parse_group_id(line);
+        if (s && group_id != last_group) {
+            last_group = group_id;
+            last_allowed = check_group_write_permission(s->user_id, line);
+        }
+        if (s && !last_allowed) {
+            failed++;
+            continue;
+        }
+
+        char path[512];
+        storage_path(line, path, sizeof(path));
+        if (mkdir(path, 0777) == 0) {
+            repl_log_mkdir(line);
+            search_index_add(line, 1);
+            created++;
+        } else if (errno == EEXIST) {
+            existed++;
+        } else {
+            failed++;
+        }
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Folders: %d created, %d existed, %d failed.", created, existed, failed);
+    send_packet(sockfd, failed ? MSG_ERROR : MSG_SUCCESS, msg, strlen(msg));
+
+    char log_msg[512];
+    snprintf(log_msg, sizeof(log_msg), "%s - MKDIR batch: %d created, %d existed, %d failed",
+             log_prefix, created, existed, failed);
+    log_activity(log_msg);
+}
+
+// Appends one entry to the MSG_LIST_TREE chunk, flushing it when full
+static void list_tree_emit(int sockfd, char *chunk, size_t *len, const char *entry) {
+    size_t n = strlen(entry);
+    if (*len + n > BUFFER_SIZE) {
+        send_packet(sockfd, MSG_LIST_TREE, chunk, *len);
+        *len = 0;
+    }
+    memcpy(chunk + *len, entry, n);
+    *len += n;
+}
+
+static void list_tree_walk(int sockfd, const char *fs_path, const char *rel,
+                           char *chunk, size_t *len, int *count) {
+    DIR *d = opendir(fs_path);
+    if (!d) return;
+
+    struct dirent *dir;
+    while ((dir = readdir(d)) != NULL) {
+        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
+
+        char child_fs[1024], child_rel[768], entry[800];
+        snprintf(child_fs, sizeof(child_fs), "%s/%s", fs_path, dir->d_name);
+        if (*rel) {
+            snprintf(child_rel, sizeof(child_rel), "%s/%s", rel, dir->d_name);
+        } else {
+            snprintf(child_rel, sizeof(child_rel), "%s", dir->d_name);
+        }
+
+        struct stat st;
+        if (stat(child_fs, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            snprintf(entry, sizeof(entry), "D 0 %s\n", child_rel);
+            list_tree_emit(sockfd, chunk, len, entry);
+            (*count)++;
+            list_tree_walk(sockfd, child_fs, child_rel, chunk, len, count);
+        } else {
+            snprintf(entry, sizeof(entry), "F %ld %s\n", (long)st.st_size, child_rel);
+            list_tree_emit(sockfd, chunk, len, entry);
+            (*count)++;
+        }
+    }
+    closedir(d);
+}
+
+/**
+ * @brief Lists a folder recursively for DOWNLOAD -r.
+ * Sends "D 0 <path>" / "F <size> <path>" lines (relative to the folder,
+ * parents first) in as many MSG_LIST_TREE packets as needed, then a final
+ * MSG_SUCCESS with the entry count.
+ */
+void handle_list_tree(int sockfd, char *subpath) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+
+    Session *s = find_session(sockfd);
+    if (strstr(subpath, "..") || (s && !check_group_write_permission(s->user_id, subpath))) {
+        char *err = "Access Denied.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    char root[512];
+    storage_path(subpath, root, sizeof(root));
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        char *err = "Error: Folder not found.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    char chunk[BUFFER_SIZE];
+    size_t len = 0;
+    int count = 0;
+    if (*subpath == '\0') {
+        // The root is spread over every shard
+        for (int i = 0; i < storage_shard_count(); i++)
+            list_tree_walk(sockfd, storage_files_dir(i), "", chunk, &len, &count);
+    } else {
+        list_tree_walk(sockfd, root, "", chunk, &len, &count);
+    }
+    if (len > 0) send_packet(sockfd, MSG_LIST_TREE, chunk, len);
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%d", count);
+    send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
+
+    char log_msg[1024];
+    snprintf(log_msg, sizeof(log_msg), "%s requested LIST_TREE '%s' (%d entries)", log_prefix, subpath, count);
+    log_activity(log_msg);
+}
+
+// Group folders are searched by their approved members only
+static int search_member_filter(int group_id, void *ctx) {
+    return db_member_status(group_id, *(int *)ctx) == 1;
+}
+
+/**
+ * @brief Searches file and folder names (payload: "<pattern> [limit [offset]]").
+ * Sends the matches in MSG_SEARCH packets of at most BUFFER_SIZE, then
+ * MSG_SUCCESS: "<n> results, more after offset <next>" when the page is
+ * full, else "<n> results of <total>" (total counts the skipped ones too).
+ */
+void handle_search(int sockfd, char *payload) {
+    char log_prefix[256];
+    get_log_prefix(sockfd, log_prefix);
+
+    Session *s = find_session(sockfd);
+    if (!s || !s->is_logged_in) {
+        char *err = "Login required";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    char pattern[256];
+    int limit = SEARCH_DEFAULT_LIMIT;
+    long offset = 0;
+    if (sscanf(payload, "%255s %d %ld", pattern, &limit, &offset) < 1 || limit <= 0 || offset < 0) {
+        char *err = "Usage: SEARCH <pattern> [limit [offset]]";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+    if (limit > SEARCH_MAX_LIMIT) limit = SEARCH_MAX_LIMIT;
+
+    char *results;
+    size_t results_len;
+    int more;
+    long total;
+    int user_id = s->user_id;
+    int count = search_index_query(pattern, offset, limit, search_member_filter, &user_id, &results, &results_len,
+                                   &more, &total);
+
+    // Pages end on a line boundary so the client can print each as it comes
+    size_t pos = 0;
+    while (pos < results_len) {
+        size_t n = results_len - pos;
+        if (n > BUFFER_SIZE) {
+            n = BUFFER_SIZE;
+            while (n > 0 && results[pos + n - 1] != '\n') n--;
+            if (n == 0) n = BUFFER_SIZE;
+        }
+        send_packet(sockfd, MSG_SEARCH, results + pos, n);
+        pos += n;
+    }
+    free(results);
+
+    char msg[96];
+    if (more) snprintf(msg, sizeof(msg), "%d results, more after offset %ld", count, offset + count);
+    else snprintf(msg, sizeof(msg), "%d results of %ld", count, total);
+    send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
+
+    char log_msg[640];
+    snprintf(log_msg, sizeof(log_msg), "%s requested SEARCH '%s' (%d results)", log_prefix, pattern, count);
+    log_activity(log_msg);
+}
+
+/**
+ * @brief Reports a folder's recursive totals (payload: folder, "" for the
+ * root) from the index, without walking the folder.
+ */
+void handle_folder_stats(int sockfd, char *foldername) {
+    Session *s = find_session(sockfd);
+    if (strstr(foldername, "..") || (s && !check_group_write_permission(s->user_id, foldername))) {
+        char *err = "Access Denied.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
+    FolderStats fs;
+    char path[512];
+    struct stat st;
+    storage_path(foldername, path, sizeof(path));
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        char *err = "Error: Folder not found.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+    } else if (search_index_folder_stats(foldername, &fs) != 0) {
+        char *err = "Folder totals are still being computed. Try again later.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+    } else {
+        char msg[400];
+        snprintf(msg, sizeof(msg), "/%.255s: %ld files, %ld folders, %lld bytes", foldername, fs.files, fs.folders,
+                 fs.bytes);
+        send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
+    }
+}
+
 int remove_directory_recursive(const char *path) {
     DIR *d = opendir(path);
     size_t path_len = strlen(path);
@@ -572,14 +1139,12 @@ int remove_directory_recursive(const char *path) {
 int copy_single_file(const char *src_path, const char *dest_path) {
     FILE *f_src = fopen(src_path, "rb");
     if (!f_src) return -1;
-    flock(fileno(f_src), LOCK_SH);
 
     FILE *f_dest = fopen(dest_path, "wb");
     if (!f_dest) {
         fclose(f_src);
         return -1;
     }
-    flock(fileno(f_dest), LOCK_EX);
 
     char buffer[4096];
     size_t n;
@@ -614,6 +1179,9 @@ int copy_recursive(const char *src, const char *dest) {
         DIR *d = opendir(src);
         if (!d) return -1;
 
+        // Keep going past a failed entry, but report it (cross-shard moves
+        // must not delete a source that was only partly copied)
+        int res = 0;
         struct dirent *entry;
         while ((entry = readdir(d)) != NULL) {
             if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
@@ -625,10 +1193,10 @@ int copy_recursive(const char *src, const char *dest) {
             snprintf(next_src, sizeof(next_src), "%s/%s", src, entry->d_name);
             snprintf(next_dest, sizeof(next_dest), "%s/%s", dest, entry->d_name);
 
-            copy_recursive(next_src, next_dest);
+            if (copy_recursive(next_src, next_dest) != 0) res = -1;
         }
         closedir(d);
-        return 0;
+        return res;
     }
     return -1;
 }
@@ -657,7 +1225,7 @@ void handle_copy_file(int sockfd, char *payload) {
     }
 
     char src_path[PATH_MAX];
-    snprintf(src_path, sizeof(src_path), "%s%s", FILE_STORAGE_PATH, src_name);
+    storage_path(src_name, src_path, sizeof(src_path));
 
     struct stat st_src;
     if (stat(src_path, &st_src) != 0) {
@@ -666,9 +1234,9 @@ void handle_copy_file(int sockfd, char *payload) {
     }
 
     char raw_dest_base[PATH_MAX];
-    snprintf(raw_dest_base, sizeof(raw_dest_base), "%s%s", FILE_STORAGE_PATH, dest_input);
+    storage_path(dest_input, raw_dest_base, sizeof(raw_dest_base));
 
-    char final_dest_path[PATH_MAX];
+    char dest_name[PATH_MAX];
     struct stat st_dest;
 
     if (stat(raw_dest_base, &st_dest) == 0 && S_ISDIR(st_dest.st_mode)) {
@@ -676,21 +1244,38 @@ void handle_copy_file(int sockfd, char *payload) {
         if (filename_only) filename_only++; 
         else filename_only = src_name;
         
-        snprintf(final_dest_path, sizeof(final_dest_path), "%s/%s", raw_dest_base, filename_only);
+        snprintf(dest_name, sizeof(dest_name), "%s/%s", dest_input, filename_only);
     } else {
-        strcpy(final_dest_path, raw_dest_base);
+        snprintf(dest_name, sizeof(dest_name), "%s", dest_input);
     }
+    char final_dest_path[PATH_MAX];
+    storage_path(dest_name, final_dest_path, sizeof(final_dest_path));
 
     char resolved_storage_root[PATH_MAX];
-    realpath(FILE_STORAGE_PATH, resolved_storage_root);
+    realpath(storage_files_dir(storage_shard_of(dest_input)), resolved_storage_root);
     
     if (strstr(dest_input, "..")) {
          send_packet(sockfd, MSG_ERROR, "Security Violation: '..' not allowed", 32);
          return;
     }
 
+    // Source shared, destination exclusive, for the whole (recursive) copy
+    PathLock src_lock, dest_lock;
+    int locked = path_lock_try(&src_lock, src_name, LOCK_MODE_S);
+    if (locked == 0 && path_lock_try(&dest_lock, dest_name, LOCK_MODE_X) != 0) {
+        path_lock_release(&src_lock);
+        locked = -1;
+    }
+    if (locked != 0) {
+        char *err = "Cannot copy: File is busy. Try again later.";
+        send_packet(sockfd, MSG_ERROR, err, strlen(err));
+        return;
+    }
+
     if (access(final_dest_path, F_OK) == 0) {
         send_packet(sockfd, MSG_ERROR, "Destination already exists (No Overwrite)", 40);
+        path_lock_release(&dest_lock);
+        path_lock_release(&src_lock);
         return;
     }
 
@@ -701,15 +1286,38 @@ void handle_copy_file(int sockfd, char *payload) {
         
         if (strncmp(abs_dest, resolved_src, strlen(resolved_src)) == 0) {
              send_packet(sockfd, MSG_ERROR, "Cannot copy folder into its own subdirectory", 43);
+             path_lock_release(&dest_lock);
+             path_lock_release(&src_lock);
              return;
         }
     }
 
+    // The copy counts against the destination group (not against a user)
+    QuotaReservation quota;
+    char quota_err[160];
+    if (quota_reserve(-1, dest_name, item_bytes(src_name), &quota, quota_err, sizeof(quota_err)) != 0) {
+        send_packet(sockfd, MSG_ERROR, quota_err, strlen(quota_err));
+        path_lock_release(&dest_lock);
+        path_lock_release(&src_lock);
+        return;
+    }
+
     char log_msg[512];
     sprintf(log_msg, "%s requesting COPY '%s' -> '%s'", log_prefix, src_name, dest_input);
     log_activity(log_msg);
 
-    if (copy_recursive(src_path, final_dest_path) == 0) {
+    TraceSpan io_span;
+    trace_span_begin(&io_span, TRACE_FILE_IO);
+    int copy_res = copy_recursive(src_path, final_dest_path);
+    file_cache_invalidate(final_dest_path);
+    repl_log_copy(src_name, dest_name); // Even a partial copy left files behind
+    search_index_add_tree(dest_name);
+    quota_release(&quota);
+    trace_span_end(&io_span);
+    path_lock_release(&dest_lock);
+    path_lock_release(&src_lock);
+
+    if (copy_res == 0) {
         send_packet(sockfd, MSG_SUCCESS, "Copy successful", 15);
         sprintf(log_msg, "%s - COPY success", log_prefix);
         log_activity(log_msg);
@@ -726,18 +1334,26 @@ int check_group_write_permission(int user_id, const char *path) {
     if (sscanf(path, "Group_%d/", &group_id) == 1 || 
         (strncmp(path, "Group_", 6) == 0 && sscanf(path, "Group_%d", &group_id) == 1)) {
         
+        TraceSpan perm_span, db_span;
+        trace_span_begin(&perm_span, TRACE_PERMISSION);
+
         GroupMemberInfo members[512];
+        trace_span_begin(&db_span, TRACE_DB_READ);
         int count = db_read_group_members(members, 512);
+        trace_span_end(&db_span);
         
+        int allowed = 0;
         for (int i = 0; i < count; i++) {
             if (members[i].group_id == group_id && 
                 members[i].user_id == user_id && 
                 members[i].status == 1) {
-                return 1;
+                allowed = 1;
+                break;
             }
         }
         
-        return 0; 
+        trace_span_end(&perm_span);
+        return allowed; 
     }
     
     return 1; 
@@ -750,19 +1366,23 @@ int check_group_owner_permission(int user_id, const char *path) {
     if (sscanf(path, "Group_%d/", &group_id) == 1 || 
         (strncmp(path, "Group_", 6) == 0 && sscanf(path, "Group_%d", &group_id) == 1)) {
         
+        TraceSpan perm_span, db_span;
+        trace_span_begin(&perm_span, TRACE_PERMISSION);
+
         GroupInfo groups[256];
+        trace_span_begin(&db_span, TRACE_DB_READ);
         int count = db_read_groups(groups, 256);
+        trace_span_end(&db_span);
         
+        int allowed = 0;
         for (int i = 0; i < count; i++) {
             if (groups[i].group_id == group_id) {
-                if (groups[i].owner_id == user_id) {
-                    return 1;
-                } else {
-                    return 0;
-                }
+                allowed = (groups[i].owner_id == user_id);
+                break;
             }
         }
-        return 0;
+        trace_span_end(&perm_span);
+        return allowed;
     }
     
     return 1; 
@@ -8,10 +8,15 @@
 #include "protocol.h"
 #include "network.h"
 #include "db.h"
+#include "storage.h"
+#include "replication.h"
+#include "search_index.h"
+#include "config.h"
 
 Session *find_session(int sockfd);
 void log_activity(const char *msg);
 int remove_directory_recursive(const char *path);
+int cluster_secret_ok(const char *secret);
 
 // Helper function to get log prefix with user info
 void get_group_log_prefix(int sockfd, char *buffer)
@@ -37,12 +42,16 @@ extern pthread_mutex_t db_mutex;
 
 int db_create_group_directory(int group_id)
 {
-    char dir_path[256];
-    // Server runs from project root, so use "./data/files/Group_X"
-    // snprintf(dir_path, sizeof(dir_path), "./data/Group_%d", group_id);
-    snprintf(dir_path, sizeof(dir_path), "./data/files/Group_%d", group_id);
+    char group_dir[64], dir_path[512];
+    // "Group_X" at the root of the storage shard the group hashes to
+    snprintf(group_dir, sizeof(group_dir), "Group_%d", group_id);
+    storage_path(group_dir, dir_path, sizeof(dir_path));
 
     int res = mkdir(dir_path, 0755);
+    if (res == 0) {
+        repl_log_mkdir(group_dir);
+        search_index_add(group_dir, 1);
+    }
     return (res == 0 || errno == EEXIST) ? 0 : -1;
 }
 
@@ -66,6 +75,8 @@ int db_create_group(const char *group_name, int owner_id)
         // Auto-add owner as an approved member (status 1)
         GroupMemberInfo owner_membership = {group_id, owner_id, 1};
         db_write_group_member(&owner_membership);
+        repl_log_meta(GROUP_DB_FILE);
+        repl_log_meta(GROUP_MEMBER_DB_FILE);
         return group_id;
     }
     return -1;
@@ -123,6 +134,53 @@ void handle_create_group(int sockfd, char *payload)
     }
 }
 
+/**
+ * @brief Records a group the router created on the metadata node, under the
+ * ID given there (payload: "<secret> <group_id> <name>"), with the logged-in
+ * user as owner. Repeating it for an existing group only ensures the folder.
+ */
+void handle_cluster_create_group(int sockfd, char *payload)
+{
+    Session *s = find_session(sockfd);
+    char secret[CONFIG_STRING_MAX], name[64];
+    int group_id;
+    if (!s || !s->is_logged_in || sscanf(payload, "%2047s %d %63s", secret, &group_id, name) < 3 ||
+        group_id <= 0 || !cluster_secret_ok(secret))
+    {
+        send_packet(sockfd, MSG_ERROR, "Cluster request refused", 23);
+        return;
+    }
+
+    GroupInfo existing;
+    if (db_find_group(group_id, &existing) != 1)
+    {
+        GroupInfo new_group = {group_id, "", s->user_id};
+        strncpy(new_group.name, name, 63);
+        GroupMemberInfo owner_membership = {group_id, s->user_id, 1};
+        if (db_write_group(&new_group) != 0 || db_write_group_member(&owner_membership) != 0)
+        {
+            send_packet(sockfd, MSG_ERROR, "Failed to create group", 22);
+            return;
+        }
+        repl_log_meta(GROUP_DB_FILE);
+        repl_log_meta(GROUP_MEMBER_DB_FILE);
+    }
+    if (db_create_group_directory(group_id) < 0)
+    {
+        send_packet(sockfd, MSG_ERROR, "Warning: directory not created", 29);
+        return;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Group %d placed on this node", group_id);
+    send_packet(sockfd, MSG_SUCCESS, msg, strlen(msg));
+
+    char log_prefix[256], log_msg[512];
+    get_group_log_prefix(sockfd, log_prefix);
+    snprintf(log_msg, sizeof(log_msg), "%s placed group '%s' (ID: %d) on this node", log_prefix, name, group_id);
+    log_activity(log_msg);
+}
+
 void handle_list_groups(int sockfd)
 {
     GroupInfo groups[256];
@@ -166,26 +224,21 @@ void handle_join_group(int sockfd, char *payload)
     }
 
     int group_id = atoi(payload);
-    GroupMemberInfo members[512];
-    int count = db_read_group_members(members, 512);
-
-    for (int i = 0; i < count; i++)
+    if (db_member_status(group_id, s->user_id) >= 0)
     {
-        if (members[i].group_id == group_id && members[i].user_id == s->user_id)
-        {
-            char log_prefix[256];
-            get_group_log_prefix(sockfd, log_prefix);
-            char log_msg[512];
-            snprintf(log_msg, sizeof(log_msg), "%s attempted to join group %d (already a member or pending)", log_prefix, group_id);
-            log_activity(log_msg);
-            send_packet(sockfd, MSG_ERROR, "Already a member or pending", 27);
-            return;
-        }
+        char log_prefix[256];
+        get_group_log_prefix(sockfd, log_prefix);
+        char log_msg[512];
+        snprintf(log_msg, sizeof(log_msg), "%s attempted to join group %d (already a member or pending)", log_prefix, group_id);
+        log_activity(log_msg);
+        send_packet(sockfd, MSG_ERROR, "Already a member or pending", 27);
+        return;
     }
 
     GroupMemberInfo new_m = {group_id, s->user_id, 0}; // 0 = Pending
     if (db_write_group_member(&new_m) == 0)
     {
+        repl_log_meta(GROUP_MEMBER_DB_FILE);
         char log_prefix[256];
         get_group_log_prefix(sockfd, log_prefix);
         char log_msg[512];
@@ -244,7 +297,7 @@ void handle_approve_member(int sockfd, char *payload)
     int count = db_read_group_members(members, 512);
     int found = 0;
 
-    FILE *f = fopen("./data/group_members.txt", "w");
+    FILE *f = fopen(GROUP_MEMBER_DB_FILE, "w");
     if (!f)
     {
         pthread_mutex_unlock(&db_mutex);
@@ -262,6 +315,7 @@ void handle_approve_member(int sockfd, char *payload)
         fprintf(f, "%d %d %d\n", members[i].group_id, members[i].user_id, members[i].status);
     }
     fclose(f);
+    repl_log_meta(GROUP_MEMBER_DB_FILE);
 
     pthread_mutex_unlock(&db_mutex);
 
@@ -313,7 +367,7 @@ void handle_leave_group(int sockfd, char *payload)
     int count = db_read_group_members(members, 512);
     int found = 0;
 
-    FILE *f = fopen("./data/group_members.txt", "w");
+    FILE *f = fopen(GROUP_MEMBER_DB_FILE, "w");
     if (!f)
     {
         pthread_mutex_unlock(&db_mutex);
@@ -331,6 +385,7 @@ void handle_leave_group(int sockfd, char *payload)
         fprintf(f, "%d %d %d\n", members[i].group_id, members[i].user_id, members[i].status);
     }
     fclose(f);
+    repl_log_meta(GROUP_MEMBER_DB_FILE);
 
     pthread_mutex_unlock(&db_mutex);
 
@@ -416,7 +471,7 @@ void handle_kick_member(int sockfd, char *payload)
     GroupMemberInfo members[512];
     int count = db_read_group_members(members, 512);
 
-    FILE *f = fopen("./data/group_members.txt", "w");
+    FILE *f = fopen(GROUP_MEMBER_DB_FILE, "w");
     if (!f)
     {
         pthread_mutex_unlock(&db_mutex);
@@ -431,6 +486,7 @@ void handle_kick_member(int sockfd, char *payload)
         fprintf(f, "%d %d %d\n", members[i].group_id, members[i].user_id, members[i].status);
     }
     fclose(f);
+    repl_log_meta(GROUP_MEMBER_DB_FILE);
 
     pthread_mutex_unlock(&db_mutex);
 
@@ -449,31 +505,9 @@ void handle_invite_member(int sockfd, char *payload)
     sscanf(payload, "%d %d", &group_id, &target_id);
 
     // 1. Check group owner and requester membership
-    GroupInfo groups[256];
-    int g_count = db_read_groups(groups, 256);
-    int is_owner = 0;
-
-    for (int i = 0; i < g_count; i++)
-    {
-        if (groups[i].group_id == group_id)
-        {
-            if (groups[i].owner_id == s->user_id)
-                is_owner = 1;
-            break;
-        }
-    }
-
-    GroupMemberInfo members[512];
-    int m_count = db_read_group_members(members, 512);
-    int is_member = 0;
-    for (int i = 0; i < m_count; i++)
-    {
-        if (members[i].group_id == group_id && members[i].user_id == s->user_id && members[i].status == 1)
-        {
-            is_member = 1;
-            break;
-        }
-    }
+    GroupInfo group;
+    int is_owner = db_find_group(group_id, &group) == 1 && group.owner_id == s->user_id;
+    int is_member = db_member_status(group_id, s->user_id) == 1;
 
     if (!is_owner && !is_member)
     {
@@ -490,6 +524,7 @@ void handle_invite_member(int sockfd, char *payload)
 
     if (db_write_group_member(&new_m) == 0)
     {
+        repl_log_meta(GROUP_MEMBER_DB_FILE);
         char log_prefix[256];
         get_group_log_prefix(sockfd, log_prefix);
         char log_msg[512];
@@ -583,7 +618,7 @@ void handle_delete_group(int sockfd, char *payload)
     // 2. Remove all members from group_members.txt
     GroupMemberInfo members[512];
     int m_count = db_read_group_members(members, 512);
-    FILE *f_members = fopen("./data/group_members.txt", "w");
+    FILE *f_members = fopen(GROUP_MEMBER_DB_FILE, "w");
     if (!f_members)
     {
         pthread_mutex_unlock(&db_mutex);
@@ -604,7 +639,7 @@ void handle_delete_group(int sockfd, char *payload)
     }
     fclose(f_members);
 
-    FILE *f_groups = fopen("./data/groups.txt", "w");
+    FILE *f_groups = fopen(GROUP_DB_FILE, "w");
     if (!f_groups)
     {
         pthread_mutex_unlock(&db_mutex);
@@ -624,15 +659,20 @@ void handle_delete_group(int sockfd, char *payload)
         }
     }
     fclose(f_groups);
+    repl_log_meta(GROUP_MEMBER_DB_FILE);
+    repl_log_meta(GROUP_DB_FILE);
 
     pthread_mutex_unlock(&db_mutex);
 
     // 4. Delete the group directory (outside mutex - filesystem operation)
-    char dir_path[256];
-    snprintf(dir_path, sizeof(dir_path), "./data/files/Group_%d", group_id);
+    char group_dir[64], dir_path[512];
+    snprintf(group_dir, sizeof(group_dir), "Group_%d", group_id);
+    storage_path(group_dir, dir_path, sizeof(dir_path));
     errno = 0;
     int dir_res = remove_directory_recursive(dir_path);
     int saved_errno = errno;
+    repl_log_delete(group_dir);
+    search_index_remove(group_dir);
 
     if (dir_res == 0 || saved_errno == ENOENT)
     {
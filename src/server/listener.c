@@ -0,0 +1,202 @@
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "listener.h"
+#include "config.h"
+
+typedef struct {
+    int sockfd;                       // Own socket, or the shared one
+    unsigned long long accepted;
+    unsigned long long failed;        // accept4 or pthread_create errors
+} Acceptor;
+
+static Acceptor acceptors[LISTENER_MAX_ACCEPTORS];
+static int acceptor_count = 0;
+static int backlog = LISTENER_DEFAULT_BACKLOG;
+static int reuseport = 1;
+static void *(*conn_handler)(void *);
+static pthread_attr_t conn_attr;
+static int stop_pipe[2] = {-1, -1};  // Readable once listener_stop() was called
+
+static int open_socket(int port, int with_reuseport) {
+    // Non-blocking: another acceptor may take the connection poll() woke us for
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (with_reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(fd);
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int listener_open(int port) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = (int)config_get(CFG_ACCEPT_THREADS);
+    if (count == 0) count = cpus < 1 ? 1 : cpus > LISTENER_MAX_ACCEPTORS ? LISTENER_MAX_ACCEPTORS : (int)cpus;
+    backlog = (int)config_get(CFG_LISTEN_BACKLOG);
+
+    // SO_REUSEPORT would let a second server silently share the port:
+    // refuse to start if a plain bind fails
+    int probe = open_socket(port, 0);
+    if (probe < 0) {
+        perror("Fail to bind");
+        return -1;
+    }
+    close(probe);
+
+    for (int i = 0; i < count; i++) {
+        int fd = reuseport ? open_socket(port, 1) : acceptors[0].sockfd;
+        if (fd < 0 && i == 0 && errno == ENOPROTOOPT) {
+            // Old kernel: one socket shared by every acceptor
+            reuseport = 0;
+            fd = open_socket(port, 0);
+        }
+        if (fd < 0) {
+            perror("Fail to bind");
+            for (int j = 0; j < i && (reuseport || j == 0); j++) close(acceptors[j].sockfd);
+            return -1;
+        }
+        acceptors[i].sockfd = fd;
+    }
+    acceptor_count = count;
+    return pipe2(stop_pipe, O_CLOEXEC) == 0 ? count : -1;
+}
+
+int listener_adopt(const int *fds, int count, int shared) {
+    if (count < 1 || count > LISTENER_MAX_ACCEPTORS)
+        return -1;
+    backlog = (int)config_get(CFG_LISTEN_BACKLOG);
+    reuseport = !shared;
+
+    // The sockets keep their queues; listen() again only applies our backlog
+    int n = count;
+    if (shared) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (int)config_get(CFG_ACCEPT_THREADS);
+        if (n == 0) n = cpus < 1 ? 1 : cpus > LISTENER_MAX_ACCEPTORS ? LISTENER_MAX_ACCEPTORS : (int)cpus;
+    }
+    for (int i = 0; i < n; i++) {
+        acceptors[i].sockfd = fds[shared ? 0 : i];
+        if (!shared || i == 0) {
+            fcntl(acceptors[i].sockfd, F_SETFD, FD_CLOEXEC);
+            listen(acceptors[i].sockfd, backlog);
+        }
+    }
+    acceptor_count = n;
+    return pipe2(stop_pipe, O_CLOEXEC) == 0 ? n : -1;
+}
+
+int listener_export(int *fds, int max, int *shared) {
+    *shared = !reuseport;
+    int n = reuseport ? acceptor_count : 1;
+    if (n > max) n = max;
+    for (int i = 0; i < n; i++) fds[i] = acceptors[i].sockfd;
+    return n;
+}
+
+void listener_stop() {
+    char c = 1;
+    if (write(stop_pipe[1], &c, 1) < 0) perror("listener_stop");
+}
+
+static void *acceptor_thread(void *arg) {
+    Acceptor *a = (Acceptor *)arg;
+    while (1) {
+        struct pollfd pfd[2] = {{a->sockfd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+        if (poll(pfd, 2, -1) < 0) continue;
+        if (pfd[1].revents) break; // Handed over: the next process accepts from here
+
+        // Drain the queue: a storm is served without a poll() per connection
+        while (1) {
+            AcceptedConn *conn = calloc(1, sizeof(AcceptedConn));
+            if (!conn) break;
+            socklen_t addr_len = sizeof(conn->addr);
+            // Connection threads use blocking I/O: only CLOEXEC here
+            conn->sockfd = accept4(a->sockfd, (struct sockaddr *)&conn->addr, &addr_len, SOCK_CLOEXEC);
+            if (conn->sockfd < 0) {
+                int err = errno;
+                free(conn);
+                if (err == EAGAIN || err == EWOULDBLOCK) break;
+                if (err == EINTR || err == ECONNABORTED) continue;
+                perror("Accept failed");
+                __atomic_add_fetch(&a->failed, 1, __ATOMIC_RELAXED);
+                if (err == EMFILE || err == ENFILE) usleep(10000); // Let connections close
+                break;
+            }
+
+            pthread_t tid;
+            if (pthread_create(&tid, &conn_attr, conn_handler, conn) != 0) {
+                perror("Thread creation failed");
+                close(conn->sockfd);
+                free(conn);
+                __atomic_add_fetch(&a->failed, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            __atomic_add_fetch(&a->accepted, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+void listener_run(void *(*handler)(void *)) {
+    conn_handler = handler;
+    pthread_attr_init(&conn_attr);
+    pthread_attr_setdetachstate(&conn_attr, PTHREAD_CREATE_DETACHED);
+
+    // The calling thread is the last acceptor
+    pthread_t tids[LISTENER_MAX_ACCEPTORS];
+    int started[LISTENER_MAX_ACCEPTORS] = {0};
+    for (int i = 0; i < acceptor_count - 1; i++) {
+        if (pthread_create(&tids[i], NULL, acceptor_thread, &acceptors[i]) != 0) {
+            perror("Acceptor creation failed");
+            continue;
+        }
+        started[i] = 1;
+    }
+    acceptor_thread(&acceptors[acceptor_count - 1]);
+
+    for (int i = 0; i < acceptor_count - 1; i++) {
+        if (started[i]) pthread_join(tids[i], NULL);
+    }
+}
+
+int listener_format_stats(char *buf, size_t size) {
+    unsigned long long total = 0, failed = 0;
+    for (int i = 0; i < acceptor_count; i++) {
+        total += __atomic_load_n(&acceptors[i].accepted, __ATOMIC_RELAXED);
+        failed += __atomic_load_n(&acceptors[i].failed, __ATOMIC_RELAXED);
+    }
+    int n = snprintf(buf, size, "LISTENER acceptors=%d %s backlog=%d accepted=%llu failed=%llu per_acceptor=",
+                     acceptor_count, reuseport ? "reuseport" : "shared", backlog, total, failed);
+    for (int i = 0; i < acceptor_count && n >= 0 && (size_t)n < size; i++) {
+        n += snprintf(buf + n, size - n, "%s%llu", i ? "," : "",
+                      __atomic_load_n(&acceptors[i].accepted, __ATOMIC_RELAXED));
+    }
+    if (n >= 0 && (size_t)n < size) n += snprintf(buf + n, size - n, "\n");
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
@@ -2,104 +2,239 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include "common.h"
 #include "network.h"
+#include "metrics.h"
+#include "trace.h"
+#include "ratelimit.h"
+#include "stream.h"
+#include "file_cache.h"
+#include "versions.h"
+#include "storage.h"
+#include "meta_snap.h"
+#include "resume.h"
+#include "listener.h"
+#include "config.h"
+#include "conn_timeout.h"
+#include "upgrade.h"
+#include "replication.h"
+#include "search_index.h"
+#include "quota.h"
 
 // Declare external functions
-void add_session(int sockfd, struct sockaddr_in addr);
+int add_session(int sockfd, struct sockaddr_in addr);
 void remove_session(int sockfd);
+Session *find_session(int sockfd);
 void process_client_request(int sockfd, int msg_type, char *payload);
+int process_stream_packet(int sockfd, int stream_id, int msg_type, char *payload, int payload_len);
 void log_activity(const char *msg);
 
+// Socket options of a new connection (config.h, read per connection so a
+// reload applies to the next ones)
+static void apply_socket_options(int sock) {
+    int val = (int)config_get(CFG_TCP_NODELAY);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    if ((val = (int)config_get(CFG_SOCKET_SNDBUF)) > 0)
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val));
+    if ((val = (int)config_get(CFG_SOCKET_RCVBUF)) > 0)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+}
+
+// SIGHUP: push the reloadable values to the modules that cache them
+static void apply_config() {
+    file_cache_init();
+    versions_init();
+    trace_set_sample_rate((int)config_get(CFG_TRACE_SAMPLE));
+}
+
+// Threads that change the tree on their own. Path locks only exclude the
+// threads of one process, so a takeover starts them once the old one is gone.
+static void start_tree_writers() {
+    storage_start_rebalancer();
+    versions_start_sweeper();
+    repl_start_follower();
+}
+
 // Thread function
 void *client_handler(void *arg) {
-    int sock = *(int*)arg;
-    free(arg);
+    AcceptedConn *conn = (AcceptedConn *)arg;
+    int sock = conn->sockfd;
+    char log_msg[100];
+
+    // --- ADD SESSION --- (here rather than in the acceptor, which only accepts)
+    if (add_session(sock, conn->addr) < 0) {
+        send_packet(sock, MSG_ERROR, "Server busy, try again later", 28);
+        sprintf(log_msg, "Connection from %s refused: max_clients reached", inet_ntoa(conn->addr.sin_addr));
+        log_activity(log_msg);
+        free(conn);
+        close(sock);
+        return NULL;
+    }
+    apply_socket_options(sock);
+
+    if (conn->restored) {
+        // Handed over by the previous process: same client, same login
+        Session *sess = find_session(sock);
+        Session *prev = conn->restored;
+        sess->user_id = prev->user_id;
+        sess->is_logged_in = prev->is_logged_in;
+        snprintf(sess->username, sizeof(sess->username), "%s", prev->username);
+        if (prev->resume_token[0] && resume_import(prev->resume_token, sock, prev->user_id, prev->username, 0) == 0)
+            memcpy(sess->resume_token, prev->resume_token, sizeof(sess->resume_token));
+        sprintf(log_msg, "Connection from %s (%.49s) handed over", inet_ntoa(conn->addr.sin_addr), prev->username);
+        free(prev);
+    } else {
+        sprintf(log_msg, "New connection from %s", inet_ntoa(conn->addr.sin_addr));
+    }
+    log_activity(log_msg);
+    free(conn);
 
     int msg_type;
-    char buffer[BUFFER_SIZE];
+    int stream_id;
+    char buffer[BUFFER_SIZE + 1];
     int payload_len;
 
-    // Loop to receive packets
-    while ((payload_len = recv_packet(sock, &msg_type, buffer)) >= 0) {
-        process_client_request(sock, msg_type, buffer);
-    }
+    ConnTimer timer;
+    conn_timeout_start(&timer, sock);
+    long long last_rx_ms = timer_now_ms();
+    int handed_off = 0, handoff_failed = 0;
+
+    // Loop to receive packets, interleaved with chunks of active downloads
+    while (1) {
+        // The upgrade descriptor wakes idle connections up for a handover;
+        // a rate-limited upload leaves the socket unread for a while
+        short events = stream_read_blocked() ? 0 : POLLIN;
+        struct pollfd pfd[2] = {{sock, events, 0}, {upgrade_in_progress() ? -1 : upgrade_wake_fd(), POLLIN, 0}};
+        int ready = poll(pfd, 2, stream_poll_timeout());
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfd[0].revents) {
+            payload_len = recv_packet_stream(sock, &stream_id, &msg_type, buffer);
+            if (payload_len < 0) break;
+            last_rx_ms = timer_now_ms();
+
+            if (msg_type == MSG_FILE_DATA || msg_type == MSG_FILE_END || msg_type == MSG_FILE_ERROR ||
+                msg_type == MSG_TRANSFER_PAUSE || msg_type == MSG_TRANSFER_RESUME) {
+                // Transfer frame: upload data, or cancel/pause/resume of a transfer
+                process_stream_packet(sock, stream_id, msg_type, buffer, payload_len);
+            } else {
+                net_reply_stream = stream_id; // Replies go back on the request's stream
+                trace_begin_request(msg_type); // Assigns the request ID used by all spans
+                process_client_request(sock, msg_type, buffer);
+                trace_end_request();
+                net_reply_stream = 0;
+            }
+        }
 
-    // Client disconnected
+        stream_pump(sock); // One chunk per ready download (round-robin)
+
+        // Idle only counts while no transfer is running
+        long long stall_base, transfer_base;
+        stream_timeout_bases(&stall_base, &transfer_base);
+        conn_timeout_update(&timer, stall_base ? 0 : last_rx_ms, stall_base, transfer_base);
+
+        // A new process took over: between requests and with no transfer
+        // running, the connection moves there; otherwise it drains here
+        if (upgrade_in_progress() && !handoff_failed && stream_active_count() == 0) {
+            conn_timeout_stop(&timer); // A shutdown() would cut the new process off too
+            if (upgrade_handoff(sock, find_session(sock)) == 0) {
+                handed_off = 1;
+                break;
+            }
+            handoff_failed = 1;
+            conn_timeout_start(&timer, sock);
+        }
+    }
+    conn_timeout_stop(&timer); // Before close(): the wheel may shut the socket down until here
+
+    // Client disconnected: a logged-in session keeps its transfers for a
+    // resume, unless it was reaped for being idle (the token goes too) or
+    // for exceeding the transfer time limit (the transfers go)
+    Session *sess = find_session(sock);
+    if (handed_off) {
+        // Served by the new process now, token included
+    } else if (sess && sess->resume_token[0] && timer.expired == CONN_TIMEOUT_IDLE) {
+        resume_revoke(sess->resume_token);
+    } else if (sess && sess->resume_token[0] && timer.expired == CONN_TIMEOUT_TRANSFER) {
+        stream_close_all(sock);
+        resume_detach(sess->resume_token, sock, NULL, 0);
+    } else if (sess && sess->resume_token[0]) {
+        Stream detached[MAX_STREAMS_PER_CONN];
+        int count = stream_detach_all(detached, MAX_STREAMS_PER_CONN);
+        resume_detach(sess->resume_token, sock, detached, count);
+    }
+    stream_close_all(sock);
     remove_session(sock); // <--- REMOVE SESSION
-    
-    char log_msg[50];
-    sprintf(log_msg, "Client (Socket %d) disconnected.", sock);
+    rl_remove_session(sock);
+
+    if (handed_off) {
+        sprintf(log_msg, "Client (Socket %d) handed over to the new process.", sock);
+    } else if (timer.expired) {
+        sprintf(log_msg, "Client (Socket %d) timed out (%s), disconnected.", sock, conn_timeout_reason(timer.expired));
+    } else {
+        sprintf(log_msg, "Client (Socket %d) disconnected.", sock);
+    }
     log_activity(log_msg);
     
     close(sock);
     return NULL;
 }
 
-int main() {
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(SERVER_PORT);
-
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
-        perror("Fail to create server socket");
-        exit(EXIT_FAILURE);
-    }
+int main(int argc, char *argv[]) {
+    // --takeover: replace the server running in this folder without
+    // dropping connections (upgrade.h)
+    int takeover = argc > 1 && strcmp(argv[1], "--takeover") == 0;
 
-    int opt = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    config_init(); // First: everything below reads it (and it blocks SIGHUP)
+    trace_init(); // Before any thread is created (sets the signal mask)
 
-    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Fail to bind");
-        close(server_sock);
+    // Bind first: a second instance must fail before touching staging files
+    int port = (int)config_get(CFG_PORT);
+    int acceptor_count = takeover ? upgrade_takeover() : listener_open(port);
+    if (acceptor_count < 0) {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_sock, 10) < 0) {
-        perror("Fail to listen");
-        close(server_sock);
-        exit(EXIT_FAILURE);
+    file_cache_init();
+    storage_init(takeover);
+    versions_init();
+    repl_init();
+    search_index_init();
+    rl_load_config(RATELIMIT_CONF);
+    quota_load(QUOTA_CONF);
+
+    // Serve metadata from the last snapshot right away; a stale or missing
+    // one is rebuilt in the background while lookups fall back to the .txt files
+    if (meta_snap_open(META_SNAP_FILE) == 0) {
+        char info[256];
+        meta_snap_format_info(info, sizeof(info));
+        printf("Metadata snapshot loaded: %s", info);
     }
-    
-    printf("Server started. Listening on port %d...\n", SERVER_PORT);
-    log_activity("Server started.");
+    meta_snap_start_refresher(META_SNAP_FILE, META_SNAP_REFRESH_INTERVAL);
 
-    while(1) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
-
-        if (client_sock < 0) {
-            perror("Accept failed");
-            continue;
-        }
-
-        // --- ADD SESSION ---
-        add_session(client_sock, client_addr);
-        
-        char log_msg[100];
-        sprintf(log_msg, "New connection from %s", inet_ntoa(client_addr.sin_addr));
-        log_activity(log_msg);
-
-        // Create Thread
-        pthread_t tid;
-        int *new_sock = malloc(sizeof(int));
-        *new_sock = client_sock;
-        if (pthread_create(&tid, NULL, client_handler, (void*)new_sock) < 0) {
-            perror("Thread creation failed");
-            free(new_sock);
-            close(client_sock);
-            continue;
-        }
-        pthread_detach(tid);
-    }
+    printf("Server started. Listening on port %d (%d acceptors)...\n", port, acceptor_count);
+    log_activity("Server started.");
 
-    close(server_sock);
+    metrics_start_dumper(METRICS_FILE, METRICS_DUMP_INTERVAL);
+    config_start_reloader(apply_config);
+    timer_wheel_start();
+    resume_start_sweeper();
+    if (takeover) upgrade_start_receiver(client_handler, start_tree_writers);
+    else start_tree_writers();
+    upgrade_listen();
+
+    listener_run(client_handler); // Returns once a new process took the sockets over
+    upgrade_drain();
+    log_activity("Server stopped (replaced by a new process).");
     return 0;
 }
\ No newline at end of file
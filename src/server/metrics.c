@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "common.h"
+#include "protocol.h"
+#include "network.h"
+#include "metrics.h"
+#include "file_cache.h"
+#include "storage.h"
+#include "meta_snap.h"
+#include "resume.h"
+#include "listener.h"
+#include "config.h"
+#include "conn_timeout.h"
+#include "replication.h"
+#include "search_index.h"
+#include "quota.h"
+#include "versions.h"
+
+Session *find_session(int sockfd);
+
+// --- HDR-STYLE LOG-LINEAR HISTOGRAM ---
+// Values are bucketed by their highest set bit, then split into
+// HIST_SUB_COUNT linear sub-buckets: ~12% worst-case relative error,
+// constant memory, and O(1) recording.
+#define HIST_SUB_BITS 3
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40 // ~18 minutes in ns, anything above lands in the last bucket
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t max_ns;
+    uint64_t hist[HIST_BUCKETS];
+} TypeStats;
+
+// One block per live thread. Only the owner writes; readers merge with relaxed loads.
+typedef struct ThreadStats {
+    TypeStats *types[METRICS_MAX_TYPES]; // Allocated lazily on first request of that type
+    int in_use;
+    struct ThreadStats *next;
+} ThreadStats;
+
+static ThreadStats *all_blocks = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t block_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static __thread ThreadStats *my_block = NULL;
+static time_t start_time = 0;
+
+static const char *type_names[] = {
+    "MSG_CONNECT", "MSG_DISCONNECT", "MSG_SUCCESS", "MSG_ERROR",
+    "MSG_REGISTER", "MSG_LOGIN", "MSG_LOGOUT", "MSG_CHANGE_PASS", "MSG_DELETE_ACCOUNT",
+    "MSG_CREATE_GROUP", "MSG_LIST_GROUPS", "MSG_JOIN_GROUP", "MSG_LEAVE_GROUP",
+    "MSG_LIST_MEMBERS", "MSG_KICK_MEMBER", "MSG_INVITE_MEMBER", "MSG_APPROVE_MEMBER",
+    "MSG_DELETE_GROUP",
+    "MSG_CREATE_FOLDER", "MSG_DELETE_ITEM", "MSG_RENAME_ITEM", "MSG_MOVE_ITEM", "MSG_COPY_ITEM",
+    "MSG_UPLOAD_REQ", "MSG_DOWNLOAD_REQ", "MSG_FILE_DATA", "MSG_FILE_END", "MSG_FILE_ERROR",
+    "MSG_LIST_FILES", "MSG_LIST_RESPONSE",
+    "MSG_STATS",
+    "MSG_TRANSFER_PAUSE", "MSG_TRANSFER_RESUME",
+    "MSG_CREATE_FOLDERS", "MSG_LIST_TREE", "MSG_NOT_MODIFIED",
+    "MSG_LIST_VERSIONS", "MSG_DOWNLOAD_VERSION", "MSG_RESTORE_VERSION",
+    "MSG_RESUME_SESSION", "MSG_RESUME_TRANSFER",
+    "MSG_CLUSTER_AUTH", "MSG_CLUSTER_CREATE_GROUP",
+    "MSG_SEARCH", "MSG_FOLDER_STATS"};
+
+const char *msg_type_name(int msg_type)
+{
+    if (msg_type >= 0 && msg_type < (int)(sizeof(type_names) / sizeof(type_names[0])))
+        return type_names[msg_type];
+    return "MSG_UNKNOWN";
+}
+
+static int hist_index(uint64_t v)
+{
+    if (v < HIST_SUB_COUNT)
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    if (msb >= HIST_MAX_BITS)
+        return HIST_BUCKETS - 1;
+    int shift = msb - HIST_SUB_BITS;
+    int sub = (int)(v >> shift) & (HIST_SUB_COUNT - 1);
+    return (shift + 1) * HIST_SUB_COUNT + sub;
+}
+
+// Highest value that maps to bucket 'idx'
+static uint64_t hist_value(int idx)
+{
+    if (idx < HIST_SUB_COUNT)
+        return (uint64_t)idx;
+    int shift = idx / HIST_SUB_COUNT - 1;
+    uint64_t base = (uint64_t)(HIST_SUB_COUNT + idx % HIST_SUB_COUNT) << shift;
+    return base + ((1ULL << shift) - 1);
+}
+
+// --- PER-THREAD BLOCK MANAGEMENT ---
+
+// Thread exit: keep the counters (they are cumulative) but let a new thread reuse the block
+static void release_block(void *arg)
+{
+    ThreadStats *b = (ThreadStats *)arg;
+    __atomic_store_n(&b->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_key()
+{
+    pthread_key_create(&block_key, release_block);
+}
+
+static ThreadStats *get_block()
+{
+    if (my_block)
+        return my_block;
+
+    pthread_once(&key_once, make_key);
+    pthread_mutex_lock(&registry_lock);
+    ThreadStats *b;
+    for (b = all_blocks; b != NULL; b = b->next)
+    {
+        if (!__atomic_load_n(&b->in_use, __ATOMIC_ACQUIRE))
+            break;
+    }
+    if (b == NULL)
+    {
+        b = calloc(1, sizeof(ThreadStats));
+        if (b == NULL)
+        {
+            pthread_mutex_unlock(&registry_lock);
+            return NULL;
+        }
+        b->next = all_blocks;
+        __atomic_store_n(&all_blocks, b, __ATOMIC_RELEASE);
+    }
+    b->in_use = 1;
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_setspecific(block_key, b);
+    my_block = b;
+    return b;
+}
+
+static inline void add_relaxed(uint64_t *p, uint64_t v)
+{
+    // Single writer: a relaxed load + store is enough and avoids a locked RMW
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+void metrics_record(int msg_type, unsigned long long latency_ns,
+                    unsigned long long bytes_in, unsigned long long bytes_out, int is_error)
+{
+    if (msg_type < 0 || msg_type >= METRICS_MAX_TYPES)
+        return;
+
+    ThreadStats *b = get_block();
+    if (b == NULL)
+        return;
+
+    TypeStats *t = b->types[msg_type];
+    if (t == NULL)
+    {
+        t = calloc(1, sizeof(TypeStats));
+        if (t == NULL)
+            return;
+        __atomic_store_n(&b->types[msg_type], t, __ATOMIC_RELEASE);
+    }
+
+    add_relaxed(&t->count, 1);
+    add_relaxed(&t->bytes_in, bytes_in);
+    add_relaxed(&t->bytes_out, bytes_out);
+    if (is_error)
+        add_relaxed(&t->errors, 1);
+    if (latency_ns > __atomic_load_n(&t->max_ns, __ATOMIC_RELAXED))
+        __atomic_store_n(&t->max_ns, latency_ns, __ATOMIC_RELAXED);
+    add_relaxed(&t->hist[hist_index(latency_ns)], 1);
+}
+
+// --- MERGE & REPORT ---
+
+static void merge_type(int msg_type, TypeStats *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (ThreadStats *b = __atomic_load_n(&all_blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next)
+    {
+        TypeStats *t = __atomic_load_n(&b->types[msg_type], __ATOMIC_ACQUIRE);
+        if (t == NULL)
+            continue;
+        out->count += __atomic_load_n(&t->count, __ATOMIC_RELAXED);
+        out->errors += __atomic_load_n(&t->errors, __ATOMIC_RELAXED);
+        out->bytes_in += __atomic_load_n(&t->bytes_in, __ATOMIC_RELAXED);
+        out->bytes_out += __atomic_load_n(&t->bytes_out, __ATOMIC_RELAXED);
+        uint64_t m = __atomic_load_n(&t->max_ns, __ATOMIC_RELAXED);
+        if (m > out->max_ns)
+            out->max_ns = m;
+        for (int i = 0; i < HIST_BUCKETS; i++)
+            out->hist[i] += __atomic_load_n(&t->hist[i], __ATOMIC_RELAXED);
+    }
+}
+
+static uint64_t percentile(const TypeStats *t, double pct)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += t->hist[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(pct / 100.0 * total + 0.5);
+    if (target < 1)
+        target = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += t->hist[i];
+        if (seen >= target)
+        {
+            uint64_t v = hist_value(i);
+            return v < t->max_ns ? v : t->max_ns;
+        }
+    }
+    return t->max_ns;
+}
+
+int metrics_format(char *buffer, size_t size)
+{
+    if (start_time == 0)
+        start_time = time(NULL);
+
+    size_t len = 0;
+    len += snprintf(buffer + len, size - len, "--- Server Stats (uptime %lds) ---\n",
+                    (long)(time(NULL) - start_time));
+    len += snprintf(buffer + len, size - len, "%-20s %7s %5s %9s %9s %8s %8s %8s %8s\n",
+                    "TYPE", "COUNT", "ERR", "IN(KB)", "OUT(KB)", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+
+    TypeStats *merged = malloc(sizeof(TypeStats));
+    if (merged == NULL)
+        return (int)len;
+
+    for (int type = 0; type < METRICS_MAX_TYPES && len < size; type++)
+    {
+        merge_type(type, merged);
+        if (merged->count == 0)
+            continue;
+        len += snprintf(buffer + len, size - len, "%-20s %7llu %5llu %9.1f %9.1f %8.0f %8.0f %8.0f %8.0f\n",
+                        msg_type_name(type),
+                        (unsigned long long)merged->count, (unsigned long long)merged->errors,
+                        merged->bytes_in / 1024.0, merged->bytes_out / 1024.0,
+                        percentile(merged, 50.0) / 1000.0, percentile(merged, 99.0) / 1000.0,
+                        percentile(merged, 99.9) / 1000.0, merged->max_ns / 1000.0);
+    }
+    free(merged);
+
+    if (len >= size)
+        len = size - 1;
+    return (int)len;
+}
+
+// --- PERIODIC DUMP ---
+
+typedef struct {
+    char path[256];
+    int interval_sec;
+} DumperArgs;
+
+static void *dumper_thread(void *arg)
+{
+    DumperArgs *a = (DumperArgs *)arg;
+    char *buffer = malloc(METRICS_REPORT_SIZE);
+    if (buffer == NULL)
+        return NULL;
+
+    while (1)
+    {
+        sleep(a->interval_sec);
+        metrics_format(buffer, METRICS_REPORT_SIZE);
+
+        // Write to a temp file and rename so readers never see a half-written dump
+        char tmp_path[300];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", a->path, (int)getpid());
+        FILE *f = fopen(tmp_path, "w");
+        if (!f)
+            continue;
+        fputs(buffer, f);
+        fclose(f);
+        rename(tmp_path, a->path);
+    }
+    return NULL;
+}
+
+void metrics_start_dumper(const char *path, int interval_sec)
+{
+    if (start_time == 0)
+        start_time = time(NULL);
+
+    DumperArgs *a = malloc(sizeof(DumperArgs));
+    if (a == NULL)
+        return;
+    snprintf(a->path, sizeof(a->path), "%s", path);
+    a->interval_sec = interval_sec > 0 ? interval_sec : METRICS_DUMP_INTERVAL;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, dumper_thread, a) != 0)
+    {
+        perror("Metrics thread creation failed");
+        free(a);
+        return;
+    }
+    pthread_detach(tid);
+}
+
+// --- MODULE HANDLER ---
+
+// Module lines appended after the request table, in this order
+static int (*const stats_sections[])(char *buf, size_t size) = {
+    file_cache_format_stats,
+    storage_format_stats,
+    versions_format_stats,
+    meta_snap_format_info,
+    resume_format_stats,
+    listener_format_stats,
+    config_format_stats,
+    conn_timeout_format_stats,
+    repl_format_stats,
+    search_index_format_stats,
+    quota_format_stats,
+};
+
+void handle_stats(int sockfd)
+{
+    Session *s = find_session(sockfd);
+    if (!s || !s->is_logged_in)
+    {
+        send_packet(sockfd, MSG_ERROR, "Login required", 14);
+        return;
+    }
+
+    char *buffer = malloc(METRICS_REPORT_SIZE);
+    if (buffer == NULL)
+    {
+        send_packet(sockfd, MSG_ERROR, "Server out of memory", 20);
+        return;
+    }
+    size_t len = metrics_format(buffer, METRICS_REPORT_SIZE);
+    for (size_t i = 0; i < sizeof(stats_sections) / sizeof(stats_sections[0]); i++) {
+        if (len >= METRICS_REPORT_SIZE - 1) break; // Full: the rest is cut off
+        len += stats_sections[i](buffer + len, METRICS_REPORT_SIZE - len);
+    }
+
+    // Chunks end on a line boundary, MSG_SUCCESS ends the report
+    size_t pos = 0;
+    while (pos < len)
+    {
+        size_t n = len - pos;
+        if (n > BUFFER_SIZE)
+        {
+            n = BUFFER_SIZE;
+            while (n > 0 && buffer[pos + n - 1] != '\n')
+                n--;
+            if (n == 0)
+                n = BUFFER_SIZE;
+        }
+        send_packet(sockfd, MSG_STATS, buffer + pos, n);
+        pos += n;
+    }
+    free(buffer);
+    send_packet(sockfd, MSG_SUCCESS, "End of statistics", 17);
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "path_lock.h"
+
+// Holders of each mode on one path. Entries exist only while some count is
+// non-zero, so the table stays as small as the set of busy paths.
+typedef struct LockEntry {
+    char path[PATH_LOCK_MAX_PATH];
+    int counts[LOCK_MODE_COUNT];
+    struct LockEntry *next;
+} LockEntry;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    LockEntry *buckets[PATH_LOCK_BUCKETS];
+} LockShard;
+
+static LockShard shards[PATH_LOCK_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+// compatible[held][requested]
+static const int compatible[LOCK_MODE_COUNT][LOCK_MODE_COUNT] = {
+    /* IS */ {1, 1, 1, 0},
+    /* IX */ {1, 1, 0, 0},
+    /* S  */ {1, 0, 1, 0},
+    /* X  */ {0, 0, 0, 0},
+};
+
+static void shards_init() {
+    for (int i = 0; i < PATH_LOCK_SHARDS; i++) pthread_mutex_init(&shards[i].mutex, NULL);
+}
+
+static unsigned int hash_path(const char *s, size_t len) {
+    unsigned int h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+void path_lock_normalize(const char *path, char *out, size_t size) {
+    size_t o = 0;
+    while (*path && o + 1 < size) {
+        while (*path == '/') path++;
+        const char *end = strchr(path, '/');
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+
+        if (len == 0) break;
+        if (!(len == 1 && path[0] == '.')) {
+            if (o > 0 && o + 1 < size) out[o++] = '/';
+            for (size_t i = 0; i < len && o + 1 < size; i++) out[o++] = path[i];
+        }
+        path += len;
+    }
+    out[o] = '\0';
+}
+
+// Adjusts one path's count for `mode` (delta = +1 tries to take, -1 releases)
+static int lock_one(const char *path, size_t len, int mode, int delta) {
+    unsigned int h = hash_path(path, len);
+    LockShard *shard = &shards[h % PATH_LOCK_SHARDS];
+    LockEntry **bucket = &shard->buckets[(h / PATH_LOCK_SHARDS) % PATH_LOCK_BUCKETS];
+    int ok = 1;
+
+    pthread_mutex_lock(&shard->mutex);
+    LockEntry **pp = bucket;
+    while (*pp && !(strncmp((*pp)->path, path, len) == 0 && (*pp)->path[len] == '\0')) pp = &(*pp)->next;
+    LockEntry *e = *pp;
+
+    if (delta > 0) {
+        if (e) {
+            for (int m = 0; m < LOCK_MODE_COUNT; m++) {
+                if (e->counts[m] > 0 && !compatible[m][mode]) ok = 0;
+            }
+        } else {
+            e = calloc(1, sizeof(LockEntry));
+            if (e == NULL) {
+                // Out of memory: reported as busy, path_lock_try() undoes the ancestors
+                pthread_mutex_unlock(&shard->mutex);
+                return 0;
+            }
+            memcpy(e->path, path, len);
+            e->path[len] = '\0';
+            e->next = *bucket;
+            *bucket = e;
+            pp = bucket;
+        }
+        if (ok) e->counts[mode]++;
+    } else if (e) {
+        e->counts[mode]--;
+    }
+
+    // Drop idle entries
+    if (e) {
+        int idle = 1;
+        for (int m = 0; m < LOCK_MODE_COUNT; m++) {
+            if (e->counts[m] > 0) idle = 0;
+        }
+        if (idle) {
+            *pp = e->next;
+            free(e);
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return ok;
+}
+
+int path_lock_try(PathLock *lock, const char *path, int mode) {
+    pthread_once(&shards_once, shards_init);
+
+    lock->held = 0;
+    lock->mode = mode;
+    path_lock_normalize(path, lock->path, sizeof(lock->path));
+    int intent = mode == LOCK_MODE_X ? LOCK_MODE_IX : LOCK_MODE_IS;
+
+    // Root to leaf: intent on each ancestor, then the path itself.
+    // Try-locks cannot deadlock, so no global ordering is needed.
+    const char *p = lock->path;
+    size_t len = strlen(p);
+    size_t pos = 0;
+    while (1) {
+        const char *slash = strchr(p + pos, '/');
+        size_t end = slash ? (size_t)(slash - p) : len;
+        int m = slash ? intent : mode;
+
+        if (!lock_one(p, end, m, +1)) {
+            // Undo the ancestors taken so far
+            for (const char *q = strchr(p, '/'); q && (size_t)(q - p) < end; q = strchr(q + 1, '/'))
+                lock_one(p, q - p, intent, -1);
+            return -1;
+        }
+        if (!slash) break;
+        pos = end + 1;
+    }
+
+    lock->held = 1;
+    return 0;
+}
+
+void path_lock_release(PathLock *lock) {
+    if (!lock->held) return;
+    int intent = lock->mode == LOCK_MODE_X ? LOCK_MODE_IX : LOCK_MODE_IS;
+    const char *p = lock->path;
+
+    for (const char *q = strchr(p, '/'); q; q = strchr(q + 1, '/'))
+        lock_one(p, q - p, intent, -1);
+    lock_one(p, strlen(p), lock->mode, -1);
+    lock->held = 0;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "quota.h"
+#include "search_index.h"
+#include "path_lock.h"
+
+void log_activity(const char *msg);
+
+typedef struct {
+    int id;              // 0 = empty slot
+    long long limit;     // Override from QUOTA_CONF, -1 = the default
+    long long reserved;  // Admitted uploads not committed yet
+} QuotaEntry;
+
+// Group or user ID -> entry, open addressing; entries are never removed
+typedef struct {
+    QuotaEntry *slots;
+    size_t cap, count;
+} QuotaTable;
+
+typedef struct {
+    int is_user;
+    int id;
+    long long limit;
+} QuotaRule;
+
+static pthread_mutex_t quota_lock = PTHREAD_MUTEX_INITIALIZER;
+static QuotaTable groups = {NULL, 0, 0}, users = {NULL, 0, 0};
+static long long default_group = 0, default_user = 0;
+static int rule_count = 0;
+static unsigned long long stat_admitted = 0, stat_refused = 0;
+
+// --- TABLES (quota_lock held) ---
+
+static size_t slot_of(int id, size_t cap) {
+    unsigned int h = (unsigned int)id * 2654435761u;
+    return (h ^ (h >> 15)) & (cap - 1);
+}
+
+static QuotaEntry *table_find(QuotaTable *t, int id, int create) {
+    if (create && (t->count + 1) * 2 > t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 64;
+        QuotaEntry *slots = calloc(cap, sizeof(QuotaEntry));
+        if (!slots) return NULL;
+        for (size_t i = 0; i < t->cap; i++) {
+            if (!t->slots[i].id) continue;
+            size_t j = slot_of(t->slots[i].id, cap);
+            while (slots[j].id) j = (j + 1) & (cap - 1);
+            slots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->cap = cap;
+    }
+    if (t->cap == 0) return NULL;
+
+    size_t i = slot_of(id, t->cap);
+    while (t->slots[i].id && t->slots[i].id != id) i = (i + 1) & (t->cap - 1);
+    if (t->slots[i].id) return &t->slots[i];
+    if (!create) return NULL;
+    t->slots[i].id = id;
+    t->slots[i].limit = -1;
+    t->count++;
+    return &t->slots[i];
+}
+
+static long long limit_of(QuotaTable *t, int id, long long def) {
+    QuotaEntry *e = table_find(t, id, 0);
+    return e && e->limit >= 0 ? e->limit : def;
+}
+
+// --- CONFIG ---
+
+int quota_load(const char *path) {
+    QuotaRule *rules = malloc(sizeof(QuotaRule) * QUOTA_MAX_RULES);
+    if (!rules) return -1;
+    long long next_group = 0, next_user = 0;
+    int count = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f) {
+        char line[256], key[64];
+        long long bytes;
+        int id;
+        while (fgets(line, sizeof(line), f)) {
+            if (line[0] == '#' || sscanf(line, "%63s", key) != 1) continue;
+            if ((strcmp(key, "group") == 0 || strcmp(key, "user") == 0) &&
+                sscanf(line, "%*s %d %lld", &id, &bytes) == 2 && id > 0 && bytes >= 0) {
+                if (count < QUOTA_MAX_RULES) rules[count++] = (QuotaRule){key[0] == 'u', id, bytes};
+            } else if (strcmp(key, "group_quota") == 0 && sscanf(line, "%*s %lld", &bytes) == 1 && bytes >= 0) {
+                next_group = bytes;
+            } else if (strcmp(key, "user_quota") == 0 && sscanf(line, "%*s %lld", &bytes) == 1 && bytes >= 0) {
+                next_user = bytes;
+            }
+        }
+        fclose(f);
+    }
+
+    // Reservations stay: they are returned against the same entries
+    pthread_mutex_lock(&quota_lock);
+    for (size_t i = 0; i < groups.cap; i++) groups.slots[i].limit = -1;
+    for (size_t i = 0; i < users.cap; i++) users.slots[i].limit = -1;
+    for (int i = 0; i < count; i++) {
+        QuotaEntry *e = table_find(rules[i].is_user ? &users : &groups, rules[i].id, 1);
+        if (e) e->limit = rules[i].limit;
+    }
+    default_group = next_group;
+    default_user = next_user;
+    rule_count = count;
+    pthread_mutex_unlock(&quota_lock);
+    free(rules);
+
+    if (f) {
+        char log_msg[160];
+        snprintf(log_msg, sizeof(log_msg), "Quotas loaded: group %lld, user %lld bytes, %d overrides", next_group,
+                 next_user, count);
+        log_activity(log_msg);
+    }
+    return f ? 0 : -1;
+}
+
+// --- ADMISSION ---
+
+int quota_reserve(int user_id, const char *filename, long long bytes, QuotaReservation *r, char *err,
+                  size_t err_size) {
+    memset(r, 0, sizeof(*r));
+    char name[PATH_LOCK_MAX_PATH];
+    path_lock_normalize(filename, name, sizeof(name));
+    int group_id = 0;
+    if (strncmp(name, "Group_", 6) != 0 || sscanf(name, "Group_%d", &group_id) != 1 || group_id < 0) group_id = 0;
+
+    pthread_mutex_lock(&quota_lock);
+    long long group_limit = group_id > 0 ? limit_of(&groups, group_id, default_group) : 0;
+    long long user_limit = user_id > 0 ? limit_of(&users, user_id, default_user) : 0;
+    if (!group_limit && !user_limit) {
+        pthread_mutex_unlock(&quota_lock);
+        return 0;
+    }
+    if (!search_index_ready()) {
+        pthread_mutex_unlock(&quota_lock);
+        stat_refused++;
+        snprintf(err, err_size, "Storage usage is still being counted. Try again shortly.");
+        return -1;
+    }
+
+    // Replacing a file frees its old size (for the user: if it was theirs)
+    long long old_size = 0;
+    int old_owner = 0;
+    search_index_file_info(name, &old_size, &old_owner);
+    long long growth = bytes > old_size ? bytes - old_size : 0;
+    long long group_charge = growth;
+    long long user_charge = old_owner == user_id ? growth : bytes;
+
+    QuotaEntry *g = group_limit ? table_find(&groups, group_id, 1) : NULL;
+    QuotaEntry *u = user_limit ? table_find(&users, user_id, 1) : NULL;
+    if ((group_limit && !g) || (user_limit && !u)) {
+        pthread_mutex_unlock(&quota_lock);
+        snprintf(err, err_size, "Server out of memory.");
+        return -1;
+    }
+    if (g) {
+        char group_dir[32];
+        FolderStats fs;
+        snprintf(group_dir, sizeof(group_dir), "Group_%d", group_id);
+        long long used = (search_index_folder_stats(group_dir, &fs) == 0 ? fs.bytes : 0) + g->reserved;
+        if (used + group_charge > group_limit) {
+            pthread_mutex_unlock(&quota_lock);
+            stat_refused++;
+            snprintf(err, err_size, "Group quota exceeded: %lld of %lld bytes used, %lld more needed.", used,
+                     group_limit, group_charge);
+            return -1;
+        }
+    }
+    if (u) {
+        long long used = search_index_owner_bytes(user_id) + u->reserved;
+        if (used + user_charge > user_limit) {
+            pthread_mutex_unlock(&quota_lock);
+            stat_refused++;
+            snprintf(err, err_size, "User quota exceeded: %lld of %lld bytes used, %lld more needed.", used,
+                     user_limit, user_charge);
+            return -1;
+        }
+    }
+
+    if (g) {
+        g->reserved += group_charge;
+        r->group_id = group_id;
+        r->group_bytes = group_charge;
+    }
+    if (u) {
+        u->reserved += user_charge;
+        r->user_id = user_id;
+        r->user_bytes = user_charge;
+    }
+    r->limited = 1;
+    stat_admitted++;
+    pthread_mutex_unlock(&quota_lock);
+    return 0;
+}
+
+void quota_release(QuotaReservation *r) {
+    if (!r->group_bytes && !r->user_bytes) {
+        r->limited = 0;
+        return;
+    }
+    pthread_mutex_lock(&quota_lock);
+    QuotaEntry *g = r->group_bytes ? table_find(&groups, r->group_id, 0) : NULL;
+    QuotaEntry *u = r->user_bytes ? table_find(&users, r->user_id, 0) : NULL;
+    if (g) g->reserved -= r->group_bytes;
+    if (u) u->reserved -= r->user_bytes;
+    pthread_mutex_unlock(&quota_lock);
+    memset(r, 0, sizeof(*r));
+}
+
+int quota_format_stats(char *buf, size_t size) {
+    pthread_mutex_lock(&quota_lock);
+    long long group_reserved = 0, user_reserved = 0;
+    for (size_t i = 0; i < groups.cap; i++) group_reserved += groups.slots[i].reserved;
+    for (size_t i = 0; i < users.cap; i++) user_reserved += users.slots[i].reserved;
+    int n = snprintf(buf, size,
+                     "QUOTA group=%lld user=%lld overrides=%d reserved_group=%lld reserved_user=%lld admitted=%llu "
+                     "refused=%llu\n",
+                     default_group, default_user, rule_count, group_reserved, user_reserved, stat_admitted,
+                     stat_refused);
+    pthread_mutex_unlock(&quota_lock);
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "common.h"
+#include "config.h"
+#include "ratelimit.h"
+
+void log_activity(const char *msg);
+
+#define RL_MAX_GROUP_RULES 256
+#define RL_MAX_USER_CLASSES 1024
+
+typedef struct {
+    double tokens;  // May be negative (debt)
+    double rate;    // Bytes per second, 0 = unlimited
+    double burst;   // Bucket capacity in bytes
+    long long last_ns;
+} TokenBucket;
+
+typedef struct {
+    int sockfd;     // -1 = free slot
+    TokenBucket dir[2];
+} SessionBuckets;
+
+typedef struct {
+    int group_id;
+    double rate;
+    double burst;
+    TokenBucket bucket;
+} GroupRule;
+
+typedef struct {
+    // Limits (bytes/sec and bytes). 0 rate = unlimited.
+    double global_rate, global_burst;
+    double session_rate[2], session_burst;
+    double group_rate, group_burst;
+    double class_weight[RL_CLASS_COUNT];   // Multiplies the per-session rate
+    double class_reserve[RL_CLASS_COUNT];  // Fraction of shared burst this class must leave untouched
+    int user_ids[RL_MAX_USER_CLASSES];
+    int user_classes[RL_MAX_USER_CLASSES];
+    int user_count;
+} RateConfig;
+
+static RateConfig cfg;
+static TokenBucket global_bucket;
+static SessionBuckets *sessions_rl = NULL; // Grows with max_clients (twice: reconnects overlap)
+static int session_cap = 0;
+static GroupRule groups_rl[RL_MAX_GROUP_RULES];
+static int group_rule_count = 0;
+// Shared by the sessions / groups that found their table full, so they are
+// still limited (together) rather than not at all
+static SessionBuckets overflow_session;
+static GroupRule overflow_group;
+static int session_overflow_logged = 0, group_overflow_logged = 0;
+static pthread_mutex_t rl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void set_defaults(RateConfig *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->global_burst = 4 * 1024 * 1024;
+    c->session_burst = 1024 * 1024;
+    c->group_burst = 2 * 1024 * 1024;
+    c->class_weight[RL_CLASS_INTERACTIVE] = 2.0;
+    c->class_weight[RL_CLASS_NORMAL] = 1.0;
+    c->class_weight[RL_CLASS_BULK] = 0.5;
+    c->class_reserve[RL_CLASS_INTERACTIVE] = 0.0;
+    c->class_reserve[RL_CLASS_NORMAL] = 0.1;
+    c->class_reserve[RL_CLASS_BULK] = 0.5;
+}
+
+static int parse_class(const char *name)
+{
+    if (strcmp(name, "interactive") == 0)
+        return RL_CLASS_INTERACTIVE;
+    if (strcmp(name, "bulk") == 0)
+        return RL_CLASS_BULK;
+    return RL_CLASS_NORMAL;
+}
+
+// Applies a new rate/burst to a bucket without resetting its current level
+static void bucket_configure(TokenBucket *b, double rate, double burst)
+{
+    if (b->rate == 0 && rate > 0)
+    {
+        b->tokens = burst; // Newly limited: start with a full bucket
+        b->last_ns = now_ns();
+    }
+    b->rate = rate;
+    b->burst = burst;
+    if (b->tokens > burst)
+        b->tokens = burst;
+}
+
+/**
+ * @brief Refills then charges a bucket.
+ * @param reserve Tokens that must remain after the charge (priority headroom).
+ * @param charge 0 to only compute the wait (nothing is taken).
+ * @return Nanoseconds until the bucket is out of debt.
+ */
+static long long bucket_charge(TokenBucket *b, double bytes, double reserve, long long now, int charge)
+{
+    if (b->rate <= 0)
+        return 0;
+
+    b->tokens += b->rate * (double)(now - b->last_ns) / 1e9;
+    if (b->tokens > b->burst)
+        b->tokens = b->burst;
+    b->last_ns = now;
+
+    double left = b->tokens - bytes;
+    if (charge)
+        b->tokens = left;
+    double deficit = reserve - left;
+    if (deficit <= 0)
+        return 0;
+    return (long long)(deficit / b->rate * 1e9);
+}
+
+// --- CONFIG FILE ---
+// Format (one rule per line, '#' comments, rates in bytes/sec, 0 = unlimited):
+//   global_rate <bps>            global_burst <bytes>
+//   session_upload_rate <bps>    session_download_rate <bps>    session_burst <bytes>
+//   group_rate <bps>             group_burst <bytes>
+//   group <id> <bps> <burst>     (per-group override)
+//   user <id> interactive|normal|bulk
+//   class_weight <class> <w>     class_reserve <class> <fraction>
+
+int rl_load_config(const char *path)
+{
+    RateConfig next;
+    set_defaults(&next);
+    GroupRule rules[RL_MAX_GROUP_RULES];
+    int rule_count = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        char line[256], key[64], a[64];
+        double v1, v2;
+        int id;
+        while (fgets(line, sizeof(line), f))
+        {
+            if (line[0] == '#' || sscanf(line, "%63s", key) != 1)
+                continue;
+
+            if (strcmp(key, "group") == 0 && sscanf(line, "%*s %d %lf %lf", &id, &v1, &v2) == 3)
+            {
+                if (rule_count < RL_MAX_GROUP_RULES)
+                {
+                    memset(&rules[rule_count], 0, sizeof(GroupRule));
+                    rules[rule_count].group_id = id;
+                    rules[rule_count].rate = v1;
+                    rules[rule_count].burst = v2;
+                    rule_count++;
+                }
+            }
+            else if (strcmp(key, "user") == 0 && sscanf(line, "%*s %d %63s", &id, a) == 2)
+            {
+                if (next.user_count < RL_MAX_USER_CLASSES)
+                {
+                    next.user_ids[next.user_count] = id;
+                    next.user_classes[next.user_count] = parse_class(a);
+                    next.user_count++;
+                }
+            }
+            else if (strcmp(key, "class_weight") == 0 && sscanf(line, "%*s %63s %lf", a, &v1) == 2)
+                next.class_weight[parse_class(a)] = v1;
+            else if (strcmp(key, "class_reserve") == 0 && sscanf(line, "%*s %63s %lf", a, &v1) == 2)
+                next.class_reserve[parse_class(a)] = v1;
+            else if (sscanf(line, "%*s %lf", &v1) == 1)
+            {
+                if (strcmp(key, "global_rate") == 0) next.global_rate = v1;
+                else if (strcmp(key, "global_burst") == 0) next.global_burst = v1;
+                else if (strcmp(key, "session_upload_rate") == 0) next.session_rate[RL_UPLOAD] = v1;
+                else if (strcmp(key, "session_download_rate") == 0) next.session_rate[RL_DOWNLOAD] = v1;
+                else if (strcmp(key, "session_burst") == 0) next.session_burst = v1;
+                else if (strcmp(key, "group_rate") == 0) next.group_rate = v1;
+                else if (strcmp(key, "group_burst") == 0) next.group_burst = v1;
+            }
+        }
+        fclose(f);
+    }
+
+    pthread_mutex_lock(&rl_lock);
+    // Keep the live bucket state of groups that still have a rule
+    for (int i = 0; i < rule_count; i++)
+    {
+        for (int j = 0; j < group_rule_count; j++)
+        {
+            if (groups_rl[j].group_id == rules[i].group_id)
+                rules[i].bucket = groups_rl[j].bucket;
+        }
+    }
+    memcpy(groups_rl, rules, sizeof(GroupRule) * rule_count);
+    group_rule_count = rule_count;
+    cfg = next;
+    bucket_configure(&global_bucket, cfg.global_rate, cfg.global_burst);
+    pthread_mutex_unlock(&rl_lock);
+
+    if (!f)
+        return -1;
+    log_activity("Rate limit configuration (re)loaded.");
+    return 0;
+}
+
+// --- LOOKUPS (rl_lock held) ---
+
+static int class_of(int user_id)
+{
+    for (int i = 0; i < cfg.user_count; i++)
+    {
+        if (cfg.user_ids[i] == user_id)
+            return cfg.user_classes[i];
+    }
+    return RL_CLASS_NORMAL;
+}
+
+static SessionBuckets *session_slot(int sockfd)
+{
+    SessionBuckets *free_slot = NULL;
+    for (int i = 0; i < session_cap; i++)
+    {
+        if (sessions_rl[i].sockfd == sockfd && sessions_rl[i].dir[0].last_ns != 0)
+            return &sessions_rl[i];
+        if (free_slot == NULL && sessions_rl[i].dir[0].last_ns == 0)
+            free_slot = &sessions_rl[i];
+    }
+    long limit = config_get(CFG_MAX_CLIENTS) * 2;
+    if (free_slot == NULL && session_cap < limit)
+    {
+        int cap = session_cap ? session_cap * 2 : MAX_CLIENTS * 2;
+        if (cap > limit)
+            cap = (int)limit;
+        SessionBuckets *bigger = realloc(sessions_rl, cap * sizeof(*bigger));
+        if (bigger)
+        {
+            memset(bigger + session_cap, 0, (cap - session_cap) * sizeof(*bigger));
+            free_slot = &bigger[session_cap];
+            sessions_rl = bigger;
+            session_cap = cap;
+        }
+    }
+    if (free_slot == NULL)
+    {
+        if (!session_overflow_logged)
+        {
+            session_overflow_logged = 1;
+            log_activity("Rate limit: session table full, extra sessions share one bucket");
+        }
+        free_slot = &overflow_session;
+        if (free_slot->dir[0].last_ns != 0)
+            return free_slot;
+    }
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->sockfd = free_slot == &overflow_session ? -1 : sockfd;
+    free_slot->dir[0].last_ns = free_slot->dir[1].last_ns = now_ns();
+    return free_slot;
+}
+
+static TokenBucket *group_bucket(int group_id, double *rate, double *burst)
+{
+    for (int i = 0; i < group_rule_count; i++)
+    {
+        if (groups_rl[i].group_id == group_id)
+        {
+            *rate = groups_rl[i].rate;
+            *burst = groups_rl[i].burst;
+            return &groups_rl[i].bucket;
+        }
+    }
+    // No explicit rule: create one from the default group limits
+    if (cfg.group_rate <= 0)
+        return NULL;
+    GroupRule *r;
+    if (group_rule_count < RL_MAX_GROUP_RULES)
+    {
+        r = &groups_rl[group_rule_count++];
+        memset(r, 0, sizeof(*r));
+    }
+    else
+    {
+        if (!group_overflow_logged)
+        {
+            group_overflow_logged = 1;
+            log_activity("Rate limit: group table full, extra groups share one bucket");
+        }
+        r = &overflow_group; // Keeps its level: the bucket is shared
+    }
+    r->group_id = group_id;
+    r->rate = cfg.group_rate;
+    r->burst = cfg.group_burst;
+    *rate = r->rate;
+    *burst = r->burst;
+    return &r->bucket;
+}
+
+// Charges (or, with charge = 0, only checks) every bucket that applies
+static long long reserve_locked(int sockfd, int user_id, int group_id, int direction, long bytes, int charge)
+{
+    long long now = now_ns();
+    long long wait = 0, w;
+    int cls = class_of(user_id);
+
+    SessionBuckets *sb = session_slot(sockfd);
+    if (sb && cfg.session_rate[direction] > 0)
+    {
+        TokenBucket *b = &sb->dir[direction];
+        bucket_configure(b, cfg.session_rate[direction] * cfg.class_weight[cls], cfg.session_burst);
+        w = bucket_charge(b, bytes, 0, now, charge);
+        if (w > wait) wait = w;
+    }
+
+    if (group_id >= 0)
+    {
+        double rate = 0, burst = 0;
+        TokenBucket *b = group_bucket(group_id, &rate, &burst);
+        if (b)
+        {
+            bucket_configure(b, rate, burst);
+            w = bucket_charge(b, bytes, burst * cfg.class_reserve[cls], now, charge);
+            if (w > wait) wait = w;
+        }
+    }
+
+    w = bucket_charge(&global_bucket, bytes, global_bucket.burst * cfg.class_reserve[cls], now, charge);
+    if (w > wait) wait = w;
+    return wait;
+}
+
+// --- PUBLIC API ---
+
+long long rl_reserve(int sockfd, int user_id, int group_id, int direction, long bytes)
+{
+    pthread_mutex_lock(&rl_lock);
+    long long wait = reserve_locked(sockfd, user_id, group_id, direction, bytes, 1);
+    pthread_mutex_unlock(&rl_lock);
+    return wait;
+}
+
+int rl_try_reserve(int sockfd, int user_id, int group_id, int direction, long bytes)
+{
+    pthread_mutex_lock(&rl_lock);
+    int res = reserve_locked(sockfd, user_id, group_id, direction, bytes, 0) == 0 ? 0 : -1;
+    if (res == 0)
+        reserve_locked(sockfd, user_id, group_id, direction, bytes, 1);
+    pthread_mutex_unlock(&rl_lock);
+    return res;
+}
+
+void rl_remove_session(int sockfd)
+{
+    pthread_mutex_lock(&rl_lock);
+    for (int i = 0; i < session_cap; i++)
+    {
+        if (sessions_rl[i].sockfd == sockfd && sessions_rl[i].dir[0].last_ns != 0)
+            memset(&sessions_rl[i], 0, sizeof(SessionBuckets));
+    }
+    pthread_mutex_unlock(&rl_lock);
+}
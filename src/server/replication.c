@@ -0,0 +1,1047 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "network.h"
+#include "replication.h"
+#include "search_index.h"
+#include "config.h"
+#include "storage.h"
+#include "path_lock.h"
+#include "file_cache.h"
+
+void log_activity(const char *msg);
+int copy_single_file(const char *src_path, const char *dest_path);
+int copy_recursive(const char *src, const char *dest);
+int remove_directory_recursive(const char *path);
+int secret_matches(const char *expected, const char *secret);
+extern pthread_mutex_t db_mutex;
+
+// Messages on the replication port (PacketHeader framing, see network.h)
+enum {
+    REPL_SUBSCRIBE = 100, // Replica: "<secret|-> <log_id|-> <offset>"
+    REPL_CONTINUE,        // Primary: "<log_id> <offset>", records from there follow
+    REPL_SNAPSHOT,        // Primary: "<log_id> <offset>", a full copy, then records from <offset>
+    REPL_SNAPSHOT_END,
+    REPL_RECORD,          // Primary: "<next_offset> <record>" (next_offset 0 inside a snapshot)
+    REPL_DATA,            // Primary: content of the PUT/META record before, in chunks
+    REPL_DATA_END,        // Primary: "ok", or "missing" (the change was undone since)
+    REPL_PING,            // Primary, while idle
+    REPL_ACK,             // Replica: "<offset>" applied
+    REPL_DENIED           // Primary: reason
+};
+
+#define LOG_ID_LEN 16
+#define RECORD_MAX 1200
+
+static int role_primary = 0;
+static int role_replica = 0;
+
+// --- LOG (primary) ---
+//
+// Segments "seg-<first offset>.log" hold the records, one text line each;
+// "blobs/<offset>" the content of a PUT or META record. The directory may
+// be shared by two processes during a takeover (upgrade.h): appends and
+// segment drops happen under flock() on "lock", and each process re-reads
+// the segment sizes from disk before trusting its own view.
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static char log_id[LOG_ID_LEN + 1];
+static int lock_fd = -1;
+static int append_fd = -1;                // Last segment, O_APPEND
+static unsigned long long *seg_starts;    // Sorted
+static unsigned long long *seg_bytes;     // Records plus their content copies
+static int seg_count = 0, seg_cap = 0;
+static unsigned long long log_start = 0, log_end = 0;
+static unsigned long long stat_records = 0;
+
+typedef struct {
+    int in_use;
+    int sockfd;
+    char addr[INET_ADDRSTRLEN];
+    unsigned long long pos;     // Next record to send: the log is kept from here
+    unsigned long long acked;
+    int snapshot;               // Receiving a full copy
+} Replica;
+
+static Replica replicas[REPL_MAX_REPLICAS];
+
+static void seg_path(unsigned long long start, char *out, size_t size) {
+    snprintf(out, size, "%s/seg-%020llu.log", REPL_LOG_DIR, start);
+}
+
+static void blob_path(unsigned long long offset, char *out, size_t size) {
+    snprintf(out, size, "%s/blobs/%llu", REPL_LOG_DIR, offset);
+}
+
+static int seg_add(unsigned long long start, unsigned long long bytes) {
+    if (seg_count == seg_cap) {
+        int cap = seg_cap ? seg_cap * 2 : 16;
+        unsigned long long *s = realloc(seg_starts, cap * sizeof(*s));
+        if (!s) return -1;
+        seg_starts = s;
+        unsigned long long *b = realloc(seg_bytes, cap * sizeof(*b));
+        if (!b) return -1;
+        seg_bytes = b;
+        seg_cap = cap;
+    }
+    seg_starts[seg_count] = start;
+    seg_bytes[seg_count] = bytes;
+    seg_count++;
+    return 0;
+}
+
+// Index of the segment holding `offset` (log_lock held)
+static int seg_of(unsigned long long offset) {
+    int i = seg_count - 1;
+    while (i > 0 && seg_starts[i] > offset) i--;
+    return i;
+}
+
+static int open_append(unsigned long long start) {
+    char path[300];
+    seg_path(start, path, sizeof(path));
+    if (append_fd >= 0) close(append_fd);
+    append_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return append_fd >= 0 ? 0 : -1;
+}
+
+// Picks up what another process appended, rolled or dropped (both locks held)
+static void refresh_locked() {
+    char path[300];
+    while (seg_count > 1) {
+        seg_path(seg_starts[0], path, sizeof(path));
+        if (access(path, F_OK) == 0) break;
+        memmove(seg_starts, seg_starts + 1, (seg_count - 1) * sizeof(*seg_starts));
+        memmove(seg_bytes, seg_bytes + 1, (seg_count - 1) * sizeof(*seg_bytes));
+        seg_count--;
+    }
+    log_start = seg_starts[0];
+
+    while (1) {
+        struct stat st;
+        unsigned long long last = seg_starts[seg_count - 1];
+        seg_path(last, path, sizeof(path));
+        unsigned long long end = last + (stat(path, &st) == 0 ? (unsigned long long)st.st_size : 0);
+        if (end > log_end) seg_bytes[seg_count - 1] += end - log_end;
+        log_end = end;
+
+        seg_path(end, path, sizeof(path));
+        if (end == last || access(path, F_OK) != 0 || seg_add(end, 0) != 0) break;
+        open_append(end); // Rolled by the other process
+    }
+}
+
+static void lock_log() {
+    pthread_mutex_lock(&log_lock);
+    flock(lock_fd, LOCK_EX);
+    refresh_locked();
+}
+
+static void unlock_log() {
+    flock(lock_fd, LOCK_UN);
+    pthread_mutex_unlock(&log_lock);
+}
+
+// Removes the content copies of the records of one segment file
+static void drop_blobs(unsigned long long start) {
+    char path[300], line[RECORD_MAX];
+    seg_path(start, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    unsigned long long offset = start;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "PUT ", 4) == 0 || strncmp(line, "META ", 5) == 0) {
+            char blob[300];
+            blob_path(offset, blob, sizeof(blob));
+            unlink(blob);
+        }
+        offset += strlen(line);
+    }
+    fclose(f);
+}
+
+// Drops the oldest segments beyond repl_log_keep_mb that no connected
+// replica still reads (both locks held). A replica that later asks for a
+// dropped offset gets a full copy instead.
+static void trim_locked() {
+    unsigned long long keep = (unsigned long long)config_get(CFG_REPL_LOG_KEEP_MB) << 20;
+    unsigned long long total = 0;
+    for (int i = 0; i < seg_count; i++) total += seg_bytes[i];
+
+    while (seg_count > 1 && total > keep) {
+        int pinned = 0;
+        for (int r = 0; r < REPL_MAX_REPLICAS; r++)
+            pinned |= replicas[r].in_use && replicas[r].pos < seg_starts[1];
+        if (pinned) break;
+
+        char path[300];
+        drop_blobs(seg_starts[0]);
+        seg_path(seg_starts[0], path, sizeof(path));
+        unlink(path);
+        total -= seg_bytes[0];
+        memmove(seg_starts, seg_starts + 1, (seg_count - 1) * sizeof(*seg_starts));
+        memmove(seg_bytes, seg_bytes + 1, (seg_count - 1) * sizeof(*seg_bytes));
+        seg_count--;
+    }
+    log_start = seg_starts[0];
+}
+
+static int random_id(char *out) {
+    unsigned char raw[LOG_ID_LEN / 2];
+    if (getrandom(raw, sizeof(raw), 0) != (ssize_t)sizeof(raw)) return -1;
+    for (size_t i = 0; i < sizeof(raw); i++) sprintf(out + 2 * i, "%02x", raw[i]);
+    return 0;
+}
+
+static int cmp_offset(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Opens the log, or starts a new one (with a new ID, so replicas of an
+// older log resync) if there is none
+static int open_log() {
+    char path[300];
+    mkdir(REPL_LOG_DIR, 0755);
+    snprintf(path, sizeof(path), "%s/blobs", REPL_LOG_DIR);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/lock", REPL_LOG_DIR);
+    lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) return -1;
+    flock(lock_fd, LOCK_EX);
+
+    DIR *d = opendir(REPL_LOG_DIR);
+    struct dirent *entry;
+    unsigned long long start;
+    while (d && (entry = readdir(d)) != NULL) {
+        if (sscanf(entry->d_name, "seg-%llu.log", &start) == 1) seg_add(start, 0);
+    }
+    if (d) closedir(d);
+    qsort(seg_starts, seg_count, sizeof(*seg_starts), cmp_offset);
+
+    snprintf(path, sizeof(path), "%s/id", REPL_LOG_DIR);
+    FILE *f = fopen(path, "r");
+    int have_id = f && fscanf(f, "%16s", log_id) == 1 && strlen(log_id) == LOG_ID_LEN;
+    if (f) fclose(f);
+
+    if (!have_id || seg_count == 0) {
+        for (int i = 0; i < seg_count; i++) {
+            drop_blobs(seg_starts[i]);
+            seg_path(seg_starts[i], path, sizeof(path));
+            unlink(path);
+        }
+        seg_count = 0;
+        if (random_id(log_id) != 0) {
+            flock(lock_fd, LOCK_UN);
+            return -1;
+        }
+        snprintf(path, sizeof(path), "%s/id", REPL_LOG_DIR);
+        f = fopen(path, "w");
+        if (f) {
+            fprintf(f, "%s\n", log_id);
+            fclose(f);
+        }
+        seg_add(0, 0);
+    }
+
+    // A crash may have left half a record: cut the last segment back to its
+    // last complete line
+    unsigned long long last = seg_starts[seg_count - 1];
+    seg_path(last, path, sizeof(path));
+    f = fopen(path, "r");
+    if (f) {
+        char line[RECORD_MAX];
+        long good = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (line[strlen(line) - 1] != '\n') break;
+            good = ftell(f);
+        }
+        fclose(f);
+        if (truncate(path, good) != 0) perror("Replication log truncate");
+    }
+    for (int i = 0; i < seg_count; i++) {
+        struct stat st;
+        seg_path(seg_starts[i], path, sizeof(path));
+        if (stat(path, &st) == 0) seg_bytes[i] = st.st_size;
+    }
+    log_start = seg_starts[0];
+    log_end = 0;
+    int rc = open_append(last);
+    refresh_locked();
+    flock(lock_fd, LOCK_UN);
+    return rc;
+}
+
+// Appends one record; `content` (a physical path) is kept with it, linked
+// if possible (`copy`: always copied, for files rewritten in place)
+static void append_record(const char *record, const char *content, int copy) {
+    if (!role_primary) return;
+    lock_log();
+
+    unsigned long long offset = log_end;
+    unsigned long long extra = 0;
+    if (content) {
+        char blob[300];
+        struct stat st;
+        blob_path(offset, blob, sizeof(blob));
+        unlink(blob); // Left by a record lost in a crash
+        if (copy || link(content, blob) != 0) copy_single_file(content, blob);
+        if (stat(blob, &st) == 0) extra = st.st_size;
+    }
+
+    size_t len = strlen(record);
+    if (write(append_fd, record, len) != (ssize_t)len) {
+        char log_msg[RECORD_MAX + 64];
+        snprintf(log_msg, sizeof(log_msg), "Replication: cannot append to the log (%s): %s", strerror(errno), record);
+        log_activity(log_msg);
+        unlock_log();
+        return;
+    }
+    log_end += len;
+    seg_bytes[seg_count - 1] += len + extra;
+    stat_records++;
+
+    if (log_end - seg_starts[seg_count - 1] >= REPL_SEGMENT_BYTES && seg_add(log_end, 0) == 0)
+        open_append(log_end);
+    trim_locked();
+    pthread_cond_broadcast(&log_cond);
+    unlock_log();
+}
+
+// Records name logical paths as the path locks do ("a/b", never "/a//b")
+static void log_names(const char *op, const char *a, const char *b, const char *content) {
+    char na[PATH_LOCK_MAX_PATH], nb[PATH_LOCK_MAX_PATH], record[RECORD_MAX];
+    path_lock_normalize(a, na, sizeof(na));
+    if (b) {
+        path_lock_normalize(b, nb, sizeof(nb));
+        snprintf(record, sizeof(record), "%s %s %s\n", op, na, nb);
+    } else {
+        snprintf(record, sizeof(record), "%s %s\n", op, na);
+    }
+    append_record(record, content, 0);
+}
+
+void repl_log_put(const char *filename) {
+    char path[512];
+    storage_path(filename, path, sizeof(path));
+    log_names("PUT", filename, NULL, path);
+}
+
+void repl_log_mkdir(const char *filename) {
+    log_names("MKDIR", filename, NULL, NULL);
+}
+
+void repl_log_delete(const char *filename) {
+    log_names("DELETE", filename, NULL, NULL);
+}
+
+void repl_log_move(const char *src_filename, const char *dest_filename) {
+    log_names("MOVE", src_filename, dest_filename, NULL);
+}
+
+void repl_log_copy(const char *src_filename, const char *dest_filename) {
+    log_names("COPY", src_filename, dest_filename, NULL);
+}
+
+void repl_log_meta(const char *db_file) {
+    char record[RECORD_MAX];
+    const char *name = strrchr(db_file, '/');
+    snprintf(record, sizeof(record), "META %s\n", name ? name + 1 : db_file);
+    append_record(record, db_file, 1);
+}
+
+// --- SENDER (primary, one thread per replica) ---
+
+static int send_content(int sock, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return send_packet(sock, REPL_DATA_END, "missing", 7) < 0 ? -1 : 0;
+
+    char chunk[BUFFER_SIZE];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        if (send_packet(sock, REPL_DATA, chunk, (int)n) < 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return send_packet(sock, REPL_DATA_END, "ok", 2) < 0 ? -1 : 0;
+}
+
+static int send_snapshot_record(int sock, const char *record, const char *content) {
+    char msg[RECORD_MAX + 8];
+    int len = snprintf(msg, sizeof(msg), "0 %s", record);
+    if (send_packet(sock, REPL_RECORD, msg, len) < 0) return -1;
+    return content ? send_content(sock, content) : 0;
+}
+
+// Folders before their content, so the replica can create them in order
+static int send_tree(int sock, const char *dir, const char *rel) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    struct dirent *entry;
+    int rc = 0;
+    while (rc == 0 && (entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char path[PATH_MAX], name[PATH_MAX], record[RECORD_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        snprintf(name, sizeof(name), "%s%s%s", rel, rel[0] ? "/" : "", entry->d_name);
+        if (lstat(path, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            snprintf(record, sizeof(record), "MKDIR %.1180s", name);
+            rc = send_snapshot_record(sock, record, NULL);
+            if (rc == 0) rc = send_tree(sock, path, name);
+        } else if (S_ISREG(st.st_mode)) {
+            snprintf(record, sizeof(record), "PUT %.1180s", name);
+            rc = send_snapshot_record(sock, record, path);
+        }
+    }
+    closedir(d);
+    return rc;
+}
+
+// The current tree and metadata, as of now: the records appended meanwhile
+// follow and bring the replica up to date
+static int send_snapshot(int sock) {
+    for (int s = 0; s < storage_shard_count(); s++) {
+        char root[512];
+        snprintf(root, sizeof(root), "%s", storage_files_dir(s));
+        root[strlen(root) - 1] = '\0'; // Trailing '/'
+        if (send_tree(sock, root, "") != 0) return -1;
+    }
+    const char *meta[] = {USER_DB_FILE, GROUP_DB_FILE, GROUP_MEMBER_DB_FILE};
+    for (int i = 0; i < 3; i++) {
+        char record[RECORD_MAX];
+        snprintf(record, sizeof(record), "META %s", strrchr(meta[i], '/') + 1);
+        if (send_snapshot_record(sock, record, meta[i]) != 0) return -1;
+    }
+    return send_packet(sock, REPL_SNAPSHOT_END, "", 0) < 0 ? -1 : 0;
+}
+
+// Reads the acknowledgements that arrived, without waiting
+static int read_acks(int sock, Replica *r) {
+    char buf[BUFFER_SIZE + 1];
+    struct pollfd pfd = {sock, POLLIN, 0};
+    while (poll(&pfd, 1, 0) > 0) {
+        int type;
+        int len = recv_packet(sock, &type, buf);
+        if (len < 0) return -1;
+        buf[len] = '\0';
+        if (type == REPL_ACK) {
+            pthread_mutex_lock(&log_lock);
+            r->acked = strtoull(buf, NULL, 10);
+            pthread_mutex_unlock(&log_lock);
+        }
+    }
+    return 0;
+}
+
+// Sends the record at r->pos (and its content), then moves past it
+static int send_next(int sock, Replica *r, FILE **seg, unsigned long long *seg_start) {
+    pthread_mutex_lock(&log_lock);
+    unsigned long long pos = r->pos;
+    unsigned long long start = seg_starts[seg_of(pos)];
+    pthread_mutex_unlock(&log_lock);
+
+    if (!*seg || *seg_start != start) {
+        char path[300];
+        if (*seg) fclose(*seg);
+        seg_path(start, path, sizeof(path));
+        *seg = fopen(path, "r");
+        *seg_start = start;
+        if (!*seg) return -1;
+    }
+    char line[RECORD_MAX];
+    if (fseek(*seg, (long)(pos - start), SEEK_SET) != 0 || !fgets(line, sizeof(line), *seg)) return -1;
+    unsigned long long next = pos + strlen(line);
+    line[strcspn(line, "\n")] = '\0';
+
+    char msg[RECORD_MAX + 32];
+    int len = snprintf(msg, sizeof(msg), "%llu %s", next, line);
+    if (send_packet(sock, REPL_RECORD, msg, len) < 0) return -1;
+    if (strncmp(line, "PUT ", 4) == 0 || strncmp(line, "META ", 5) == 0) {
+        char blob[300];
+        blob_path(pos, blob, sizeof(blob));
+        if (send_content(sock, blob) != 0) return -1;
+    }
+
+    pthread_mutex_lock(&log_lock);
+    r->pos = next;
+    pthread_mutex_unlock(&log_lock);
+    return 0;
+}
+
+static void *sender_thread(void *arg) {
+    Replica *r = (Replica *)arg;
+    int sock = r->sockfd;
+    char buf[BUFFER_SIZE + 1], log_msg[300];
+    int type;
+
+    int len = recv_packet(sock, &type, buf);
+    char secret[256], id[LOG_ID_LEN + 1];
+    unsigned long long offset;
+    if (len < 0 || type != REPL_SUBSCRIBE) goto done;
+    buf[len] = '\0';
+    if (sscanf(buf, "%255s %16s %llu", secret, id, &offset) != 3 ||
+        !secret_matches(config_string(CFG_REPL_SECRET), secret)) {
+        send_packet(sock, REPL_DENIED, "Bad secret", 10);
+        snprintf(log_msg, sizeof(log_msg), "Replication: refused replica %s (bad secret)", r->addr);
+        log_activity(log_msg);
+        goto done;
+    }
+
+    lock_log();
+    int snapshot = strcmp(id, log_id) != 0 || offset < log_start || offset > log_end;
+    r->pos = r->acked = snapshot ? log_end : offset;
+    r->snapshot = snapshot;
+    unlock_log();
+
+    len = snprintf(buf, sizeof(buf), "%s %llu", log_id, r->pos);
+    if (send_packet(sock, snapshot ? REPL_SNAPSHOT : REPL_CONTINUE, buf, len) < 0) goto done;
+    snprintf(log_msg, sizeof(log_msg), "Replication: replica %s connected, %s from offset %llu",
+             r->addr, snapshot ? "full copy, then records" : "records", r->pos);
+    log_activity(log_msg);
+    if (snapshot) {
+        if (send_snapshot(sock) != 0) goto done;
+        r->snapshot = 0;
+    }
+
+    FILE *seg = NULL;
+    unsigned long long seg_start = 0;
+    while (1) {
+        pthread_mutex_lock(&log_lock);
+        if (r->pos >= log_end) {
+            // Appends of this process signal; another one's (takeover) are
+            // seen by the refresh below
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 200 * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&log_cond, &log_lock, &until);
+        }
+        pthread_mutex_unlock(&log_lock);
+
+        lock_log();
+        int pending = r->pos < log_end;
+        unlock_log();
+
+        static __thread long long idle_since;
+        if (pending) {
+            if (send_next(sock, r, &seg, &seg_start) != 0) break;
+            idle_since = 0;
+        } else {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long now_ms = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+            if (idle_since == 0) idle_since = now_ms;
+            if (now_ms - idle_since >= REPL_HEARTBEAT_MS) {
+                if (send_packet(sock, REPL_PING, "", 0) < 0) break;
+                idle_since = now_ms;
+            }
+        }
+        if (read_acks(sock, r) != 0) break;
+    }
+    if (seg) fclose(seg);
+
+done:
+    snprintf(log_msg, sizeof(log_msg), "Replication: replica %s disconnected", r->addr);
+    log_activity(log_msg);
+    close(sock);
+    pthread_mutex_lock(&log_lock);
+    r->in_use = 0;
+    pthread_mutex_unlock(&log_lock);
+    return NULL;
+}
+
+static void *repl_accept_thread(void *arg) {
+    int port = (int)(long)arg;
+    int server_fd = -1;
+
+    // During a takeover the previous process holds the port until it exits
+    for (int warned = 0; server_fd < 0; sleep(1)) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(fd, REPL_MAX_REPLICAS) == 0) {
+            server_fd = fd;
+        } else {
+            if (!warned++) perror("Replication port busy, retrying");
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int sock = accept4(server_fd, (struct sockaddr *)&addr, &addr_len, SOCK_CLOEXEC);
+        if (sock < 0) continue;
+
+        pthread_mutex_lock(&log_lock);
+        Replica *r = NULL;
+        for (int i = 0; i < REPL_MAX_REPLICAS && !r; i++) {
+            if (!replicas[i].in_use) r = &replicas[i];
+        }
+        if (r) {
+            memset(r, 0, sizeof(*r));
+            r->in_use = 1;
+            r->sockfd = sock;
+            r->pos = log_end; // Pins nothing older until it subscribed
+            inet_ntop(AF_INET, &addr.sin_addr, r->addr, sizeof(r->addr));
+        }
+        pthread_mutex_unlock(&log_lock);
+
+        pthread_t tid;
+        if (!r) {
+            send_packet(sock, REPL_DENIED, "Too many replicas", 17);
+            close(sock);
+        } else if (pthread_create(&tid, NULL, sender_thread, r) != 0) {
+            close(sock);
+            pthread_mutex_lock(&log_lock);
+            r->in_use = 0;
+            pthread_mutex_unlock(&log_lock);
+        } else {
+            pthread_detach(tid);
+        }
+    }
+    return NULL;
+}
+
+// --- FOLLOWER (replica) ---
+
+static char primary_addr[256]; // "host:port"
+static char applied_id[LOG_ID_LEN + 1] = "-";
+static unsigned long long applied_offset = 0;
+static int follower_connected = 0;
+static unsigned long long stat_applied = 0, stat_snapshots = 0;
+
+static void load_state() {
+    FILE *f = fopen(REPL_STATE_FILE, "r");
+    if (!f || fscanf(f, "%16s %llu", applied_id, &applied_offset) != 2) {
+        snprintf(applied_id, sizeof(applied_id), "-");
+        applied_offset = 0;
+    }
+    if (f) fclose(f);
+}
+
+static void save_state() {
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", REPL_STATE_FILE);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+    fprintf(f, "%s %llu\n", applied_id, applied_offset);
+    fclose(f);
+    rename(tmp, REPL_STATE_FILE);
+}
+
+// Logical paths come from the network: relative, without ".."
+static int safe_name(const char *name) {
+    return name[0] && name[0] != '/' && strstr(name, "..") == NULL;
+}
+
+static void lock_wait(PathLock *lock, const char *name, int mode) {
+    while (path_lock_try(lock, name, mode) != 0) usleep(10000); // Only the rebalancer competes
+}
+
+static void mkdir_parents(const char *name) {
+    char prefix[PATH_MAX], path[PATH_MAX];
+    for (const char *p = strchr(name, '/'); p; p = strchr(p + 1, '/')) {
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)(p - name), name);
+        storage_path(prefix, path, sizeof(path));
+        mkdir(path, 0755);
+    }
+}
+
+static void remove_any(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return;
+    if (S_ISDIR(st.st_mode)) remove_directory_recursive(path);
+    else unlink(path);
+}
+
+// Receives the DATA frames of a record into `path`.
+// @return 1 if written, 0 if the primary had no content, -1 on a broken connection
+static int receive_content(int sock, const char *path) {
+    FILE *f = fopen(path, "wb");
+    char buf[BUFFER_SIZE + 1];
+    int type, len, ok = f != NULL;
+    while ((len = recv_packet(sock, &type, buf)) >= 0) {
+        if (type == REPL_DATA) {
+            if (ok && fwrite(buf, 1, len, f) != (size_t)len) ok = 0;
+        } else if (type == REPL_DATA_END) {
+            if (f && fclose(f) != 0) ok = 0;
+            buf[len] = '\0';
+            if (ok && strcmp(buf, "ok") == 0) return 1;
+            unlink(path);
+            return 0;
+        } else {
+            break;
+        }
+    }
+    if (f) fclose(f);
+    unlink(path);
+    return -1;
+}
+
+// Names received during a full copy: whatever else the replica holds goes
+typedef struct {
+    char **names;
+    int count, cap;
+} NameSet;
+
+static void name_add(NameSet *set, const char *name) {
+    if (set->count == set->cap) {
+        int cap = set->cap ? set->cap * 2 : 256;
+        char **n = realloc(set->names, cap * sizeof(char *));
+        if (!n) return;
+        set->names = n;
+        set->cap = cap;
+    }
+    char *copy = strdup(name);
+    if (copy) set->names[set->count++] = copy;
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void name_set_free(NameSet *set) {
+    for (int i = 0; i < set->count; i++) free(set->names[i]);
+    free(set->names);
+    memset(set, 0, sizeof(*set));
+}
+
+static void sweep_extra(const NameSet *set, const char *dir, const char *rel) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char path[PATH_MAX], name[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        snprintf(name, sizeof(name), "%s%s%s", rel, rel[0] ? "/" : "", entry->d_name);
+        const char *key = name;
+        if (!bsearch(&key, set->names, set->count, sizeof(char *), cmp_name)) {
+            PathLock lock;
+            lock_wait(&lock, name, LOCK_MODE_X);
+            file_cache_invalidate(path);
+            remove_any(path);
+            search_index_remove(name);
+            path_lock_release(&lock);
+            continue;
+        }
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) sweep_extra(set, path, name);
+    }
+    closedir(d);
+}
+
+static int apply_meta(int sock, const char *name) {
+    const char *files[] = {USER_DB_FILE, GROUP_DB_FILE, GROUP_MEMBER_DB_FILE};
+    const char *target = NULL;
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(strrchr(files[i], '/') + 1, name) == 0) target = files[i];
+    }
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s/meta.%d.tmp", REPL_LOG_DIR, (int)getpid());
+    int got = receive_content(sock, tmp);
+    if (got <= 0 || !target) {
+        unlink(tmp);
+        return got < 0 ? -1 : 0;
+    }
+    // The metadata snapshot notices the new mtime and falls back to the file
+    pthread_mutex_lock(&db_mutex);
+    rename(tmp, target);
+    pthread_mutex_unlock(&db_mutex);
+    return 0;
+}
+
+static int apply_put(int sock, const char *name) {
+    char staged[600];
+    static unsigned long seq = 0;
+    snprintf(staged, sizeof(staged), "%s%d-repl-%lu.part", storage_staging_dir(storage_shard_of(name)),
+             (int)getpid(), seq++);
+    int got = receive_content(sock, staged);
+    if (got <= 0) return got;
+
+    mkdir_parents(name);
+    char path[PATH_MAX];
+    storage_path(name, path, sizeof(path));
+    PathLock lock;
+    lock_wait(&lock, name, LOCK_MODE_X);
+    if (storage_publish(staged, name) == 0) {
+        file_cache_invalidate(path);
+        search_index_add(name, 0);
+    } else {
+        unlink(staged);
+    }
+    path_lock_release(&lock);
+    return 0;
+}
+
+// Applies one record. Every operation tolerates being replayed: the
+// replica's offset is saved after the change, not atomically with it.
+static int apply_record(int sock, const char *record, NameSet *snapshot) {
+    char op[16], a[PATH_MAX], b[PATH_MAX];
+    int n = sscanf(record, "%15s %4095s %4095s", op, a, b);
+    int needs_content = n >= 2 && (strcmp(op, "PUT") == 0 || strcmp(op, "META") == 0);
+
+    if (n < 2 || !safe_name(a) || (n == 3 && !safe_name(b))) {
+        // Still drain the content so the stream stays in step
+        if (needs_content) {
+            char tmp[300];
+            snprintf(tmp, sizeof(tmp), "%s/skip.%d.tmp", REPL_LOG_DIR, (int)getpid());
+            return receive_content(sock, tmp) < 0 ? -1 : 0;
+        }
+        return 0;
+    }
+    if (snapshot && strcmp(op, "META") != 0) name_add(snapshot, a);
+
+    char pa[PATH_MAX], pb[PATH_MAX];
+    storage_path(a, pa, sizeof(pa));
+    if (n == 3) storage_path(b, pb, sizeof(pb));
+    PathLock la, lb;
+
+    if (strcmp(op, "PUT") == 0) {
+        return apply_put(sock, a);
+    } else if (strcmp(op, "META") == 0) {
+        return apply_meta(sock, a);
+    } else if (strcmp(op, "MKDIR") == 0) {
+        mkdir_parents(a);
+        mkdir(pa, 0755);
+        search_index_add(a, 1);
+    } else if (strcmp(op, "DELETE") == 0) {
+        lock_wait(&la, a, LOCK_MODE_X);
+        file_cache_invalidate(pa);
+        remove_any(pa);
+        search_index_remove(a);
+        path_lock_release(&la);
+    } else if ((strcmp(op, "MOVE") == 0 || strcmp(op, "COPY") == 0) && n == 3) {
+        int move = op[0] == 'M';
+        lock_wait(&la, a, move ? LOCK_MODE_X : LOCK_MODE_S);
+        lock_wait(&lb, b, LOCK_MODE_X);
+        if (access(pa, F_OK) == 0) { // Gone if replayed after the move
+            file_cache_invalidate(pb);
+            remove_any(pb);
+            mkdir_parents(b);
+            if (move) {
+                storage_move(a, b);
+                file_cache_invalidate(pa);
+                search_index_move(a, b);
+            } else {
+                copy_recursive(pa, pb);
+                search_index_remove(b);
+                search_index_add_tree(b);
+            }
+        }
+        path_lock_release(&lb);
+        path_lock_release(&la);
+    }
+    return 0;
+}
+
+static int connect_primary() {
+    char host[sizeof(primary_addr)];
+    snprintf(host, sizeof(host), "%s", primary_addr);
+    char *colon = strrchr(host, ':');
+    if (!colon) return -1;
+    *colon = '\0';
+
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0) return -1;
+    int sock = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, 0);
+    if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+static void follow(int sock) {
+    char buf[BUFFER_SIZE + 1], log_msg[sizeof(primary_addr) + 160];
+    int type, len;
+
+    load_state();
+    const char *secret = config_string(CFG_REPL_SECRET);
+    len = snprintf(buf, sizeof(buf), "%s %s %llu", secret ? secret : "-", applied_id, applied_offset);
+    if (send_packet(sock, REPL_SUBSCRIBE, buf, len) < 0 || (len = recv_packet(sock, &type, buf)) < 0) return;
+    buf[len] = '\0';
+
+    char id[LOG_ID_LEN + 1];
+    unsigned long long offset;
+    if ((type != REPL_CONTINUE && type != REPL_SNAPSHOT) || sscanf(buf, "%16s %llu", id, &offset) != 2) {
+        snprintf(log_msg, sizeof(log_msg), "Replication: primary %s refused: %.100s", primary_addr, buf);
+        log_activity(log_msg);
+        return;
+    }
+
+    NameSet snapshot = {0};
+    int in_snapshot = type == REPL_SNAPSHOT;
+    if (in_snapshot) {
+        // A crash in the middle must not resume from the old offset
+        snprintf(applied_id, sizeof(applied_id), "-");
+        applied_offset = 0;
+        save_state();
+        stat_snapshots++;
+    }
+    snprintf(log_msg, sizeof(log_msg), "Replication: following %s (log %s) %s offset %llu",
+             primary_addr, id, in_snapshot ? "with a full copy, then from" : "from", offset);
+    log_activity(log_msg);
+    __atomic_store_n(&follower_connected, 1, __ATOMIC_RELAXED);
+
+    while ((len = recv_packet(sock, &type, buf)) >= 0) {
+        buf[len] = '\0';
+        if (type == REPL_RECORD) {
+            char *record = strchr(buf, ' ');
+            if (!record) break;
+            unsigned long long next = strtoull(buf, NULL, 10);
+            if (apply_record(sock, record + 1, in_snapshot ? &snapshot : NULL) != 0) break;
+            stat_applied++;
+            if (!in_snapshot) {
+                snprintf(applied_id, sizeof(applied_id), "%s", id);
+                applied_offset = next;
+                save_state();
+                len = snprintf(buf, sizeof(buf), "%llu", next);
+                if (send_packet(sock, REPL_ACK, buf, len) < 0) break;
+            }
+        } else if (type == REPL_SNAPSHOT_END && in_snapshot) {
+            qsort(snapshot.names, snapshot.count, sizeof(char *), cmp_name);
+            for (int s = 0; s < storage_shard_count(); s++) {
+                char root[512];
+                snprintf(root, sizeof(root), "%s", storage_files_dir(s));
+                root[strlen(root) - 1] = '\0';
+                sweep_extra(&snapshot, root, "");
+            }
+            name_set_free(&snapshot);
+            in_snapshot = 0;
+            snprintf(applied_id, sizeof(applied_id), "%s", id);
+            applied_offset = offset;
+            save_state();
+            snprintf(log_msg, sizeof(log_msg), "Replication: full copy from %s applied", primary_addr);
+            log_activity(log_msg);
+            len = snprintf(buf, sizeof(buf), "%llu", offset);
+            if (send_packet(sock, REPL_ACK, buf, len) < 0) break;
+        } else if (type == REPL_PING) {
+            len = snprintf(buf, sizeof(buf), "%llu", applied_offset);
+            if (send_packet(sock, REPL_ACK, buf, len) < 0) break;
+        } else {
+            break;
+        }
+    }
+    name_set_free(&snapshot);
+    __atomic_store_n(&follower_connected, 0, __ATOMIC_RELAXED);
+}
+
+static void *follower_thread(void *arg) {
+    (void)arg;
+    char log_msg[sizeof(primary_addr) + 64];
+    int was_up = 1;
+    while (1) {
+        int sock = connect_primary();
+        if (sock >= 0) {
+            follow(sock);
+            close(sock);
+            was_up = 1;
+        } else if (was_up) {
+            snprintf(log_msg, sizeof(log_msg), "Replication: cannot reach primary %s, retrying", primary_addr);
+            log_activity(log_msg);
+            was_up = 0;
+        }
+        sleep(REPL_RETRY_DELAY);
+    }
+    return NULL;
+}
+
+// --- PUBLIC API ---
+
+void repl_init() {
+    const char *from = config_string(CFG_REPLICATE_FROM);
+    int port = (int)config_get(CFG_REPL_PORT);
+    pthread_t tid;
+
+    if (from) {
+        snprintf(primary_addr, sizeof(primary_addr), "%s", from);
+        mkdir(REPL_LOG_DIR, 0755);
+        role_replica = 1;
+        printf("Read-only replica of %s\n", primary_addr);
+    } else if (port > 0) {
+        // Replicas get the whole tree and the users file: never without a secret
+        if (!config_string(CFG_REPL_SECRET)) {
+            fprintf(stderr, "repl_port is set but repl_secret is not, replication disabled\n");
+            log_activity("Replication: repl_secret is not set, not starting as primary");
+            return;
+        }
+        if (open_log() != 0) {
+            perror("Replication log cannot be opened, replication disabled");
+            return;
+        }
+        role_primary = 1;
+        if (pthread_create(&tid, NULL, repl_accept_thread, (void *)(long)port) == 0) pthread_detach(tid);
+        else perror("Replication listener creation failed");
+        printf("Replication primary on port %d (log %s, offsets %llu..%llu)\n", port, log_id, log_start, log_end);
+    }
+}
+
+int repl_is_replica() {
+    return role_replica;
+}
+
+void repl_start_follower() {
+    if (!role_replica) return;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, follower_thread, NULL) == 0) pthread_detach(tid);
+    else perror("Replication follower creation failed");
+}
+
+int repl_format_stats(char *buf, size_t size) {
+    int n = 0;
+    if (role_replica) {
+        n = snprintf(buf, size, "REPLICATION replica of %s %s log=%s applied=%llu records=%llu full_copies=%llu\n",
+                     primary_addr, __atomic_load_n(&follower_connected, __ATOMIC_RELAXED) ? "connected" : "disconnected",
+                     applied_id, applied_offset, stat_applied, stat_snapshots);
+    } else if (role_primary) {
+        pthread_mutex_lock(&log_lock);
+        int count = 0;
+        for (int i = 0; i < REPL_MAX_REPLICAS; i++) count += replicas[i].in_use;
+        n = snprintf(buf, size, "REPLICATION primary log=%s offsets=%llu..%llu segments=%d records=%llu replicas=%d\n",
+                     log_id, log_start, log_end, seg_count, stat_records, count);
+        for (int i = 0; i < REPL_MAX_REPLICAS && n >= 0 && (size_t)n < size; i++) {
+            Replica *r = &replicas[i];
+            if (!r->in_use) continue;
+            n += snprintf(buf + n, size - n, "  REPLICA %s sent=%llu acked=%llu lag=%llu bytes%s\n", r->addr, r->pos,
+                          r->acked, log_end - r->acked, r->snapshot ? " (full copy)" : "");
+        }
+        pthread_mutex_unlock(&log_lock);
+    }
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
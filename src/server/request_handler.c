@@ -1,6 +1,11 @@
 #include "protocol.h"
 #include "network.h"
+#include "metrics.h"
+#include "stream.h"
+#include "replication.h"
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 // External functions (Logic Handlers)
 
@@ -9,6 +14,8 @@ void handle_register(int sockfd, char *payload);
 void handle_logout(int sockfd, char *payload);
 void handle_change_password(int sockfd, char *payload);
 void handle_delete_account(int sockfd, char *payload);
+void handle_resume_session(int sockfd, char *payload);
+void handle_cluster_auth(int sockfd, char *payload);
 
 void handle_create_group(int sockfd, char *payload);
 void handle_list_groups(int sockfd);
@@ -19,19 +26,118 @@ void handle_kick_member(int sockfd, char *payload);
 void handle_invite_member(int sockfd, char *payload);
 void handle_approve_member(int sockfd, char *payload);
 void handle_delete_group(int sockfd, char *payload);
+void handle_cluster_create_group(int sockfd, char *payload);
 
 void handle_list_files(int sockfd, char *subpath);
 void handle_upload_request(int sockfd, char *payload);
-void handle_download_request(int sockfd, char *filename);
+void handle_download_request(int sockfd, char *payload);
 void handle_delete_item(int sockfd, char *filename);
 void handle_create_folder(int sockfd, char *foldername);
 void handle_copy_file(int sockfd, char *payload);
 void handle_rename_item(int sockfd, char *payload);
 void handle_move_item(int sockfd, char *payload);
+void handle_create_folders(int sockfd, char *payload);
+void handle_list_tree(int sockfd, char *subpath);
+void handle_search(int sockfd, char *payload);
+void handle_folder_stats(int sockfd, char *foldername);
+void handle_list_versions(int sockfd, char *filename);
+void handle_download_version(int sockfd, char *payload);
+void handle_restore_version(int sockfd, char *payload);
+void handle_resume_transfer(int sockfd, char *payload);
 
+void handle_stats(int sockfd);
 
+// Bytes received before this mark belong to requests already recorded
+static __thread unsigned long long rx_mark = 0;
+
+static void dispatch_request(int sockfd, int msg_type, char *payload);
+
+/**
+ * @brief Routes a transfer frame (MSG_FILE_DATA/END/ERROR) to its stream and
+ * records it in the metrics like any other request.
+ * @return 1 if the frame belonged to an active stream, 0 otherwise.
+ */
+int process_stream_packet(int sockfd, int stream_id, int msg_type, char *payload, int payload_len)
+{
+    struct timespec start, end;
+    unsigned long long tx_before = net_tx_bytes;
+    unsigned long long errors_before = net_tx_errors;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int handled = stream_handle_packet(sockfd, stream_id, msg_type, payload, payload_len);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    unsigned long long latency_ns = (unsigned long long)(end.tv_sec - start.tv_sec) * 1000000000ULL
+                                    + (end.tv_nsec - start.tv_nsec);
+    metrics_record(msg_type, latency_ns, net_rx_bytes - rx_mark, net_tx_bytes - tx_before,
+                   net_tx_errors > errors_before || !handled);
+    rx_mark = net_rx_bytes;
+    return handled;
+}
+
+/**
+ * @brief Routes one request to its handler and records its latency,
+ * traffic and error outcome in the per-thread metrics.
+ */
 void process_client_request(int sockfd, int msg_type, char *payload)
+{
+    struct timespec start, end;
+    unsigned long long tx_before = net_tx_bytes;
+    unsigned long long errors_before = net_tx_errors;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    dispatch_request(sockfd, msg_type, payload);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    unsigned long long latency_ns = (unsigned long long)(end.tv_sec - start.tv_sec) * 1000000000ULL
+                                    + (end.tv_nsec - start.tv_nsec);
+    metrics_record(msg_type, latency_ns, net_rx_bytes - rx_mark, net_tx_bytes - tx_before,
+                   net_tx_errors > errors_before);
+    rx_mark = net_rx_bytes;
+}
+
+/**
+ * @brief 1 for requests that change users, groups or files (refused by a
+ * read-only replica).
+ */
+static int is_write_request(int msg_type)
 {
+    switch (msg_type)
+    {
+    case MSG_REGISTER:
+    case MSG_CHANGE_PASS:
+    case MSG_DELETE_ACCOUNT:
+    case MSG_CREATE_GROUP:
+    case MSG_JOIN_GROUP:
+    case MSG_LEAVE_GROUP:
+    case MSG_KICK_MEMBER:
+    case MSG_INVITE_MEMBER:
+    case MSG_APPROVE_MEMBER:
+    case MSG_DELETE_GROUP:
+    case MSG_CREATE_FOLDER:
+    case MSG_CREATE_FOLDERS:
+    case MSG_DELETE_ITEM:
+    case MSG_RENAME_ITEM:
+    case MSG_MOVE_ITEM:
+    case MSG_COPY_ITEM:
+    case MSG_UPLOAD_REQ:
+    case MSG_RESTORE_VERSION:
+    case MSG_CLUSTER_CREATE_GROUP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void dispatch_request(int sockfd, int msg_type, char *payload)
+{
+    if (repl_is_replica() && is_write_request(msg_type))
+    {
+        const char *msg = "Read-only replica: send changes to the primary";
+        send_packet(sockfd, MSG_ERROR, msg, strlen(msg));
+        return;
+    }
+
     switch (msg_type)
     {
     case MSG_LOGIN:
@@ -52,6 +158,9 @@ void process_client_request(int sockfd, int msg_type, char *payload)
     case MSG_DELETE_ACCOUNT:
         handle_delete_account(sockfd, payload);
         break;
+    case MSG_RESUME_SESSION:
+        handle_resume_session(sockfd, payload);
+        break;
 
     // --- MODULE 3: FILE HANDLING ---
     case MSG_LIST_FILES:
@@ -78,6 +187,30 @@ void process_client_request(int sockfd, int msg_type, char *payload)
     case MSG_COPY_ITEM:
         handle_copy_file(sockfd, payload);
         break;
+    case MSG_CREATE_FOLDERS:
+        handle_create_folders(sockfd, payload);
+        break;
+    case MSG_LIST_TREE:
+        handle_list_tree(sockfd, payload);
+        break;
+    case MSG_SEARCH:
+        handle_search(sockfd, payload);
+        break;
+    case MSG_FOLDER_STATS:
+        handle_folder_stats(sockfd, payload);
+        break;
+    case MSG_LIST_VERSIONS:
+        handle_list_versions(sockfd, payload);
+        break;
+    case MSG_DOWNLOAD_VERSION:
+        handle_download_version(sockfd, payload);
+        break;
+    case MSG_RESTORE_VERSION:
+        handle_restore_version(sockfd, payload);
+        break;
+    case MSG_RESUME_TRANSFER:
+        handle_resume_transfer(sockfd, payload);
+        break;
 
         // --- MODULE 2: GROUP MANAGEMENT ---
     case MSG_CREATE_GROUP:
@@ -108,6 +241,19 @@ void process_client_request(int sockfd, int msg_type, char *payload)
         handle_delete_group(sockfd, payload);
         break;
 
+    // --- CLUSTER (bin/router) ---
+    case MSG_CLUSTER_AUTH:
+        handle_cluster_auth(sockfd, payload);
+        break;
+    case MSG_CLUSTER_CREATE_GROUP:
+        handle_cluster_create_group(sockfd, payload);
+        break;
+
+    // --- MONITORING ---
+    case MSG_STATS:
+        handle_stats(sockfd);
+        break;
+
     default:
         printf("Unknown message type: %d\n", msg_type);
         send_packet(sockfd, MSG_ERROR, "Unknown command", 15);
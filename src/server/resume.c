@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "resume.h"
+#include "config.h"
+#include "timer_wheel.h"
+
+typedef struct ResumeEntry {
+    char token[RESUME_TOKEN_LEN + 1];
+    int user_id;
+    char username[50];
+    int attached_fd;          // Connection using the token, -1 while detached
+    time_t expires_at;        // Only counts while detached
+    Stream *parked;           // Transfers of the dropped connection
+    int parked_count;
+    struct ResumeEntry *next;
+} ResumeEntry;
+
+static ResumeEntry *buckets[RESUME_BUCKETS];
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static int token_count = 0;
+static int parked_total = 0;
+static int sweep_cursor = 0;
+static unsigned long long stat_resumed, stat_expired;
+
+static unsigned bucket_of(const char *token) {
+    unsigned h = 2166136261u; // FNV-1a
+    for (const char *p = token; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+    return h % RESUME_BUCKETS;
+}
+
+// Compares in constant time: a token is a credential
+static int token_equal(const char *a, const char *b) {
+    unsigned char diff = 0;
+    for (int i = 0; i < RESUME_TOKEN_LEN; i++) diff |= (unsigned char)(a[i] ^ b[i]);
+    return diff == 0 && b[RESUME_TOKEN_LEN] == '\0';
+}
+
+static ResumeEntry **find_slot(const char *token) {
+    if (strlen(token) != RESUME_TOKEN_LEN) return NULL;
+    ResumeEntry **pp = &buckets[bucket_of(token)];
+    while (*pp && !token_equal((*pp)->token, token)) pp = &(*pp)->next;
+    return *pp ? pp : NULL;
+}
+
+static void free_parked(ResumeEntry *e) {
+    for (int i = 0; i < e->parked_count; i++) stream_discard(&e->parked[i]);
+    parked_total -= e->parked_count;
+    free(e->parked);
+    e->parked = NULL;
+    e->parked_count = 0;
+}
+
+static void unlink_entry(ResumeEntry **pp) {
+    ResumeEntry *e = *pp;
+    *pp = e->next;
+    free_parked(e);
+    free(e);
+    token_count--;
+}
+
+// Every table operation sweeps one bucket (a storm of logins never pays
+// for a full scan); the sweeper below covers an idle table
+static void sweep_bucket(int b) {
+    time_t now = time(NULL);
+    ResumeEntry **pp = &buckets[b];
+    while (*pp) {
+        if ((*pp)->attached_fd < 0 && (*pp)->expires_at <= now) {
+            unlink_entry(pp);
+            stat_expired++;
+        } else {
+            pp = &(*pp)->next;
+        }
+    }
+}
+
+static void sweep_step() {
+    sweep_bucket(sweep_cursor);
+    sweep_cursor = (sweep_cursor + 1) % RESUME_BUCKETS;
+}
+
+// Full sweep on the timer wheel, so the staging files of expired transfers
+// are released on time even when nobody logs in. Lock order: wheel, then
+// table (nothing here calls the timer_* functions with table_lock held).
+static TimerEntry sweeper;
+
+static long long sweeper_fire(TimerEntry *entry, long long now_ms) {
+    (void)entry;
+    pthread_mutex_lock(&table_lock);
+    if (token_count > 0) {
+        for (int b = 0; b < RESUME_BUCKETS; b++) sweep_bucket(b);
+    }
+    pthread_mutex_unlock(&table_lock);
+    return now_ms + RESUME_SWEEP_INTERVAL_MS;
+}
+
+void resume_start_sweeper() {
+    sweeper.fire = sweeper_fire;
+    timer_arm(&sweeper, timer_now_ms() + RESUME_SWEEP_INTERVAL_MS);
+}
+
+static int random_token(char *token) {
+    unsigned char raw[RESUME_TOKEN_LEN / 2];
+    if (getrandom(raw, sizeof(raw), 0) != (ssize_t)sizeof(raw)) return -1;
+    for (size_t i = 0; i < sizeof(raw); i++) sprintf(token + 2 * i, "%02x", raw[i]);
+    return 0;
+}
+
+int resume_issue(int sockfd, int user_id, const char *username, char *token) {
+    pthread_mutex_lock(&table_lock);
+    sweep_step();
+    if (token_count >= RESUME_MAX_TOKENS) {
+        for (int b = 0; b < RESUME_BUCKETS; b++) sweep_bucket(b);
+    }
+
+    ResumeEntry *e = token_count < RESUME_MAX_TOKENS ? calloc(1, sizeof(ResumeEntry)) : NULL;
+    if (!e || random_token(e->token) != 0) {
+        pthread_mutex_unlock(&table_lock);
+        free(e);
+        return -1;
+    }
+    e->user_id = user_id;
+    snprintf(e->username, sizeof(e->username), "%s", username);
+    e->attached_fd = sockfd;
+
+    unsigned b = bucket_of(e->token);
+    e->next = buckets[b];
+    buckets[b] = e;
+    token_count++;
+    memcpy(token, e->token, RESUME_TOKEN_LEN + 1);
+    pthread_mutex_unlock(&table_lock);
+    return 0;
+}
+
+int resume_claim(const char *token, int sockfd, int *user_id, char *username, Stream *parked, int *parked_count) {
+    pthread_mutex_lock(&table_lock);
+    sweep_step();
+
+    ResumeEntry **pp = find_slot(token);
+    int waited_ms = 0;
+    while (pp && (*pp)->attached_fd >= 0 && waited_ms < RESUME_TAKEOVER_WAIT_MS) {
+        // The old connection is still registered. It cannot have closed its
+        // socket yet (it detaches under this lock first), so the descriptor
+        // is still its own: wake its thread up and let it detach.
+        shutdown((*pp)->attached_fd, SHUT_RDWR);
+        pthread_mutex_unlock(&table_lock);
+        usleep(5000);
+        waited_ms += 5;
+        pthread_mutex_lock(&table_lock);
+        pp = find_slot(token);
+    }
+
+    ResumeEntry *e = pp ? *pp : NULL;
+    if (!e || e->attached_fd >= 0 || e->expires_at <= time(NULL)) {
+        if (e && e->attached_fd < 0) {
+            unlink_entry(pp);
+            stat_expired++;
+        }
+        pthread_mutex_unlock(&table_lock);
+        return -1;
+    }
+
+    *user_id = e->user_id;
+    snprintf(username, 50, "%s", e->username);
+    *parked_count = e->parked_count;
+    if (e->parked_count > 0) memcpy(parked, e->parked, e->parked_count * sizeof(Stream));
+    parked_total -= e->parked_count;
+    free(e->parked);
+    e->parked = NULL;
+    e->parked_count = 0;
+    e->attached_fd = sockfd;
+    stat_resumed++;
+    pthread_mutex_unlock(&table_lock);
+    return 0;
+}
+
+void resume_detach(const char *token, int sockfd, Stream *parked, int count) {
+    pthread_mutex_lock(&table_lock);
+    sweep_step();
+
+    ResumeEntry **pp = find_slot(token);
+    ResumeEntry *e = pp ? *pp : NULL;
+    if (!e || e->attached_fd != sockfd) {
+        // Revoked meanwhile: nobody will resume these transfers
+        pthread_mutex_unlock(&table_lock);
+        for (int i = 0; i < count; i++) stream_discard(&parked[i]);
+        return;
+    }
+
+    if (count > 0) {
+        e->parked = malloc(count * sizeof(Stream));
+        if (e->parked) {
+            memcpy(e->parked, parked, count * sizeof(Stream));
+            e->parked_count = count;
+            parked_total += count;
+        } else {
+            for (int i = 0; i < count; i++) stream_discard(&parked[i]);
+        }
+    }
+    e->attached_fd = -1;
+    e->expires_at = time(NULL) + config_get(CFG_RESUME_TTL);
+    pthread_mutex_unlock(&table_lock);
+}
+
+void resume_revoke(const char *token) {
+    pthread_mutex_lock(&table_lock);
+    ResumeEntry **pp = find_slot(token);
+    if (pp) unlink_entry(pp);
+    pthread_mutex_unlock(&table_lock);
+}
+
+void resume_revoke_user(int user_id, const char *keep_token) {
+    pthread_mutex_lock(&table_lock);
+    for (int b = 0; b < RESUME_BUCKETS; b++) {
+        ResumeEntry **pp = &buckets[b];
+        while (*pp) {
+            ResumeEntry *e = *pp;
+            if (e->user_id == user_id && !(keep_token && token_equal(e->token, keep_token))) {
+                unlink_entry(pp);
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+int resume_export(ResumeExport **out) {
+    pthread_mutex_lock(&table_lock);
+    *out = malloc((token_count > 0 ? token_count : 1) * sizeof(ResumeExport));
+    if (!*out) {
+        pthread_mutex_unlock(&table_lock);
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    int n = 0;
+    for (int b = 0; b < RESUME_BUCKETS; b++) {
+        ResumeEntry **pp = &buckets[b];
+        while (*pp) {
+            ResumeEntry *e = *pp;
+            if (e->attached_fd >= 0) {
+                pp = &e->next;
+                continue;
+            }
+            if (e->expires_at > now) {
+                ResumeExport *x = &(*out)[n++];
+                memcpy(x->token, e->token, sizeof(x->token));
+                x->user_id = e->user_id;
+                snprintf(x->username, sizeof(x->username), "%s", e->username);
+                x->ttl_left = (long)(e->expires_at - now);
+            }
+            unlink_entry(pp);
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+    return n;
+}
+
+int resume_import(const char *token, int sockfd, int user_id, const char *username, long ttl_left) {
+    if (strlen(token) != RESUME_TOKEN_LEN) return -1;
+    pthread_mutex_lock(&table_lock);
+    ResumeEntry *e = token_count < RESUME_MAX_TOKENS ? calloc(1, sizeof(ResumeEntry)) : NULL;
+    if (!e) {
+        pthread_mutex_unlock(&table_lock);
+        return -1;
+    }
+    memcpy(e->token, token, RESUME_TOKEN_LEN + 1);
+    e->user_id = user_id;
+    snprintf(e->username, sizeof(e->username), "%s", username);
+    e->attached_fd = sockfd;
+    e->expires_at = time(NULL) + ttl_left;
+
+    unsigned b = bucket_of(e->token);
+    e->next = buckets[b];
+    buckets[b] = e;
+    token_count++;
+    pthread_mutex_unlock(&table_lock);
+    return 0;
+}
+
+int resume_format_stats(char *buf, size_t size) {
+    pthread_mutex_lock(&table_lock);
+    int n = snprintf(buf, size, "RESUME tokens=%d parked_transfers=%d resumed=%llu expired=%llu ttl=%lds\n",
+                     token_count, parked_total, stat_resumed, stat_expired, config_get(CFG_RESUME_TTL));
+    pthread_mutex_unlock(&table_lock);
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
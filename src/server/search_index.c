@@ -0,0 +1,881 @@
+#define _GNU_SOURCE // strcasestr, FNM_CASEFOLD
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "search_index.h"
+#include "storage.h"
+#include "config.h"
+
+void log_activity(const char *msg);
+
+typedef struct {
+    char *name;          // NULL = free slot
+    int parent;          // -1 for top-level entries
+    int first_child;
+    int next_sibling;    // Also links the free slots
+    int prev_sibling;
+    int is_dir;
+    unsigned int mark;   // Last query that reported it
+    unsigned int seen;   // Last reconciler pass that found it on disk
+    long long bytes;     // Totals of the subtree, the node itself included
+    long files, dirs;
+    int owner;           // File: user who uploaded it (0 = unknown)
+} IndexNode;
+
+typedef struct {
+    unsigned int key;    // Trigram + 1 (0 = empty slot)
+    unsigned int len, cap;
+    int *ids;            // May hold stale or repeated IDs: candidates only
+} Posting;
+
+#define SLOT_EMPTY -1
+#define SLOT_DELETED -2
+#define MAX_TRIGRAMS 256
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static IndexNode *nodes = NULL;
+static int node_cap = 0, node_high = 0; // Slots [0, node_high) have been used
+static int free_head = -1;
+static int root_first = -1;
+static long live_nodes = 0;
+static FolderStats root_stats = {0, 0, 0};
+
+// (parent, name) -> node ID, open addressing
+static int *child_slots = NULL;
+static size_t child_cap = 0, child_used = 0; // Used includes deleted slots
+
+// Bytes of the files each user uploaded (user IDs are never removed)
+typedef struct {
+    int user_id;         // 0 = empty slot
+    long long bytes;
+} OwnerUsage;
+
+static OwnerUsage *owners = NULL;
+static size_t owner_cap = 0, owner_count = 0;
+
+static Posting *postings = NULL;
+static size_t posting_cap = 0, posting_count = 0;
+static unsigned long long live_postings = 0, stale_postings = 0;
+
+static unsigned int query_seq = 0, sweep_seq = 0;
+static int build_done = 0;
+static unsigned long long stat_queries = 0, stat_compactions = 0;
+static unsigned long long stat_reconciles = 0, stat_repairs = 0;
+
+// --- HASHING ---
+
+static unsigned int hash_child(int parent, const char *name) {
+    unsigned int h = 2166136261u ^ (unsigned int)parent;
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static unsigned int hash_key(unsigned int key) {
+    key ^= key >> 16;
+    key *= 0x85ebca6bu;
+    key ^= key >> 13;
+    return key;
+}
+
+// --- CHILD TABLE ---
+
+static int child_find(int parent, const char *name) {
+    if (child_cap == 0) return -1;
+    for (size_t i = hash_child(parent, name) & (child_cap - 1);; i = (i + 1) & (child_cap - 1)) {
+        int id = child_slots[i];
+        if (id == SLOT_EMPTY) return -1;
+        if (id >= 0 && nodes[id].parent == parent && strcmp(nodes[id].name, name) == 0) return id;
+    }
+}
+
+static void child_place(int id) {
+    size_t i = hash_child(nodes[id].parent, nodes[id].name) & (child_cap - 1);
+    while (child_slots[i] >= 0) i = (i + 1) & (child_cap - 1);
+    if (child_slots[i] == SLOT_EMPTY) child_used++;
+    child_slots[i] = id;
+}
+
+static int child_insert(int id) {
+    if ((child_used + 1) * 10 > child_cap * 7) {
+        size_t cap = child_cap ? child_cap * 2 : 1024;
+        while (cap * 7 < ((size_t)live_nodes + 1) * 20) cap *= 2;
+        int *slots = malloc(cap * sizeof(int));
+        if (!slots) return -1;
+        for (size_t i = 0; i < cap; i++) slots[i] = SLOT_EMPTY;
+        free(child_slots);
+        child_slots = slots;
+        child_cap = cap;
+        child_used = 0;
+        for (int n = 0; n < node_high; n++) {
+            if (nodes[n].name && n != id) child_place(n);
+        }
+    }
+    child_place(id);
+    return 0;
+}
+
+static void child_remove(int id) {
+    for (size_t i = hash_child(nodes[id].parent, nodes[id].name) & (child_cap - 1);; i = (i + 1) & (child_cap - 1)) {
+        if (child_slots[i] == SLOT_EMPTY) return;
+        if (child_slots[i] == id) {
+            child_slots[i] = SLOT_DELETED;
+            return;
+        }
+    }
+}
+
+// --- OWNER TOTALS ---
+
+static OwnerUsage *owner_find(int user_id, int create) {
+    if (create && (owner_count + 1) * 2 > owner_cap) {
+        size_t cap = owner_cap ? owner_cap * 2 : 256;
+        OwnerUsage *table = calloc(cap, sizeof(OwnerUsage));
+        if (!table) return NULL;
+        for (size_t i = 0; i < owner_cap; i++) {
+            if (!owners[i].user_id) continue;
+            size_t j = hash_key((unsigned int)owners[i].user_id) & (cap - 1);
+            while (table[j].user_id) j = (j + 1) & (cap - 1);
+            table[j] = owners[i];
+        }
+        free(owners);
+        owners = table;
+        owner_cap = cap;
+    }
+    if (owner_cap == 0) return NULL;
+
+    size_t i = hash_key((unsigned int)user_id) & (owner_cap - 1);
+    while (owners[i].user_id && owners[i].user_id != user_id) i = (i + 1) & (owner_cap - 1);
+    if (owners[i].user_id) return &owners[i];
+    if (!create) return NULL;
+    owners[i].user_id = user_id;
+    owner_count++;
+    return &owners[i];
+}
+
+static void owner_add(int user_id, long long bytes) {
+    if (user_id <= 0 || bytes == 0) return;
+    OwnerUsage *o = owner_find(user_id, 1);
+    if (o) o->bytes += bytes;
+}
+
+// Uploader recorded on the file by the upload commit
+static int read_owner(const char *path) {
+    char value[16];
+    ssize_t n = lgetxattr(path, SEARCH_OWNER_XATTR, value, sizeof(value) - 1);
+    if (n <= 0) return 0;
+    value[n] = '\0';
+    return atoi(value);
+}
+
+// --- TRIGRAM POSTINGS ---
+
+// Distinct lowercase trigrams of a name
+static int name_trigrams(const char *name, unsigned int *out) {
+    int count = 0;
+    size_t len = strlen(name);
+    for (size_t i = 0; i + 2 < len && count < MAX_TRIGRAMS; i++) {
+        unsigned int t = (unsigned int)tolower((unsigned char)name[i]) << 16 |
+                         (unsigned int)tolower((unsigned char)name[i + 1]) << 8 |
+                         (unsigned int)tolower((unsigned char)name[i + 2]);
+        int seen = 0;
+        for (int j = 0; j < count && !seen; j++) seen = out[j] == t;
+        if (!seen) out[count++] = t;
+    }
+    return count;
+}
+
+static Posting *posting_find(unsigned int trigram, int create) {
+    if (create && (posting_count + 1) * 10 > posting_cap * 7) {
+        size_t cap = posting_cap ? posting_cap * 2 : 4096;
+        Posting *table = calloc(cap, sizeof(Posting));
+        if (!table) return NULL;
+        for (size_t i = 0; i < posting_cap; i++) {
+            if (!postings[i].key) continue;
+            size_t j = hash_key(postings[i].key) & (cap - 1);
+            while (table[j].key) j = (j + 1) & (cap - 1);
+            table[j] = postings[i];
+        }
+        free(postings);
+        postings = table;
+        posting_cap = cap;
+    }
+    if (posting_cap == 0) return NULL;
+
+    unsigned int key = trigram + 1;
+    size_t i = hash_key(key) & (posting_cap - 1);
+    while (postings[i].key && postings[i].key != key) i = (i + 1) & (posting_cap - 1);
+    if (postings[i].key) return &postings[i];
+    if (!create) return NULL;
+    postings[i].key = key;
+    posting_count++;
+    return &postings[i];
+}
+
+static void index_name(int id) {
+    unsigned int trigrams[MAX_TRIGRAMS];
+    int count = name_trigrams(nodes[id].name, trigrams);
+    for (int t = 0; t < count; t++) {
+        Posting *p = posting_find(trigrams[t], 1);
+        if (!p) continue;
+        if (p->len == p->cap) {
+            unsigned int cap = p->cap ? p->cap * 2 : 4;
+            int *ids = realloc(p->ids, cap * sizeof(int));
+            if (!ids) continue;
+            p->ids = ids;
+            p->cap = cap;
+        }
+        p->ids[p->len++] = id;
+        live_postings++;
+    }
+}
+
+static void unindex_name(const char *name) {
+    unsigned int trigrams[MAX_TRIGRAMS];
+    int count = name_trigrams(name, trigrams);
+    live_postings -= count;
+    stale_postings += count;
+}
+
+// Rebuilds the postings from the live names once stale ones dominate
+static void maybe_compact() {
+    if (stale_postings < SEARCH_MIN_COMPACT || stale_postings < live_postings) return;
+    for (size_t i = 0; i < posting_cap; i++) postings[i].len = 0;
+    live_postings = stale_postings = 0;
+    for (int n = 0; n < node_high; n++) {
+        if (nodes[n].name) index_name(n);
+    }
+    stat_compactions++;
+}
+
+// --- TREE ---
+
+static void link_child(int id, int parent) {
+    nodes[id].parent = parent;
+    nodes[id].prev_sibling = -1;
+    int *head = parent < 0 ? &root_first : &nodes[parent].first_child;
+    nodes[id].next_sibling = *head;
+    if (*head >= 0) nodes[*head].prev_sibling = id;
+    *head = id;
+}
+
+static void unlink_child(int id) {
+    IndexNode *n = &nodes[id];
+    if (n->prev_sibling >= 0) nodes[n->prev_sibling].next_sibling = n->next_sibling;
+    else if (n->parent >= 0) nodes[n->parent].first_child = n->next_sibling;
+    else root_first = n->next_sibling;
+    if (n->next_sibling >= 0) nodes[n->next_sibling].prev_sibling = n->prev_sibling;
+}
+
+// Adds a change of a subtree's totals to `id` and all its ancestors
+static void propagate(int id, long long bytes, long files, long dirs) {
+    for (; id >= 0; id = nodes[id].parent) {
+        nodes[id].bytes += bytes;
+        nodes[id].files += files;
+        nodes[id].dirs += dirs;
+    }
+    root_stats.bytes += bytes;
+    root_stats.files += files;
+    root_stats.folders += dirs;
+}
+
+static int node_create(int parent, const char *name, int is_dir, long long size, int owner) {
+    int id;
+    if (free_head >= 0) {
+        id = free_head;
+        free_head = nodes[id].next_sibling;
+    } else {
+        if (node_high == node_cap) {
+            int cap = node_cap ? node_cap * 2 : 1024;
+            IndexNode *grown = realloc(nodes, cap * sizeof(IndexNode));
+            if (!grown) return -1;
+            nodes = grown;
+            node_cap = cap;
+        }
+        id = node_high++;
+    }
+    IndexNode *n = &nodes[id];
+    memset(n, 0, sizeof(*n));
+    n->name = strdup(name);
+    n->first_child = -1;
+    n->is_dir = is_dir;
+    n->bytes = is_dir ? 0 : size;
+    n->files = !is_dir;
+    n->dirs = is_dir;
+    n->owner = is_dir ? 0 : owner;
+    if (!n->name) {
+        n->next_sibling = free_head;
+        free_head = id;
+        return -1;
+    }
+    link_child(id, parent);
+    if (child_insert(id) != 0) {
+        unlink_child(id);
+        free(n->name);
+        n->name = NULL;
+        n->next_sibling = free_head;
+        free_head = id;
+        return -1;
+    }
+    index_name(id);
+    live_nodes++;
+    propagate(parent, n->bytes, n->files, n->dirs);
+    owner_add(n->owner, n->bytes);
+    return id;
+}
+
+// Frees a node and its descendants (already unlinked from its parent)
+static void node_free_tree(int id) {
+    for (int c = nodes[id].first_child; c >= 0;) {
+        int next = nodes[c].next_sibling;
+        child_remove(c);
+        node_free_tree(c);
+        c = next;
+    }
+    if (!nodes[id].is_dir) owner_add(nodes[id].owner, -nodes[id].bytes);
+    unindex_name(nodes[id].name);
+    free(nodes[id].name);
+    nodes[id].name = NULL;
+    nodes[id].next_sibling = free_head;
+    free_head = id;
+    live_nodes--;
+}
+
+static void node_delete(int id) {
+    propagate(nodes[id].parent, -nodes[id].bytes, -nodes[id].files, -nodes[id].dirs);
+    unlink_child(id);
+    child_remove(id);
+    node_free_tree(id);
+}
+
+// Components of a logical path ("./a//b/" -> "a", "b")
+static int split_path(const char *filename, char parts[][256], int max) {
+    int count = 0;
+    const char *p = filename;
+    while (*p && count < max) {
+        while (*p == '/') p++;
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 0) break;
+        if (!(len == 1 && p[0] == '.') && len < 256) {
+            memcpy(parts[count], p, len);
+            parts[count][len] = '\0';
+            count++;
+        }
+        p += len;
+    }
+    return count;
+}
+
+static int node_lookup(const char *filename) {
+    char parts[64][256];
+    int count = split_path(filename, parts, 64);
+    int id = -1;
+    for (int i = 0; i < count; i++) {
+        id = child_find(id, parts[i]);
+        if (id < 0) return -1;
+    }
+    return count ? id : -1;
+}
+
+// Finds or creates every component (a file replaced by a folder, or the
+// reverse, is recreated); returns the last one
+static int node_ensure(const char *filename, int is_dir, long long size, int owner) {
+    char parts[64][256];
+    int count = split_path(filename, parts, 64);
+    int id = -1;
+    for (int i = 0; i < count; i++) {
+        int last = i == count - 1;
+        int want_dir = last ? is_dir : 1;
+        int child = child_find(id, parts[i]);
+        if (child >= 0 && nodes[child].is_dir != want_dir) {
+            node_delete(child);
+            child = -1;
+        }
+        if (child < 0) {
+            child = node_create(id, parts[i], want_dir, size, owner);
+        } else if (last && !is_dir && (nodes[child].bytes != size || nodes[child].owner != owner)) {
+            owner_add(nodes[child].owner, -nodes[child].bytes);
+            propagate(child, size - nodes[child].bytes, 0, 0);
+            nodes[child].owner = owner;
+            owner_add(owner, size);
+        }
+        if (child < 0) return -1;
+        id = child;
+    }
+    return id;
+}
+
+// --- PUBLIC UPDATES ---
+
+void search_index_add(const char *filename, int is_dir) {
+    char path[512];
+    struct stat st;
+    storage_path(filename, path, sizeof(path));
+
+    // A file's size and owner are read under the lock, so a later change is
+    // never overwritten by an earlier one
+    pthread_mutex_lock(&index_lock);
+    if (is_dir) {
+        node_ensure(filename, 1, 0, 0);
+    } else if (lstat(path, &st) == 0) {
+        int dir = S_ISDIR(st.st_mode);
+        node_ensure(filename, dir, dir ? 0 : st.st_size, dir ? 0 : read_owner(path));
+    }
+    pthread_mutex_unlock(&index_lock);
+}
+
+void search_index_remove(const char *filename) {
+    pthread_mutex_lock(&index_lock);
+    int id = node_lookup(filename);
+    if (id >= 0) {
+        node_delete(id);
+        maybe_compact();
+    }
+    pthread_mutex_unlock(&index_lock);
+}
+
+// Each entry is checked on disk under the lock: a delete that races with
+// the walk either happened before the check (skipped) or is applied after.
+// With `sweep` (the reconciler), entries the folder no longer has are
+// dropped and every correction is counted.
+static void scan_tree(const char *fs_path, const char *rel, int sweep) {
+    DIR *d = opendir(fs_path);
+    if (!d) return;
+    unsigned int seq = 0;
+    if (sweep) {
+        pthread_mutex_lock(&index_lock);
+        if (++sweep_seq == 0) sweep_seq = 1;
+        seq = sweep_seq;
+        pthread_mutex_unlock(&index_lock);
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char child_fs[1024], child_rel[1024];
+        snprintf(child_fs, sizeof(child_fs), "%s/%s", fs_path, entry->d_name);
+        snprintf(child_rel, sizeof(child_rel), "%s%s%s", rel, rel[0] ? "/" : "", entry->d_name);
+
+        struct stat st;
+        pthread_mutex_lock(&index_lock);
+        int found = lstat(child_fs, &st) == 0;
+        if (found) {
+            int is_dir = S_ISDIR(st.st_mode);
+            long long size = is_dir ? 0 : st.st_size;
+            int owner = is_dir ? 0 : read_owner(child_fs);
+            int id = node_lookup(child_rel);
+            if (sweep && (id < 0 || nodes[id].is_dir != is_dir ||
+                          (!is_dir && (nodes[id].bytes != size || nodes[id].owner != owner))))
+                stat_repairs++;
+            id = node_ensure(child_rel, is_dir, size, owner);
+            if (id >= 0) nodes[id].seen = seq;
+        }
+        pthread_mutex_unlock(&index_lock);
+        if (found && S_ISDIR(st.st_mode)) scan_tree(child_fs, child_rel, sweep);
+    }
+    closedir(d);
+
+    // The root is spread over the shards: see reconcile()
+    if (!sweep || !rel[0]) return;
+    pthread_mutex_lock(&index_lock);
+    int dir = node_lookup(rel);
+    for (int c = dir >= 0 ? nodes[dir].first_child : -1, next; c >= 0; c = next) {
+        next = nodes[c].next_sibling;
+        if (nodes[c].seen == seq) continue;
+        char child_fs[1024];
+        struct stat st;
+        snprintf(child_fs, sizeof(child_fs), "%s/%s", fs_path, nodes[c].name);
+        if (lstat(child_fs, &st) != 0) {
+            node_delete(c);
+            stat_repairs++;
+        }
+    }
+    maybe_compact();
+    pthread_mutex_unlock(&index_lock);
+}
+
+void search_index_add_tree(const char *filename) {
+    char path[512];
+    struct stat st;
+    storage_path(filename, path, sizeof(path));
+    if (lstat(path, &st) != 0) return;
+    search_index_add(filename, S_ISDIR(st.st_mode));
+    if (S_ISDIR(st.st_mode)) scan_tree(path, filename, 0);
+}
+
+void search_index_move(const char *src_filename, const char *dest_filename) {
+    char parts[64][256];
+    int count = split_path(dest_filename, parts, 64);
+    if (count == 0) return;
+
+    pthread_mutex_lock(&index_lock);
+    int id = node_lookup(src_filename);
+    if (id < 0) {
+        // Not indexed yet (startup scan still running): read it from disk
+        pthread_mutex_unlock(&index_lock);
+        search_index_add_tree(dest_filename);
+        return;
+    }
+
+    // The destination's folder, created if needed; a replaced entry goes
+    int parent = -1;
+    for (int i = 0; i < count - 1; i++) {
+        int child = child_find(parent, parts[i]);
+        if (child >= 0 && !nodes[child].is_dir && child != id) {
+            node_delete(child);
+            child = -1;
+        }
+        if (child < 0) child = node_create(parent, parts[i], 1, 0, 0);
+        if (child < 0) {
+            pthread_mutex_unlock(&index_lock);
+            return;
+        }
+        parent = child;
+    }
+    const char *name = parts[count - 1];
+    int existing = child_find(parent, name);
+    if (existing == id) {
+        pthread_mutex_unlock(&index_lock);
+        return;
+    }
+    for (int a = parent; a >= 0; a = nodes[a].parent) {
+        if (a == id) { // Into itself: refused by the handler, never applied
+            pthread_mutex_unlock(&index_lock);
+            return;
+        }
+    }
+    if (existing >= 0) node_delete(existing);
+
+    IndexNode *n = &nodes[id];
+    propagate(n->parent, -n->bytes, -n->files, -n->dirs);
+    unlink_child(id);
+    child_remove(id);
+    if (strcmp(nodes[id].name, name) != 0) {
+        char *renamed = strdup(name);
+        if (renamed) {
+            unindex_name(nodes[id].name);
+            free(nodes[id].name);
+            nodes[id].name = renamed;
+            index_name(id);
+        }
+    }
+    link_child(id, parent);
+    child_insert(id);
+    propagate(parent, nodes[id].bytes, nodes[id].files, nodes[id].dirs);
+    maybe_compact();
+    pthread_mutex_unlock(&index_lock);
+}
+
+// --- QUERIES ---
+
+static void lower_copy(const char *src, char *dst, size_t size) {
+    size_t i = 0;
+    for (; src[i] && i + 1 < size; i++) dst[i] = (char)tolower((unsigned char)src[i]);
+    dst[i] = '\0';
+}
+
+// The smallest posting list among the pattern's literal trigrams (glob
+// wildcards and bracket sets split the literals). NULL with *none = 1 if
+// a trigram is absent: nothing can match.
+static Posting *rarest_posting(const char *pattern, int glob, int *none) {
+    char lower[512], run[512];
+    lower_copy(pattern, lower, sizeof(lower));
+    Posting *best = NULL;
+    *none = 0;
+
+    size_t run_len = 0;
+    for (const char *p = lower;; p++) {
+        int wild = glob && (*p == '*' || *p == '?' || *p == '[');
+        if (*p && !wild) {
+            run[run_len++] = *p;
+            continue;
+        }
+        run[run_len] = '\0';
+        unsigned int trigrams[MAX_TRIGRAMS];
+        int count = name_trigrams(run, trigrams);
+        for (int t = 0; t < count; t++) {
+            Posting *posting = posting_find(trigrams[t], 0);
+            if (!posting || posting->len == 0) {
+                *none = 1;
+                return NULL;
+            }
+            if (!best || posting->len < best->len) best = posting;
+        }
+        run_len = 0;
+        if (*p == '[') {
+            while (*p && *p != ']') p++; // A set is not literal text
+        }
+        if (!*p) break;
+    }
+    return best;
+}
+
+static int append_path(int id, char **buf, size_t *len, size_t *cap) {
+    int chain[64], depth = 0;
+    for (int a = id; a >= 0 && depth < 64; a = nodes[a].parent) chain[depth++] = a;
+
+    size_t need = 2;
+    for (int i = 0; i < depth; i++) need += strlen(nodes[chain[i]].name) + 1;
+    if (*len + need > *cap) {
+        size_t cap2 = *cap ? *cap * 2 : 8192;
+        while (cap2 < *len + need) cap2 *= 2;
+        char *grown = realloc(*buf, cap2);
+        if (!grown) return -1;
+        *buf = grown;
+        *cap = cap2;
+    }
+    for (int i = depth - 1; i >= 0; i--) {
+        *len += sprintf(*buf + *len, "%s%s", nodes[chain[i]].name, i > 0 ? "/" : "");
+    }
+    *len += sprintf(*buf + *len, "%s\n", nodes[id].is_dir ? "/" : "");
+    return 0;
+}
+
+typedef struct {
+    int group_id, allowed;
+} GroupVerdict;
+
+int search_index_query(const char *pattern, long offset, int limit, SearchGroupFilter filter, void *ctx,
+                       char **out, size_t *out_len, int *more, long *total) {
+    int glob = strpbrk(pattern, "*?[") != NULL;
+    GroupVerdict verdicts[64];
+    int verdict_count = 0;
+    size_t len = 0, cap = 0;
+    long matched = 0;
+    int emitted = 0;
+
+    *out = NULL;
+    *out_len = 0;
+    *more = 0;
+
+    pthread_mutex_lock(&index_lock);
+    stat_queries++;
+    if (++query_seq == 0) query_seq = 1;
+    unsigned int seq = query_seq;
+
+    int none;
+    Posting *candidates = rarest_posting(pattern, glob, &none);
+    long scan = none ? 0 : candidates ? (long)candidates->len : node_high;
+
+    for (long i = 0; i < scan; i++) {
+        int id = candidates ? candidates->ids[i] : (int)i;
+        IndexNode *n = &nodes[id];
+        if (!n->name || n->mark == seq) continue;
+        if (glob ? fnmatch(pattern, n->name, FNM_CASEFOLD) != 0 : strcasestr(n->name, pattern) == NULL) continue;
+
+        // Group folders are only searched by their members
+        int top = id;
+        while (nodes[top].parent >= 0) top = nodes[top].parent;
+        int group_id;
+        if (filter && strncmp(nodes[top].name, "Group_", 6) == 0 && sscanf(nodes[top].name, "Group_%d", &group_id) == 1) {
+            int v = 0;
+            while (v < verdict_count && verdicts[v].group_id != group_id) v++;
+            int allowed;
+            if (v < verdict_count) {
+                allowed = verdicts[v].allowed;
+            } else {
+                allowed = filter(group_id, ctx);
+                if (verdict_count < 64) verdicts[verdict_count++] = (GroupVerdict){group_id, allowed};
+            }
+            if (!allowed) continue;
+        }
+
+        n->mark = seq;
+        if (matched++ < offset) continue;
+        if (emitted == limit) {
+            *more = 1;
+            break;
+        }
+        if (append_path(id, out, &len, &cap) != 0) break;
+        emitted++;
+    }
+    pthread_mutex_unlock(&index_lock);
+
+    *out_len = len;
+    *total = matched;
+    return emitted;
+}
+
+// --- FOLDER TOTALS ---
+
+int search_index_folder_stats(const char *filename, FolderStats *out) {
+    pthread_mutex_lock(&index_lock);
+    int id = node_lookup(filename);
+    char parts[1][256];
+    int is_root = split_path(filename, parts, 1) == 0;
+    int res = build_done && (id >= 0 ? nodes[id].is_dir : is_root) ? 0 : -1;
+    if (res == 0 && id >= 0) {
+        out->bytes = nodes[id].bytes;
+        out->files = nodes[id].files;
+        out->folders = nodes[id].dirs - 1; // Not counting itself
+    } else if (res == 0) {
+        *out = root_stats;
+    }
+    pthread_mutex_unlock(&index_lock);
+    return res;
+}
+
+int search_index_file_info(const char *filename, long long *size, int *owner) {
+    pthread_mutex_lock(&index_lock);
+    int id = node_lookup(filename);
+    int res = id >= 0 && !nodes[id].is_dir ? 0 : -1;
+    if (res == 0) {
+        *size = nodes[id].bytes;
+        *owner = nodes[id].owner;
+    }
+    pthread_mutex_unlock(&index_lock);
+    return res;
+}
+
+long long search_index_owner_bytes(int user_id) {
+    pthread_mutex_lock(&index_lock);
+    OwnerUsage *o = owner_find(user_id, 0);
+    long long bytes = o ? o->bytes : 0;
+    pthread_mutex_unlock(&index_lock);
+    return bytes;
+}
+
+int search_index_ready() {
+    pthread_mutex_lock(&index_lock);
+    int ready = build_done;
+    pthread_mutex_unlock(&index_lock);
+    return ready;
+}
+
+// Recomputes the per-user totals from the files
+static void recount_owners() {
+    OwnerUsage *before = owner_cap ? malloc(owner_cap * sizeof(OwnerUsage)) : NULL;
+    if (owner_cap && !before) return;
+    if (before) memcpy(before, owners, owner_cap * sizeof(OwnerUsage));
+    for (size_t i = 0; i < owner_cap; i++) owners[i].bytes = 0;
+    for (int n = 0; n < node_high; n++) {
+        if (nodes[n].name && !nodes[n].is_dir) owner_add(nodes[n].owner, nodes[n].bytes);
+    }
+    for (size_t i = 0; i < owner_cap && before; i++) {
+        if (!before[i].user_id) continue;
+        OwnerUsage *o = owner_find(before[i].user_id, 0);
+        if (!o || o->bytes != before[i].bytes) stat_repairs++;
+    }
+    free(before);
+}
+
+// Recomputes a subtree's totals from its files, fixing any that drifted
+static void recount(int id, long long *bytes, long *files, long *dirs) {
+    IndexNode *n = &nodes[id];
+    long long b = n->is_dir ? 0 : n->bytes;
+    long f = !n->is_dir, d = n->is_dir;
+    for (int c = n->first_child; c >= 0; c = nodes[c].next_sibling) recount(c, &b, &f, &d);
+    if (n->is_dir && (n->bytes != b || n->files != f || n->dirs != d)) {
+        n->bytes = b;
+        n->files = f;
+        n->dirs = d;
+        stat_repairs++;
+    }
+    *bytes += b;
+    *files += f;
+    *dirs += d;
+}
+
+// Brings the tree back in line with the disk (changes made outside the
+// server, or missed by a handler), then the totals with the tree
+static void reconcile() {
+    for (int s = 0; s < storage_shard_count(); s++) {
+        char root[512];
+        snprintf(root, sizeof(root), "%s", storage_files_dir(s));
+        size_t n = strlen(root);
+        if (n > 1 && root[n - 1] == '/') root[n - 1] = '\0';
+        scan_tree(root, "", 1);
+    }
+
+    pthread_mutex_lock(&index_lock);
+    for (int c = root_first, next; c >= 0; c = next) {
+        next = nodes[c].next_sibling;
+        int found = 0;
+        for (int s = 0; s < storage_shard_count() && !found; s++) {
+            char path[1024];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s%s", storage_files_dir(s), nodes[c].name);
+            found = lstat(path, &st) == 0;
+        }
+        if (!found) {
+            node_delete(c);
+            stat_repairs++;
+        }
+    }
+    FolderStats total = {0, 0, 0};
+    for (int c = root_first; c >= 0; c = nodes[c].next_sibling) recount(c, &total.bytes, &total.files, &total.folders);
+    if (total.bytes != root_stats.bytes || total.files != root_stats.files || total.folders != root_stats.folders) {
+        root_stats = total;
+        stat_repairs++;
+    }
+    recount_owners();
+    maybe_compact();
+    stat_reconciles++;
+    pthread_mutex_unlock(&index_lock);
+}
+
+// --- STARTUP ---
+
+static void *build_thread(void *arg) {
+    (void)arg;
+    for (int s = 0; s < storage_shard_count(); s++) {
+        char root[512];
+        snprintf(root, sizeof(root), "%s", storage_files_dir(s));
+        size_t n = strlen(root);
+        if (n > 1 && root[n - 1] == '/') root[n - 1] = '\0';
+        scan_tree(root, "", 0);
+    }
+
+    pthread_mutex_lock(&index_lock);
+    build_done = 1;
+    char log_msg[128];
+    snprintf(log_msg, sizeof(log_msg), "Search index built: %ld entries", live_nodes);
+    pthread_mutex_unlock(&index_lock);
+    log_activity(log_msg);
+
+    // Polled each second so a reload of reconcile_interval applies at once
+    for (long waited = 0;; waited = 0) {
+        long interval;
+        while ((interval = config_get(CFG_RECONCILE_INTERVAL)) == 0 || waited < interval) {
+            sleep(1);
+            waited++;
+        }
+        unsigned long long repairs = stat_repairs;
+        reconcile();
+        if (stat_repairs != repairs) {
+            snprintf(log_msg, sizeof(log_msg), "Search index reconciled: %llu corrections", stat_repairs - repairs);
+            log_activity(log_msg);
+        }
+    }
+    return NULL;
+}
+
+void search_index_init() {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, build_thread, NULL) == 0) pthread_detach(tid);
+    else perror("Search index build thread creation failed");
+}
+
+int search_index_format_stats(char *buf, size_t size) {
+    pthread_mutex_lock(&index_lock);
+    int n = snprintf(buf, size,
+                     "SEARCH_INDEX %s entries=%ld trigrams=%zu postings=%llu stale=%llu queries=%llu compactions=%llu\n"
+                     "FOLDER_TOTALS bytes=%lld files=%ld folders=%ld reconciles=%llu repairs=%llu\n",
+                     build_done ? "ready" : "building", live_nodes, posting_count, live_postings, stale_postings,
+                     stat_queries, stat_compactions, root_stats.bytes, root_stats.files, root_stats.folders,
+                     stat_reconciles, stat_repairs);
+    pthread_mutex_unlock(&index_lock);
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
@@ -3,32 +3,60 @@
 #include <string.h>
 #include <pthread.h>
 #include "common.h"
+#include "config.h"
 
-// Global array of session pointers
-Session *sessions[MAX_CLIENTS] = {NULL};
+// Session pointers; the array grows on demand, so a reload may raise max_clients
+static Session **sessions = NULL;
+static int session_cap = 0;
 // Mutex to protect the session array
 pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static int session_count = 0;
+
+// Makes room for one more session (session_lock held)
+static int grow_sessions() {
+    int cap = session_cap ? session_cap * 2 : MAX_CLIENTS;
+    long limit = config_get(CFG_MAX_CLIENTS);
+    if (cap > limit) cap = (int)limit;
+    if (cap <= session_cap) cap = session_cap + 1;
+    Session **bigger = realloc(sessions, cap * sizeof(*sessions));
+    if (bigger == NULL) return -1;
+    memset(bigger + session_cap, 0, (cap - session_cap) * sizeof(*sessions));
+    sessions = bigger;
+    session_cap = cap;
+    return 0;
+}
 
 /**
  * @brief Adds a new connection to the session list.
+ * @return 0 on success, -1 if max_clients connections are already open.
  */
-void add_session(int sockfd, struct sockaddr_in addr) {
+int add_session(int sockfd, struct sockaddr_in addr) {
+    int res = -1;
     pthread_mutex_lock(&session_lock);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (session_count == session_cap && session_count < config_get(CFG_MAX_CLIENTS) && grow_sessions() != 0) {
+        pthread_mutex_unlock(&session_lock);
+        return -1;
+    }
+    for (int i = 0; i < session_cap && session_count < config_get(CFG_MAX_CLIENTS); i++) {
         if (sessions[i] == NULL) {
             sessions[i] = (Session *)malloc(sizeof(Session));
+            if (sessions[i] == NULL) break;
             sessions[i]->socket_fd = sockfd;
             sessions[i]->user_id = -1; // Not logged in
             sessions[i]->is_logged_in = 0;
             strcpy(sessions[i]->username, "Guest");
+            sessions[i]->resume_token[0] = '\0';
             
             // Store IP Address
             inet_ntop(AF_INET, &(addr.sin_addr), sessions[i]->client_ip, INET_ADDRSTRLEN);
-            
+
+            session_count++;
+            res = 0;
             break;
         }
     }
     pthread_mutex_unlock(&session_lock);
+    return res;
 }
 
 /**
@@ -36,22 +64,33 @@ void add_session(int sockfd, struct sockaddr_in addr) {
  */
 void remove_session(int sockfd) {
     pthread_mutex_lock(&session_lock);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    for (int i = 0; i < session_cap; i++) {
         if (sessions[i] != NULL && sessions[i]->socket_fd == sockfd) {
             free(sessions[i]);
             sessions[i] = NULL;
+            session_count--;
             break;
         }
     }
     pthread_mutex_unlock(&session_lock);
 }
 
+/**
+ * @brief Number of open connections.
+ */
+int session_count_active() {
+    pthread_mutex_lock(&session_lock);
+    int n = session_count;
+    pthread_mutex_unlock(&session_lock);
+    return n;
+}
+
 /**
  * @brief Finds a session by socket ID.
  */
 Session *find_session(int sockfd) {
     pthread_mutex_lock(&session_lock);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    for (int i = 0; i < session_cap; i++) {
         if (sessions[i] != NULL && sessions[i]->socket_fd == sockfd) {
             pthread_mutex_unlock(&session_lock);
             return sessions[i];
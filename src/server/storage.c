@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+#include <time.h>
+
+#include "storage.h"
+#include "path_lock.h"
+#include "file_cache.h"
+#include "config.h"
+#include "search_index.h"
+
+#define MAX_WEIGHT 16
+
+typedef struct {
+    char base[256];
+    char files[300];
+    char staging[300];
+    char versions[300];
+    int weight;           // Integer share of the placement (1..MAX_WEIGHT)
+} Shard;
+
+static Shard shards[STORAGE_MAX_SHARDS];
+static int shard_count = 0;
+static unsigned long temp_counter = 0;
+static unsigned long long stat_cross_moves, stat_rebalanced;
+
+int copy_recursive(const char *src, const char *dest);
+int copy_single_file(const char *src_path, const char *dest_path);
+int remove_directory_recursive(const char *path);
+void log_activity(const char *msg);
+
+static unsigned long long hash64(const char *a, const char *b, int k) {
+    unsigned long long h = 14695981039346656037ULL; // FNV-1a 64
+    for (; *a; a++) h = (h ^ (unsigned char)*a) * 1099511628211ULL;
+    h = (h ^ (unsigned char)k) * 1099511628211ULL;
+    for (; *b; b++) h = (h ^ (unsigned char)*b) * 1099511628211ULL;
+    h ^= h >> 33; // Final mix: FNV alone spreads the low bits poorly
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Top-level item of a logical path ("Group_3/a/b" -> "Group_3")
+static void top_level(const char *filename, char *out, size_t size) {
+    char norm[PATH_LOCK_MAX_PATH];
+    path_lock_normalize(filename, norm, sizeof(norm));
+    size_t len = strcspn(norm, "/");
+    if (len >= size) len = size - 1;
+    memcpy(out, norm, len);
+    out[len] = '\0';
+}
+
+// Weighted rendezvous hashing: a shard of weight w gets w draws and the
+// highest draw over all shards wins. Keyed by the base path, so the order
+// of FS_STORAGE_DIRS does not matter.
+static int home_shard(const char *top) {
+    int best = 0;
+    unsigned long long best_score = 0;
+    for (int i = 0; i < shard_count; i++) {
+        for (int k = 0; k < shards[i].weight; k++) {
+            unsigned long long score = hash64(shards[i].base, top, k);
+            if (score > best_score) {
+                best_score = score;
+                best = i;
+            }
+        }
+    }
+    return best;
+}
+
+static int exists_on(int shard, const char *top) {
+    char path[600];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s%s", shards[shard].files, top);
+    return lstat(path, &st) == 0;
+}
+
+static void add_shard(const char *spec) {
+    if (shard_count == STORAGE_MAX_SHARDS || *spec == '\0') return;
+    Shard *sh = &shards[shard_count];
+
+    char base[256];
+    snprintf(base, sizeof(base), "%s", spec);
+    char *at = strrchr(base, '@');
+    sh->weight = 1;
+    if (at) {
+        *at = '\0';
+        sh->weight = atoi(at + 1);
+        if (sh->weight < 1) sh->weight = 1;
+        if (sh->weight > MAX_WEIGHT) sh->weight = MAX_WEIGHT;
+    }
+    size_t len = strlen(base);
+    while (len > 1 && base[len - 1] == '/') base[--len] = '\0';
+
+    snprintf(sh->base, sizeof(sh->base), "%s", base);
+    snprintf(sh->files, sizeof(sh->files), "%s/files/", base);
+    snprintf(sh->staging, sizeof(sh->staging), "%s/staging/", base);
+    snprintf(sh->versions, sizeof(sh->versions), "%s/versions/", base);
+    mkdir(sh->base, 0755);
+    mkdir(sh->files, 0755);
+    mkdir(sh->staging, 0755);
+    mkdir(sh->versions, 0755);
+    shard_count++;
+}
+
+static void clean_staging(int shard) {
+    DIR *d = opendir(shards[shard].staging);
+    if (!d) return;
+
+    struct dirent *entry;
+    char path[600];
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(path, sizeof(path), "%s%s", shards[shard].staging, entry->d_name);
+        if (remove(path) != 0) remove_directory_recursive(path); // Interrupted folder moves
+    }
+    closedir(d);
+}
+
+// --- CROSS-SHARD COPY ---
+
+static void remove_any(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return;
+    if (S_ISDIR(st.st_mode)) remove_directory_recursive(path);
+    else unlink(path);
+}
+
+// Keeps the uploader tags (user quotas) of moved files; a COPY, which
+// does not call this, makes new files that belong to no one
+static void copy_owner_tags(const char *src, const char *dest) {
+    struct stat st;
+    if (lstat(src, &st) != 0) return;
+    if (!S_ISDIR(st.st_mode)) {
+        char value[16];
+        ssize_t n = lgetxattr(src, SEARCH_OWNER_XATTR, value, sizeof(value));
+        if (n > 0) lsetxattr(dest, SEARCH_OWNER_XATTR, value, n, 0);
+        return;
+    }
+
+    DIR *d = opendir(src);
+    if (!d) return;
+    struct dirent *entry;
+    char src_child[600], dest_child[600];
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(src_child, sizeof(src_child), "%s/%s", src, entry->d_name);
+        snprintf(dest_child, sizeof(dest_child), "%s/%s", dest, entry->d_name);
+        copy_owner_tags(src_child, dest_child);
+    }
+    closedir(d);
+}
+
+// Streams `src` into the staging folder of `shard`, then renames it to
+// `dest` (on that shard): the item appears complete or not at all
+static int copy_into(int shard, const char *src, const char *dest) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%scopy-%d-%lu", shards[shard].staging, (int)getpid(),
+             __sync_fetch_and_add(&temp_counter, 1));
+
+    int copied = copy_recursive(src, tmp);
+    if (copied == 0) copy_owner_tags(src, tmp);
+    if (copied != 0 || rename(tmp, dest) != 0) {
+        int saved = errno;
+        remove_any(tmp);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+// Moves a physical item to another shard: copy, publish, then drop the source
+static int move_across(int dest_shard, const char *src, const char *dest) {
+    if (copy_into(dest_shard, src, dest) != 0) return -1;
+    remove_any(src);
+    __sync_fetch_and_add(&stat_cross_moves, 1);
+    return 0;
+}
+
+// --- REBALANCER ---
+
+static int rebalancer_stopped = 0;
+static pthread_mutex_t switch_lock = PTHREAD_MUTEX_INITIALIZER; // Held while a move switches over
+
+// Files whose inode changed since the copy began (ctime also moves on
+// rename, so published uploads count); a size mismatch is a broken copy
+static int changed_since(const struct stat *st, time_t since) {
+    return st->st_ctime >= since || st->st_mtime >= since;
+}
+
+// Brings a copy made without the lock up to date with `src`: changed
+// entries are copied again and entries gone from `src` are dropped
+static int sync_tree(const char *src, const char *dest, time_t since) {
+    struct stat ss, ds;
+    if (lstat(src, &ss) != 0) return -1;
+    int have = lstat(dest, &ds) == 0;
+    if (have && S_ISDIR(ss.st_mode) != S_ISDIR(ds.st_mode)) {
+        remove_any(dest);
+        have = 0;
+    }
+
+    if (!S_ISDIR(ss.st_mode)) {
+        if (have && ds.st_size == ss.st_size && !changed_since(&ss, since)) return 0;
+        if (have) unlink(dest);
+        if (copy_single_file(src, dest) != 0) return -1;
+        copy_owner_tags(src, dest);
+        return 0;
+    }
+    if (!have && mkdir(dest, 0755) != 0) return -1;
+
+    struct dirent *entry;
+    char src_child[600], dest_child[600];
+    struct stat st;
+    DIR *d = opendir(dest);
+    if (!d) return -1;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(src_child, sizeof(src_child), "%s/%s", src, entry->d_name);
+        snprintf(dest_child, sizeof(dest_child), "%s/%s", dest, entry->d_name);
+        if (lstat(src_child, &st) != 0) remove_any(dest_child);
+    }
+    closedir(d);
+
+    int res = 0;
+    d = opendir(src);
+    if (!d) return -1;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(src_child, sizeof(src_child), "%s/%s", src, entry->d_name);
+        snprintf(dest_child, sizeof(dest_child), "%s/%s", dest, entry->d_name);
+        if (sync_tree(src_child, dest_child, since) != 0) res = -1;
+    }
+    closedir(d);
+    return res;
+}
+
+// Copies a misplaced item to the staging folder of its home shard while it
+// stays in use, then holds the X lock only to catch up on changes and
+// switch over. Returns 1 if the item was busy (retried on the next pass).
+static int rebalance_item(int home, const char *name, const char *src, const char *dest) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%srebalance-%d-%lu", shards[home].staging, (int)getpid(),
+             __sync_fetch_and_add(&temp_counter, 1));
+
+    // Filesystem timestamps lag the clock by a tick: re-check a margin.
+    // Entries that change under the copy make it fail; the sync fixes them.
+    time_t since = time(NULL) - 1;
+    copy_recursive(src, tmp);
+    copy_owner_tags(src, tmp);
+
+    // A process being replaced leaves the switch-over to its successor
+    pthread_mutex_lock(&switch_lock);
+    PathLock lock;
+    if (__atomic_load_n(&rebalancer_stopped, __ATOMIC_RELAXED) ||
+        path_lock_try(&lock, name, LOCK_MODE_X) != 0) {
+        pthread_mutex_unlock(&switch_lock);
+        remove_any(tmp);
+        return 1;
+    }
+    int res = -1;
+    struct stat st;
+    if (lstat(src, &st) != 0) {
+        // Deleted or renamed while copying
+    } else if (exists_on(home, name)) {
+        errno = EEXIST;
+    } else if (sync_tree(src, tmp, since) == 0 && rename(tmp, dest) == 0) {
+        remove_any(src);
+        __sync_fetch_and_add(&stat_cross_moves, 1);
+        res = 0;
+    }
+    int saved = errno;
+    if (res != 0) remove_any(tmp);
+    file_cache_invalidate(src);
+    path_lock_release(&lock);
+    pthread_mutex_unlock(&switch_lock);
+    errno = saved;
+    return res;
+}
+
+// One pass: every top-level item found away from its home shard is moved
+// there. Busy items are retried on the next pass.
+static void rebalance_pass() {
+    for (int s = 0; s < shard_count; s++) {
+        DIR *d = opendir(shards[s].files);
+        if (!d) continue;
+
+        // Collect first: moving entries while reading the folder skips some
+        int count = 0, cap = 64;
+        char (*names)[256] = malloc(cap * sizeof(*names));
+        struct dirent *entry;
+        while (names && (entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            if (home_shard(entry->d_name) == s) continue;
+            if (count == cap) {
+                cap *= 2;
+                char (*bigger)[256] = realloc(names, cap * sizeof(*names));
+                if (!bigger) break;
+                names = bigger;
+            }
+            snprintf(names[count++], sizeof(names[0]), "%s", entry->d_name);
+        }
+        closedir(d);
+
+        for (int i = 0; i < count && !__atomic_load_n(&rebalancer_stopped, __ATOMIC_RELAXED); i++) {
+            int home = home_shard(names[i]);
+            char src[600], dest[600], log_msg[1024];
+            snprintf(src, sizeof(src), "%s%s", shards[s].files, names[i]);
+            snprintf(dest, sizeof(dest), "%s%s", shards[home].files, names[i]);
+
+            if (exists_on(home, names[i])) {
+                // Leftover of an interrupted move: the home copy is the one being served
+                pthread_mutex_lock(&switch_lock);
+                PathLock lock;
+                if (__atomic_load_n(&rebalancer_stopped, __ATOMIC_RELAXED) ||
+                    path_lock_try(&lock, names[i], LOCK_MODE_X) != 0) {
+                    pthread_mutex_unlock(&switch_lock);
+                    continue;
+                }
+                remove_any(src);
+                file_cache_invalidate(src);
+                path_lock_release(&lock);
+                pthread_mutex_unlock(&switch_lock);
+                snprintf(log_msg, sizeof(log_msg), "Rebalancer: removed stale copy of '%s' from shard %d", names[i], s);
+                log_activity(log_msg);
+                continue;
+            }
+
+            int res = rebalance_item(home, names[i], src, dest);
+            if (res > 0) continue;
+            if (res == 0) {
+                __sync_fetch_and_add(&stat_rebalanced, 1);
+                snprintf(log_msg, sizeof(log_msg), "Rebalancer: moved '%s' from shard %d to shard %d", names[i], s, home);
+            } else {
+                snprintf(log_msg, sizeof(log_msg), "Rebalancer: cannot move '%s' to shard %d: %s", names[i], home, strerror(errno));
+            }
+            log_activity(log_msg);
+        }
+        free(names);
+    }
+}
+
+static void *rebalancer_thread(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&rebalancer_stopped, __ATOMIC_RELAXED)) {
+        rebalance_pass();
+        sleep(STORAGE_REBALANCE_INTERVAL);
+    }
+    return NULL;
+}
+
+// --- PUBLIC API ---
+
+void storage_init(int keep_staging) {
+    const char *dirs = config_string(CFG_STORAGE_DIRS);
+    char spec[2048];
+    snprintf(spec, sizeof(spec), "%s", dirs ? dirs : STORAGE_DEFAULT_DIRS);
+
+    char *saveptr;
+    for (char *tok = strtok_r(spec, ":", &saveptr); tok; tok = strtok_r(NULL, ":", &saveptr))
+        add_shard(tok);
+    if (shard_count == 0) add_shard(STORAGE_DEFAULT_DIRS);
+
+    // A takeover shares the folders with the process it replaces, whose
+    // uploads are still running
+    for (int i = 0; i < shard_count && !keep_staging; i++) clean_staging(i);
+}
+
+void storage_start_rebalancer() {
+    if (shard_count < 2) return;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, rebalancer_thread, NULL) != 0) {
+        perror("Rebalancer thread creation failed");
+        return;
+    }
+    pthread_detach(tid);
+}
+
+void storage_stop_rebalancer() {
+    pthread_mutex_lock(&switch_lock); // Waits for a switch-over in progress
+    __atomic_store_n(&rebalancer_stopped, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&switch_lock);
+}
+
+int storage_shard_count() {
+    return shard_count;
+}
+
+int storage_shard_of(const char *filename) {
+    if (shard_count <= 1) return 0;
+
+    char top[256];
+    top_level(filename, top, sizeof(top));
+    if (top[0] == '\0') return 0;
+
+    int home = home_shard(top);
+    if (exists_on(home, top)) return home;
+    for (int i = 0; i < shard_count; i++) {
+        if (i != home && exists_on(i, top)) return i; // Not rebalanced yet
+    }
+    return home;
+}
+
+void storage_path(const char *filename, char *out, size_t size) {
+    snprintf(out, size, "%s%s", shards[storage_shard_of(filename)].files, filename);
+}
+
+const char *storage_files_dir(int shard) {
+    return shards[shard].files;
+}
+
+const char *storage_staging_dir(int shard) {
+    return shards[shard].staging;
+}
+
+const char *storage_versions_dir(int shard) {
+    return shards[shard].versions;
+}
+
+int storage_move(const char *src_filename, const char *dest_filename) {
+    int src_shard = storage_shard_of(src_filename);
+    int dest_shard = storage_shard_of(dest_filename);
+
+    char src[600], dest[600];
+    snprintf(src, sizeof(src), "%s%s", shards[src_shard].files, src_filename);
+    snprintf(dest, sizeof(dest), "%s%s", shards[dest_shard].files, dest_filename);
+
+    if (access(dest, F_OK) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (src_shard == dest_shard) return rename(src, dest);
+    return move_across(dest_shard, src, dest);
+}
+
+int storage_publish(const char *staged, const char *filename) {
+    int shard = storage_shard_of(filename);
+    char dest[600];
+    snprintf(dest, sizeof(dest), "%s%s", shards[shard].files, filename);
+
+    if (rename(staged, dest) == 0) return 0;
+    if (errno != EXDEV) return -1;
+
+    // The item now lives on another disk: stage a copy there
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%spublish-%d-%lu", shards[shard].staging, (int)getpid(),
+             __sync_fetch_and_add(&temp_counter, 1));
+    int copied = copy_single_file(staged, tmp);
+    if (copied == 0) copy_owner_tags(staged, tmp);
+    if (copied != 0 || rename(tmp, dest) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    unlink(staged);
+    return 0;
+}
+
+int storage_format_stats(char *buf, size_t size) {
+    size_t used = 0;
+    for (int i = 0; i < shard_count && used < size; i++) {
+        struct statvfs vfs;
+        unsigned long long free_mb = 0;
+        if (statvfs(shards[i].files, &vfs) == 0)
+            free_mb = (unsigned long long)vfs.f_bavail * vfs.f_frsize / (1024 * 1024);
+
+        int n = snprintf(buf + used, size - used, "SHARD %d %s weight=%d free=%lluMB\n", i, shards[i].base,
+                         shards[i].weight, free_mb);
+        if (n < 0) break;
+        used += n;
+    }
+    if (used < size && shard_count > 1) {
+        int n = snprintf(buf + used, size - used, "STORAGE cross_shard_moves=%llu rebalanced=%llu\n",
+                         stat_cross_moves, stat_rebalanced);
+        if (n > 0) used += n;
+    }
+    if (used >= size) used = size - 1;
+    return (int)used;
+}
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/xattr.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "common.h"
+#include "protocol.h"
+#include "network.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "stream.h"
+#include "file_cache.h"
+#include "path_lock.h"
+#include "versions.h"
+#include "storage.h"
+#include "config.h"
+#include "timer_wheel.h"
+#include "replication.h"
+#include "search_index.h"
+
+// A commit blocked by a rename/delete/copy/rebalance is retried this often
+#define COMMIT_RETRY_MS 10
+
+void log_activity(const char *msg);
+
+// Each connection is served by one thread, so the table needs no locking
+static __thread Stream streams[MAX_STREAMS_PER_CONN];
+static __thread int rr_next = 0; // Round-robin start for fair chunk scheduling
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+Stream *stream_open(int stream_id, int kind)
+{
+    Stream *free_slot = NULL;
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        if (streams[i].in_use && streams[i].stream_id == stream_id)
+            return NULL; // Stream ID already carries a transfer
+        if (!streams[i].in_use && free_slot == NULL)
+            free_slot = &streams[i];
+    }
+    if (free_slot == NULL)
+        return NULL;
+
+    memset(free_slot, 0, sizeof(Stream));
+    free_slot->in_use = 1;
+    free_slot->stream_id = stream_id;
+    free_slot->kind = kind;
+    free_slot->started_ms = free_slot->progress_ms = timer_now_ms();
+    trace_context_save(&free_slot->trace);
+    trace_accum_init(&free_slot->io_span, TRACE_FILE_IO);
+    trace_accum_init(&free_slot->net_span, kind == STREAM_UPLOAD ? TRACE_NET_RECV : TRACE_NET_SEND);
+    return free_slot;
+}
+
+Stream *stream_find(int stream_id)
+{
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        if (streams[i].in_use && streams[i].stream_id == stream_id)
+            return &streams[i];
+    }
+    return NULL;
+}
+
+void stream_timeout_bases(long long *stall_base, long long *transfer_base)
+{
+    *stall_base = 0;
+    *transfer_base = 0;
+    long long now = timer_now_ms();
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        Stream *st = &streams[i];
+        if (!st->in_use)
+            continue;
+        if (*transfer_base == 0 || st->started_ms < *transfer_base)
+            *transfer_base = st->started_ms;
+        // Paused by the user: not stalled (a kept stream waiting for its resume is)
+        if (st->paused && !st->resume_pending)
+            continue;
+        // Received in full, waiting for the server's own lock: not stalled
+        if (st->commit_pending)
+            continue;
+        // Held back by the rate limiter: counts from when it may send again
+        long long base = st->progress_ms;
+        long long ready_ms = st->not_before_ns / 1000000LL;
+        if (ready_ms > base && ready_ms > now)
+            base = ready_ms;
+        if (*stall_base == 0 || base < *stall_base)
+            *stall_base = base;
+    }
+}
+
+int stream_active_count()
+{
+    int n = 0;
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+        n += streams[i].in_use;
+    return n;
+}
+
+FILE *stream_staging_open(Stream *st, const char *filename)
+{
+    static unsigned long counter = 0;
+    unsigned long id = __sync_fetch_and_add(&counter, 1);
+
+    snprintf(st->staging, sizeof(st->staging), "%s%d-%lu.part",
+             storage_staging_dir(storage_shard_of(filename)), (int)getpid(), id);
+    FILE *f = fopen(st->staging, "wbx");
+    if (!f)
+        st->staging[0] = '\0';
+    return f;
+}
+
+static void stream_flush_trace(Stream *st)
+{
+    TraceContext saved;
+    trace_context_save(&saved);
+    trace_context_restore(&st->trace);
+    trace_accum_flush(&st->io_span);
+    trace_accum_flush(&st->net_span);
+    trace_context_restore(&saved);
+}
+
+void stream_discard(Stream *st)
+{
+    if (st->f)
+        fclose(st->f);
+    if (st->staging[0])
+        remove(st->staging);
+    st->f = NULL;
+    st->staging[0] = '\0';
+    quota_release(&st->quota);
+}
+
+// Releases the slot; an upload that was not committed loses its staging file
+static void stream_release(Stream *st)
+{
+    stream_flush_trace(st);
+    stream_discard(st);
+    st->in_use = 0;
+}
+
+// --- UPLOAD FRAMES ---
+
+// The folder the upload goes into still exists (a busy lock is worth waiting for)
+static int upload_folder_exists(Stream *st)
+{
+    char path[512];
+    struct stat sb;
+    storage_path(st->filename, path, sizeof(path));
+    char *slash = strrchr(path, '/');
+    if (slash)
+        *slash = '\0';
+    return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+// Disk full or I/O error: the staging file is incomplete and is never published
+static void upload_write_failed(int sockfd, Stream *st)
+{
+    char log_msg[600];
+    char *err = "Upload failed: cannot write to disk.";
+    send_packet_stream(sockfd, st->stream_id, MSG_FILE_ERROR, err, strlen(err));
+    snprintf(log_msg, sizeof(log_msg), "%s - UPLOAD failed: cannot write '%s' after %ld bytes",
+             st->log_prefix, st->filename, st->transferred);
+    log_activity(log_msg);
+    stream_release(st);
+}
+
+// Publishes the staging file with one rename(): readers see either the old
+// or the new version, never a partial one
+// Returns 0 when published, 1 if the target is locked (retry later), -1 on
+// error, -2 if the staging file could not be written out
+static int upload_commit(Stream *st)
+{
+    if (st->f)
+    {
+        trace_accum_start(&st->io_span);
+        int failed = ferror(st->f);
+        int closed = fclose(st->f); // Flushes: a full disk shows up here
+        trace_accum_stop(&st->io_span);
+        st->f = NULL;
+        if (failed || closed != 0)
+            return -2;
+    }
+
+    // Never waits here: the connection's other streams would stall with it
+    PathLock lock;
+    TraceSpan lock_span;
+    trace_span_begin(&lock_span, TRACE_LOCK_WAIT);
+    int locked = path_lock_try(&lock, st->filename, LOCK_MODE_X);
+    trace_span_end(&lock_span);
+    if (locked != 0)
+        return upload_folder_exists(st) ? 1 : -1;
+
+    // Tag the uploader so the index can count their bytes (user quotas)
+    if (st->user_id > 0)
+    {
+        char owner[16];
+        int owner_len = snprintf(owner, sizeof(owner), "%d", st->user_id);
+        setxattr(st->staging, SEARCH_OWNER_XATTR, owner, owner_len, 0);
+    }
+
+    // The rebalancer may have moved the file to another shard meanwhile
+    storage_path(st->filename, st->filepath, sizeof(st->filepath));
+    version_snapshot(st->filename, st->filepath); // Old content stays restorable
+    int res = storage_publish(st->staging, st->filename);
+    if (res == 0)
+    {
+        st->staging[0] = '\0';
+        file_cache_invalidate(st->filepath);
+        repl_log_put(st->filename);
+        search_index_add(st->filename, 0);
+        quota_release(&st->quota); // Now counted by the index
+    }
+    path_lock_release(&lock);
+    return res;
+}
+
+static void upload_finish(int sockfd, Stream *st)
+{
+    char log_msg[600];
+
+    int res = upload_commit(st);
+    if (res > 0)
+    {
+        // Kept staged; stream_pump() tries again
+        if (!st->commit_pending)
+        {
+            snprintf(log_msg, sizeof(log_msg), "%s - UPLOAD waiting: '%s' is busy", st->log_prefix, st->filename);
+            log_activity(log_msg);
+        }
+        st->commit_pending = 1;
+        st->not_before_ns = now_ns() + COMMIT_RETRY_MS * 1000000LL;
+        return;
+    }
+    if (res == -2)
+    {
+        upload_write_failed(sockfd, st);
+        return;
+    }
+    if (res != 0)
+    {
+        char *err = "Upload failed: cannot store file (folder removed?).";
+        send_packet_stream(sockfd, st->stream_id, MSG_ERROR, err, strlen(err));
+        snprintf(log_msg, sizeof(log_msg), "%s - UPLOAD failed: cannot commit '%s'", st->log_prefix, st->filename);
+        log_activity(log_msg);
+        stream_release(st);
+        return;
+    }
+    printf("Upload completed: %s (%ld bytes)\n", st->filename, st->transferred);
+
+    char success_msg[300];
+    snprintf(success_msg, sizeof(success_msg), "File uploaded successfully: %s", st->filename);
+    send_packet_stream(sockfd, st->stream_id, MSG_SUCCESS, success_msg, strlen(success_msg));
+
+    snprintf(log_msg, sizeof(log_msg), "%s - UPLOAD completed: '%s' (Received %ld bytes)",
+             st->log_prefix, st->filename, st->transferred);
+    log_activity(log_msg);
+    stream_release(st);
+}
+
+int stream_handle_packet(int sockfd, int stream_id, int msg_type, char *payload, int len)
+{
+    Stream *st = stream_find(stream_id);
+    if (st == NULL)
+        return 0;
+
+    char log_msg[600];
+
+    // Client cancelled the transfer (either direction)
+    if (msg_type == MSG_FILE_ERROR)
+    {
+        snprintf(log_msg, sizeof(log_msg), "%s - %s cancelled: '%s' after %ld bytes", st->log_prefix,
+                 st->kind == STREAM_UPLOAD ? "UPLOAD" : "DOWNLOAD", st->filename, st->transferred);
+        log_activity(log_msg);
+        stream_release(st);
+        return 1;
+    }
+
+    // Received in full: only a cancel still applies while the commit waits
+    if (st->commit_pending)
+        return 1;
+
+    // Pausing a download stops stream_pump(); a paused upload simply
+    // receives no frames until the client resumes it
+    if (msg_type == MSG_TRANSFER_PAUSE || msg_type == MSG_TRANSFER_RESUME)
+    {
+        if (!st->resume_pending)
+        {
+            st->paused = (msg_type == MSG_TRANSFER_PAUSE);
+            st->progress_ms = timer_now_ms();
+        }
+        return 1;
+    }
+
+    // Data frames are never sent towards a download, nor before a kept
+    // upload is resumed (its offset is not agreed yet)
+    if (st->kind != STREAM_UPLOAD || st->resume_pending)
+        return 1;
+
+    TraceContext saved;
+    trace_context_save(&saved);
+    trace_context_restore(&st->trace);
+
+    if (msg_type == MSG_FILE_DATA)
+    {
+        // Only the announced size was admitted against the quota
+        if (st->quota.limited && st->transferred + len > st->filesize)
+        {
+            char *err = "Upload exceeds its announced size.";
+            send_packet_stream(sockfd, st->stream_id, MSG_ERROR, err, strlen(err));
+            snprintf(log_msg, sizeof(log_msg), "%s - UPLOAD refused: '%s' exceeds %ld announced bytes",
+                     st->log_prefix, st->filename, st->filesize);
+            log_activity(log_msg);
+            stream_release(st);
+            trace_context_restore(&saved);
+            return 1;
+        }
+        trace_accum_start(&st->io_span);
+        size_t written = fwrite(payload, 1, len, st->f);
+        trace_accum_stop(&st->io_span);
+        if (written != (size_t)len)
+        {
+            upload_write_failed(sockfd, st);
+            trace_context_restore(&saved);
+            return 1;
+        }
+        st->transferred += len;
+        st->progress_ms = timer_now_ms();
+        // One TCP connection carries every stream, so upload shaping can only
+        // pause reading the socket (TCP pushes back on the client); the loop
+        // skips the read until then, downloads and commits keep going
+        long long wait = rl_reserve(sockfd, st->user_id, st->group_id, RL_UPLOAD, len);
+        if (wait > 0)
+            st->not_before_ns = now_ns() + wait;
+        trace_context_restore(&saved);
+    }
+    else if (msg_type == MSG_FILE_END)
+    {
+        upload_finish(sockfd, st);
+        trace_context_restore(&saved);
+    }
+    else
+    {
+        trace_context_restore(&saved);
+    }
+    return 1;
+}
+
+// --- DOWNLOAD SCHEDULING ---
+
+static void download_step(int sockfd, Stream *st)
+{
+    char buffer[BUFFER_SIZE];
+    char log_msg[600];
+
+    trace_accum_start(&st->io_span);
+    size_t bytes_read = fread(buffer, 1, config_get(CFG_FRAME_SIZE), st->f);
+    trace_accum_stop(&st->io_span);
+
+    if (bytes_read == 0)
+    {
+        send_packet_stream(sockfd, st->stream_id, MSG_FILE_END, "", 0);
+        snprintf(log_msg, sizeof(log_msg), "%s - DOWNLOAD success: Sent '%s' (%ld bytes)",
+                 st->log_prefix, st->filename, st->transferred);
+        log_activity(log_msg);
+        printf("[INFO] File sent successfully.\n");
+        stream_release(st);
+        return;
+    }
+
+    struct timespec start, end;
+    unsigned long long tx_before = net_tx_bytes;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    trace_accum_start(&st->net_span);
+    int res = send_packet_stream(sockfd, st->stream_id, MSG_FILE_DATA, buffer, bytes_read);
+    trace_accum_stop(&st->net_span);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    metrics_record(MSG_FILE_DATA,
+                   (unsigned long long)(end.tv_sec - start.tv_sec) * 1000000000ULL + (end.tv_nsec - start.tv_nsec),
+                   0, net_tx_bytes - tx_before, res < 0);
+
+    if (res < 0)
+    {
+        stream_release(st);
+        return;
+    }
+    st->transferred += bytes_read;
+    st->progress_ms = timer_now_ms();
+
+    // Charge after sending; the debt delays this stream's next chunk only
+    long long wait = rl_reserve(sockfd, st->user_id, st->group_id, RL_DOWNLOAD, bytes_read);
+    if (wait > 0)
+        st->not_before_ns = now_ns() + wait;
+}
+
+void stream_pump(int sockfd)
+{
+    long long now = now_ns();
+    int start = rr_next;
+    rr_next = (rr_next + 1) % MAX_STREAMS_PER_CONN;
+
+    // Uploads whose target was busy at FILE_END
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        Stream *st = &streams[i];
+        if (!st->in_use || !st->commit_pending || st->not_before_ns > now)
+            continue;
+        TraceContext saved;
+        trace_context_save(&saved);
+        trace_context_restore(&st->trace);
+        upload_finish(sockfd, st);
+        trace_context_restore(&saved);
+    }
+
+    // tcp_cork: the frames of one round leave in full-sized segments
+    int cork = config_get(CFG_TCP_CORK) ? 1 : 0;
+    int corked = 0;
+
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        Stream *st = &streams[(start + i) % MAX_STREAMS_PER_CONN];
+        if (!st->in_use || st->kind != STREAM_DOWNLOAD || st->paused || st->not_before_ns > now)
+            continue;
+
+        if (cork && !corked)
+        {
+            setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+            corked = 1;
+        }
+
+        TraceContext saved;
+        trace_context_save(&saved);
+        trace_context_restore(&st->trace);
+        download_step(sockfd, st);
+        trace_context_restore(&saved);
+    }
+
+    if (corked)
+    {
+        int off = 0;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    }
+}
+
+int stream_poll_timeout()
+{
+    long long now = now_ns();
+    long long earliest = -1;
+
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        Stream *st = &streams[i];
+        if (!st->in_use ||
+            (st->kind == STREAM_DOWNLOAD ? st->paused : !st->commit_pending && st->not_before_ns <= now))
+            continue;
+        if (st->not_before_ns <= now)
+            return 0;
+        if (earliest < 0 || st->not_before_ns < earliest)
+            earliest = st->not_before_ns;
+    }
+    if (earliest < 0)
+        return -1;
+    return (int)((earliest - now) / 1000000LL) + 1;
+}
+
+int stream_read_blocked()
+{
+    long long now = now_ns();
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        Stream *st = &streams[i];
+        if (st->in_use && st->kind == STREAM_UPLOAD && !st->commit_pending && st->not_before_ns > now)
+            return 1;
+    }
+    return 0;
+}
+
+void stream_close_all(int sockfd)
+{
+    char log_msg[600];
+    for (int i = 0; i < MAX_STREAMS_PER_CONN; i++)
+    {
+        if (!streams[i].in_use)
+            continue;
+        snprintf(log_msg, sizeof(log_msg), "%s - %s interrupted: '%s' after %ld bytes", streams[i].log_prefix,
+                 streams[i].kind == STREAM_UPLOAD ? "UPLOAD" : "DOWNLOAD", streams[i].filename, streams[i].transferred);
+        log_activity(log_msg);
+        stream_release(&streams[i]);
+    }
+}
+
+// --- RESUMPTION ---
+
+int stream_detach_all(Stream *out, int max)
+{
+    char log_msg[600];
+    int n = 0;
+    for (int i = 0; i < MAX_STREAMS_PER_CONN && n < max; i++)
+    {
+        Stream *st = &streams[i];
+        // A commit still waiting is dropped with the connection (never confirmed)
+        if (!st->in_use || st->commit_pending)
+            continue;
+        stream_flush_trace(st);
+        if (st->kind == STREAM_UPLOAD)
+            fflush(st->f); // stream_resume() truncates through the descriptor
+
+        snprintf(log_msg, sizeof(log_msg), "%s - %s interrupted: '%s' after %ld bytes (kept for resume)",
+                 st->log_prefix, st->kind == STREAM_UPLOAD ? "UPLOAD" : "DOWNLOAD", st->filename, st->transferred);
+        log_activity(log_msg);
+        out[n++] = *st;
+        st->f = NULL;
+        st->staging[0] = '\0';
+        memset(&st->quota, 0, sizeof(st->quota)); // Held by the copy now
+        st->in_use = 0;
+    }
+    return n;
+}
+
+int stream_adopt(const Stream *detached)
+{
+    Stream *st = stream_open(detached->stream_id, detached->kind);
+    if (st == NULL)
+        return -1;
+
+    // Keep the fresh trace state: spans now belong to the resuming request
+    TraceContext trace = st->trace;
+    TraceSpan io_span = st->io_span, net_span = st->net_span;
+    *st = *detached;
+    st->in_use = 1;
+    st->trace = trace;
+    st->io_span = io_span;
+    st->net_span = net_span;
+    st->not_before_ns = 0;
+    st->progress_ms = timer_now_ms();
+    st->paused = 1; // Downloads: stream_pump() skips the stream until resumed
+    st->resume_pending = 1;
+    return 0;
+}
+
+int stream_resume(Stream *st, long offset)
+{
+    if (!st->resume_pending || offset < 0)
+        return -1;
+
+    if (st->kind == STREAM_UPLOAD)
+    {
+        // Frames sent before the drop may not all have arrived: keep what did
+        if (offset > st->transferred || fflush(st->f) != 0 || ftruncate(fileno(st->f), offset) != 0 ||
+            fseek(st->f, offset, SEEK_SET) != 0)
+            return -1;
+    }
+    else if (offset > st->filesize || fseek(st->f, offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+
+    st->transferred = offset;
+    st->progress_ms = timer_now_ms();
+    st->paused = 0;
+    st->resume_pending = 0;
+    return 0;
+}
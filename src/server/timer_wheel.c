@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "timer_wheel.h"
+
+#define SLOTS (1 << TIMER_LEVEL_BITS)
+#define SLOT_MASK (SLOTS - 1)
+#define MAX_SPAN ((1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+static TimerEntry *wheel[TIMER_LEVELS][SLOTS];
+static unsigned long long current_tick = 0;
+static long long epoch_ms = 0;  // Time of tick 0
+static int armed_count = 0;
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+long long timer_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// --- SLOT LISTS (wheel_lock held) ---
+
+static void slot_insert(TimerEntry *e) {
+    unsigned long long delta = e->expires > current_tick ? e->expires - current_tick : 1;
+    if (delta > MAX_SPAN) {
+        delta = MAX_SPAN;
+        e->expires = current_tick + delta; // Re-checked by its callback when reached
+    }
+
+    // Lowest level whose span covers the deadline
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_LEVEL_BITS * (level + 1))))
+        level++;
+    int slot = (int)((e->expires >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK);
+
+    e->prev = NULL;
+    e->next = wheel[level][slot];
+    if (e->next) e->next->prev = e;
+    wheel[level][slot] = e;
+    e->armed = 1;
+    armed_count++;
+}
+
+static void slot_unlink(TimerEntry *e) {
+    // The head pointer is found again from the entry's own deadline
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        for (int level = 0; level < TIMER_LEVELS; level++) {
+            int slot = (int)((e->expires >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK);
+            if (wheel[level][slot] == e) {
+                wheel[level][slot] = e->next;
+                break;
+            }
+        }
+    }
+    if (e->next) e->next->prev = e->prev;
+    e->prev = e->next = NULL;
+    e->armed = 0;
+    armed_count--;
+}
+
+static unsigned long long tick_of(long long deadline_ms) {
+    long long ms = deadline_ms - epoch_ms;
+    if (ms <= 0) return current_tick + 1;
+    unsigned long long tick = (unsigned long long)((ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS);
+    return tick > current_tick ? tick : current_tick + 1;
+}
+
+// Moves every timer of a higher-level slot down to where it now belongs
+static void cascade(int level) {
+    int slot = (int)((current_tick >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK);
+    TimerEntry *e = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    while (e) {
+        TimerEntry *next = e->next;
+        armed_count--;
+        slot_insert(e);
+        e = next;
+    }
+}
+
+static void advance_one_tick(long long now) {
+    current_tick++;
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+        if ((current_tick & ((1ULL << (TIMER_LEVEL_BITS * level)) - 1)) != 0) break;
+        cascade(level);
+    }
+
+    int slot = (int)(current_tick & SLOT_MASK);
+    TimerEntry *e = wheel[0][slot];
+    wheel[0][slot] = NULL;
+    while (e) {
+        TimerEntry *next = e->next;
+        e->prev = e->next = NULL;
+        e->armed = 0;
+        armed_count--;
+
+        long long again = e->fire(e, now);
+        if (again > 0) {
+            e->expires = tick_of(again);
+            slot_insert(e);
+        }
+        e = next;
+    }
+}
+
+static void *wheel_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        usleep(TIMER_TICK_MS * 1000);
+        long long now = timer_now_ms();
+        pthread_mutex_lock(&wheel_lock);
+        // Catch up after a late wake-up, one tick at a time
+        while ((long long)(current_tick + 1) * TIMER_TICK_MS <= now - epoch_ms)
+            advance_one_tick(now);
+        pthread_mutex_unlock(&wheel_lock);
+    }
+    return NULL;
+}
+
+void timer_wheel_start() {
+    epoch_ms = timer_now_ms();
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, wheel_thread, NULL) != 0) {
+        perror("Timer thread creation failed");
+        return;
+    }
+    pthread_detach(tid);
+}
+
+// --- PUBLIC API ---
+
+void timer_arm(TimerEntry *entry, long long deadline_ms) {
+    pthread_mutex_lock(&wheel_lock);
+    if (entry->armed) slot_unlink(entry);
+    entry->expires = tick_of(deadline_ms);
+    slot_insert(entry);
+    pthread_mutex_unlock(&wheel_lock);
+}
+
+void timer_cancel(TimerEntry *entry) {
+    pthread_mutex_lock(&wheel_lock);
+    if (entry->armed) slot_unlink(entry);
+    pthread_mutex_unlock(&wheel_lock);
+}
+
+int timer_armed_count() {
+    pthread_mutex_lock(&wheel_lock);
+    int n = armed_count;
+    pthread_mutex_unlock(&wheel_lock);
+    return n;
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+#include "metrics.h"
+#include "config.h"
+
+void log_activity(const char *msg);
+
+// Fixed-size binary span record. 'seq' is written last so readers can
+// detect slots that are being overwritten while they export.
+typedef struct {
+    uint64_t seq;
+    uint64_t request_id;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    uint32_t count;
+    int32_t tid;
+    int16_t phase;
+    int16_t msg_type;
+} TraceRecord;
+
+static TraceRecord ring[TRACE_RING_SIZE];
+static uint64_t ring_head = 0;      // Next slot to claim (monotonic)
+static uint64_t next_request_id = 1;
+static int sample_rate = TRACE_DEFAULT_SAMPLE;
+
+// Per-thread current request
+static __thread uint64_t cur_request_id = 0;
+static __thread int cur_sampled = 0;
+static __thread int cur_msg_type = -1;
+static __thread int cur_tid = 0;
+static __thread TraceSpan cur_request_span;
+
+static const char *phase_names[TRACE_PHASE_COUNT] = {
+    "request", "permission", "db_read", "lock_wait", "file_io", "net_send", "net_recv"};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void emit(int phase, uint64_t start_ns, uint64_t dur_ns, unsigned int count)
+{
+    uint64_t idx = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+    TraceRecord *r = &ring[idx & (TRACE_RING_SIZE - 1)];
+
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELEASE); // Mark slot as in-progress
+    r->request_id = cur_request_id;
+    r->start_ns = start_ns;
+    r->dur_ns = dur_ns;
+    r->count = count;
+    r->tid = cur_tid;
+    r->phase = (int16_t)phase;
+    r->msg_type = (int16_t)cur_msg_type;
+    __atomic_store_n(&r->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+// --- REQUEST SCOPE ---
+
+void trace_set_sample_rate(int one_in_n)
+{
+    __atomic_store_n(&sample_rate, one_in_n < 0 ? 0 : one_in_n, __ATOMIC_RELAXED);
+}
+
+void trace_begin_request(int msg_type)
+{
+    cur_request_id = __atomic_fetch_add(&next_request_id, 1, __ATOMIC_RELAXED);
+    cur_msg_type = msg_type;
+
+    int rate = __atomic_load_n(&sample_rate, __ATOMIC_RELAXED);
+    cur_sampled = (rate > 0 && cur_request_id % rate == 0);
+    if (!cur_sampled)
+        return;
+
+    if (cur_tid == 0)
+        cur_tid = (int)syscall(SYS_gettid);
+    trace_span_begin(&cur_request_span, TRACE_REQUEST);
+}
+
+void trace_end_request()
+{
+    if (cur_sampled)
+        trace_span_end(&cur_request_span);
+    cur_request_id = 0;
+    cur_sampled = 0;
+    cur_msg_type = -1;
+}
+
+unsigned long long trace_request_id()
+{
+    return cur_request_id;
+}
+
+void trace_context_save(TraceContext *ctx)
+{
+    ctx->request_id = cur_request_id;
+    ctx->sampled = cur_sampled;
+    ctx->msg_type = cur_msg_type;
+}
+
+void trace_context_restore(const TraceContext *ctx)
+{
+    cur_request_id = ctx->request_id;
+    cur_sampled = ctx->sampled;
+    cur_msg_type = ctx->msg_type;
+    if (cur_sampled && cur_tid == 0)
+        cur_tid = (int)syscall(SYS_gettid);
+}
+
+// --- SPANS ---
+
+void trace_span_begin(TraceSpan *span, int phase)
+{
+    span->phase = phase;
+    span->count = 1;
+    span->total_ns = 0;
+    span->start_ns = cur_sampled ? now_ns() : 0;
+}
+
+void trace_span_end(TraceSpan *span)
+{
+    if (!cur_sampled || span->start_ns == 0)
+        return;
+    emit(span->phase, span->start_ns, now_ns() - span->start_ns, 1);
+}
+
+void trace_accum_init(TraceSpan *span, int phase)
+{
+    span->phase = phase;
+    span->count = 0;
+    span->total_ns = 0;
+    span->start_ns = 0;
+}
+
+void trace_accum_start(TraceSpan *span)
+{
+    if (!cur_sampled)
+        return;
+    uint64_t t = now_ns();
+    if (span->count == 0)
+        span->start_ns = t;
+    span->total_ns -= t; // Completed by trace_accum_stop
+}
+
+void trace_accum_stop(TraceSpan *span)
+{
+    if (!cur_sampled)
+        return;
+    span->total_ns += now_ns();
+    span->count++;
+}
+
+void trace_accum_flush(TraceSpan *span)
+{
+    if (!cur_sampled || span->count == 0)
+        return;
+    emit(span->phase, span->start_ns, span->total_ns, span->count);
+    span->count = 0;
+    span->total_ns = 0;
+}
+
+// --- EXPORT ---
+
+int trace_export_chrome(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    int written = 0;
+
+    fprintf(f, "{\"traceEvents\":[");
+    for (uint64_t i = first; i < head; i++)
+    {
+        TraceRecord copy = ring[i & (TRACE_RING_SIZE - 1)];
+        // Skip slots overwritten (or still being written) during the copy
+        if (copy.seq != i + 1 || __atomic_load_n(&ring[i & (TRACE_RING_SIZE - 1)].seq, __ATOMIC_ACQUIRE) != i + 1)
+            continue;
+
+        fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"pid\":%d,\"tid\":%d,\"args\":{\"request_id\":%llu,\"count\":%u}}",
+                written ? "," : "", phase_names[copy.phase], msg_type_name(copy.msg_type),
+                copy.start_ns / 1000.0, copy.dur_ns / 1000.0, (int)getpid(), copy.tid,
+                (unsigned long long)copy.request_id, copy.count);
+        written++;
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+    return written;
+}
+
+// Waits for SIGUSR2 (kill -USR2 <pid>) and dumps the ring
+static void *exporter_thread(void *arg)
+{
+    sigset_t *set = (sigset_t *)arg;
+    int sig;
+    while (sigwait(set, &sig) == 0)
+    {
+        int n = trace_export_chrome(TRACE_FILE);
+        char log_msg[128];
+        snprintf(log_msg, sizeof(log_msg), "Trace exported: %d spans -> %s", n, TRACE_FILE);
+        log_activity(log_msg);
+    }
+    return NULL;
+}
+
+void trace_init()
+{
+    trace_set_sample_rate(config_get(CFG_TRACE_SAMPLE));
+
+    // Block SIGUSR2 in every thread (inherited by threads created later)
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, exporter_thread, &set) != 0)
+    {
+        perror("Trace thread creation failed");
+        return;
+    }
+    pthread_detach(tid);
+}
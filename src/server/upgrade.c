@@ -0,0 +1,325 @@
+#define _GNU_SOURCE // accept4, pipe2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "upgrade.h"
+#include "listener.h"
+#include "resume.h"
+#include "storage.h"
+#include "versions.h"
+#include "config.h"
+#include "timer_wheel.h"
+
+int session_count_active();
+void log_activity(const char *msg);
+
+static int control_fd = -1;                // UPGRADE_SOCKET
+static int peer_fd = -1;                   // Old process: the new one, during a handover
+static int takeover_fd = -1;               // New process: the old one
+static pthread_mutex_t peer_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wake_pipe[2] = {-1, -1};
+static int upgrading = 0;
+static void *(*conn_handler)(void *);
+static void (*done_hook)(void);
+
+// --- RECORDS ---
+
+static int send_record(int fd, const char *text, const int *fds, int nfds) {
+    struct iovec iov = {(void *)text, strlen(text)};
+    struct msghdr msg = {0};
+    char control[CMSG_SPACE(sizeof(int) * LISTENER_MAX_ACCEPTORS)];
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)iov.iov_len ? 0 : -1;
+}
+
+// Returns the text length (0 on EOF, -1 on error); `*nfds` descriptors received
+static int recv_record(int fd, char *text, size_t size, int *fds, int max_fds, int *nfds) {
+    struct iovec iov = {text, size - 1};
+    struct msghdr msg = {0};
+    char control[CMSG_SPACE(sizeof(int) * LISTENER_MAX_ACCEPTORS)];
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    *nfds = 0;
+    if (n < 0) return -1;
+    text[n] = '\0';
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int *received = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < count; i++) {
+            if (*nfds < max_fds) fds[(*nfds)++] = received[i];
+            else close(received[i]);
+        }
+    }
+    return (int)n;
+}
+
+// --- OLD PROCESS ---
+
+// Detached resume tokens move with the connections, so a client that
+// dropped can resume against the new process
+static void send_tokens(int fd) {
+    ResumeExport *tokens;
+    int count = resume_export(&tokens);
+    char rec[UPGRADE_RECORD_SIZE];
+    for (int i = 0; i < count; i++) {
+        snprintf(rec, sizeof(rec), "TOKEN %d %s %s %ld", tokens[i].user_id, tokens[i].username,
+                 tokens[i].token, tokens[i].ttl_left);
+        if (send_record(fd, rec, NULL, 0) != 0) break;
+    }
+    if (count >= 0) free(tokens);
+}
+
+static int begin_handover(int fd) {
+    int fds[LISTENER_MAX_ACCEPTORS], shared;
+    int n = listener_export(fds, LISTENER_MAX_ACCEPTORS, &shared);
+    char rec[UPGRADE_RECORD_SIZE];
+    snprintf(rec, sizeof(rec), "LISTENER %d %d", n, shared);
+    if (send_record(fd, rec, fds, n) != 0) return -1;
+
+    // The new process owns the listening sockets now; it creates its own
+    // control socket after READY
+    unlink(UPGRADE_SOCKET);
+    close(control_fd);
+    control_fd = -1;
+    send_tokens(fd);
+    // Before READY: the new process starts serving then, and path locks do
+    // not reach across processes
+    storage_stop_rebalancer();
+    versions_stop_sweeper();
+    send_record(fd, "READY", NULL, 0);
+
+    pthread_mutex_lock(&peer_lock);
+    peer_fd = fd;
+    pthread_mutex_unlock(&peer_lock);
+    __atomic_store_n(&upgrading, 1, __ATOMIC_RELEASE);
+    listener_stop();
+    char c = 1;
+    if (write(wake_pipe[1], &c, 1) < 0) perror("Upgrade wake-up");
+
+    log_activity("Upgrade: a new process took the listening sockets over, draining connections");
+    return 0;
+}
+
+static void *control_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        int fd = accept4(control_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR) perror("Upgrade accept failed");
+            continue;
+        }
+        char rec[UPGRADE_RECORD_SIZE];
+        int nfds;
+        if (recv_record(fd, rec, sizeof(rec), NULL, 0, &nfds) > 0 && strcmp(rec, "HELLO 1") == 0 &&
+            begin_handover(fd) == 0)
+            break;
+        close(fd);
+    }
+    return NULL;
+}
+
+int upgrade_listen() {
+    if (pipe2(wake_pipe, O_CLOEXEC) != 0) {
+        perror("Upgrade pipe failed");
+        return -1;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", UPGRADE_SOCKET);
+    unlink(UPGRADE_SOCKET); // Left by a server that crashed: the port is ours, so it is stale
+
+    control_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (control_fd < 0 || bind(control_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(control_fd, 1) != 0) {
+        perror("Upgrade socket failed");
+        if (control_fd >= 0) close(control_fd);
+        control_fd = -1;
+        return -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, control_thread, NULL) != 0) {
+        perror("Upgrade thread creation failed");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+int upgrade_wake_fd() {
+    return wake_pipe[0];
+}
+
+int upgrade_in_progress() {
+    return __atomic_load_n(&upgrading, __ATOMIC_ACQUIRE);
+}
+
+int upgrade_handoff(int sockfd, const Session *sess) {
+    char rec[UPGRADE_RECORD_SIZE];
+    snprintf(rec, sizeof(rec), "CONN %d %d %s %s", sess->is_logged_in, sess->user_id, sess->username,
+             sess->resume_token[0] ? sess->resume_token : "-");
+
+    pthread_mutex_lock(&peer_lock);
+    int rc = peer_fd >= 0 ? send_record(peer_fd, rec, &sockfd, 1) : -1;
+    pthread_mutex_unlock(&peer_lock);
+
+    if (rc == 0 && sess->resume_token[0]) resume_revoke(sess->resume_token); // Lives on over there
+    return rc;
+}
+
+void upgrade_drain() {
+    long long deadline = timer_now_ms() + config_get(CFG_DRAIN_TIMEOUT) * 1000;
+    int open;
+    while ((open = session_count_active()) > 0 && timer_now_ms() < deadline) usleep(100000);
+
+    char log_msg[128];
+    if (open > 0) {
+        snprintf(log_msg, sizeof(log_msg), "Upgrade: drain_timeout reached, closing %d connection(s)", open);
+    } else {
+        snprintf(log_msg, sizeof(log_msg), "Upgrade: all connections handed over or finished");
+    }
+    log_activity(log_msg);
+
+    pthread_mutex_lock(&peer_lock);
+    if (peer_fd >= 0) {
+        send_tokens(peer_fd); // Of the connections that dropped while draining
+        send_record(peer_fd, "DONE", NULL, 0);
+        close(peer_fd);
+        peer_fd = -1;
+    }
+    pthread_mutex_unlock(&peer_lock);
+}
+
+// --- NEW PROCESS ---
+
+static void import_token(const char *rec) {
+    int user_id;
+    char username[50], token[RESUME_TOKEN_LEN + 1];
+    long ttl;
+    if (sscanf(rec, "TOKEN %d %49s %32s %ld", &user_id, username, token, &ttl) == 4)
+        resume_import(token, -1, user_id, username, ttl);
+}
+
+int upgrade_takeover() {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", UPGRADE_SOCKET);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("Takeover: no running server on " UPGRADE_SOCKET);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    char rec[UPGRADE_RECORD_SIZE];
+    int fds[LISTENER_MAX_ACCEPTORS], nfds, count, shared;
+    if (send_record(fd, "HELLO 1", NULL, 0) != 0 ||
+        recv_record(fd, rec, sizeof(rec), fds, LISTENER_MAX_ACCEPTORS, &nfds) <= 0 ||
+        sscanf(rec, "LISTENER %d %d", &count, &shared) != 2 || count != nfds) {
+        fprintf(stderr, "Takeover: the running server refused the handover\n");
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        close(fd);
+        return -1;
+    }
+    int acceptors = listener_adopt(fds, nfds, shared);
+
+    while (recv_record(fd, rec, sizeof(rec), NULL, 0, &nfds) > 0 && strcmp(rec, "READY") != 0)
+        import_token(rec);
+    takeover_fd = fd;
+    return acceptors;
+}
+
+static void spawn_restored(const char *rec, int sockfd) {
+    Session *sess = calloc(1, sizeof(Session));
+    AcceptedConn *conn = calloc(1, sizeof(AcceptedConn));
+    char token[RESUME_TOKEN_LEN + 1];
+    socklen_t len = sizeof(struct sockaddr_in);
+
+    if (!sess || !conn ||
+        sscanf(rec, "CONN %d %d %49s %32s", &sess->is_logged_in, &sess->user_id, sess->username, token) != 4) {
+        free(sess);
+        free(conn);
+        close(sockfd);
+        return;
+    }
+    snprintf(sess->resume_token, sizeof(sess->resume_token), "%s", strcmp(token, "-") ? token : "");
+    conn->sockfd = sockfd;
+    getpeername(sockfd, (struct sockaddr *)&conn->addr, &len);
+    conn->restored = sess;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t tid;
+    if (pthread_create(&tid, &attr, conn_handler, conn) != 0) {
+        perror("Thread creation failed");
+        free(sess);
+        free(conn);
+        close(sockfd);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void *receiver_thread(void *arg) {
+    (void)arg;
+    char rec[UPGRADE_RECORD_SIZE];
+    int fds[1], nfds, handed = 0;
+    while (recv_record(takeover_fd, rec, sizeof(rec), fds, 1, &nfds) > 0 && strcmp(rec, "DONE") != 0) {
+        if (strncmp(rec, "CONN ", 5) == 0 && nfds == 1) {
+            spawn_restored(rec, fds[0]);
+            handed++;
+        } else {
+            for (int i = 0; i < nfds; i++) close(fds[i]);
+            if (strncmp(rec, "TOKEN ", 6) == 0) import_token(rec);
+        }
+    }
+    close(takeover_fd);
+    takeover_fd = -1;
+
+    char log_msg[128];
+    snprintf(log_msg, sizeof(log_msg), "Upgrade: previous process exited, %d connection(s) handed over", handed);
+    log_activity(log_msg);
+    if (done_hook) done_hook();
+    return NULL;
+}
+
+void upgrade_start_receiver(void *(*handler)(void *), void (*on_done)(void)) {
+    conn_handler = handler;
+    done_hook = on_done;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, receiver_thread, NULL) != 0) {
+        perror("Upgrade receiver creation failed");
+        return;
+    }
+    pthread_detach(tid);
+}
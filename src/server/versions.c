@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "versions.h"
+#include "path_lock.h"
+#include "storage.h"
+#include "config.h"
+
+#define MAX_VERSIONS_SCANNED 1024
+#define HISTORY_NAME_FILE "name" // Logical path of the history (folders are named by its hash)
+
+void log_activity(const char *msg);
+
+// One archived version. A file's history may be spread over several shards
+// when the file moved between disks: each snapshot is linked on the shard
+// that held the file at the time (hardlinks cannot cross filesystems).
+typedef struct {
+    int id;
+    int shard;
+} VersionRef;
+
+static int keep = VERSION_DEFAULT_KEEP;
+static long max_age_sec = VERSION_DEFAULT_MAX_AGE_DAYS * 86400L;
+
+// Sweeper results (totals are from the last complete pass)
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static long stat_histories = 0, stat_versions = 0;
+static long long stat_bytes = 0;
+static unsigned long long stat_sweeps = 0, stat_expired = 0, stat_repaired = 0;
+
+void versions_init() {
+    long k = config_get(CFG_VERSION_KEEP);
+    keep = k > MAX_VERSIONS_SCANNED - 1 ? MAX_VERSIONS_SCANNED - 1 : (int)k;
+    max_age_sec = config_get(CFG_VERSION_MAX_AGE_DAYS) * 86400L;
+}
+
+// History folder of a file on one shard: hash of the normalized logical
+// path, so that "a//b" and "./a/b" share one history and nested names never collide
+static void history_dir(int shard, const char *filename, char *out, size_t size) {
+    char norm[PATH_LOCK_MAX_PATH];
+    path_lock_normalize(filename, norm, sizeof(norm));
+
+    unsigned long long h = 14695981039346656037ULL; // FNV-1a 64
+    for (const char *p = norm; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    snprintf(out, size, "%s%016llx", storage_versions_dir(shard), h);
+}
+
+static int cmp_desc(const void *a, const void *b) {
+    return ((const VersionRef *)b)->id - ((const VersionRef *)a)->id;
+}
+
+static int cmp_int_asc(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Version ID of a directory entry, 0 if it is not a version
+static int entry_id(const char *name) {
+    char *end;
+    long id = strtol(name, &end, 10);
+    return name[0] >= '1' && name[0] <= '9' && *end == '\0' ? (int)id : 0;
+}
+
+// Version IDs in one history folder, oldest first
+static int read_ids(const char *dir, int *ids, int max) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    int n = 0, id;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL && n < max) {
+        if ((id = entry_id(entry->d_name)) > 0) ids[n++] = id;
+    }
+    closedir(d);
+    qsort(ids, n, sizeof(int), cmp_int_asc);
+    return n;
+}
+
+// Records whose history a folder is (written before versions are moved in)
+static void history_write_name(const char *dir, const char *filename) {
+    char norm[PATH_LOCK_MAX_PATH], path[600], tmp[620];
+    path_lock_normalize(filename, norm, sizeof(norm));
+    snprintf(path, sizeof(path), "%s/%s", dir, HISTORY_NAME_FILE);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+    fputs(norm, f);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) unlink(tmp);
+}
+
+static int history_read_name(const char *dir, char *out, size_t size) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, HISTORY_NAME_FILE);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(out, (int)size, f) != NULL && out[0];
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+// Removes a history folder that no longer holds a version
+static void history_drop_if_empty(const char *dir) {
+    int id;
+    if (read_ids(dir, &id, 1) > 0) return;
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, HISTORY_NAME_FILE);
+    unlink(path);
+    rmdir(dir);
+}
+
+// Versions of a file on every shard, newest first
+static int list_versions(const char *filename, VersionRef *refs, int max) {
+    int n = 0;
+    for (int s = 0; s < storage_shard_count(); s++) {
+        char dir[512];
+        history_dir(s, filename, dir, sizeof(dir));
+        DIR *d = opendir(dir);
+        if (!d) continue;
+
+        struct dirent *entry;
+        int id;
+        while ((entry = readdir(d)) != NULL && n < max) {
+            if ((id = entry_id(entry->d_name)) > 0) {
+                refs[n].id = id;
+                refs[n].shard = s;
+                n++;
+            }
+        }
+        closedir(d);
+    }
+    qsort(refs, n, sizeof(VersionRef), cmp_desc);
+    return n;
+}
+
+static void ref_path(const char *filename, const VersionRef *ref, char *out, size_t size) {
+    char dir[512];
+    history_dir(ref->shard, filename, dir, sizeof(dir));
+    snprintf(out, size, "%s/%d", dir, ref->id);
+}
+
+// Retention: at most `keep` versions, none archived more than max_age ago
+static void prune(const char *filename) {
+    VersionRef refs[MAX_VERSIONS_SCANNED];
+    int n = list_versions(filename, refs, MAX_VERSIONS_SCANNED);
+    time_t now = time(NULL);
+    char path[600];
+
+    for (int i = 0; i < n; i++) {
+        ref_path(filename, &refs[i], path, sizeof(path));
+        struct stat st;
+        int expired = max_age_sec > 0 && stat(path, &st) == 0 && now - st.st_ctime > max_age_sec;
+        if (i >= keep || expired) {
+            unlink(path);
+            __sync_fetch_and_add(&stat_expired, 1);
+        }
+    }
+    for (int s = 0; s < storage_shard_count(); s++) {
+        char dir[512];
+        history_dir(s, filename, dir, sizeof(dir));
+        history_drop_if_empty(dir);
+    }
+}
+
+int version_snapshot(const char *filename, const char *filepath) {
+    struct stat st;
+    if (keep == 0 || stat(filepath, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+
+    char dir[512];
+    history_dir(storage_shard_of(filename), filename, dir, sizeof(dir));
+    if (mkdir(dir, 0755) == 0) history_write_name(dir, filename);
+
+    VersionRef refs[MAX_VERSIONS_SCANNED];
+    int id = list_versions(filename, refs, MAX_VERSIONS_SCANNED) > 0 ? refs[0].id + 1 : 1;
+
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%d", dir, id);
+    if (link(filepath, path) != 0) return -1;
+
+    prune(filename);
+    return id;
+}
+
+int version_path(const char *filename, int id, char *out, size_t size) {
+    if (id <= 0) return -1;
+    for (int s = 0; s < storage_shard_count(); s++) {
+        VersionRef ref = {id, s};
+        ref_path(filename, &ref, out, size);
+
+        struct stat st;
+        if (stat(out, &st) == 0 && S_ISREG(st.st_mode)) return 0;
+    }
+    return -1;
+}
+
+int version_restore(const char *filename, const char *filepath, int id) {
+    char vpath[600];
+    if (version_path(filename, id, vpath, sizeof(vpath)) != 0) return -1;
+
+    // Link first: archiving the current content may prune this very version
+    char tmp[620];
+    snprintf(tmp, sizeof(tmp), "%s.restore", vpath);
+    unlink(tmp);
+    if (link(vpath, tmp) != 0) return -1;
+
+    version_snapshot(filename, filepath);
+    if (storage_publish(tmp, filename) != 0) { // Copies only if the file changed disks
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Moves the versions in `src_dir` (on `shard`) into the history of
+// `filename`. They keep their IDs if that history is empty, otherwise they
+// are renumbered after its newest version, so nothing is overwritten.
+static void history_merge(const char *src_dir, int shard, const char *filename) {
+    int ids[MAX_VERSIONS_SCANNED];
+    int n = read_ids(src_dir, ids, MAX_VERSIONS_SCANNED);
+    if (n == 0) {
+        history_drop_if_empty(src_dir);
+        return;
+    }
+    // From here on the folder belongs to `filename`: an interrupted move is
+    // finished by the sweeper
+    history_write_name(src_dir, filename);
+
+    VersionRef refs[MAX_VERSIONS_SCANNED];
+    int have = list_versions(filename, refs, MAX_VERSIONS_SCANNED);
+    char dir[512];
+    history_dir(shard, filename, dir, sizeof(dir));
+    if (have == 0) {
+        history_drop_if_empty(dir); // A leftover name file only
+        if (rename(src_dir, dir) == 0) return;
+    }
+
+    if (mkdir(dir, 0755) == 0) history_write_name(dir, filename);
+    int next = have > 0 ? refs[0].id + 1 : 1;
+    for (int i = 0; i < n; i++) {
+        char from[600], to[600];
+        snprintf(from, sizeof(from), "%s/%d", src_dir, ids[i]);
+        snprintf(to, sizeof(to), "%s/%d", dir, next++);
+        rename(from, to);
+    }
+    history_drop_if_empty(src_dir);
+}
+
+static void history_move(const char *old_filename, const char *new_filename) {
+    for (int s = 0; s < storage_shard_count(); s++) {
+        char old_dir[512];
+        history_dir(s, old_filename, old_dir, sizeof(old_dir));
+        history_merge(old_dir, s, new_filename);
+    }
+}
+
+void versions_rename(const char *old_filename, const char *new_filename) {
+    history_move(old_filename, new_filename);
+
+    // A folder: the histories of the files below it follow too
+    char path[512];
+    struct stat st;
+    storage_path(new_filename, path, sizeof(path));
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return;
+
+    char old_norm[PATH_LOCK_MAX_PATH], new_norm[PATH_LOCK_MAX_PATH];
+    path_lock_normalize(old_filename, old_norm, sizeof(old_norm));
+    path_lock_normalize(new_filename, new_norm, sizeof(new_norm));
+    size_t old_len = strlen(old_norm);
+
+    for (int s = 0; s < storage_shard_count(); s++) {
+        DIR *d = opendir(storage_versions_dir(s));
+        if (!d) continue;
+        // Collected first: merging adds and removes entries of this folder
+        char (*names)[PATH_LOCK_MAX_PATH] = NULL;
+        int count = 0, cap = 0;
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            char dir[600], name[PATH_LOCK_MAX_PATH];
+            if (entry->d_name[0] == '.') continue;
+            snprintf(dir, sizeof(dir), "%s%s", storage_versions_dir(s), entry->d_name);
+            if (history_read_name(dir, name, sizeof(name)) != 0 || strncmp(name, old_norm, old_len) != 0 ||
+                name[old_len] != '/')
+                continue;
+            if (count == cap) {
+                cap = cap ? cap * 2 : 64;
+                void *grown = realloc(names, cap * sizeof(*names));
+                if (!grown) break;
+                names = grown;
+            }
+            memcpy(names[count++], name, sizeof(name));
+        }
+        closedir(d);
+
+        for (int i = 0; i < count; i++) {
+            char moved[PATH_LOCK_MAX_PATH * 2];
+            snprintf(moved, sizeof(moved), "%s%s", new_norm, names[i] + old_len);
+            history_move(names[i], moved);
+        }
+        free(names);
+    }
+}
+
+int versions_format_list(const char *filename, char *buf, size_t size) {
+    VersionRef refs[MAX_VERSIONS_SCANNED];
+    int n = list_versions(filename, refs, MAX_VERSIONS_SCANNED);
+    size_t used = 0;
+    buf[0] = '\0';
+
+    for (int i = 0; i < n; i++) {
+        char path[600], when[32];
+        struct stat st;
+        struct tm tm;
+        ref_path(filename, &refs[i], path, sizeof(path));
+        if (stat(path, &st) != 0) continue;
+
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&st.st_ctime, &tm));
+        int len = snprintf(buf + used, size - used, "%d %ld %s\n", refs[i].id, (long)st.st_size, when);
+        if (len < 0 || (size_t)len >= size - used) {
+            buf[used] = '\0';
+            break;
+        }
+        used += len;
+    }
+    return n;
+}
+
+// --- SWEEPER ---
+
+// One history folder: retention (of a deleted file too), leftovers of an
+// interrupted restore or folder move, then its totals
+static void sweep_history(int shard, const char *dir, long *histories, long *versions, long long *bytes) {
+    char name[PATH_LOCK_MAX_PATH];
+    int named = history_read_name(dir, name, sizeof(name)) == 0;
+    PathLock lock;
+    if (named && path_lock_try(&lock, name, LOCK_MODE_X) != 0) return; // Busy: next pass
+
+    time_t now = time(NULL);
+    if (named) {
+        char home[512];
+        history_dir(shard, name, home, sizeof(home));
+        if (strcmp(home, dir) != 0) {
+            history_merge(dir, shard, name); // Moved with its folder, not finished
+            __sync_fetch_and_add(&stat_repaired, 1);
+        }
+        prune(name);
+    }
+
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            char path[600];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            if (entry_id(entry->d_name) == 0) {
+                size_t len = strlen(entry->d_name);
+                if (named && len > 8 && strcmp(entry->d_name + len - 8, ".restore") == 0) unlink(path);
+                continue;
+            }
+            if (stat(path, &st) != 0) continue;
+            // No name (written before names were kept): only the age limit applies
+            if (!named && max_age_sec > 0 && now - st.st_ctime > max_age_sec) {
+                unlink(path);
+                __sync_fetch_and_add(&stat_expired, 1);
+                continue;
+            }
+            (*versions)++;
+            *bytes += st.st_size;
+        }
+        closedir(d);
+    }
+    history_drop_if_empty(dir);
+    if (access(dir, F_OK) == 0) (*histories)++;
+    if (named) path_lock_release(&lock);
+}
+
+static int sweeper_stopped = 0;
+static pthread_mutex_t sweep_lock = PTHREAD_MUTEX_INITIALIZER; // Held while a history is swept
+
+void versions_sweep() {
+    long histories = 0, versions = 0;
+    long long bytes = 0;
+    for (int s = 0; s < storage_shard_count(); s++) {
+        DIR *d = opendir(storage_versions_dir(s));
+        if (!d) continue;
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            char dir[600];
+            struct stat st;
+            snprintf(dir, sizeof(dir), "%s%s", storage_versions_dir(s), entry->d_name);
+            if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+            pthread_mutex_lock(&sweep_lock);
+            int stopped = __atomic_load_n(&sweeper_stopped, __ATOMIC_RELAXED);
+            if (!stopped) sweep_history(s, dir, &histories, &versions, &bytes);
+            pthread_mutex_unlock(&sweep_lock);
+            if (stopped) break;
+        }
+        closedir(d);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    stat_histories = histories;
+    stat_versions = versions;
+    stat_bytes = bytes;
+    stat_sweeps++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void *sweeper_thread(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&sweeper_stopped, __ATOMIC_RELAXED)) {
+        versions_sweep();
+        sleep(VERSION_SWEEP_INTERVAL);
+    }
+    return NULL;
+}
+
+void versions_start_sweeper() {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, sweeper_thread, NULL) != 0) {
+        perror("Version sweeper thread creation failed");
+        return;
+    }
+    pthread_detach(tid);
+}
+
+void versions_stop_sweeper() {
+    pthread_mutex_lock(&sweep_lock); // Waits for the history being swept
+    __atomic_store_n(&sweeper_stopped, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&sweep_lock);
+}
+
+int versions_format_stats(char *buf, size_t size) {
+    pthread_mutex_lock(&stats_lock);
+    int n = snprintf(buf, size, "VERSIONS histories=%ld versions=%ld bytes=%lld expired=%llu repaired=%llu sweeps=%llu\n",
+                     stat_histories, stat_versions, stat_bytes, stat_expired, stat_repaired, stat_sweeps);
+    pthread_mutex_unlock(&stats_lock);
+    if (n < 0) return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}